@@ -84,6 +84,9 @@ QcMapItem::QcMapItem(QQuickItem * parent)
   for (const auto & plugin_name : m_plugin_manager.plugin_names())
     m_plugin_layers.insert(plugin_name, make_plugin_layers(plugin_name));
 
+  // Process the map updates at most once per frame, in the polish step
+  m_map_view->set_frame_driven(true);
+  connect(m_map_view->scheduler(), &QcMapUpdateScheduler::update_requested, this, &QQuickItem::polish);
   connect(m_map_view, &QcMapView::scene_graph_changed, this, &QQuickItem::update);
   connect(location_circle_data(), &QcLocationCircleData::bearing_changed, this, &QQuickItem::update);
 
@@ -527,6 +530,13 @@ QcMapItem::geometryChanged(const QRectF & new_geometry, const QRectF & old_geome
   m_viewport->set_viewport_size(viewport_size, window()->devicePixelRatio());
 }
 
+void
+QcMapItem::updatePolish()
+{
+  // qInfo();
+  m_map_view->process_updates();
+}
+
 QSGNode *
 QcMapItem::updatePaintNode(QSGNode * old_node, UpdatePaintNodeData *)
 {
@@ -642,6 +652,23 @@ QcMapItem::plugin_layers(const QString & plugin_name)
     return QVariantList();
 }
 
+/*! Return the statistics of the tile cache of a plugin, null if the
+ *  plugin is unknown.  They are updated periodically when a snapshot
+ *  interval is set.
+ */
+QcTileCacheMetrics *
+QcMapItem::cache_metrics(const QString & plugin_name)
+{
+  QcWmtsPlugin * plugin = m_plugin_manager[plugin_name];
+  if (!plugin)
+    return nullptr;
+
+  // Owned by the cache
+  QcTileCacheMetrics * metrics = plugin->wmts_manager()->tile_cache()->metrics();
+  metrics->update();
+  return metrics;
+}
+
 void
 QcMapItem::set_projection(const QcProjection * projection)
 {
@@ -731,10 +758,14 @@ QcMapItem::make_scale(unsigned int max_length_px) const
 
 /**************************************************************************************************/
 
+/*! Prefetch the tiles of the viewport predicted from the motion of the
+ *  gesture, it is called when a gesture starts or ends.
+ */
 void
 QcMapItem::prefetch_data()
 {
   // qInfo();
+  m_map_view->prefetch(m_gesture_area->velocity(), m_gesture_area->zoom_direction());
 }
 
 /**************************************************************************************************/
@@ -127,6 +127,7 @@ public:
 
   QVariantList plugins() const;
   Q_INVOKABLE QVariantList plugin_layers(const QString & plugin_name);
+  Q_INVOKABLE QcTileCacheMetrics * cache_metrics(const QString & plugin_name);
 
   QString projection() const;
   QStringList projections() const;
@@ -163,6 +164,7 @@ protected:
 
   void componentComplete() Q_DECL_OVERRIDE ;
   void geometryChanged(const QRectF & new_geometry, const QRectF & old_geometry) Q_DECL_OVERRIDE ;
+  void updatePolish() Q_DECL_OVERRIDE ;
   QSGNode * updatePaintNode(QSGNode * old_node, UpdatePaintNodeData *) Q_DECL_OVERRIDE ;
 
 private slots:
@@ -447,6 +447,17 @@ QcMapGestureArea::is_active() const
   return is_pan_active() or is_pinch_active();
 }
 
+// Return the sign of the zoom change of the active pinch
+int
+QcMapGestureArea::zoom_direction() const
+{
+  if (m_pinch_state != PinchActive)
+    return 0;
+
+  qreal zoom_change = m_pinch.m_zoom.m_previous - m_pinch.m_zoom.m_start;
+  return (zoom_change > 0) - (zoom_change < 0);
+}
+
 void
 QcMapGestureArea::set_enabled(bool enabled)
 {
@@ -1063,6 +1074,7 @@ QcMapGestureArea::update_pinch()
     new_zoom_level = qMin(qMax(per_pinch_minimum_zoom_level, new_zoom_level), per_pinch_maximum_zoom_level);
     m_map->set_zoom_level(new_zoom_level);
     m_pinch.m_zoom.m_previous = new_zoom_level;
+    m_map->prefetch_data(); // throttled by the prefetcher
   }
 }
 
@@ -1122,6 +1134,7 @@ QcMapGestureArea::pan_state_machine()
         m_flick_state = FlickActive;
         emit pan_finished();
         emit flick_started();
+        m_map->prefetch_data();
       }
     }
     break;
@@ -228,6 +228,10 @@ public:
   bool is_pan_active() const;
   bool is_active() const;
 
+  // Motion used to predict the viewport
+  QcVectorDouble velocity() const { return QcVectorDouble(m_velocity_x, m_velocity_y); } // px/s
+  int zoom_direction() const;
+
   bool enabled() const { return m_enabled; }
   void set_enabled(bool enabled);
 
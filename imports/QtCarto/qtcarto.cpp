@@ -35,6 +35,7 @@
 #include "map_gesture_area.h"
 
 // Fixme:
+#include "cache/tile_cache_metrics.h"
 #include "coordinate/wgs84.h"
 #include "geometry/vector.h"
 #include "map/location_circle_data.h"
@@ -97,6 +98,9 @@ class QtCartoDeclarativeModule : public QQmlExtensionPlugin
       qmlRegisterUncreatableType<QcMapEventRouter>(uri, major, minor, "QcMapEventRouter",
                                                    QStringLiteral("QcMapEventRouter is not intended instantiable by developer."));
 
+      qmlRegisterUncreatableType<QcTileCacheMetrics>(uri, major, minor, "QcTileCacheMetrics",
+                                                     QStringLiteral("QcTileCacheMetrics is not intended instantiable by developer."));
+
       // registrations below are version independent
     } else {
       qDebug() << "Unsupported URI given to load location QML plugin: " << QLatin1String(uri);
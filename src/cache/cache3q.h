@@ -167,11 +167,19 @@ public:
   inline void set_promote_at(int p) { m_promote = p; }
 
   inline int total_cost() const { return m_q1->cost + m_q2->cost + m_q3->cost; }
+  inline int size() const { return m_q1->size + m_q2->size + m_q3->size; }
+
+  inline int hit_count() const { return m_hit_count; }
+  inline int miss_count() const { return m_miss_count; }
+  inline int promotion_count() const { return m_promotion_count; } // from q1 and ghosts to q2
+  inline int eviction_count() const { return m_eviction_count; }
 
   void clear();
   bool insert(const Key & key, QSharedPointer<T> object, int cost = 1);
   QSharedPointer<T> object(const Key & key) const;
   QSharedPointer<T> operator[](const Key & key) const;
+  // Lookup without updating the popularity and the queues
+  QSharedPointer<T> peek(const Key & key) const;
 
   void remove(const Key & key);
 
@@ -196,6 +204,7 @@ private:
 private:
   int m_max_cost, m_min_recent, m_max_old_popular;
   int m_hit_count, m_miss_count, m_promote;
+  int m_promotion_count, m_eviction_count;
 };
 
 /**************************************************************************************************/
@@ -101,7 +101,8 @@ template <class Key, class T, class EvictionPolicy>
 QcCache3Q<Key,T,EvictionPolicy>::QcCache3Q(int max_cost, int min_recent, int max_old_popular)
   : m_q1(new Queue), m_q2(new Queue), m_q3(new Queue), m_q1_evicted(new Queue), // Fixme: delete ?
     m_max_cost(max_cost), m_min_recent(min_recent), m_max_old_popular(max_old_popular),
-    m_hit_count(0), m_miss_count(0), m_promote(0)
+    m_hit_count(0), m_miss_count(0), m_promote(0),
+    m_promotion_count(0), m_eviction_count(0)
 {
   if (m_min_recent < 0)
     m_min_recent = max_cost / 3;
@@ -135,14 +136,17 @@ QcCache3Q<Key, T, EvictionPolicy>::deserialize_queue(int queue_number, const QLi
   if (buffer_size == 0)
     return;
 
-  clear();
+  // Don't clear the cache, the queues are deserialized one after the other
 
   Queue *queue = queue_number == 1 ? m_q1 :
     queue_number == 2 ? m_q2 :
     queue_number == 3 ? m_q3 :
     m_q1_evicted;
 
-  for (int i = 0; i < buffer_size; ++i) {
+  // Link from the last so as to preserve the order of serialize_queue
+  for (int i = buffer_size - 1; i >= 0; --i) {
+    if (m_lookup.contains(keys[i]))
+      continue;
     Node * node = new Node;
     node->value = values[i];
     node->key = keys[i];
@@ -176,6 +180,9 @@ QcCache3Q<Key, T, EvictionPolicy>::insert(const Key & key, QSharedPointer<T> obj
 
   if (m_lookup.contains(key)) {
     Node * node = m_lookup[key];
+    // the previous object is replaced, not evicted
+    if (node->value && node->value != object)
+      EvictionPolicy::about_to_be_removed(node->key, node->value);
     node->value = object;
     node->queue->cost -= node->cost;
     node->cost = cost;
@@ -185,6 +192,7 @@ QcCache3Q<Key, T, EvictionPolicy>::insert(const Key & key, QSharedPointer<T> obj
       if (node->pop > (uint)m_promote) { // uint(...)
 	unlink(node);
 	link_front(node, m_q2);
+	m_promotion_count++;
 	rebalance();
       }
     } else if (node->queue != m_q1) {
@@ -295,12 +303,14 @@ QcCache3Q<Key, T, EvictionPolicy>::rebalance()
     if (m_q3->cost > m_max_old_popular) {
       Node * node = m_q3->last;
       unlink(node);
+      m_eviction_count++;
       EvictionPolicy::about_to_be_evicted(node->key, node->value);
       m_lookup.remove(node->key);
       delete node;
     } else if (m_q1->cost > m_min_recent) {
       Node * node = m_q1->last;
       unlink(node);
+      m_eviction_count++;
       EvictionPolicy::about_to_be_evicted(node->key, node->value);
       node->value.clear();
       node->cost = 0;
@@ -311,6 +321,7 @@ QcCache3Q<Key, T, EvictionPolicy>::rebalance()
       if (node->pop > (m_q2->pop / m_q2->size)) {
 	link_front(node, m_q3);
       } else {
+	m_eviction_count++;
 	EvictionPolicy::about_to_be_evicted(node->key, node->value);
 	node->value.clear();
 	node->cost = 0;
@@ -355,6 +366,7 @@ QSharedPointer<T> QcCache3Q<Key, T, EvictionPolicy>::object(const Key & key) con
     if (node->pop > (quint64)m_promote) {
       me->unlink(node);
       me->link_front(node, m_q2);
+      me->m_promotion_count++;
       me->rebalance();
     }
   } else if (node->queue != m_q1_evicted) {
@@ -371,6 +383,16 @@ QSharedPointer<T> QcCache3Q<Key, T, EvictionPolicy>::object(const Key & key) con
   return node->value;
 }
 
+template <class Key, class T, class EvictionPolicy>
+QSharedPointer<T> QcCache3Q<Key, T, EvictionPolicy>::peek(const Key & key) const
+{
+  Node * node = m_lookup.value(key, nullptr);
+  if (node)
+    return node->value; // null for an evicted node
+  else
+    return QSharedPointer<T>(nullptr);
+}
+
 template <class Key, class T, class EvictionPolicy>
 inline
 QSharedPointer<T> QcCache3Q<Key, T, EvictionPolicy>::operator[](const Key & key) const
@@ -0,0 +1,139 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __CONCURRENT_CACHE3Q_H__
+#define __CONCURRENT_CACHE3Q_H__
+
+/**************************************************************************************************/
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QVector>
+
+#include "cache/cache3q.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/*
+ * QcConcurrentCache3Q
+ *
+ * A thread-safe variant of QcCache3Q using lock striping: the keys are
+ * distributed over shards according to their hash, each shard is a
+ * QcCache3Q protected by its own mutex and has its own share of the
+ * maximum cost. Thus the 3Q eviction semantics apply per shard, and
+ * lookups on different shards don't contend.
+ *
+ * A shard must hold enough objects for the 3Q queues to be meaningful,
+ * thus the number of shards is sized from the maximum cost so that each
+ * shard has at least min_shard_cost, up to max_number_of_shards.  A
+ * small cache is a single QcCache3Q behind one mutex.  The cached objects
+ * are dropped when a new maximum cost changes the number of shards.
+ *
+ * The eviction policy is called with the shard lock held, it must not
+ * call back the cache.
+ */
+template <class Key, class T, class EvictionPolicy = QcCache3QDefaultEvictionPolicy<Key, T> >
+class QcConcurrentCache3Q
+{
+private:
+  class Shard
+  {
+  public:
+    mutable QMutex mutex;
+    QcCache3Q<Key, T, EvictionPolicy> cache;
+  };
+
+public:
+  explicit QcConcurrentCache3Q(int max_cost = 100, int max_number_of_shards = 8, int min_shard_cost = 1);
+  ~QcConcurrentCache3Q();
+
+  inline int number_of_shards() const { return m_number_of_shards.loadAcquire(); }
+  inline int max_number_of_shards() const { return m_shards.size(); }
+  inline int min_shard_cost() const { return m_min_shard_cost; }
+
+  int max_cost() const;
+  void set_max_cost(int max_cost);
+  int total_cost() const;
+  int size() const;
+
+  void clear();
+  bool insert(const Key & key, QSharedPointer<T> object, int cost = 1);
+  QSharedPointer<T> object(const Key & key) const;
+  QSharedPointer<T> operator[](const Key & key) const { return object(key); }
+  QSharedPointer<T> peek(const Key & key) const;
+  void remove(const Key & key);
+
+  // Per shard statistics
+  int hit_count(int shard) const;
+  int miss_count(int shard) const;
+  int hit_count() const;
+  int miss_count() const;
+  int promotion_count() const;
+  int eviction_count() const;
+
+  void print_stats();
+
+private:
+  inline Shard * shard_of(const Key & key) const {
+    // number of shards is a power of two
+    return m_shards[qHash(key) & (number_of_shards() - 1)];
+  }
+  Shard * lock_shard(const Key & key) const;
+
+  // make these private so they can't be used
+  QcConcurrentCache3Q(const QcConcurrentCache3Q<Key, T, EvictionPolicy> &);
+  QcConcurrentCache3Q<Key, T, EvictionPolicy> & operator=(const QcConcurrentCache3Q<Key, T, EvictionPolicy> &);
+
+private:
+  QVector<Shard *> m_shards; // allocated up to the maximum number of shards
+  QAtomicInt m_number_of_shards; // in use
+  int m_min_shard_cost;
+  int m_max_cost;
+};
+
+/**************************************************************************************************/
+
+#ifndef QC_MANUAL_INSTANTIATION
+#include "concurrent_cache3q.hxx"
+#endif
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+#endif /* __CONCURRENT_CACHE3Q_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
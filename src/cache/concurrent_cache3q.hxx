@@ -0,0 +1,269 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include <QMutexLocker>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+template <class Key, class T, class EvictionPolicy>
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::QcConcurrentCache3Q(int max_cost, int max_number_of_shards, int min_shard_cost)
+  : m_shards(),
+    m_number_of_shards(1),
+    m_min_shard_cost(qMax(min_shard_cost, 1)),
+    m_max_cost(0)
+{
+  // round to a power of two
+  int size = 1;
+  while (size < max_number_of_shards)
+    size <<= 1;
+
+  m_shards.reserve(size);
+  for (int i = 0; i < size; i++)
+    m_shards.append(new Shard);
+
+  set_max_cost(max_cost);
+}
+
+template <class Key, class T, class EvictionPolicy>
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::~QcConcurrentCache3Q()
+{
+  for (auto * shard : m_shards)
+    delete shard;
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::max_cost() const
+{
+  return m_max_cost;
+}
+
+template <class Key, class T, class EvictionPolicy>
+void
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::set_max_cost(int max_cost)
+{
+  // Largest power of two giving at least the minimum cost per shard
+  int number_of_shards = 1;
+  while (number_of_shards < m_shards.size() && max_cost / (2 * number_of_shards) >= m_min_shard_cost)
+    number_of_shards <<= 1;
+
+  for (auto * shard : m_shards)
+    shard->mutex.lock();
+
+  m_max_cost = max_cost;
+  if (number_of_shards != m_number_of_shards.loadAcquire()) {
+    // The keys move to other shards
+    for (auto * shard : m_shards)
+      shard->cache.clear();
+    m_number_of_shards.storeRelease(number_of_shards);
+  }
+  int shard_max_cost = max_cost / number_of_shards;
+  for (int i = 0; i < number_of_shards; i++)
+    m_shards[i]->cache.set_max_cost(shard_max_cost);
+
+  for (auto * shard : m_shards)
+    shard->mutex.unlock();
+}
+
+/* Return the locked shard of the key.
+ *
+ * The number of shards can change while waiting for the lock, thus the
+ * shard is looked up again once locked.
+ */
+template <class Key, class T, class EvictionPolicy>
+typename QcConcurrentCache3Q<Key, T, EvictionPolicy>::Shard *
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::lock_shard(const Key & key) const
+{
+  for (;;) {
+    Shard * shard = shard_of(key);
+    shard->mutex.lock();
+    if (shard == shard_of(key))
+      return shard;
+    shard->mutex.unlock();
+  }
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::total_cost() const
+{
+  int cost = 0;
+  for (const auto * shard : m_shards) {
+    QMutexLocker locker(&shard->mutex);
+    cost += shard->cache.total_cost();
+  }
+  return cost;
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::size() const
+{
+  int size = 0;
+  for (const auto * shard : m_shards) {
+    QMutexLocker locker(&shard->mutex);
+    size += shard->cache.size();
+  }
+  return size;
+}
+
+template <class Key, class T, class EvictionPolicy>
+void
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::clear()
+{
+  for (auto * shard : m_shards) {
+    QMutexLocker locker(&shard->mutex);
+    shard->cache.clear();
+  }
+}
+
+template <class Key, class T, class EvictionPolicy>
+bool
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::insert(const Key & key, QSharedPointer<T> object, int cost)
+{
+  Shard * shard = lock_shard(key);
+  bool inserted = shard->cache.insert(key, object, cost);
+  shard->mutex.unlock();
+  return inserted;
+}
+
+template <class Key, class T, class EvictionPolicy>
+QSharedPointer<T>
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::object(const Key & key) const
+{
+  Shard * shard = lock_shard(key);
+  QSharedPointer<T> object = shard->cache.object(key);
+  shard->mutex.unlock();
+  return object;
+}
+
+template <class Key, class T, class EvictionPolicy>
+QSharedPointer<T>
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::peek(const Key & key) const
+{
+  Shard * shard = lock_shard(key);
+  QSharedPointer<T> object = shard->cache.peek(key);
+  shard->mutex.unlock();
+  return object;
+}
+
+template <class Key, class T, class EvictionPolicy>
+void
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::remove(const Key & key)
+{
+  Shard * shard = lock_shard(key);
+  shard->cache.remove(key);
+  shard->mutex.unlock();
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::hit_count(int shard_index) const
+{
+  const Shard * shard = m_shards[shard_index];
+  QMutexLocker locker(&shard->mutex);
+  return shard->cache.hit_count();
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::miss_count(int shard_index) const
+{
+  const Shard * shard = m_shards[shard_index];
+  QMutexLocker locker(&shard->mutex);
+  return shard->cache.miss_count();
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::hit_count() const
+{
+  int count = 0;
+  for (int i = 0; i < m_shards.size(); i++)
+    count += hit_count(i);
+  return count;
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::miss_count() const
+{
+  int count = 0;
+  for (int i = 0; i < m_shards.size(); i++)
+    count += miss_count(i);
+  return count;
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::promotion_count() const
+{
+  int count = 0;
+  for (const Shard * shard : m_shards) {
+    QMutexLocker locker(&shard->mutex);
+    count += shard->cache.promotion_count();
+  }
+  return count;
+}
+
+template <class Key, class T, class EvictionPolicy>
+int
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::eviction_count() const
+{
+  int count = 0;
+  for (const Shard * shard : m_shards) {
+    QMutexLocker locker(&shard->mutex);
+    count += shard->cache.eviction_count();
+  }
+  return count;
+}
+
+template <class Key, class T, class EvictionPolicy>
+void
+QcConcurrentCache3Q<Key, T, EvictionPolicy>::print_stats()
+{
+  qInfo("\n=== concurrent cache %p: %d shards ===", this, number_of_shards());
+  for (int i = 0; i < number_of_shards(); i++) {
+    int hits = hit_count(i);
+    int misses = miss_count(i);
+    qInfo("shard %d: hits: %d (%.2f%%)\tmisses: %d", i, hits,
+          100.0 * float(hits) / float(qMax(hits + misses, 1)), misses);
+  }
+}
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -65,11 +65,15 @@
 #include "file_tile_cache.h"
 #include "tile_image.h"
 
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
+#include <QFileInfo>
 #include <QMetaType>
 #include <QPixmap>
+#include <QRunnable>
 #include <QStandardPaths>
+#include <QThread>
 
 // Q_DECLARE_METATYPE(QList<QcTileSpec>)
 // Q_DECLARE_METATYPE(QcTileSpecSet)
@@ -95,14 +99,15 @@ public:
 
   QcTileSpec tile_spec;
   QcFileTileCache *cache;
-  QByteArray bytes;
+  QByteArray bytes; // can be a view on a mapped file
   QString format;
+  QSharedPointer<QcMappedTileFile> mapped_file; // keep the mapping of a per-file tile alive
 };
 
 /**************************************************************************************************/
 
 void
-QCache3QTileEvictionPolicy::about_to_be_removed(const QcTileSpec & key, QSharedPointer<QcCachedTileDisk> obj)
+QCache3QTileEvictionPolicy::about_to_be_removed(const QcTileKey & key, QSharedPointer<QcCachedTileDisk> obj)
 {
   Q_UNUSED(key);
   // set the cache pointer to zero so we can't call evict_from_disk_cache
@@ -110,7 +115,7 @@ QCache3QTileEvictionPolicy::about_to_be_removed(const QcTileSpec & key, QSharedP
 }
 
 void
-QCache3QTileEvictionPolicy::about_to_be_evicted(const QcTileSpec & key, QSharedPointer<QcCachedTileDisk> obj)
+QCache3QTileEvictionPolicy::about_to_be_evicted(const QcTileKey & key, QSharedPointer<QcCachedTileDisk> obj)
 {
   Q_UNUSED(key);
   Q_UNUSED(obj);
@@ -127,6 +132,225 @@ QcCachedTileDisk::~QcCachedTileDisk()
 
 /**************************************************************************************************/
 
+// Read an encoded tile either from its file or from a pack
+static QByteArray
+read_disk_tile(const QcTileSpec & tile_spec, const QString & filename, const QcTilePack * tile_pack)
+{
+  if (filename.isEmpty() && tile_pack)
+    return tile_pack->read(tile_spec);
+  else
+    return read_tile_image(filename);
+}
+
+/**************************************************************************************************/
+
+/* Read and decode a tile image on a worker thread.
+ *
+ * The job reads the file if bytes are not provided, then hands the
+ * decoded image back to the cache on its own thread.
+ */
+class QcTileDecodeJob : public QRunnable
+{
+public:
+  QcTileDecodeJob(QcFileTileCache * cache, const QcTileSpec & tile_spec,
+                  const QByteArray & bytes, const QString & filename, const QString & format,
+                  const QcTilePack * tile_pack, const QSharedPointer<QcMappedTileFile> & mapped_file,
+                  QcTileImageFormat texture_format)
+    : QRunnable(),
+      m_cache(cache), m_tile_spec(tile_spec),
+      m_bytes(bytes), m_filename(filename), m_format(format),
+      m_tile_pack(tile_pack), m_mapped_file(mapped_file),
+      m_texture_format(texture_format)
+  {}
+
+  void run() override
+  {
+    // Bytes read from disk are sent back to feed the memory cache
+    bool from_disk = m_bytes.isEmpty();
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray bytes = m_bytes;
+    if (from_disk) {
+      bytes = read_disk_tile(m_tile_spec, m_filename, m_tile_pack);
+      m_cache->metrics()->record_disk_read(timer.nsecsElapsed() / 1000);
+      timer.restart();
+    }
+
+    QImage image = decode_tile_image(bytes, m_texture_format);
+    m_cache->metrics()->record_decode_time(timer.nsecsElapsed() / 1000);
+
+    // A view on a pack must be released before the cache can compact it
+    if (!from_disk)
+      bytes.clear();
+    m_bytes.clear();
+    m_mapped_file.clear();
+
+    QMetaObject::invokeMethod(m_cache, "on_tile_decoded",
+                              Qt::QueuedConnection,
+                              Q_ARG(QcTileSpec, m_tile_spec),
+                              Q_ARG(QImage, image),
+                              Q_ARG(QByteArray, from_disk ? bytes : QByteArray()),
+                              Q_ARG(QString, m_format));
+  }
+
+private:
+  QcFileTileCache * m_cache;
+  QcTileSpec m_tile_spec;
+  QByteArray m_bytes;
+  QString m_filename;
+  QString m_format;
+  const QcTilePack * m_tile_pack; // reads are thread safe
+  QSharedPointer<QcMappedTileFile> m_mapped_file; // m_bytes can be a view on it
+  QcTileImageFormat m_texture_format;
+};
+
+/**************************************************************************************************/
+
+class QcTileIndexRebuild
+{
+public:
+  QcTileCacheIndexEntryList entries;
+  qint64 dead_size;
+  qint64 end; // of the last valid record of the pack
+};
+
+/* Rebuild the index of the disk cache on a worker thread.
+ *
+ * Scan the pack up to its size at the time the job was created, else
+ * the cache directory. The result is applied by the cache on its own
+ * thread, or by its destructor once the job is done.
+ */
+class QcTileIndexRebuildJob : public QRunnable
+{
+public:
+  QcTileIndexRebuildJob(QcFileTileCache * cache, const QSharedPointer<QcTileIndexRebuild> & result,
+                        const QString & directory, const QString & pack_filename, qint64 pack_size)
+    : QRunnable(),
+      m_cache(cache), m_result(result),
+      m_directory(directory), m_pack_filename(pack_filename), m_pack_size(pack_size)
+  {}
+
+  void run() override
+  {
+    QcTileCacheIndexEntryList & entries = m_result->entries;
+    qint64 & dead_size = m_result->dead_size;
+    qint64 & end = m_result->end;
+    dead_size = 0;
+    end = m_pack_size;
+
+    if (!m_pack_filename.isEmpty()) {
+      QFile file(m_pack_filename);
+      QHash<QcTileSpec, QcTilePackEntry> index;
+      if (file.open(QIODevice::ReadOnly))
+        end = QcTilePack::scan_file(file, m_pack_size, index, dead_size);
+      for (auto it = index.constBegin(); it != index.constEnd(); ++it) {
+        QcTileCacheIndexEntry entry;
+        entry.tile_spec = it.key();
+        entry.format = it->format;
+        entry.size = it->size;
+        entry.offset = it->offset;
+        entry.data_offset = it->data_offset;
+        entries << entry;
+      }
+    } else {
+      QDir directory(m_directory);
+      QStringList files = directory.entryList(QStringList(QLatin1Literal("*-*-*-*.*")), QDir::Files);
+      for (const auto & relative_filename : files) {
+        QcTileCacheIndexEntry entry;
+        entry.tile_spec = filename_to_tile_spec(relative_filename);
+        if (entry.tile_spec.level() == -1)
+          continue;
+        QFileInfo file_info(directory.filePath(relative_filename));
+        entry.format = file_info.suffix();
+        entry.size = file_info.size();
+        entries << entry;
+      }
+    }
+
+    QMetaObject::invokeMethod(m_cache, "on_index_rebuilt", Qt::QueuedConnection);
+  }
+
+private:
+  QcFileTileCache * m_cache;
+  QSharedPointer<QcTileIndexRebuild> m_result;
+  QString m_directory;
+  QString m_pack_filename;
+  qint64 m_pack_size;
+};
+
+/* Delete a batch of evicted tiles on a worker thread.
+ *
+ */
+class QcTileEvictionJob : public QRunnable
+{
+public:
+  QcTileEvictionJob(QcFileTileCache * cache, QcTilePack * tile_pack, const QList<QcTileEviction> & evictions)
+    : QRunnable(),
+      m_cache(cache), m_tile_pack(tile_pack), m_evictions(evictions)
+  {}
+
+  void run() override
+  {
+    int number_of_tiles = 0;
+    qint64 bytes = 0;
+    qint64 evicted_at = m_evictions.isEmpty() ? 0 : m_evictions.first().evicted_at;
+
+    for (const auto & eviction : m_evictions) {
+      bool removed;
+      if (eviction.offset >= 0)
+        removed = m_tile_pack->remove(eviction.tile_spec, eviction.offset);
+      else
+        removed = QFile::remove(eviction.filename);
+      if (removed) {
+        number_of_tiles++;
+        // A removed record only frees disk space once the pack is compacted
+        if (eviction.offset < 0)
+          bytes += eviction.size;
+      }
+    }
+
+    QMetaObject::invokeMethod(m_cache, "on_evictions_done",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, number_of_tiles),
+                              Q_ARG(qint64, bytes),
+                              Q_ARG(qint64, evicted_at));
+  }
+
+private:
+  QcFileTileCache * m_cache;
+  QcTilePack * m_tile_pack; // removal is thread safe
+  QList<QcTileEviction> m_evictions;
+};
+
+/* Compact the tile pack on a worker thread.
+ *
+ */
+class QcTilePackCompactionJob : public QRunnable
+{
+public:
+  QcTilePackCompactionJob(QcFileTileCache * cache, QcTilePack * tile_pack)
+    : QRunnable(),
+      m_cache(cache), m_tile_pack(tile_pack)
+  {}
+
+  void run() override
+  {
+    qint64 size = m_tile_pack->size();
+    m_tile_pack->compact();
+    qint64 reclaimed_bytes = qMax(size - m_tile_pack->size(), qint64(0));
+
+    QMetaObject::invokeMethod(m_cache, "on_compaction_done",
+                              Qt::QueuedConnection,
+                              Q_ARG(qint64, reclaimed_bytes));
+  }
+
+private:
+  QcFileTileCache * m_cache;
+  QcTilePack * m_tile_pack; // compaction is thread safe
+};
+
+/**************************************************************************************************/
+
 // Fixme: export
 constexpr int KILO = 1000;
 constexpr int KILO2 = 1024;
@@ -137,14 +361,41 @@ constexpr int MAX_DISK_USAGE = 512 * MEGA2;
 constexpr int MAX_MEMORY_USAGE = 128 * MEGA2;
 constexpr int EXTRA_TEXTURE_USAGE = 16 * MEGA2;
 
+// The memory and texture tiers are sharded above this cost per shard,
+// i.e. 64 textures of 256 px or some hundreds of encoded tiles
+constexpr int MAX_CACHE_SHARDS = 8;
+constexpr int MIN_CACHE_SHARD_COST = 16 * MEGA2;
+
 constexpr int NUMBER_OF_QUEUES = 4;
 
+constexpr int MAX_DECODE_THREADS = 4;
+
+constexpr int EVICTION_BATCH_SIZE = 256;
+constexpr int EVICTION_DELAY = 250; // ms, to batch the evictions
+
+// Compact the pack when the dead records exceed this ratio of the maximum disk usage,
+// the live tiles are limited to the remaining part
+constexpr double PACK_COMPACTION_RATIO = .25;
+
 /**************************************************************************************************/
 
-QcFileTileCache::QcFileTileCache(const QString & directory)
+QcFileTileCache::QcFileTileCache(const QString & directory, QcTileStorage storage)
   : QObject(),
     m_offline_cache(nullptr),
-    m_directory(directory), m_min_texture_usage(0), m_extra_texture_usage(0)
+    m_tile_pack(nullptr),
+    m_max_disk_usage(0),
+    m_memory_cache(0, MAX_CACHE_SHARDS, MIN_CACHE_SHARD_COST),
+    m_texture_cache(0, MAX_CACHE_SHARDS, MIN_CACHE_SHARD_COST),
+    m_directory(directory), m_min_texture_usage(0), m_extra_texture_usage(0),
+    m_memory_mapped(false),
+    m_texture_format(QcTileImageFormat::Rgba8888),
+    m_rebuilding_index(false),
+    m_compacting(false),
+    m_evicted_tiles(0),
+    m_reclaimed_bytes(0),
+    m_last_eviction_latency(0),
+    m_max_eviction_latency(0),
+    m_metrics(new QcTileCacheMetrics(this, this))
 {
   const QString base_path = base_cache_directory();
 
@@ -155,45 +406,69 @@ QcFileTileCache::QcFileTileCache(const QString & directory)
   QDir::root().mkpath(m_directory);
 
   // default values
-  set_max_disk_usage(MAX_DISK_USAGE);
   set_max_memory_usage(MAX_MEMORY_USAGE);
   set_extra_texture_usage(EXTRA_TEXTURE_USAGE);
 
+  qRegisterMetaType<QcTileSpec>();
+  // Keep a core for the GUI thread
+  set_max_decode_threads(QThread::idealThreadCount() - 1);
+  m_io_pool.setMaxThreadCount(1);
+
+  m_eviction_clock.start();
+  m_eviction_timer.setSingleShot(true);
+  m_eviction_timer.setInterval(EVICTION_DELAY);
+  connect(&m_eviction_timer, &QTimer::timeout, this, &QcFileTileCache::flush_evictions);
+
+  if (storage == QcTileStorage::Packed) {
+    m_tile_pack = new QcTilePack(QDir(m_directory).filePath(QcTilePack::default_filename));
+    // The records are indexed by load_tiles
+    if (!m_tile_pack->open(false)) {
+      qWarning() << "Fallback to one file per tile for cache" << m_directory;
+      delete m_tile_pack;
+      m_tile_pack = nullptr;
+    }
+  }
+
+  // The budget of the live tiles depends on the storage
+  set_max_disk_usage(MAX_DISK_USAGE);
+
+  // Before the tiles, evictions at load time drop their metadata
+  m_freshness.read(freshness_filename());
   load_tiles();
 
   QString offline_cache_directory = m_directory + QDir::separator() + QLatin1Literal("offline");
-  m_offline_cache = new QcOfflineTileCache(offline_cache_directory);
+  m_offline_cache = new QcOfflineTileCache(offline_cache_directory, storage);
 }
 
 QcFileTileCache::~QcFileTileCache()
 {
-  // qInfo() << "Serialize cache queue";
-
-  // For each disk cache queue write the list of filenames to a file
-  QDir directory(m_directory);
-  for (int i = 1; i <= NUMBER_OF_QUEUES; i++) {
-    QString filename = queue_filename(i);
-    QFile file(filename);
-    if (!file.open(QIODevice::WriteOnly)){
-      qWarning() << "Unable to write tile cache file " << filename;
-      continue;
-    }
+  // Pending results are dropped with the queued events
+  m_decode_pool.clear();
+  m_decode_pool.waitForDone();
+
+  // Apply a rebuild or a compaction whose result was not yet delivered
+  m_io_pool.waitForDone();
+  on_index_rebuilt();
+  m_compaction_decodes.clear();
+  if (m_compacting)
+    on_compaction_done(0);
+
+  // Delete the pending evictions now
+  flush_evictions();
+  m_io_pool.waitForDone();
+
+  // Views must be released before the packs are unmapped or compacted
+  m_memory_cache.clear();
 
-    QList<QSharedPointer<QcCachedTileDisk> > queue;
-    m_disk_cache.serialize_queue(i, queue);
-    for(const auto & tile : queue)
-      if (!tile.isNull()) {
-	// we just want the filename here, not the full path
-        const QString & tile_filename = tile->filename;
-	int index = tile_filename.lastIndexOf(QLatin1Char('/'));
-	QByteArray filename = tile_filename.mid(index + 1).toLatin1() + '\n';
-	file.write(filename);
-      }
+  if (m_tile_pack && m_tile_pack->dead_size() > max_disk_usage() * PACK_COMPACTION_RATIO)
+    m_tile_pack->compact();
 
-    file.close();
-  }
+  save_index();
+  m_freshness.write(freshness_filename());
 
+  // Must be deleted after the index was saved
   delete m_offline_cache;
+  delete m_tile_pack;
 }
 
 QString
@@ -248,13 +523,32 @@ QcFileTileCache::base_cache_directory()
 void
 QcFileTileCache::clear_all()
 {
+  // Decode jobs can hold views on the pack
+  m_decode_pool.waitForDone();
+
+  // Discard a rebuild in progress and the pending evictions
+  m_eviction_timer.stop();
+  m_eviction_batch.clear();
+  m_io_pool.waitForDone();
+  m_index_rebuild.clear();
+  m_rebuilding_index = false;
+  m_compacting = false;
+  m_compaction_decodes.clear();
+  m_deferred_inserts.clear();
+
   m_texture_cache.clear();
   m_memory_cache.clear();
   m_disk_cache.clear();
+  m_freshness.clear();
+
+  if (m_tile_pack)
+    m_tile_pack->clear();
 
   QStringList string_list;
   string_list << QLatin1Literal("*-*-*-*.*"); // tile pattern
-  string_list << QLatin1Literal("queue?");
+  string_list << QLatin1Literal("queue?"); // legacy queue files
+  string_list << QcTileCacheIndex::default_filename;
+  string_list << QcTileFreshnessStore::default_filename;
   QDir directory(m_directory);
   directory.setNameFilters(string_list);
   directory.setFilter(QDir::Files);
@@ -263,63 +557,205 @@ QcFileTileCache::clear_all()
 }
 
 QString
-QcFileTileCache::queue_filename(int i) const
+QcFileTileCache::index_filename() const
 {
-  // queue%u
-  return QDir(m_directory).filePath(QLatin1Literal("queue") + QString::number(i));
+  return QDir(m_directory).filePath(QcTileCacheIndex::default_filename);
 }
 
+QString
+QcFileTileCache::freshness_filename() const
+{
+  return QDir(m_directory).filePath(QcTileFreshnessStore::default_filename);
+}
+
+/* Load the disk cache from the index.
+ *
+ * The index is removed once loaded and written back on exit, thus a
+ * crash leaves no index. A missing or stale index triggers a rebuild
+ * in background.
+ */
 void
 QcFileTileCache::load_tiles()
 {
-  QStringList formats;
-  formats << QLatin1Literal("*.*");
+  QString filename = index_filename();
+  QcTileCacheIndexEntryList entries;
+  qint64 pack_size = -1;
+  qint64 dead_size = 0;
+  bool loaded = QcTileCacheIndex::read(filename, entries, pack_size, dead_size);
+  QFile::remove(filename);
+
+  if (loaded && m_tile_pack && pack_size != m_tile_pack->size()) {
+    qWarning() << "Stale tile cache index" << filename;
+    loaded = false;
+  }
+  if (!loaded) {
+    rebuild_index();
+    return;
+  }
 
-  QDir directory(m_directory);
-  QStringList files = directory.entryList(formats, QDir::Files);
+  QHash<QcTileSpec, QcTilePackEntry> pack_index;
+  QList<QcTileKey> tile_keys[NUMBER_OF_QUEUES];
+  QList<QSharedPointer<QcCachedTileDisk> > queues[NUMBER_OF_QUEUES];
+  QList<int> costs[NUMBER_OF_QUEUES];
+  QcTileCacheIndexEntryList unqueued_entries;
+
+  for (const auto & entry : entries) {
+    const QcTileSpec & tile_spec = entry.tile_spec;
+    if (m_tile_pack) {
+      QcTilePackEntry pack_entry;
+      pack_entry.offset = entry.offset;
+      pack_entry.data_offset = entry.data_offset;
+      pack_entry.size = entry.size;
+      pack_entry.format = entry.format;
+      pack_index.insert(tile_spec, pack_entry);
+    }
 
-  // Method:
-  // 1. read each queue file then, if each file exists, deserialize the data into the appropriate cache queue.
-  for (int i = 1; i <= NUMBER_OF_QUEUES; i++) {
-    QFile file(queue_filename(i));
-    if (!file.open(QIODevice::ReadOnly))
+    int queue = entry.queue - 1;
+    if (queue < 0 || queue >= NUMBER_OF_QUEUES) {
+      unqueued_entries << entry;
       continue;
+    }
+    QSharedPointer<QcCachedTileDisk> tile_disk(new QcCachedTileDisk);
+    tile_disk->tile_spec = tile_spec;
+    if (!m_tile_pack)
+      tile_disk->filename = tile_spec_to_filename(tile_spec, entry.format, m_directory);
+    tile_disk->format = entry.format;
+    tile_disk->size = entry.size;
+    tile_disk->cache = this;
+    tile_keys[queue] << tile_spec.key();
+    queues[queue] << tile_disk;
+    costs[queue] << entry.size;
+  }
+
+  if (m_tile_pack)
+    m_tile_pack->merge_index(pack_index, dead_size);
+
+  for (int i = 0; i < NUMBER_OF_QUEUES; i++)
+    m_disk_cache.deserialize_queue(i + 1, tile_keys[i], queues[i], costs[i]);
+
+  // Tiles of the pack which are not referenced by a queue
+  for (const auto & entry : unqueued_entries)
+    add_to_disk_cache(entry.tile_spec, QString(), entry.format, entry.size);
+
+  // qInfo() << "Loaded" << entries.size() << "tiles from index" << filename;
+}
+
+void
+QcFileTileCache::save_index()
+{
+  QHash<QcTileSpec, int> queue_of;
+  QcTileCacheIndexEntryList entries;
+
+  for (int i = 1; i <= NUMBER_OF_QUEUES; i++) {
     QList<QSharedPointer<QcCachedTileDisk> > queue;
-    QList<QcTileSpec> tile_specs;
-    QList<int> costs;
-    while (!file.atEnd()) {
-      QByteArray line = file.readLine().trimmed();
-      QString filename = QString::fromLatin1(line.constData(), line.length());
-      if (directory.exists(filename)){
-	files.removeOne(filename);
-	QcTileSpec tile_spec = filename_to_tile_spec(filename);
-	// qInfo() << "Load" << tile_spec;
-	if (tile_spec.level() == -1) // Fixme: when ?
-	  continue;
-	QSharedPointer<QcCachedTileDisk> tile_disk(new QcCachedTileDisk);
-	tile_disk->filename = directory.filePath(filename);
-	tile_disk->cache = this;
-	tile_disk->tile_spec = tile_spec;
-	tile_specs.append(tile_spec);
-	queue.append(tile_disk);
-	costs.append(QFileInfo(filename).size());
+    m_disk_cache.serialize_queue(i, queue);
+    for (const auto & tile : queue)
+      if (!tile.isNull()) {
+        if (m_tile_pack)
+          queue_of.insert(tile->tile_spec, i);
+        else {
+          QcTileCacheIndexEntry entry;
+          entry.tile_spec = tile->tile_spec;
+          entry.format = tile->format;
+          entry.size = tile->size;
+          entry.queue = i;
+          entries << entry;
+        }
       }
+  }
+
+  // Index all the records of the pack, else they would be lost
+  if (m_tile_pack) {
+    QHash<QcTileSpec, QcTilePackEntry> pack_index = m_tile_pack->index();
+    entries.reserve(pack_index.size());
+    for (auto it = pack_index.constBegin(); it != pack_index.constEnd(); ++it) {
+      QcTileCacheIndexEntry entry;
+      entry.tile_spec = it.key();
+      entry.format = it->format;
+      entry.size = it->size;
+      entry.queue = queue_of.value(it.key(), 0);
+      entry.offset = it->offset;
+      entry.data_offset = it->data_offset;
+      entries << entry;
     }
-    file.close();
-    m_disk_cache.deserialize_queue(i, tile_specs, queue, costs);
   }
 
-  // 2. remaining tiles that aren't registered in a queue get pushed into cache here
-  // this is a backup, in case the queue manifest files get deleted or out of sync due to
-  // the application not closing down properly
-  // Fixme: or for off-line cache
-  for (const auto & relative_filename : files) {
-    QcTileSpec tile_spec = filename_to_tile_spec(relative_filename);
-    if (tile_spec.level() == -1)
-      continue;
-    QString filename = directory.filePath(relative_filename);
-    add_to_disk_cache(tile_spec, filename);
+  qint64 pack_size = m_tile_pack ? m_tile_pack->size() : -1;
+  qint64 dead_size = m_tile_pack ? m_tile_pack->dead_size() : 0;
+  QcTileCacheIndex::write(index_filename(), entries, pack_size, dead_size);
+}
+
+void
+QcFileTileCache::rebuild_index()
+{
+  qInfo() << "Rebuild tile cache index" << m_directory;
+
+  // Legacy queue files
+  for (int i = 1; i <= NUMBER_OF_QUEUES; i++)
+    QFile::remove(QDir(m_directory).filePath(QLatin1Literal("queue") + QString::number(i)));
+
+  QString pack_filename;
+  qint64 pack_size = 0;
+  if (m_tile_pack) {
+    pack_filename = m_tile_pack->filename();
+    pack_size = m_tile_pack->size();
+  }
+
+  m_rebuilding_index = true;
+  m_index_rebuild = QSharedPointer<QcTileIndexRebuild>(new QcTileIndexRebuild);
+  m_io_pool.start(new QcTileIndexRebuildJob(this, m_index_rebuild, m_directory, pack_filename, pack_size));
+}
+
+void
+QcFileTileCache::on_index_rebuilt()
+{
+  // Already applied or discarded by clear_all
+  if (!m_rebuilding_index || m_index_rebuild.isNull())
+    return;
+
+  m_rebuilding_index = false;
+  QSharedPointer<QcTileIndexRebuild> rebuild = m_index_rebuild;
+  m_index_rebuild.clear();
+  const QcTileCacheIndexEntryList & entries = rebuild->entries;
+  qint64 dead_size = rebuild->dead_size;
+  qint64 end = rebuild->end;
+
+  if (m_tile_pack) {
+    // The pack was not modified during the rebuild, drop a truncated record
+    if (end < 0) {
+      qWarning() << "Reset invalid tile pack" << m_tile_pack->filename();
+      m_tile_pack->clear();
+    } else if (end < m_tile_pack->size())
+      m_tile_pack->truncate(end);
+
+    QHash<QcTileSpec, QcTilePackEntry> pack_index;
+    for (const auto & entry : entries) {
+      QcTilePackEntry pack_entry;
+      pack_entry.offset = entry.offset;
+      pack_entry.data_offset = entry.data_offset;
+      pack_entry.size = entry.size;
+      pack_entry.format = entry.format;
+      pack_index.insert(entry.tile_spec, pack_entry);
+    }
+    m_tile_pack->merge_index(pack_index, dead_size);
+
+    // Migrate from one file per tile
+    m_tile_pack->import_files(m_directory);
+
+    QHash<QcTileSpec, QcTilePackEntry> index = m_tile_pack->index();
+    for (auto it = index.constBegin(); it != index.constEnd(); ++it)
+      add_to_disk_cache(it.key(), QString(), it->format, it->size);
+  } else {
+    for (const auto & entry : entries) {
+      QString filename = tile_spec_to_filename(entry.tile_spec, entry.format, m_directory);
+      add_to_disk_cache(entry.tile_spec, filename, entry.format, entry.size);
+    }
   }
+
+  // Inserts received during the rebuild
+  for (const auto & deferred_insert : m_deferred_inserts)
+    insert(deferred_insert.tile_spec, deferred_insert.bytes, deferred_insert.format, deferred_insert.freshness);
+  m_deferred_inserts.clear();
 }
 
 void
@@ -330,28 +766,83 @@ QcFileTileCache::print_stats()
   m_disk_cache.print_stats();
 }
 
+QcTileCacheTierMetrics
+QcFileTileCache::texture_metrics() const
+{
+  QcTileCacheTierMetrics metrics;
+  metrics.hits = m_texture_cache.hit_count();
+  metrics.misses = m_texture_cache.miss_count();
+  metrics.promotions = m_texture_cache.promotion_count();
+  metrics.evictions = m_texture_cache.eviction_count();
+  metrics.tiles = m_texture_cache.size();
+  metrics.bytes = m_texture_cache.total_cost();
+  metrics.max_bytes = m_texture_cache.max_cost();
+  return metrics;
+}
+
+QcTileCacheTierMetrics
+QcFileTileCache::memory_metrics() const
+{
+  QcTileCacheTierMetrics metrics;
+  metrics.hits = m_memory_cache.hit_count();
+  metrics.misses = m_memory_cache.miss_count();
+  metrics.promotions = m_memory_cache.promotion_count();
+  metrics.evictions = m_memory_cache.eviction_count();
+  metrics.tiles = m_memory_cache.size();
+  metrics.bytes = m_memory_cache.total_cost();
+  metrics.max_bytes = m_memory_cache.max_cost();
+  return metrics;
+}
+
+QcTileCacheTierMetrics
+QcFileTileCache::disk_metrics() const
+{
+  QcTileCacheTierMetrics metrics;
+  metrics.hits = m_disk_cache.hit_count();
+  metrics.misses = m_disk_cache.miss_count();
+  metrics.promotions = m_disk_cache.promotion_count();
+  metrics.evictions = m_disk_cache.eviction_count();
+  metrics.tiles = m_disk_cache.size();
+  metrics.bytes = m_disk_cache.total_cost();
+  metrics.max_bytes = m_disk_cache.max_cost();
+  return metrics;
+}
+
 void
 QcFileTileCache::handle_error(const QcTileSpec & tile_spec, const QString & error)
 {
   qWarning() << "tile request error " << tile_spec << error;
 }
 
+/* Set the maximum size of the cache on disk.
+ *
+ * For a pack, the dead records are accounted: the live tiles are
+ * limited so that the pack is compacted before it exceeds this size.
+ */
 void
 QcFileTileCache::set_max_disk_usage(int disk_usage)
 {
-  m_disk_cache.set_max_cost(disk_usage);
+  m_max_disk_usage = disk_usage;
+  if (m_tile_pack)
+    m_disk_cache.set_max_cost(disk_usage * (1. - PACK_COMPACTION_RATIO));
+  else
+    m_disk_cache.set_max_cost(disk_usage);
 }
 
 int
 QcFileTileCache::max_disk_usage() const
 {
-  return m_disk_cache.max_cost();
+  return m_max_disk_usage;
 }
 
+//! Return the size of the tiles on disk, for a pack the size of the file
 int
 QcFileTileCache::disk_usage() const
 {
-  return m_disk_cache.total_cost();
+  if (m_tile_pack)
+    return m_tile_pack->size();
+  else
+    return m_disk_cache.total_cost();
 }
 
 void
@@ -408,19 +899,19 @@ QSharedPointer<QcTileTexture>
 QcFileTileCache::get(const QcTileSpec & tile_spec)
 {
   // Try texture cache
-  QSharedPointer<QcTileTexture> tile_texture = m_texture_cache.object(tile_spec);
+  QSharedPointer<QcTileTexture> tile_texture = m_texture_cache.object(tile_spec.key());
   if (tile_texture)
     return tile_texture;
 
   // Try memory cache
-  QSharedPointer<QcCachedTileMemory> tile_memory = m_memory_cache.object(tile_spec);
+  QSharedPointer<QcCachedTileMemory> tile_memory = m_memory_cache.object(tile_spec.key());
   if (tile_memory)
     return load_from_memory(tile_memory);
 
   // Try disk cache
-  QSharedPointer<QcCachedTileDisk> tile_directory = m_disk_cache.object(tile_spec);
+  QSharedPointer<QcCachedTileDisk> tile_directory = m_disk_cache.object(tile_spec.key());
   if (tile_directory)
-    return load_from_disk(tile_directory->tile_spec, tile_directory->filename);
+    return load_from_disk(tile_directory->tile_spec, tile_directory->filename, tile_directory->format, m_tile_pack);
 
   // Try offline cache
   // QSharedPointer<QcOfflineCachedTileDisk> offline_tile = m_offline_cache->get(tile_spec);
@@ -429,27 +920,198 @@ QcFileTileCache::get(const QcTileSpec & tile_spec)
     QcOfflineCachedTileDisk offline_tile = m_offline_cache->get(tile_spec);
     // qInfo() << "In offline cache" << tile_spec;
     // return load_from_disk(offline_tile->tile_spec, offline_tile->filename);
-    return load_from_disk(offline_tile.tile_spec, offline_tile.filename);
+    return load_from_disk(offline_tile.tile_spec, offline_tile.filename, offline_tile.format,
+                          m_offline_cache->tile_pack());
   }
 
   // else
   return QSharedPointer<QcTileTexture>();
 }
 
+void
+QcFileTileCache::set_max_decode_threads(int number_of_threads)
+{
+  m_decode_pool.setMaxThreadCount(qBound(1, number_of_threads, MAX_DECODE_THREADS));
+}
+
+/*! Asynchronous lookup.
+ *
+ * Return the texture if it is already decoded. Else if the tile is
+ * in the memory, disk or offline cache, schedule a decode job on the
+ * worker pool, set \a pending and return a null pointer. The signal
+ * tile_decoded() or tile_decode_error() is emitted when the job completes.
+ */
+QSharedPointer<QcTileTexture>
+QcFileTileCache::get_async(const QcTileSpec & tile_spec, bool & pending)
+{
+  pending = false;
+
+  // Try texture cache
+  QSharedPointer<QcTileTexture> tile_texture = m_texture_cache.object(tile_spec.key());
+  if (tile_texture)
+    return tile_texture;
+
+  if (m_pending_decodes.contains(tile_spec.key())) {
+    pending = true;
+    return QSharedPointer<QcTileTexture>();
+  }
+
+  // Try memory cache
+  QSharedPointer<QcCachedTileMemory> tile_memory = m_memory_cache.object(tile_spec.key());
+  if (tile_memory) {
+    schedule_decode(tile_spec, tile_memory->bytes, QString(), tile_memory->format);
+    pending = true;
+    return QSharedPointer<QcTileTexture>();
+  }
+
+  // Try disk cache
+  QSharedPointer<QcCachedTileDisk> tile_directory = m_disk_cache.object(tile_spec.key());
+  if (tile_directory) {
+    const QString & filename = tile_directory->filename;
+    const QString format = filename.isEmpty() ? tile_directory->format : QFileInfo(filename).suffix();
+    if (m_memory_mapped)
+      tile_memory = map_disk_tile(tile_spec, filename, format, m_tile_pack);
+    if (tile_memory)
+      schedule_decode(tile_spec, tile_memory->bytes, QString(), format, nullptr, tile_memory->mapped_file);
+    else
+      schedule_decode(tile_spec, QByteArray(), filename, format, m_tile_pack);
+    pending = true;
+    return QSharedPointer<QcTileTexture>();
+  }
+
+  // Try offline cache
+  if (m_offline_cache->contains(tile_spec)) {
+    QcOfflineCachedTileDisk offline_tile = m_offline_cache->get(tile_spec);
+    const QString & filename = offline_tile.filename;
+    const QString format = filename.isEmpty() ? offline_tile.format : QFileInfo(filename).suffix();
+    if (m_memory_mapped)
+      tile_memory = map_disk_tile(tile_spec, filename, format, m_offline_cache->tile_pack());
+    if (tile_memory)
+      schedule_decode(tile_spec, tile_memory->bytes, QString(), format, nullptr, tile_memory->mapped_file);
+    else
+      schedule_decode(tile_spec, QByteArray(), filename, format, m_offline_cache->tile_pack());
+    pending = true;
+  }
+
+  return QSharedPointer<QcTileTexture>();
+}
+
+//! Return true if the tile is in a tier of the cache
+bool
+QcFileTileCache::contains(const QcTileSpec & tile_spec) const
+{
+  QcTileKey tile_key = tile_spec.key();
+  return
+    !m_texture_cache.peek(tile_key).isNull() ||
+    !m_memory_cache.peek(tile_key).isNull() ||
+    !m_disk_cache.peek(tile_key).isNull() ||
+    m_offline_cache->contains(tile_spec);
+}
+
+/*! Read the encoded image of a tile on disk into the memory tier.
+ *
+ * A next lookup then only has to decode the image.  Return true if the
+ * tile was read.
+ */
+bool
+QcFileTileCache::warm(const QcTileSpec & tile_spec)
+{
+  QcTileKey tile_key = tile_spec.key();
+  if (m_texture_cache.peek(tile_key) || m_memory_cache.peek(tile_key) || m_pending_decodes.contains(tile_key))
+    return false;
+
+  QString filename;
+  QString format;
+  const QcTilePack * tile_pack;
+  QSharedPointer<QcCachedTileDisk> tile_directory = m_disk_cache.peek(tile_key);
+  if (tile_directory) {
+    filename = tile_directory->filename;
+    format = tile_directory->format;
+    tile_pack = m_tile_pack;
+  } else if (m_offline_cache->contains(tile_spec)) {
+    QcOfflineCachedTileDisk offline_tile = m_offline_cache->get(tile_spec);
+    filename = offline_tile.filename;
+    format = offline_tile.format;
+    tile_pack = m_offline_cache->tile_pack();
+  } else
+    return false;
+  if (!filename.isEmpty())
+    format = QFileInfo(filename).suffix();
+
+  if (m_memory_mapped)
+    return !map_disk_tile(tile_spec, filename, format, tile_pack).isNull();
+
+  QElapsedTimer timer;
+  timer.start();
+  QByteArray bytes = read_disk_tile(tile_spec, filename, tile_pack);
+  m_metrics->record_disk_read(timer.nsecsElapsed() / 1000);
+  if (bytes.isEmpty())
+    return false;
+  add_to_memory_cache(tile_spec, bytes, format);
+  return true;
+}
+
+void
+QcFileTileCache::schedule_decode(const QcTileSpec & tile_spec,
+                                 const QByteArray & bytes, const QString & filename, const QString & format,
+                                 const QcTilePack * tile_pack, const QSharedPointer<QcMappedTileFile> & mapped_file)
+{
+  m_pending_decodes.insert(tile_spec.key());
+  m_decode_pool.start(new QcTileDecodeJob(this, tile_spec, bytes, filename, format, tile_pack, mapped_file, m_texture_format));
+}
+
+void
+QcFileTileCache::on_tile_decoded(const QcTileSpec & tile_spec, const QImage & image,
+                                 const QByteArray & bytes, const QString & format)
+{
+  m_pending_decodes.remove(tile_spec.key());
+
+  // The last job which could hold a view on the pack is done
+  if (m_compaction_decodes.remove(tile_spec.key()) && m_compaction_decodes.isEmpty())
+    m_io_pool.start(new QcTilePackCompactionJob(this, m_tile_pack));
+
+  if (image.isNull()) {
+    handle_error(tile_spec, QLatin1Literal("Problem with tile image"));
+    // The tile must be fetched again in full, not revalidated
+    m_freshness.remove(tile_spec);
+    emit tile_decode_error(tile_spec);
+    return;
+  }
+
+  // The image was read from disk
+  if (!bytes.isEmpty())
+    add_to_memory_cache(tile_spec, bytes, format);
+
+  add_to_texture_cache(tile_spec, image);
+  emit tile_decoded(tile_spec);
+}
+
 QSharedPointer<QcTileTexture>
 // QcFileTileCache::load_from_disk(const QSharedPointer<QcCachedTileDisk> & tile_directory)
-QcFileTileCache::load_from_disk(const QcTileSpec & tile_spec, const QString & filename)
+QcFileTileCache::load_from_disk(const QcTileSpec & tile_spec, const QString & filename,
+                                const QString & format, const QcTilePack * tile_pack)
 {
   // const QcTileSpec & tile_spec = tile_directory->tile_spec;
   // const QString & filename = tile_directory->filename;
 
-  QByteArray bytes = read_tile_image(filename);
+  if (m_memory_mapped) {
+    QSharedPointer<QcCachedTileMemory> tile_memory =
+      map_disk_tile(tile_spec, filename, format.isEmpty() ? QFileInfo(filename).suffix() : format, tile_pack);
+    if (tile_memory)
+      return load_from_memory(tile_memory);
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  QByteArray bytes = read_disk_tile(tile_spec, filename, tile_pack);
+  m_metrics->record_disk_read(timer.nsecsElapsed() / 1000);
 
   // Load PNG, JPEG from bytes
-  QImage image;
-  if (image.loadFromData(bytes)) {
-    const QString format = QFileInfo(filename).suffix();
-    add_to_memory_cache(tile_spec, bytes, format);
+  timer.restart();
+  QImage image = decode_tile_image(bytes, m_texture_format);
+  m_metrics->record_decode_time(timer.nsecsElapsed() / 1000);
+  if (!image.isNull()) {
+    add_to_memory_cache(tile_spec, bytes, format.isEmpty() ? QFileInfo(filename).suffix() : format);
 
     QSharedPointer<QcTileTexture> tile_texture = add_to_texture_cache(tile_spec, image);
     if (tile_texture) // Fixme: when ? memory overflow ?
@@ -467,8 +1129,11 @@ QcFileTileCache::load_from_memory(const QSharedPointer<QcCachedTileMemory> & til
   const QcTileSpec & tile_spec = tile_memory->tile_spec;
 
   // Fixme: duplicated code, excepted add_to_memory_cache
-  QImage image;
-  if (image.loadFromData(tile_memory->bytes)) {
+  QElapsedTimer timer;
+  timer.start();
+  QImage image = decode_tile_image(tile_memory->bytes, m_texture_format);
+  m_metrics->record_decode_time(timer.nsecsElapsed() / 1000);
+  if (!image.isNull()) {
     QSharedPointer<QcTileTexture> tile_texture = add_to_texture_cache(tile_spec, image);
     if (tile_texture)
       return tile_texture;
@@ -480,7 +1145,8 @@ QcFileTileCache::load_from_memory(const QSharedPointer<QcCachedTileMemory> & til
 }
 
 void
-QcFileTileCache::insert(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format)
+QcFileTileCache::insert(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format,
+                        const QcTileFreshness & freshness)
 // Fixme:
 // QcTiledMappingManagerEngine::CacheAreas areas
 {
@@ -488,26 +1154,229 @@ QcFileTileCache::insert(const QcTileSpec & tile_spec, const QByteArray & bytes,
     return;
 
   // if (areas & QcTiledMappingManagerEngine::DiskCache) {
-  QString filename = tile_spec_to_filename(tile_spec, format, m_directory);
-  write_tile_image(filename, bytes);
-  add_to_disk_cache(tile_spec, filename);
+  // A pending deletion of this tile is obsolete
+  for (int i = m_eviction_batch.size() - 1; i >= 0; i--)
+    if (m_eviction_batch[i].tile_spec == tile_spec)
+      m_eviction_batch.removeAt(i);
+
+  if (m_tile_pack && m_rebuilding_index) {
+    // The pack is scanned in background, append the tile once done
+    QcDeferredTileInsert deferred_insert;
+    deferred_insert.tile_spec = tile_spec;
+    deferred_insert.bytes = bytes;
+    deferred_insert.format = format;
+    deferred_insert.freshness = freshness;
+    m_deferred_inserts << deferred_insert;
+  } else if (m_tile_pack) {
+    if (m_tile_pack->insert(tile_spec, bytes, format)) {
+      add_to_disk_cache(tile_spec, QString(), format, bytes.size());
+      m_freshness.insert(tile_spec, freshness);
+    }
+  } else {
+    QString filename = tile_spec_to_filename(tile_spec, format, m_directory);
+    write_tile_image(filename, bytes);
+    add_to_disk_cache(tile_spec, filename, format, bytes.size());
+    m_freshness.insert(tile_spec, freshness);
+  }
   // }
 
   // if (areas & QcTiledMappingManagerEngine::MemoryCache) {
   add_to_memory_cache(tile_spec, bytes, format);
   // }
 
+  // A refreshed tile replaces the decoded image of the previous version
+  m_texture_cache.remove(tile_spec.key());
+
   /* Inserts do not hit the texture cache -- this actually reduces overall
    * cache hit rates because many tiles come too late to be useful
    * and act as a poison
    */
 }
 
+/*! Update the freshness of a tile on disk which was revalidated by the
+ *  server, i.e. a 304 Not Modified response.
+ */
+void
+QcFileTileCache::update_freshness(const QcTileSpec & tile_spec, const QcTileFreshness & freshness)
+{
+  if (!m_freshness.contains(tile_spec) || m_disk_cache.peek(tile_spec.key()).isNull())
+    return;
+
+  QcTileFreshness updated_freshness = m_freshness.value(tile_spec);
+  updated_freshness.update(freshness);
+  m_freshness.insert(tile_spec, updated_freshness);
+}
+
+/*! Return the encoded image of a tile on disk, an empty array if the
+ *  tile is not on disk.
+ */
+QByteArray
+QcFileTileCache::read(const QcTileSpec & tile_spec, QString * format) const
+{
+  QSharedPointer<QcCachedTileDisk> tile_directory = m_disk_cache.peek(tile_spec.key());
+  if (tile_directory.isNull())
+    return QByteArray();
+
+  if (m_tile_pack)
+    return m_tile_pack->read(tile_spec, format);
+
+  if (format)
+    *format = tile_directory->format;
+  return read_tile_image(tile_directory->filename);
+}
+
+//! Return the freshness of a tile on disk, an invalid freshness if unknown
+QcTileFreshness
+QcFileTileCache::freshness(const QcTileSpec & tile_spec) const
+{
+  // The metadata of the tiles lost in a crash are still there
+  if (m_disk_cache.peek(tile_spec.key()).isNull())
+    return QcTileFreshness();
+  return m_freshness.value(tile_spec);
+}
+
+int
+QcFileTileCache::stale_tile_count() const
+{
+  return m_freshness.stale_count(QDateTime::currentMSecsSinceEpoch());
+}
+
+/*! Return at most \a max_count tiles on disk which must be revalidated,
+ *  the longest expired first.
+ */
+QList<QcTileSpec>
+QcFileTileCache::stale_tiles(int max_count, const QcTileKeySet & excluded) const
+{
+  QList<QcTileSpec> tile_specs;
+  QcTileKeySet skipped = excluded;
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  while (tile_specs.size() < max_count) {
+    QList<QcTileSpec> stale_tiles = m_freshness.stale_tiles(now, max_count - tile_specs.size(), skipped);
+    if (stale_tiles.isEmpty())
+      break;
+    for (const auto & tile_spec : stale_tiles) {
+      if (!m_disk_cache.peek(tile_spec.key()).isNull())
+        tile_specs << tile_spec;
+      skipped.insert(tile_spec.key());
+    }
+  }
+  return tile_specs;
+}
+
 void
 QcFileTileCache::evict_from_disk_cache(QcCachedTileDisk * tile_directory)
 {
-  qWarning() << "evict_from_disk_cache disabled";
-  // QFile::remove(tile_directory->filename);
+  if (tile_directory->cache)
+    tile_directory->cache->schedule_eviction(tile_directory);
+}
+
+/* Queue an evicted tile for deletion.
+ *
+ * The tiles are deleted by batch on the I/O thread, so as to not block
+ * the GUI thread on file system operations.
+ */
+void
+QcFileTileCache::schedule_eviction(const QcCachedTileDisk * tile_directory)
+{
+  m_freshness.remove(tile_directory->tile_spec);
+
+  QcTileEviction eviction;
+  eviction.tile_spec = tile_directory->tile_spec;
+  eviction.filename = tile_directory->filename;
+  eviction.size = tile_directory->size;
+  eviction.offset = -1;
+  eviction.evicted_at = m_eviction_clock.elapsed();
+
+  if (tile_directory->filename.isEmpty()) {
+    // Remember the record, a tile inserted again must not be removed
+    QcTilePackEntry entry;
+    if (!m_tile_pack || !m_tile_pack->entry(eviction.tile_spec, entry))
+      return;
+    eviction.offset = entry.offset;
+  }
+
+  m_eviction_batch << eviction;
+
+  if (m_eviction_batch.size() >= EVICTION_BATCH_SIZE)
+    flush_evictions();
+  else if (!m_eviction_timer.isActive())
+    m_eviction_timer.start();
+}
+
+void
+QcFileTileCache::flush_evictions()
+{
+  m_eviction_timer.stop();
+  // The record offsets change, the batch is flushed once the pack is compacted
+  if (m_eviction_batch.isEmpty() || m_compacting)
+    return;
+
+  m_io_pool.start(new QcTileEvictionJob(this, m_tile_pack, m_eviction_batch));
+  m_eviction_batch.clear();
+}
+
+void
+QcFileTileCache::on_evictions_done(int number_of_tiles, qint64 bytes, qint64 evicted_at)
+{
+  m_evicted_tiles += number_of_tiles;
+  m_reclaimed_bytes += bytes;
+  // latency of the oldest eviction of the batch
+  m_last_eviction_latency = m_eviction_clock.elapsed() - evicted_at;
+  m_max_eviction_latency = qMax(m_max_eviction_latency, m_last_eviction_latency);
+  // qInfo() << "Evicted" << number_of_tiles << "tiles" << bytes << "bytes in" << m_last_eviction_latency << "ms";
+
+  schedule_compaction();
+}
+
+/* Compact the pack on the I/O thread when the dead records exceed the
+ * compaction ratio of the maximum disk usage.
+ *
+ * The compaction unmaps the pack, thus no view is mapped meanwhile and
+ * the views held by the memory tier and the decode jobs are released
+ * beforehand.  The GUI thread doesn't wait for the decode jobs, the
+ * compaction is started by the completion of the last job which was
+ * running, the next ones cannot map the pack.
+ */
+void
+QcFileTileCache::schedule_compaction()
+{
+  if (!m_tile_pack || m_compacting || m_rebuilding_index ||
+      m_tile_pack->dead_size() <= m_max_disk_usage * PACK_COMPACTION_RATIO)
+    return;
+
+  // Pending evictions must be applied to the current offsets
+  flush_evictions();
+  m_compacting = true;
+
+  if (m_memory_mapped) {
+    m_memory_cache.clear();
+    m_compaction_decodes = m_pending_decodes;
+    if (!m_compaction_decodes.isEmpty())
+      return; // see on_tile_decoded
+  }
+
+  m_io_pool.start(new QcTilePackCompactionJob(this, m_tile_pack));
+}
+
+void
+QcFileTileCache::on_compaction_done(qint64 reclaimed_bytes)
+{
+  m_compacting = false;
+  m_reclaimed_bytes += reclaimed_bytes;
+  // qInfo() << "Compacted tile pack" << reclaimed_bytes << "bytes";
+
+  // The evictions queued during the compaction refer to the former offsets
+  for (int i = m_eviction_batch.size() - 1; i >= 0; i--) {
+    QcTileEviction & eviction = m_eviction_batch[i];
+    if (eviction.offset < 0)
+      continue;
+    QcTilePackEntry entry;
+    if (m_tile_pack->entry(eviction.tile_spec, entry))
+      eviction.offset = entry.offset;
+    else
+      m_eviction_batch.removeAt(i);
+  }
+  flush_evictions();
 }
 
 void
@@ -515,16 +1384,19 @@ QcFileTileCache::evict_from_memory_cache(QcCachedTileMemory * /* tile_memory  */
 {}
 
 QSharedPointer<QcCachedTileDisk>
-QcFileTileCache::add_to_disk_cache(const QcTileSpec & tile_spec, const QString  & filename)
+QcFileTileCache::add_to_disk_cache(const QcTileSpec & tile_spec, const QString  & filename,
+                                   const QString & format, int size)
 {
   QSharedPointer<QcCachedTileDisk> tile_directory(new QcCachedTileDisk);
   tile_directory->tile_spec = tile_spec;
   tile_directory->filename = filename;
+  tile_directory->format = format;
+  tile_directory->size = size;
   tile_directory->cache = this;
 
-  QFileInfo file_info(filename);
-  int disk_cost = filename.size();
-  m_disk_cache.insert(tile_spec, tile_directory, disk_cost);
+  // Cost is the size of the encoded image in bytes
+  int disk_cost = size;
+  m_disk_cache.insert(tile_spec.key(), tile_directory, disk_cost);
   return tile_directory;
 }
 
@@ -538,8 +1410,37 @@ QcFileTileCache::add_to_memory_cache(const QcTileSpec & tile_spec, const QByteAr
   tile_memory->format = format;
 
   int cost = bytes.size();
-  m_memory_cache.insert(tile_spec, tile_memory, cost);
+  m_memory_cache.insert(tile_spec.key(), tile_memory, cost);
+
+  return tile_memory;
+}
+
+/* Add a view on the mapped tile to the memory cache.
+ *
+ * The pages are shared with the kernel page cache, thus the memory
+ * tier doesn't hold a private copy of the encoded image.
+ */
+QSharedPointer<QcCachedTileMemory>
+QcFileTileCache::map_disk_tile(const QcTileSpec & tile_spec, const QString & filename,
+                               const QString & format, const QcTilePack * tile_pack)
+{
+  QSharedPointer<QcMappedTileFile> mapped_file;
+  QByteArray bytes;
+  if (filename.isEmpty() && tile_pack) {
+    // The pack is unmapped by the compaction
+    if (m_compacting && tile_pack == m_tile_pack)
+      return QSharedPointer<QcCachedTileMemory>();
+    bytes = tile_pack->read_view(tile_spec);
+  } else {
+    mapped_file = QSharedPointer<QcMappedTileFile>(new QcMappedTileFile(filename));
+    bytes = mapped_file->bytes();
+  }
+
+  if (bytes.isEmpty())
+    return QSharedPointer<QcCachedTileMemory>();
 
+  QSharedPointer<QcCachedTileMemory> tile_memory = add_to_memory_cache(tile_spec, bytes, format);
+  tile_memory->mapped_file = mapped_file;
   return tile_memory;
 }
 
@@ -551,7 +1452,7 @@ QcFileTileCache::add_to_texture_cache(const QcTileSpec & tile_spec, const QImage
   tile_texture->image = image;
 
   int texture_cost = image.width() * image.height() * image.depth() / 8;
-  m_texture_cache.insert(tile_spec, tile_texture, texture_cost);
+  m_texture_cache.insert(tile_spec.key(), tile_texture, texture_cost);
 
   return tile_texture;
 }
@@ -71,14 +71,22 @@
 
 #include <QCache>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QImage>
 #include <QMutex>
 #include <QObject>
 #include <QSet>
+#include <QThreadPool>
 #include <QTimer>
 
 #include "cache/cache3q.h"
+#include "cache/concurrent_cache3q.h"
 #include "cache/offline_cache.h"
+#include "cache/tile_cache_index.h"
+#include "cache/tile_cache_metrics.h"
+#include "cache/tile_freshness.h"
+#include "cache/tile_image.h"
+#include "cache/tile_pack.h"
 #include "qtcarto_global.h"
 #include "wmts/tile_spec.h"
 
@@ -88,6 +96,7 @@
 
 class QcCachedTileMemory;
 class QcFileTileCache;
+class QcTileIndexRebuild;
 
 /**************************************************************************************************/
 
@@ -116,17 +125,42 @@ class QcCachedTileDisk
   QcTileSpec tile_spec;
   QString filename;
   QString format;
+  int size; // of the encoded image
   QcFileTileCache * cache;
 };
 
 /**************************************************************************************************/
 
 // Custom eviction policy for the disk cache, to avoid deleting all the files when the application closes
-class QCache3QTileEvictionPolicy : public QcCache3QDefaultEvictionPolicy<QcTileSpec, QcCachedTileDisk>
+class QCache3QTileEvictionPolicy : public QcCache3QDefaultEvictionPolicy<QcTileKey, QcCachedTileDisk>
 {
  protected:
-  void about_to_be_removed(const QcTileSpec & key, QSharedPointer<QcCachedTileDisk> obj);
-  void about_to_be_evicted(const QcTileSpec & key, QSharedPointer<QcCachedTileDisk> obj);
+  void about_to_be_removed(const QcTileKey & key, QSharedPointer<QcCachedTileDisk> obj);
+  void about_to_be_evicted(const QcTileKey & key, QSharedPointer<QcCachedTileDisk> obj);
+};
+
+/**************************************************************************************************/
+
+// Tile evicted from the disk cache and waiting to be deleted
+class QcTileEviction
+{
+ public:
+  QcTileSpec tile_spec;
+  QString filename;
+  int size;
+  qint64 offset; // record offset in the pack, -1 for a tile file
+  qint64 evicted_at; // ms
+};
+
+/**************************************************************************************************/
+
+class QcDeferredTileInsert
+{
+ public:
+  QcTileSpec tile_spec;
+  QByteArray bytes;
+  QString format;
+  QcTileFreshness freshness;
 };
 
 /**************************************************************************************************/
@@ -136,13 +170,23 @@ class QC_EXPORT QcFileTileCache : public QObject
   Q_OBJECT
 
  public:
-  QcFileTileCache(const QString & directory = QString());
+  QcFileTileCache(const QString & directory = QString(), QcTileStorage storage = QcTileStorage::Packed);
   ~QcFileTileCache();
 
+  QcTileStorage storage() const { return m_tile_pack ? QcTileStorage::Packed : QcTileStorage::Files; }
+  const QcTilePack * tile_pack() const { return m_tile_pack; }
+
   void set_max_disk_usage(int disk_usage);
   int max_disk_usage() const;
   int disk_usage() const;
 
+  // Disk eviction statistics
+  int evicted_tiles() const { return m_evicted_tiles; }
+  qint64 reclaimed_bytes() const { return m_reclaimed_bytes; }
+  qint64 last_eviction_latency() const { return m_last_eviction_latency; } // ms
+  qint64 max_eviction_latency() const { return m_max_eviction_latency; } // ms
+  int pending_evictions() const { return m_eviction_batch.size(); }
+
   void set_max_memory_usage(int memory_usage);
   int max_memory_usage() const;
   int memory_usage() const;
@@ -156,8 +200,32 @@ class QC_EXPORT QcFileTileCache : public QObject
   void clear_all();
 
   QSharedPointer<QcTileTexture> get(const QcTileSpec & tile_spec);
+  // Thread safe lookup in the texture tier, doesn't update the popularity
+  QSharedPointer<QcTileTexture> peek_texture(const QcTileSpec & tile_spec) const {
+    return m_texture_cache.peek(tile_spec.key());
+  }
+  QSharedPointer<QcTileTexture> peek_texture(const QcTileKey & tile_key) const {
+    return m_texture_cache.peek(tile_key);
+  }
+  QSharedPointer<QcTileTexture> get_async(const QcTileSpec & tile_spec, bool & pending);
+  // Lookups which don't update the popularity
+  bool contains(const QcTileSpec & tile_spec) const;
+  bool warm(const QcTileSpec & tile_spec);
+  bool is_decoding(const QcTileSpec & tile_spec) const { return m_pending_decodes.contains(tile_spec.key()); }
+
+  void set_max_decode_threads(int number_of_threads);
+  int max_decode_threads() const { return m_decode_pool.maxThreadCount(); }
+
+  void set_memory_mapped(bool memory_mapped) { m_memory_mapped = memory_mapped; }
+  bool is_memory_mapped() const { return m_memory_mapped; }
+
+  // Rgb565 halves the cost of opaque tiles in the texture tier
+  void set_texture_format(QcTileImageFormat format) { m_texture_format = format; }
+  QcTileImageFormat texture_format() const { return m_texture_format; }
   // QSharedPointer<QcTileTexture> load_from_disk(const QSharedPointer<QcCachedTileDisk> & tile_directory);
-  QSharedPointer<QcTileTexture> load_from_disk(const QcTileSpec & tile_spec, const QString & filename);
+  QSharedPointer<QcTileTexture> load_from_disk(const QcTileSpec & tile_spec, const QString & filename,
+                                               const QString & format = QString(),
+                                               const QcTilePack * tile_pack = nullptr);
 
   // can be called without a specific tileCache pointer
   static void evict_from_disk_cache(QcCachedTileDisk * td);
@@ -165,7 +233,9 @@ class QC_EXPORT QcFileTileCache : public QObject
 
   void insert(const QcTileSpec & tile_spec,
 	      const QByteArray & bytes,
-	      const QString & format);
+	      const QString & format,
+	      const QcTileFreshness & freshness = QcTileFreshness());
+  QByteArray read(const QcTileSpec & tile_spec, QString * format = nullptr) const;
   // QcTiledMappingManagerEngine::CacheAreas areas = QcTiledMappingManagerEngine::AllCaches
   void handle_error(const QcTileSpec & tile_spec, const QString & error);
 
@@ -173,27 +243,86 @@ class QC_EXPORT QcFileTileCache : public QObject
 
   QcOfflineTileCache * offline_cache() { return m_offline_cache; }
 
- private:
+  // HTTP freshness of the tiles on disk
+  QcTileFreshness freshness(const QcTileSpec & tile_spec) const;
+  void update_freshness(const QcTileSpec & tile_spec, const QcTileFreshness & freshness);
+  int stale_tile_count() const;
+  QList<QcTileSpec> stale_tiles(int max_count, const QcTileKeySet & excluded = QcTileKeySet()) const;
+
+  // Statistics
+  QcTileCacheMetrics * metrics() { return m_metrics; }
+  QcTileCacheTierMetrics texture_metrics() const;
+  QcTileCacheTierMetrics memory_metrics() const;
+  QcTileCacheTierMetrics disk_metrics() const;
   void print_stats();
+
+ signals:
+  void tile_decoded(const QcTileSpec & tile_spec);
+  void tile_decode_error(const QcTileSpec & tile_spec);
+
+ private slots:
+  void on_tile_decoded(const QcTileSpec & tile_spec, const QImage & image,
+                       const QByteArray & bytes, const QString & format);
+  void on_index_rebuilt();
+  void flush_evictions();
+  void on_evictions_done(int number_of_tiles, qint64 bytes, qint64 evicted_at);
+  void on_compaction_done(qint64 reclaimed_bytes);
+
+ private:
   void load_tiles();
+  void save_index();
+  void rebuild_index();
+  void schedule_eviction(const QcCachedTileDisk * tile_directory);
+  void schedule_compaction();
 
   QString directory() const { return m_directory; } // Fixme: ???
-  QString queue_filename(int i) const;
+  QString index_filename() const;
+  QString freshness_filename() const;
 
   QSharedPointer<QcTileTexture> load_from_memory(const QSharedPointer<QcCachedTileMemory> & tile_memory);
 
-  QSharedPointer<QcCachedTileDisk> add_to_disk_cache(const QcTileSpec & tile_spec, const QString & filename);
+  QSharedPointer<QcCachedTileDisk> add_to_disk_cache(const QcTileSpec & tile_spec, const QString & filename,
+                                                     const QString & format = QString(), int size = 0);
   QSharedPointer<QcCachedTileMemory> add_to_memory_cache(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format);
   QSharedPointer<QcTileTexture> add_to_texture_cache(const QcTileSpec & tile_spec, const QImage & image);
+  QSharedPointer<QcCachedTileMemory> map_disk_tile(const QcTileSpec & tile_spec, const QString & filename,
+                                                   const QString & format, const QcTilePack * tile_pack);
+
+  void schedule_decode(const QcTileSpec & tile_spec,
+                       const QByteArray & bytes, const QString & filename, const QString & format,
+                       const QcTilePack * tile_pack = nullptr,
+                       const QSharedPointer<QcMappedTileFile> & mapped_file = QSharedPointer<QcMappedTileFile>());
 
  private:
   QcOfflineTileCache * m_offline_cache;
-  QcCache3Q<QcTileSpec, QcCachedTileDisk, QCache3QTileEvictionPolicy > m_disk_cache; // Store image on disk
-  QcCache3Q<QcTileSpec, QcCachedTileMemory > m_memory_cache; // Store encoded images on memory : PNG, JPEG
-  QcCache3Q<QcTileSpec, QcTileTexture > m_texture_cache; // Store decoded images
+  QcTilePack * m_tile_pack; // null for one file per tile
+  int m_max_disk_usage; // size of the files on disk, dead records included
+  QcCache3Q<QcTileKey, QcCachedTileDisk, QCache3QTileEvictionPolicy > m_disk_cache; // Store image on disk
+  // The memory and texture tiers are thread safe
+  QcConcurrentCache3Q<QcTileKey, QcCachedTileMemory > m_memory_cache; // Store encoded images on memory : PNG, JPEG
+  QcConcurrentCache3Q<QcTileKey, QcTileTexture > m_texture_cache; // Store decoded images
   QString m_directory;
   int m_min_texture_usage;
   int m_extra_texture_usage;
+  bool m_memory_mapped; // memory tier holds views on mapped files
+  QcTileImageFormat m_texture_format; // of the decoded images
+  QThreadPool m_decode_pool; // read and decode tile images off the GUI thread
+  QcTileKeySet m_pending_decodes;
+  QcTileKeySet m_compaction_decodes; // running jobs which can hold views on the pack to be compacted
+  bool m_rebuilding_index;
+  QThreadPool m_io_pool; // index rebuild and eviction, serialised on one thread
+  QSharedPointer<QcTileIndexRebuild> m_index_rebuild; // result of the rebuild in progress
+  QList<QcDeferredTileInsert> m_deferred_inserts; // received during a rebuild
+  QList<QcTileEviction> m_eviction_batch;
+  bool m_compacting; // the pack is compacted on the I/O thread
+  QTimer m_eviction_timer;
+  QElapsedTimer m_eviction_clock;
+  int m_evicted_tiles;
+  qint64 m_reclaimed_bytes;
+  qint64 m_last_eviction_latency;
+  qint64 m_max_eviction_latency;
+  QcTileCacheMetrics * m_metrics;
+  QcTileFreshnessStore m_freshness;
 };
 
 // QC_END_NAMESPACE
@@ -32,6 +32,9 @@
 #include "tile_image.h"
 
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtDebug>
 
 // QC_BEGIN_NAMESPACE
 
@@ -63,22 +66,100 @@ QcOfflineCachedTileDisk::operator=(const QcOfflineCachedTileDisk & other)
 
 /**************************************************************************************************/
 
-QcOfflineTileCache::QcOfflineTileCache(const QString & directory)
+QcOfflineTileCache::QcOfflineTileCache(const QString & directory, QcTileStorage storage)
   : m_directory(directory),
-    m_database(nullptr)
+    m_database(nullptr),
+    m_tile_pack(nullptr)
 {
   QDir::root().mkpath(m_directory);
   QString sqlite_file_path = QDir(directory).absoluteFilePath(QStringLiteral("offline_cache.sqlite"));
 
   m_database = new QcOfflineCacheDatabase(sqlite_file_path);
+
+  if (storage == QcTileStorage::Packed)
+    open_tile_pack();
+
+  m_freshness.read(QDir(m_directory).filePath(QcTileFreshnessStore::default_filename));
 }
 
 QcOfflineTileCache::~QcOfflineTileCache()
-{}
+{
+  if (m_tile_pack)
+    save_index();
+  m_freshness.write(QDir(m_directory).filePath(QcTileFreshnessStore::default_filename));
+  delete m_tile_pack;
+}
+
+void
+QcOfflineTileCache::save_index()
+{
+  QcTileCacheIndexEntryList entries;
+  QHash<QcTileSpec, QcTilePackEntry> index = m_tile_pack->index();
+  entries.reserve(index.size());
+  for (auto it = index.constBegin(); it != index.constEnd(); ++it) {
+    QcTileCacheIndexEntry entry;
+    entry.tile_spec = it.key();
+    entry.format = it->format;
+    entry.size = it->size;
+    entry.offset = it->offset;
+    entry.data_offset = it->data_offset;
+    entries << entry;
+  }
+
+  QString index_filename = QDir(m_directory).filePath(QcTileCacheIndex::default_filename);
+  QcTileCacheIndex::write(index_filename, entries, m_tile_pack->size(), m_tile_pack->dead_size());
+}
+
+void
+QcOfflineTileCache::open_tile_pack()
+{
+  m_tile_pack = new QcTilePack(QDir(m_directory).filePath(QcTilePack::default_filename));
+  if (!m_tile_pack->open(false)) {
+    qWarning() << "Fallback to one file per tile for offline cache" << m_directory;
+    delete m_tile_pack;
+    m_tile_pack = nullptr;
+    return;
+  }
+
+  // Load the index written on exit, else scan the pack
+  QString index_filename = QDir(m_directory).filePath(QcTileCacheIndex::default_filename);
+  QcTileCacheIndexEntryList entries;
+  qint64 pack_size = -1;
+  qint64 dead_size = 0;
+  if (QcTileCacheIndex::read(index_filename, entries, pack_size, dead_size)
+      && pack_size == m_tile_pack->size()) {
+    QHash<QcTileSpec, QcTilePackEntry> index;
+    for (const auto & entry : entries) {
+      QcTilePackEntry pack_entry;
+      pack_entry.offset = entry.offset;
+      pack_entry.data_offset = entry.data_offset;
+      pack_entry.size = entry.size;
+      pack_entry.format = entry.format;
+      index.insert(entry.tile_spec, pack_entry);
+    }
+    m_tile_pack->merge_index(index, dead_size);
+  } else
+    m_tile_pack->rescan();
+  QFile::remove(index_filename);
+
+  // Migrate the tiles stored in the level directories, the database is left as is
+  // Fixme: level range
+  for (int level = 0; level < 20; level++) {
+    QString level_directory = m_directory + QDir::separator() + QString::number(level);
+    if (QDir(level_directory).exists()) {
+      m_tile_pack->import_files(level_directory);
+      QDir(m_directory).rmdir(QString::number(level)); // only if empty
+    }
+  }
+}
 
 void
 QcOfflineTileCache::clear_all()
 {
+  if (m_tile_pack)
+    m_tile_pack->clear();
+  m_freshness.clear();
+
   QStringList formats;
   formats << QLatin1Literal("*.*");
 
@@ -124,7 +205,11 @@ QcOfflineTileCache::load_tiles()
 bool
 QcOfflineTileCache::contains(const QcTileSpec & tile_spec) const
 {
-  qInfo() << tile_spec;
+  // qInfo() << tile_spec;
+
+  // The pack index is in memory, avoid a query per tile
+  if (m_tile_pack)
+    return m_tile_pack->contains(tile_spec);
 
   return m_database->has_tile(tile_spec) > 0;
 
@@ -137,6 +222,16 @@ QcOfflineTileCache::get(const QcTileSpec & tile_spec)
 {
   // Fixme: if not in cache ?
 
+  if (m_tile_pack) {
+    QcOfflineCachedTileDisk tile_directory;
+    tile_directory.tile_spec = tile_spec;
+    QcTilePackEntry entry;
+    if (m_tile_pack->entry(tile_spec, entry))
+      tile_directory.format = entry.format;
+    // filename is empty, use read()
+    return tile_directory;
+  }
+
   QString directory = m_directory + QDir::separator() + QString::number(tile_spec.level());
   const QString format = "jpeg"; // Fixme:
   QString filename = tile_spec_to_filename(tile_spec, format, directory);
@@ -160,19 +255,43 @@ QcOfflineTileCache::get(const QcTileSpec & tile_spec)
 }
 
 void
-QcOfflineTileCache::insert(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format)
+QcOfflineTileCache::insert(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format,
+                           const QcTileFreshness & freshness)
 {
   if (bytes.isEmpty())
     return;
 
-  QString directory = m_directory + QDir::separator() + QString::number(tile_spec.level());
-  QDir::root().mkpath(directory);
-  QString filename = tile_spec_to_filename(tile_spec, format, directory);
-  write_tile_image(filename, bytes);
+  if (m_tile_pack) {
+    if (!m_tile_pack->insert(tile_spec, bytes, format))
+      return;
+  } else {
+    QString directory = m_directory + QDir::separator() + QString::number(tile_spec.level());
+    QDir::root().mkpath(directory);
+    QString filename = tile_spec_to_filename(tile_spec, format, directory);
+    write_tile_image(filename, bytes);
+  }
 
+  m_freshness.insert(tile_spec, freshness);
   m_database->insert_tile(tile_spec);
 }
 
+/*! Return the encoded image of the tile, this method is thread safe for the packed storage.
+ *
+ */
+QByteArray
+QcOfflineTileCache::read(const QcTileSpec & tile_spec, QString * format) const
+{
+  if (m_tile_pack)
+    return m_tile_pack->read(tile_spec, format);
+
+  // Fixme: format
+  QString directory = m_directory + QDir::separator() + QString::number(tile_spec.level());
+  QString filename = tile_spec_to_filename(tile_spec, QLatin1Literal("jpeg"), directory);
+  if (format)
+    *format = QFileInfo(filename).suffix();
+  return read_tile_image(filename);
+}
+
 void
 QcOfflineTileCache::add_to_disk_cache(const QcTileSpec & tile_spec, const QString & filename)
 {
@@ -39,6 +39,9 @@
 
 #include "qtcarto_global.h"
 #include "cache/offline_cache_database.h"
+#include "cache/tile_cache_index.h"
+#include "cache/tile_freshness.h"
+#include "cache/tile_pack.h"
 #include "wmts/tile_spec.h"
 
 /**************************************************************************************************/
@@ -72,25 +75,36 @@ class QC_EXPORT QcOfflineTileCache // : public QObject
   // Q_OBJECT
 
  public:
-  QcOfflineTileCache(const QString & directory = QString());
+  QcOfflineTileCache(const QString & directory = QString(), QcTileStorage storage = QcTileStorage::Packed);
   ~QcOfflineTileCache();
 
+  QcTileStorage storage() const { return m_tile_pack ? QcTileStorage::Packed : QcTileStorage::Files; }
+  const QcTilePack * tile_pack() const { return m_tile_pack; }
+  QcOfflineCacheDatabase * database() { return m_database; }
+
   void clear_all();
 
   bool contains(const QcTileSpec & tile_spec) const;
   // QSharedPointer<QcOfflineCachedTileDisk> get(const QcTileSpec & tile_spec); //  const
   QcOfflineCachedTileDisk get(const QcTileSpec & tile_spec); //  const
-  void insert(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format);
+  void insert(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format,
+              const QcTileFreshness & freshness = QcTileFreshness());
+  QByteArray read(const QcTileSpec & tile_spec, QString * format = nullptr) const;
+  QcTileFreshness freshness(const QcTileSpec & tile_spec) const { return m_freshness.value(tile_spec); }
 
  private:
+  void open_tile_pack();
+  void save_index();
   void load_tiles();
   void add_to_disk_cache(const QcTileSpec & tile_spec, const QString & filename);
 
  private:
   QString m_directory;
   QcOfflineCacheDatabase * m_database;
+  QcTilePack * m_tile_pack;
   // QHash<QcTileSpec, QSharedPointer<QcOfflineCachedTileDisk>> m_offline_cache;
   QHash<QcTileSpec, QcOfflineCachedTileDisk> m_offline_cache;
+  QcTileFreshnessStore m_freshness;
 };
 
 /**************************************************************************************************/
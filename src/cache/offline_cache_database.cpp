@@ -28,6 +28,7 @@
 
 #include "offline_cache_database.h"
 
+#include <QDateTime>
 #include <QSqlError>
 #include <QtDebug>
 
@@ -51,16 +52,60 @@ const QString TILE = "tile";
 
 /**************************************************************************************************/
 
+QcOfflineDownloadJob::QcOfflineDownloadJob()
+  : job_id(-1),
+    provider(),
+    map_id(-1),
+    min_level(0),
+    max_level(0),
+    area(),
+    state(0),
+    number_of_tiles(0),
+    downloaded_tiles(0),
+    skipped_tiles(0),
+    missing_tiles(0),
+    received_bytes(0)
+{}
+
+/**************************************************************************************************/
+
 QcOfflineCacheDatabase::QcOfflineCacheDatabase(const QString & sqlite_path)
+  : m_providers(),
+    m_map_levels(),
+    m_in_transaction(false),
+    m_pending_writes(0),
+    m_write_clock()
 {
   bool created = open(sqlite_path);
 
-  if (!created)
+  configure();
+  if (!created) {
+    upgrade_schema();
     init_cache();
+  }
+  prepare_tile_queries();
 }
 
 QcOfflineCacheDatabase::~QcOfflineCacheDatabase()
-{}
+{
+  flush();
+}
+
+/*! Tune SQLite for a write intensive usage.
+ *
+ * The write-ahead log lets the readers run during a write, and only
+ * requires a sync at checkpoints when synchronous is NORMAL.
+ */
+void
+QcOfflineCacheDatabase::configure()
+{
+  QStringList pragmas;
+  pragmas << QStringLiteral("PRAGMA journal_mode = WAL");
+  pragmas << QStringLiteral("PRAGMA synchronous = NORMAL");
+  pragmas << QStringLiteral("PRAGMA temp_store = MEMORY");
+  pragmas << QStringLiteral("PRAGMA cache_size = -8192"); // KiB
+  execute_queries(pragmas, false);
+}
 
 void
 QcOfflineCacheDatabase::create_tables()
@@ -109,19 +154,90 @@ QcOfflineCacheDatabase::create_tables()
     if (!query.exec(sql_query))
       qWarning() << query.lastError().text();
 
+  create_job_tables();
+  create_tile_index();
   init_version();
   commit();
 }
 
+//! Create the index of the tiles, it was added in the version 3
+void
+QcOfflineCacheDatabase::create_tile_index()
+{
+  execute_query(QStringLiteral("CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tile (map_level_id, row, column)"));
+}
+
+/*! Create the tables of the download jobs, they were added in the version 2.
+ *
+ * The primary key of the level table is used to sum the progress of a job.
+ */
+void
+QcOfflineCacheDatabase::create_job_tables()
+{
+  QStringList schemas;
+
+  const QString job_schema =
+    "CREATE TABLE IF NOT EXISTS download_job ("
+    "job_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "provider_id INTEGER, "
+    "map_id INTEGER, "
+    "min_level INTEGER, "
+    "max_level INTEGER, "
+    "area TEXT, "
+    "state INTEGER, "
+    "number_of_tiles INTEGER, "
+    "downloaded_tiles INTEGER, "
+    "skipped_tiles INTEGER, "
+    "missing_tiles INTEGER, "
+    "received_bytes INTEGER, "
+    "updated_at INTEGER, "
+    "FOREIGN KEY(provider_id) REFERENCES provider(provider_id)"
+    ")";
+  schemas << job_schema;
+
+  const QString job_level_schema =
+    "CREATE TABLE IF NOT EXISTS download_job_level ("
+    "job_id INTEGER, "
+    "level INTEGER, "
+    "number_of_tiles INTEGER, "
+    "done_tiles INTEGER, "
+    "bitmap BLOB, "
+    "PRIMARY KEY (job_id, level), "
+    "FOREIGN KEY(job_id) REFERENCES download_job(job_id)"
+    ")";
+  schemas << job_level_schema;
+
+  execute_queries(schemas, false);
+}
+
 void
 QcOfflineCacheDatabase::init_version()
 {
   // Fixme: check api usage
   KeyValuePair kwargs;
-  kwargs.insert(QStringLiteral("version"), 1);
+  kwargs.insert(QStringLiteral("version"), schema_version);
   insert(QStringLiteral("metadata"), kwargs);
 }
 
+void
+QcOfflineCacheDatabase::upgrade_schema()
+{
+  QSqlRecord record = select_one(QStringLiteral("metadata"), QStringList(QStringLiteral("version")));
+  int version = record.isEmpty() ? 1 : record.value(0).toInt();
+  if (version < schema_version) {
+    qInfo() << "Upgrade offline cache database from version" << version;
+    transaction();
+    if (version < 2)
+      create_job_tables();
+    if (version < 3)
+      create_tile_index();
+    KeyValuePair kwargs;
+    kwargs.insert(QStringLiteral("version"), schema_version);
+    update(QStringLiteral("metadata"), kwargs);
+    commit();
+  }
+}
+
 void
 QcOfflineCacheDatabase::init_cache()
 {
@@ -181,6 +297,12 @@ QcOfflineCacheDatabase::get_provider_id(const QString & provider)
   }
 }
 
+QString
+QcOfflineCacheDatabase::get_provider_name(int provider_id) const
+{
+  return m_providers.key(provider_id);
+}
+
 unsigned int
 QcOfflineCacheDatabase::hash_tile_spec(int provider_id, int map_id, int level)
 {
@@ -213,46 +335,96 @@ QcOfflineCacheDatabase::get_map_level_id(const QcTileSpec & tile_spec)
   }
 }
 
-QString
-QcOfflineCacheDatabase::tile_where_clause(const QcTileSpec & tile_spec)
+/*! Prepare the queries on the tiles once, they are executed for each tile. */
+void
+QcOfflineCacheDatabase::prepare_tile_queries()
 {
-  int map_level_id = get_map_level_id(tile_spec);
-  KeyValuePair kwargs;
-  kwargs.insert(MAP_LEVEL_ID, map_level_id);
-  kwargs.insert(ROW, tile_spec.x());
-  kwargs.insert(COLUMN, tile_spec.y());
-  return format_simple_where(kwargs);
+  const QString where = QStringLiteral(" WHERE map_level_id = ? AND row = ? AND column = ?");
+
+  m_has_tile_query = new_query();
+  m_has_tile_query.prepare(QStringLiteral("SELECT offline_count FROM tile") + where);
+
+  m_insert_tile_query = new_query();
+  m_insert_tile_query.prepare(QStringLiteral("INSERT INTO tile (map_level_id, row, column, offline_count) "
+                                             "VALUES (?, ?, ?, 1)"));
+
+  m_increment_tile_query = new_query();
+  m_increment_tile_query.prepare(QStringLiteral("UPDATE tile SET offline_count = offline_count + 1") + where);
+
+  m_decrement_tile_query = new_query();
+  m_decrement_tile_query.prepare(QStringLiteral("UPDATE tile SET offline_count = offline_count - 1") + where +
+                                 QStringLiteral(" AND offline_count > 1"));
+
+  m_delete_tile_query = new_query();
+  m_delete_tile_query.prepare(QStringLiteral("DELETE FROM tile") + where);
+}
+
+//! Bind the tile to the \a query and execute it
+bool
+QcOfflineCacheDatabase::execute_tile_query(QSqlQuery & query, const QcTileSpec & tile_spec)
+{
+  query.addBindValue(get_map_level_id(tile_spec));
+  query.addBindValue(tile_spec.x());
+  query.addBindValue(tile_spec.y());
+  if (!query.exec()) {
+    qWarning() << query.lastError().text();
+    return false;
+  }
+  return true;
+}
+
+/*! Open a transaction for the writes if none is opened.
+ *
+ * The writes are committed by batch, a commit per tile limits the
+ * ingestion to a few hundred tiles per second.  A batch is committed
+ * when it is full or when its oldest write is older than
+ * max_write_delay, the writer should also flush when it goes idle.
+ */
+void
+QcOfflineCacheDatabase::begin_write()
+{
+  if (!m_in_transaction) {
+    m_in_transaction = transaction();
+    m_write_clock.start();
+  }
+}
+
+void
+QcOfflineCacheDatabase::end_write()
+{
+  if (++m_pending_writes >= batch_size || m_write_clock.elapsed() >= max_write_delay)
+    flush();
+}
+
+//! Commit the pending writes
+void
+QcOfflineCacheDatabase::flush()
+{
+  if (m_in_transaction) {
+    if (!commit())
+      qWarning() << database().lastError().text();
+    m_in_transaction = false;
+  }
+  m_pending_writes = 0;
 }
 
 int
 QcOfflineCacheDatabase::has_tile(const QcTileSpec & tile_spec)
 {
-  QSqlRecord record = select_one(TILE, QStringList(OFFLINE_COUNT), tile_where_clause(tile_spec));
-  if (record.isEmpty())
-    return 0;
-  else
-    return record.value(0).toInt();
+  int offline_count = 0;
+  if (execute_tile_query(m_has_tile_query, tile_spec) && m_has_tile_query.next())
+    offline_count = m_has_tile_query.value(0).toInt();
+  m_has_tile_query.finish();
+  return offline_count;
 }
 
 void
 QcOfflineCacheDatabase::insert_tile(const QcTileSpec & tile_spec)
 {
-  QString where = tile_where_clause(tile_spec);
-  QSqlRecord record = select_one(TILE, QStringList(OFFLINE_COUNT), where);
-  if (record.isEmpty()) {
-    int map_level_id = get_map_level_id(tile_spec);
-    KeyValuePair kwargs;
-    kwargs.insert(MAP_LEVEL_ID, map_level_id);
-    kwargs.insert(ROW, tile_spec.x());
-    kwargs.insert(COLUMN, tile_spec.y());
-    kwargs.insert(OFFLINE_COUNT, 1);
-    insert(TILE, kwargs);
-  } else {
-    int offline_count = record.value(0).toInt();
-    KeyValuePair kwargs;
-    kwargs.insert(OFFLINE_COUNT, offline_count +1);
-    update(TILE, kwargs, where);
-  }
+  begin_write();
+  if (execute_tile_query(m_increment_tile_query, tile_spec) && !m_increment_tile_query.numRowsAffected())
+    execute_tile_query(m_insert_tile_query, tile_spec);
+  end_write();
 }
 
 /*
@@ -268,18 +440,194 @@ QcOfflineCacheDatabase::update_tile_offline_count(const QcTileSpec & tile_spec,
 void
 QcOfflineCacheDatabase::delete_tile(const QcTileSpec & tile_spec)
 {
-  QString where = tile_where_clause(tile_spec);
-  QSqlRecord record = select_one(TILE, QStringList(OFFLINE_COUNT), where);
-  if (!record.isEmpty()) {
-    int offline_count = record.value(0).toInt();
-    if (offline_count > 1) {
-      KeyValuePair kwargs;
-      kwargs.insert(OFFLINE_COUNT, offline_count -1);
-      update(TILE, kwargs, where);
-    }
-    else
-      delete_row(TILE, where);
+  begin_write();
+  if (execute_tile_query(m_decrement_tile_query, tile_spec) && !m_decrement_tile_query.numRowsAffected())
+    execute_tile_query(m_delete_tile_query, tile_spec);
+  end_write();
+}
+
+/**************************************************************************************************/
+
+/*! Create a job and its levels, no tile is done.
+ *
+ * \a tile_counts gives the number of tiles per level from the minimum level.
+ */
+int
+QcOfflineCacheDatabase::create_job(QcOfflineDownloadJob & job, const QVector<int> & tile_counts)
+{
+  int provider_id = get_provider_id(job.provider);
+
+  begin_write();
+
+  QSqlQuery query = new_query();
+  query.prepare(QStringLiteral("INSERT INTO download_job "
+                               "(provider_id, map_id, min_level, max_level, area, state, number_of_tiles, "
+                               "downloaded_tiles, skipped_tiles, missing_tiles, received_bytes, updated_at) "
+                               "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"));
+  query.addBindValue(provider_id);
+  query.addBindValue(job.map_id);
+  query.addBindValue(job.min_level);
+  query.addBindValue(job.max_level);
+  query.addBindValue(QString::fromUtf8(job.area));
+  query.addBindValue(job.state);
+  query.addBindValue(job.number_of_tiles);
+  query.addBindValue(job.downloaded_tiles);
+  query.addBindValue(job.skipped_tiles);
+  query.addBindValue(job.missing_tiles);
+  query.addBindValue(job.received_bytes);
+  query.addBindValue(QDateTime::currentMSecsSinceEpoch() / 1000);
+  if (!query.exec()) {
+    qWarning() << query.lastError().text();
+    flush();
+    return -1;
+  }
+  job.job_id = query.lastInsertId().toInt();
+
+  QSqlQuery level_query = new_query();
+  level_query.prepare(QStringLiteral("INSERT INTO download_job_level "
+                                     "(job_id, level, number_of_tiles, done_tiles, bitmap) "
+                                     "VALUES (?, ?, ?, 0, ?)"));
+  for (int i = 0; i < tile_counts.size(); i++) {
+    int number_of_tiles = tile_counts[i];
+    level_query.addBindValue(job.job_id);
+    level_query.addBindValue(job.min_level + i);
+    level_query.addBindValue(number_of_tiles);
+    level_query.addBindValue(QByteArray((number_of_tiles + 7) / 8, 0));
+    if (!level_query.exec())
+      qWarning() << level_query.lastError().text();
+  }
+
+  flush();
+
+  return job.job_id;
+}
+
+bool
+QcOfflineCacheDatabase::load_job(int job_id, QcOfflineDownloadJob & job)
+{
+  QSqlQuery query = new_query();
+  query.prepare(QStringLiteral("SELECT provider_id, map_id, min_level, max_level, area, state, number_of_tiles, "
+                               "downloaded_tiles, skipped_tiles, missing_tiles, received_bytes "
+                               "FROM download_job WHERE job_id = ?"));
+  query.addBindValue(job_id);
+  if (!query.exec()) {
+    qWarning() << query.lastError().text();
+    return false;
+  }
+  if (!query.next())
+    return false;
+
+  QSqlRecord record = query.record();
+  int i = 0;
+  job.job_id = job_id;
+  job.provider = get_provider_name(record.value(i++).toInt());
+  job.map_id = record.value(i++).toInt();
+  job.min_level = record.value(i++).toInt();
+  job.max_level = record.value(i++).toInt();
+  job.area = record.value(i++).toString().toUtf8();
+  job.state = record.value(i++).toInt();
+  job.number_of_tiles = record.value(i++).toInt();
+  job.downloaded_tiles = record.value(i++).toInt();
+  job.skipped_tiles = record.value(i++).toInt();
+  job.missing_tiles = record.value(i++).toInt();
+  job.received_bytes = record.value(i++).toLongLong();
+  return true;
+}
+
+QList<int>
+QcOfflineCacheDatabase::job_ids()
+{
+  QList<int> job_ids;
+  QSqlQuery query = new_query();
+  if (!query.exec(QStringLiteral("SELECT job_id FROM download_job ORDER BY job_id")))
+    qWarning() << query.lastError().text();
+  while (query.next())
+    job_ids << query.value(0).toInt();
+  return job_ids;
+}
+
+/*! Update the state and the counters of a job.
+ *
+ * The update is pending until the next flush, as the updates of the levels.
+ */
+void
+QcOfflineCacheDatabase::update_job(const QcOfflineDownloadJob & job)
+{
+  begin_write();
+  QSqlQuery query = new_query();
+  query.prepare(QStringLiteral("UPDATE download_job SET "
+                               "state = ?, downloaded_tiles = ?, skipped_tiles = ?, missing_tiles = ?, "
+                               "received_bytes = ?, updated_at = ? "
+                               "WHERE job_id = ?"));
+  query.addBindValue(job.state);
+  query.addBindValue(job.downloaded_tiles);
+  query.addBindValue(job.skipped_tiles);
+  query.addBindValue(job.missing_tiles);
+  query.addBindValue(job.received_bytes);
+  query.addBindValue(QDateTime::currentMSecsSinceEpoch() / 1000);
+  query.addBindValue(job.job_id);
+  if (!query.exec())
+    qWarning() << query.lastError().text();
+}
+
+QByteArray
+QcOfflineCacheDatabase::job_bitmap(int job_id, int level, int * done_tiles)
+{
+  QSqlQuery query = new_query();
+  query.prepare(QStringLiteral("SELECT bitmap, done_tiles FROM download_job_level WHERE job_id = ? AND level = ?"));
+  query.addBindValue(job_id);
+  query.addBindValue(level);
+  if (!query.exec())
+    qWarning() << query.lastError().text();
+  if (!query.next())
+    return QByteArray();
+
+  if (done_tiles)
+    *done_tiles = query.value(1).toInt();
+  return query.value(0).toByteArray();
+}
+
+void
+QcOfflineCacheDatabase::update_job_level(int job_id, int level, const QByteArray & bitmap, int done_tiles)
+{
+  begin_write();
+  QSqlQuery query = new_query();
+  query.prepare(QStringLiteral("UPDATE download_job_level SET bitmap = ?, done_tiles = ? "
+                               "WHERE job_id = ? AND level = ?"));
+  query.addBindValue(bitmap);
+  query.addBindValue(done_tiles);
+  query.addBindValue(job_id);
+  query.addBindValue(level);
+  if (!query.exec())
+    qWarning() << query.lastError().text();
+}
+
+//! Return the number of tiles of a job which are not done, it only sums the levels
+int
+QcOfflineCacheDatabase::missing_job_tiles(int job_id)
+{
+  QSqlQuery query = new_query();
+  query.prepare(QStringLiteral("SELECT SUM(number_of_tiles - done_tiles) FROM download_job_level WHERE job_id = ?"));
+  query.addBindValue(job_id);
+  if (!query.exec())
+    qWarning() << query.lastError().text();
+  if (!query.next())
+    return 0;
+  return query.value(0).toInt();
+}
+
+void
+QcOfflineCacheDatabase::delete_job(int job_id)
+{
+  begin_write();
+  for (const QString & table : {QStringLiteral("download_job_level"), QStringLiteral("download_job")}) {
+    QSqlQuery query = new_query();
+    query.prepare(QStringLiteral("DELETE FROM ") + table + QStringLiteral(" WHERE job_id = ?"));
+    query.addBindValue(job_id);
+    if (!query.exec())
+      qWarning() << query.lastError().text();
   }
+  flush();
 }
 
 /**************************************************************************************************/
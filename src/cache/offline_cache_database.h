@@ -33,10 +33,16 @@
 
 /**************************************************************************************************/
 
+#include "qtcarto_global.h"
 #include "wmts/tile_spec.h"
 #include "database/database.h"
 
+#include <QByteArray>
+#include <QElapsedTimer>
 #include <QHash>
+#include <QList>
+#include <QSqlQuery>
+#include <QVector>
 
 /**************************************************************************************************/
 
@@ -44,8 +50,41 @@
 
 /**************************************************************************************************/
 
-class QcOfflineCacheDatabase : public QcSqliteDatabase
+/* Download job of an area.
+ *
+ * The progress of each level is a bitmap of the tiles of the level, in
+ * the order of the tiled area, cf. QcOfflineArea::tile_runs.  A tile is
+ * done when it is offline or missing on the server.
+ */
+class QcOfflineDownloadJob
 {
+public:
+  QcOfflineDownloadJob();
+
+public:
+  int job_id;
+  QString provider;
+  int map_id;
+  int min_level;
+  int max_level;
+  QByteArray area; // JSON
+  int state;
+  int number_of_tiles;
+  int downloaded_tiles;
+  int skipped_tiles;
+  int missing_tiles;
+  qint64 received_bytes;
+};
+
+/**************************************************************************************************/
+
+class QC_EXPORT QcOfflineCacheDatabase : public QcSqliteDatabase
+{
+public:
+  static const int schema_version = 3;
+  static const int batch_size = 1000; // writes per transaction
+  static const int max_write_delay = 1000; // ms, age of the oldest pending write
+
 public:
   QcOfflineCacheDatabase(const QString & sqlite_path);
   ~QcOfflineCacheDatabase();
@@ -53,22 +92,50 @@ public:
   void insert_tile(const QcTileSpec & tile_spec);
   int has_tile(const QcTileSpec & tile_spec);
   void delete_tile(const QcTileSpec & tile_spec);
+  void flush();
+  bool has_pending_writes() const { return m_in_transaction; }
+
+  // Download jobs
+  int create_job(QcOfflineDownloadJob & job, const QVector<int> & tile_counts);
+  bool load_job(int job_id, QcOfflineDownloadJob & job);
+  QList<int> job_ids();
+  void update_job(const QcOfflineDownloadJob & job);
+  QByteArray job_bitmap(int job_id, int level, int * done_tiles = nullptr);
+  void update_job_level(int job_id, int level, const QByteArray & bitmap, int done_tiles);
+  int missing_job_tiles(int job_id);
+  void delete_job(int job_id);
 
 private:
   void create_tables();
+  void create_job_tables();
+  void create_tile_index();
+  void upgrade_schema();
+  void configure();
+  void prepare_tile_queries();
+  bool execute_tile_query(QSqlQuery & query, const QcTileSpec & tile_spec);
+  void begin_write();
+  void end_write();
 
   void init_cache();
   void load_providers();
   void load_map_levels();
   void init_version();
   int get_provider_id(const QString & provider);
+  QString get_provider_name(int provider_id) const;
   unsigned int hash_tile_spec(int provider_id, int map_id, int level);
   int get_map_level_id(const QcTileSpec & tile_spec);
-  QString tile_where_clause(const QcTileSpec & tile_spec);
 
 private:
   QHash<QString, int> m_providers;
   QHash<unsigned int, int> m_map_levels;
+  bool m_in_transaction;
+  int m_pending_writes;
+  QElapsedTimer m_write_clock; // started by the first pending write
+  QSqlQuery m_has_tile_query;
+  QSqlQuery m_insert_tile_query;
+  QSqlQuery m_increment_tile_query;
+  QSqlQuery m_decrement_tile_query;
+  QSqlQuery m_delete_tile_query;
 };
 
 /**************************************************************************************************/
@@ -0,0 +1,219 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_cache_index.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QtDebug>
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* Index layout
+ *
+ * Header:
+ *   quint32 magic
+ *   quint32 version
+ *   qint64  pack size
+ *   qint64  pack dead size
+ *   quint32 number of strings
+ *   strings as quint8 size followed by Latin-1 characters
+ *   quint32 number of records
+ *
+ * Record:
+ *   quint16 plugin string index
+ *   quint16 format string index
+ *   quint8  queue
+ *   quint8  reserved
+ *   qint32  map_id, level, x, y
+ *   qint32  size
+ *   qint64  pack record offset
+ *   quint16 pack record header size
+ *
+ * Integers are stored in little endian.
+ */
+
+constexpr quint32 INDEX_MAGIC = 0x49544351; // QCTI
+constexpr quint32 INDEX_VERSION = 1;
+
+const QString QcTileCacheIndex::default_filename = QLatin1Literal("tiles.index");
+
+/**************************************************************************************************/
+
+QcTileCacheIndexEntry::QcTileCacheIndexEntry()
+  : tile_spec(),
+    format(),
+    size(0),
+    queue(0),
+    offset(-1),
+    data_offset(-1)
+{}
+
+/**************************************************************************************************/
+
+bool
+QcTileCacheIndex::write(const QString & filename, const QcTileCacheIndexEntryList & entries,
+                        qint64 pack_size, qint64 dead_size)
+{
+  QStringList strings;
+  QHash<QString, int> string_indexes;
+  auto string_index = [&strings, &string_indexes](const QString & string) {
+    auto it = string_indexes.constFind(string);
+    if (it != string_indexes.constEnd())
+      return *it;
+    int index = strings.size();
+    strings << string;
+    string_indexes.insert(string, index);
+    return index;
+  };
+
+  QByteArray records;
+  QDataStream record_stream(&records, QIODevice::WriteOnly);
+  record_stream.setByteOrder(QDataStream::LittleEndian);
+  for (const auto & entry : entries) {
+    const QcTileSpec & tile_spec = entry.tile_spec;
+    qint64 offset = entry.offset;
+    quint16 header_size = offset >= 0 ? entry.data_offset - offset : 0;
+    record_stream << static_cast<quint16>(string_index(tile_spec.plugin()))
+                  << static_cast<quint16>(string_index(entry.format))
+                  << static_cast<quint8>(entry.queue)
+                  << static_cast<quint8>(0)
+                  << static_cast<qint32>(tile_spec.map_id())
+                  << static_cast<qint32>(tile_spec.level())
+                  << static_cast<qint32>(tile_spec.x())
+                  << static_cast<qint32>(tile_spec.y())
+                  << static_cast<qint32>(entry.size)
+                  << offset
+                  << header_size;
+  }
+
+  QByteArray header;
+  QDataStream stream(&header, QIODevice::WriteOnly);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream << INDEX_MAGIC << INDEX_VERSION << pack_size << dead_size;
+  stream << static_cast<quint32>(strings.size());
+  for (const auto & string : strings) {
+    QByteArray latin1 = string.toLatin1();
+    stream << static_cast<quint8>(latin1.size());
+    stream.writeRawData(latin1.constData(), latin1.size());
+  }
+  stream << static_cast<quint32>(entries.size());
+
+  QSaveFile file(filename);
+  if (!file.open(QIODevice::WriteOnly)) {
+    qWarning() << "Unable to write tile cache index" << filename;
+    return false;
+  }
+  file.write(header);
+  file.write(records);
+
+  return file.commit();
+}
+
+bool
+QcTileCacheIndex::read(const QString & filename, QcTileCacheIndexEntryList & entries,
+                       qint64 & pack_size, qint64 & dead_size)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+  QByteArray data = file.readAll();
+  file.close();
+
+  QDataStream stream(data);
+  stream.setByteOrder(QDataStream::LittleEndian);
+
+  quint32 magic, version;
+  stream >> magic >> version;
+  if (stream.status() != QDataStream::Ok || magic != INDEX_MAGIC || version != INDEX_VERSION) {
+    qWarning() << "Invalid tile cache index" << filename;
+    return false;
+  }
+  stream >> pack_size >> dead_size;
+
+  quint32 number_of_strings;
+  stream >> number_of_strings;
+  QStringList strings;
+  for (quint32 i = 0; i < number_of_strings && stream.status() == QDataStream::Ok; i++) {
+    quint8 size;
+    stream >> size;
+    QByteArray latin1(size, '\0');
+    if (stream.readRawData(latin1.data(), size) != size)
+      stream.setStatus(QDataStream::ReadPastEnd);
+    strings << QString::fromLatin1(latin1);
+  }
+
+  quint32 number_of_entries;
+  stream >> number_of_entries;
+  if (stream.status() != QDataStream::Ok) {
+    qWarning() << "Truncated tile cache index" << filename;
+    return false;
+  }
+
+  entries.clear();
+  entries.reserve(number_of_entries);
+  for (quint32 i = 0; i < number_of_entries; i++) {
+    quint16 plugin_index, format_index, header_size;
+    quint8 queue, reserved;
+    qint32 map_id, level, x, y, size;
+    qint64 offset;
+    stream >> plugin_index >> format_index >> queue >> reserved
+           >> map_id >> level >> x >> y >> size
+           >> offset >> header_size;
+    if (stream.status() != QDataStream::Ok
+        || plugin_index >= strings.size() || format_index >= strings.size()) {
+      qWarning() << "Corrupted tile cache index" << filename;
+      entries.clear();
+      return false;
+    }
+    QcTileCacheIndexEntry entry;
+    entry.tile_spec = QcTileSpec(strings[plugin_index], map_id, level, x, y);
+    entry.format = strings[format_index];
+    entry.size = size;
+    entry.queue = queue;
+    entry.offset = offset;
+    entry.data_offset = offset >= 0 ? offset + header_size : -1;
+    entries << entry;
+  }
+
+  return true;
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,97 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_CACHE_INDEX_H__
+#define __TILE_CACHE_INDEX_H__
+
+/**************************************************************************************************/
+
+#include <QList>
+#include <QString>
+
+#include "qtcarto_global.h"
+#include "wmts/tile_spec.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+class QcTileCacheIndexEntry
+{
+public:
+  QcTileCacheIndexEntry();
+
+public:
+  QcTileSpec tile_spec;
+  QString format;
+  int size;
+  int queue; // cache queue, 0 if not queued
+  qint64 offset; // record offset in the pack, -1 for a tile file
+  qint64 data_offset;
+};
+
+typedef QList<QcTileCacheIndexEntry> QcTileCacheIndexEntryList;
+
+/**************************************************************************************************/
+
+/* Persistent index of a tile cache.
+ *
+ * The index is a versioned binary file made of a header, a string
+ * table for the plugin and format names and a flat array of fixed
+ * size records. It is written atomically and read with a single read.
+ *
+ * The size of the pack at the time the index was written is stored in
+ * the header so as to detect a stale index.
+ */
+class QC_EXPORT QcTileCacheIndex
+{
+public:
+  static const QString default_filename;
+
+public:
+  static bool write(const QString & filename, const QcTileCacheIndexEntryList & entries,
+                    qint64 pack_size = -1, qint64 dead_size = 0);
+  static bool read(const QString & filename, QcTileCacheIndexEntryList & entries,
+                   qint64 & pack_size, qint64 & dead_size);
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+#endif /* __TILE_CACHE_INDEX_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
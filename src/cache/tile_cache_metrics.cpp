@@ -0,0 +1,381 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_cache_metrics.h"
+#include "cache/file_tile_cache.h"
+
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QtMath>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+QcLatencyHistogram::QcLatencyHistogram()
+{
+  clear();
+}
+
+void
+QcLatencyHistogram::clear()
+{
+  for (int i = 0; i < number_of_buckets; i++)
+    m_buckets[i] = 0;
+  m_count = 0;
+  m_sum = 0;
+  m_max = 0;
+}
+
+qint64
+QcLatencyHistogram::bucket_upper_bound(int i)
+{
+  if (i >= number_of_buckets - 1)
+    return -1; // overflow
+  return Q_INT64_C(1) << i;
+}
+
+void
+QcLatencyHistogram::add(qint64 latency)
+{
+  int i = 0;
+  while (i < number_of_buckets - 1 && latency > bucket_upper_bound(i))
+    i++;
+  m_buckets[i]++;
+  m_count++;
+  m_sum += latency;
+  m_max = qMax(m_max, latency);
+}
+
+/* Return the upper bound of the bucket which contains the given
+ * percentile, or the maximum if it is the overflow bucket.
+ */
+qint64
+QcLatencyHistogram::percentile(double percent) const
+{
+  if (!m_count)
+    return 0;
+
+  int rank = qCeil(percent / 100. * m_count);
+  int count = 0;
+  for (int i = 0; i < number_of_buckets - 1; i++) {
+    count += m_buckets[i];
+    if (count >= rank)
+      return qMin(bucket_upper_bound(i), m_max);
+  }
+  return m_max;
+}
+
+QJsonObject
+QcLatencyHistogram::to_json() const
+{
+  QJsonObject object;
+  object["count"] = m_count;
+  object["mean"] = mean();
+  object["max"] = double(m_max);
+  object["p50"] = double(percentile(50));
+  object["p90"] = double(percentile(90));
+  object["p99"] = double(percentile(99));
+  // Trailing empty buckets are omitted
+  int last = number_of_buckets - 1;
+  while (last >= 0 && !m_buckets[last])
+    last--;
+  QJsonArray buckets;
+  for (int i = 0; i <= last; i++)
+    buckets.append(m_buckets[i]);
+  object["buckets"] = buckets;
+  return object;
+}
+
+/**************************************************************************************************/
+
+QcTileCacheTierMetrics::QcTileCacheTierMetrics()
+  : hits(0),
+    misses(0),
+    promotions(0),
+    evictions(0),
+    tiles(0),
+    bytes(0),
+    max_bytes(0)
+{}
+
+double
+QcTileCacheTierMetrics::hit_ratio() const
+{
+  int lookups = hits + misses;
+  return lookups ? double(hits) / lookups : 0.;
+}
+
+QJsonObject
+QcTileCacheTierMetrics::to_json() const
+{
+  QJsonObject object;
+  object["hits"] = hits;
+  object["misses"] = misses;
+  object["hit_ratio"] = hit_ratio();
+  object["promotions"] = promotions;
+  object["evictions"] = evictions;
+  object["tiles"] = tiles;
+  object["bytes"] = double(bytes);
+  object["max_bytes"] = double(max_bytes);
+  return object;
+}
+
+/**************************************************************************************************/
+
+QcTileCacheMetrics::QcTileCacheMetrics(QcFileTileCache * cache, QObject * parent)
+  : QObject(parent),
+    m_cache(cache),
+    m_evicted_tiles(0),
+    m_reclaimed_bytes(0),
+    m_max_eviction_latency(0),
+    m_mutex(),
+    m_fetch_queue_depth(0),
+    m_fetch_in_flight(0),
+    m_max_fetch_queue_depth(0),
+    m_max_fetch_in_flight(0),
+    m_snapshot_timer(),
+    m_snapshot_path()
+{
+  connect(&m_snapshot_timer, &QTimer::timeout,
+          this, &QcTileCacheMetrics::take_snapshot);
+}
+
+QcTileCacheMetrics::~QcTileCacheMetrics()
+{}
+
+double
+QcTileCacheMetrics::decode_time() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_decode_time.mean();
+}
+
+double
+QcTileCacheMetrics::disk_read_latency() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_disk_read.mean();
+}
+
+QVariantMap
+QcTileCacheMetrics::fetch_latencies() const
+{
+  QMutexLocker locker(&m_mutex);
+  QVariantMap latencies;
+  for (auto it = m_fetch.constBegin(); it != m_fetch.constEnd(); ++it)
+    latencies.insert(it.key(), it->mean());
+  return latencies;
+}
+
+QcLatencyHistogram
+QcTileCacheMetrics::decode_time_histogram() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_decode_time;
+}
+
+QcLatencyHistogram
+QcTileCacheMetrics::disk_read_histogram() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_disk_read;
+}
+
+QcLatencyHistogram
+QcTileCacheMetrics::fetch_histogram(const QString & provider) const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_fetch.value(provider);
+}
+
+int
+QcTileCacheMetrics::fetch_errors(const QString & provider) const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_fetch_errors.value(provider);
+}
+
+int
+QcTileCacheMetrics::fetch_queue_depth() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_fetch_queue_depth;
+}
+
+int
+QcTileCacheMetrics::fetch_in_flight() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_fetch_in_flight;
+}
+
+void
+QcTileCacheMetrics::record_decode_time(qint64 latency)
+{
+  QMutexLocker locker(&m_mutex);
+  m_decode_time.add(latency);
+}
+
+void
+QcTileCacheMetrics::record_disk_read(qint64 latency)
+{
+  QMutexLocker locker(&m_mutex);
+  m_disk_read.add(latency);
+}
+
+void
+QcTileCacheMetrics::record_fetch(const QString & provider, qint64 latency, bool error)
+{
+  QMutexLocker locker(&m_mutex);
+  m_fetch[provider].add(latency);
+  if (error)
+    m_fetch_errors[provider]++;
+}
+
+void
+QcTileCacheMetrics::record_fetch_queue(int queue_depth, int in_flight)
+{
+  QMutexLocker locker(&m_mutex);
+  m_fetch_queue_depth = queue_depth;
+  m_fetch_in_flight = in_flight;
+  m_max_fetch_queue_depth = qMax(m_max_fetch_queue_depth, queue_depth);
+  m_max_fetch_in_flight = qMax(m_max_fetch_in_flight, in_flight);
+}
+
+void
+QcTileCacheMetrics::reset_latencies()
+{
+  QMutexLocker locker(&m_mutex);
+  m_decode_time.clear();
+  m_disk_read.clear();
+  m_fetch.clear();
+  m_fetch_errors.clear();
+}
+
+void
+QcTileCacheMetrics::update()
+{
+  m_texture_tier = m_cache->texture_metrics();
+  m_memory_tier = m_cache->memory_metrics();
+  m_disk_tier = m_cache->disk_metrics();
+  m_evicted_tiles = m_cache->evicted_tiles();
+  m_reclaimed_bytes = m_cache->reclaimed_bytes();
+  m_max_eviction_latency = m_cache->max_eviction_latency();
+  emit updated();
+}
+
+void
+QcTileCacheMetrics::set_snapshot_interval(int interval)
+{
+  if (interval == snapshot_interval())
+    return;
+  if (interval > 0)
+    m_snapshot_timer.start(interval);
+  else
+    m_snapshot_timer.stop();
+  emit snapshot_interval_changed();
+}
+
+QJsonObject
+QcTileCacheMetrics::to_json() const
+{
+  QJsonObject tiers;
+  tiers["texture"] = m_texture_tier.to_json();
+  tiers["memory"] = m_memory_tier.to_json();
+  tiers["disk"] = m_disk_tier.to_json();
+
+  QJsonObject disk_eviction;
+  disk_eviction["evicted_tiles"] = m_evicted_tiles;
+  disk_eviction["reclaimed_bytes"] = double(m_reclaimed_bytes);
+  disk_eviction["max_latency_ms"] = double(m_max_eviction_latency);
+
+  QJsonObject object;
+  object["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+  object["tiers"] = tiers;
+  object["disk_eviction"] = disk_eviction;
+
+  QMutexLocker locker(&m_mutex);
+  object["decode_time_us"] = m_decode_time.to_json();
+  object["disk_read_latency_us"] = m_disk_read.to_json();
+  QJsonObject fetch;
+  for (auto it = m_fetch.constBegin(); it != m_fetch.constEnd(); ++it) {
+    QJsonObject provider = it->to_json();
+    provider["errors"] = m_fetch_errors.value(it.key());
+    fetch[it.key()] = provider;
+  }
+  object["fetch_latency_us"] = fetch;
+
+  QJsonObject fetch_queue;
+  fetch_queue["depth"] = m_fetch_queue_depth;
+  fetch_queue["in_flight"] = m_fetch_in_flight;
+  fetch_queue["max_depth"] = m_max_fetch_queue_depth;
+  fetch_queue["max_in_flight"] = m_max_fetch_in_flight;
+  object["fetch_queue"] = fetch_queue;
+
+  return object;
+}
+
+QByteArray
+QcTileCacheMetrics::snapshot()
+{
+  update();
+  return QJsonDocument(to_json()).toJson(QJsonDocument::Compact);
+}
+
+void
+QcTileCacheMetrics::take_snapshot()
+{
+  QByteArray json = snapshot();
+
+  if (!m_snapshot_path.isEmpty()) {
+    // A scraper never reads a partial file
+    QSaveFile file(m_snapshot_path);
+    if (file.open(QIODevice::WriteOnly)) {
+      file.write(json);
+      if (!file.commit())
+        qWarning() << "Cannot write metrics snapshot" << m_snapshot_path;
+    } else
+      qWarning() << "Cannot open metrics snapshot" << m_snapshot_path;
+  }
+
+  emit snapshot_ready(json);
+}
+
+// QC_END_NAMESPACE
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
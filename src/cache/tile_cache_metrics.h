@@ -0,0 +1,230 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_CACHE_METRICS_H__
+#define __TILE_CACHE_METRICS_H__
+
+/**************************************************************************************************/
+
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVariantMap>
+
+#include "qtcarto_global.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+class QcFileTileCache;
+
+/**************************************************************************************************/
+
+/* Latency histogram with power of two buckets.
+ *
+ * The bucket i counts the latencies in ]2^(i-1), 2^i] us, the last
+ * bucket counts the overflows.
+ */
+class QC_EXPORT QcLatencyHistogram
+{
+public:
+  static const int number_of_buckets = 25; // up to 2^23 us ~ 8 s, and overflow
+
+public:
+  QcLatencyHistogram();
+
+  void add(qint64 latency); // us
+  void clear();
+
+  int count() const { return m_count; }
+  qint64 sum() const { return m_sum; }
+  qint64 max() const { return m_max; }
+  double mean() const { return m_count ? double(m_sum) / m_count : 0.; }
+  qint64 percentile(double percent) const;
+
+  int bucket(int i) const { return m_buckets[i]; }
+  static qint64 bucket_upper_bound(int i);
+
+  QJsonObject to_json() const;
+
+private:
+  int m_buckets[number_of_buckets];
+  int m_count;
+  qint64 m_sum;
+  qint64 m_max;
+};
+
+/**************************************************************************************************/
+
+// Counters of a cache tier
+class QC_EXPORT QcTileCacheTierMetrics
+{
+public:
+  QcTileCacheTierMetrics();
+
+  double hit_ratio() const;
+  QJsonObject to_json() const;
+
+public:
+  int hits;
+  int misses;
+  int promotions;
+  int evictions;
+  int tiles;
+  qint64 bytes;
+  qint64 max_bytes;
+};
+
+/**************************************************************************************************/
+
+/* Statistics of a file tile cache.
+ *
+ * The tier counters are pulled from the cache by update(), the latencies
+ * are pushed by the cache, the decode jobs and the tile fetcher.  The
+ * record methods are thread safe.
+ *
+ * A JSON snapshot is emitted periodically when an interval is set, and
+ * is written atomically to the snapshot path if any so as to be scraped.
+ */
+class QC_EXPORT QcTileCacheMetrics : public QObject
+{
+  Q_OBJECT
+  Q_PROPERTY(int texture_hits READ texture_hits NOTIFY updated)
+  Q_PROPERTY(int texture_misses READ texture_misses NOTIFY updated)
+  Q_PROPERTY(int memory_hits READ memory_hits NOTIFY updated)
+  Q_PROPERTY(int memory_misses READ memory_misses NOTIFY updated)
+  Q_PROPERTY(int disk_hits READ disk_hits NOTIFY updated)
+  Q_PROPERTY(int disk_misses READ disk_misses NOTIFY updated)
+  Q_PROPERTY(qint64 texture_usage READ texture_usage NOTIFY updated)
+  Q_PROPERTY(qint64 memory_usage READ memory_usage NOTIFY updated)
+  Q_PROPERTY(qint64 disk_usage READ disk_usage NOTIFY updated)
+  Q_PROPERTY(int evicted_tiles READ evicted_tiles NOTIFY updated)
+  Q_PROPERTY(double decode_time READ decode_time NOTIFY updated)
+  Q_PROPERTY(double disk_read_latency READ disk_read_latency NOTIFY updated)
+  Q_PROPERTY(QVariantMap fetch_latencies READ fetch_latencies NOTIFY updated)
+  Q_PROPERTY(int fetch_queue_depth READ fetch_queue_depth NOTIFY updated)
+  Q_PROPERTY(int fetch_in_flight READ fetch_in_flight NOTIFY updated)
+  Q_PROPERTY(int snapshot_interval READ snapshot_interval WRITE set_snapshot_interval NOTIFY snapshot_interval_changed)
+  Q_PROPERTY(QString snapshot_path READ snapshot_path WRITE set_snapshot_path)
+
+public:
+  QcTileCacheMetrics(QcFileTileCache * cache, QObject * parent = nullptr);
+  ~QcTileCacheMetrics();
+
+  const QcTileCacheTierMetrics & texture_tier() const { return m_texture_tier; }
+  const QcTileCacheTierMetrics & memory_tier() const { return m_memory_tier; }
+  const QcTileCacheTierMetrics & disk_tier() const { return m_disk_tier; }
+
+  int texture_hits() const { return m_texture_tier.hits; }
+  int texture_misses() const { return m_texture_tier.misses; }
+  int memory_hits() const { return m_memory_tier.hits; }
+  int memory_misses() const { return m_memory_tier.misses; }
+  int disk_hits() const { return m_disk_tier.hits; }
+  int disk_misses() const { return m_disk_tier.misses; }
+  qint64 texture_usage() const { return m_texture_tier.bytes; }
+  qint64 memory_usage() const { return m_memory_tier.bytes; }
+  qint64 disk_usage() const { return m_disk_tier.bytes; }
+  int evicted_tiles() const { return m_evicted_tiles; }
+
+  // Means in us
+  double decode_time() const;
+  double disk_read_latency() const;
+  QVariantMap fetch_latencies() const; // provider -> mean in us
+
+  QcLatencyHistogram decode_time_histogram() const;
+  QcLatencyHistogram disk_read_histogram() const;
+  QcLatencyHistogram fetch_histogram(const QString & provider) const;
+  int fetch_errors(const QString & provider) const;
+  int fetch_queue_depth() const;
+  int fetch_in_flight() const;
+
+  void record_decode_time(qint64 latency);
+  void record_disk_read(qint64 latency);
+  void record_fetch(const QString & provider, qint64 latency, bool error);
+  void record_fetch_queue(int queue_depth, int in_flight);
+
+  int snapshot_interval() const { return m_snapshot_timer.isActive() ? m_snapshot_timer.interval() : 0; }
+  void set_snapshot_interval(int interval); // ms, 0 to disable
+  const QString & snapshot_path() const { return m_snapshot_path; }
+  void set_snapshot_path(const QString & path) { m_snapshot_path = path; }
+
+  Q_INVOKABLE QJsonObject to_json() const;
+  Q_INVOKABLE QByteArray snapshot();
+
+public slots:
+  void update();
+  void reset_latencies();
+
+signals:
+  void updated();
+  void snapshot_ready(const QByteArray & json);
+  void snapshot_interval_changed();
+
+private slots:
+  void take_snapshot();
+
+private:
+  QcFileTileCache * m_cache;
+  QcTileCacheTierMetrics m_texture_tier;
+  QcTileCacheTierMetrics m_memory_tier;
+  QcTileCacheTierMetrics m_disk_tier;
+  int m_evicted_tiles;
+  qint64 m_reclaimed_bytes;
+  qint64 m_max_eviction_latency; // ms
+  mutable QMutex m_mutex; // guards the latencies
+  QcLatencyHistogram m_decode_time;
+  QcLatencyHistogram m_disk_read;
+  QHash<QString, QcLatencyHistogram> m_fetch;
+  QHash<QString, int> m_fetch_errors;
+  int m_fetch_queue_depth;
+  int m_fetch_in_flight;
+  int m_max_fetch_queue_depth;
+  int m_max_fetch_in_flight;
+  QTimer m_snapshot_timer;
+  QString m_snapshot_path;
+};
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __TILE_CACHE_METRICS_H__ */
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,350 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_freshness.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QLocale>
+#include <QSaveFile>
+#include <QStringList>
+#include <QtDebug>
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* Freshness file layout
+ *
+ * Header:
+ *   quint32 magic
+ *   quint32 version
+ *   quint32 number of plugin names
+ *   names as quint8 size followed by Latin-1 characters
+ *   quint32 number of records
+ *
+ * Record:
+ *   quint16 plugin name index
+ *   qint32  map_id, level, x, y
+ *   qint64  last modified, fetched at, expires at
+ *   quint16 ETag size followed by the ETag
+ *
+ * Integers are stored in little endian.
+ */
+
+constexpr quint32 FRESHNESS_MAGIC = 0x46544351; // QCTF
+constexpr quint32 FRESHNESS_VERSION = 1;
+
+constexpr qint64 DAY = 24 * 3600 * 1000LL;
+
+const qint64 QcTileFreshness::default_max_age = DAY;
+const qint64 QcTileFreshness::max_heuristic_age = 7 * DAY;
+
+const QString QcTileFreshnessStore::default_filename = QLatin1Literal("tiles.freshness");
+
+static const QString HTTP_DATE_FORMAT = QLatin1Literal("ddd, dd MMM yyyy hh:mm:ss 'GMT'");
+
+/**************************************************************************************************/
+
+QcTileFreshness::QcTileFreshness()
+  : etag(),
+    last_modified(-1),
+    fetched_at(-1),
+    expires_at(-1)
+{}
+
+/*! Update the metadata from the headers of a 304 response, which can
+ *  omit the validators.
+ */
+void
+QcTileFreshness::update(const QcTileFreshness & other)
+{
+  if (!other.etag.isEmpty())
+    etag = other.etag;
+  if (other.last_modified >= 0)
+    last_modified = other.last_modified;
+  fetched_at = other.fetched_at;
+  expires_at = other.expires_at;
+}
+
+/*! Compute the freshness of a response received at \a now.
+ *
+ * The max-age directive of Cache-Control takes precedence over the
+ * Expires header, no-cache and no-store make the tile stale at once.
+ * Without both of them, the freshness lifetime is a tenth of the age of
+ * the resource as suggested by RFC 7234, else a default lifetime.
+ */
+QcTileFreshness
+QcTileFreshness::from_http_headers(const QByteArray & etag,
+                                   const QByteArray & last_modified,
+                                   const QByteArray & cache_control,
+                                   const QByteArray & expires,
+                                   qint64 now)
+{
+  QcTileFreshness freshness;
+  freshness.etag = etag.trimmed();
+  freshness.last_modified = parse_http_date(last_modified);
+  freshness.fetched_at = now;
+
+  qint64 max_age = -1;
+  bool no_cache = false;
+  for (const QByteArray & directive : cache_control.split(',')) {
+    QByteArray token = directive.trimmed().toLower();
+    if (token == "no-cache" || token == "no-store")
+      no_cache = true;
+    else if (token.startsWith("max-age=")) {
+      bool ok = false;
+      qint64 seconds = token.mid(8).toLongLong(&ok);
+      if (ok && seconds >= 0)
+        max_age = seconds * 1000;
+    }
+  }
+  if (no_cache)
+    max_age = 0;
+
+  if (max_age < 0 && !expires.trimmed().isEmpty()) {
+    // An invalid date, e.g. "0", means already expired
+    qint64 expiry = parse_http_date(expires);
+    max_age = expiry >= 0 ? qMax(expiry - now, qint64(0)) : 0;
+  }
+
+  if (max_age < 0 && freshness.last_modified >= 0)
+    max_age = qBound(qint64(0), (now - freshness.last_modified) / 10, max_heuristic_age);
+
+  if (max_age < 0)
+    max_age = default_max_age;
+
+  freshness.expires_at = now + max_age;
+
+  return freshness;
+}
+
+//! Parse an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT", return -1 if invalid
+qint64
+QcTileFreshness::parse_http_date(const QByteArray & date)
+{
+  QByteArray trimmed = date.trimmed();
+  if (trimmed.isEmpty())
+    return -1;
+
+  QDateTime date_time = QLocale::c().toDateTime(QString::fromLatin1(trimmed), HTTP_DATE_FORMAT);
+  if (!date_time.isValid())
+    return -1;
+  date_time.setTimeSpec(Qt::UTC);
+  return date_time.toMSecsSinceEpoch();
+}
+
+QByteArray
+QcTileFreshness::to_http_date(qint64 time)
+{
+  QDateTime date_time = QDateTime::fromMSecsSinceEpoch(time, Qt::UTC);
+  return QLocale::c().toString(date_time, HTTP_DATE_FORMAT).toLatin1();
+}
+
+/**************************************************************************************************/
+
+QcTileFreshnessStore::QcTileFreshnessStore()
+  : m_entries(),
+    m_expiries()
+{}
+
+void
+QcTileFreshnessStore::insert(const QcTileSpec & tile_spec, const QcTileFreshness & freshness)
+{
+  remove(tile_spec);
+  if (freshness.is_valid()) {
+    m_entries.insert(tile_spec, freshness);
+    m_expiries.insert(freshness.expires_at, tile_spec);
+  }
+}
+
+void
+QcTileFreshnessStore::remove(const QcTileSpec & tile_spec)
+{
+  auto it = m_entries.find(tile_spec);
+  if (it != m_entries.end()) {
+    m_expiries.remove(it->expires_at, tile_spec);
+    m_entries.erase(it);
+  }
+}
+
+void
+QcTileFreshnessStore::clear()
+{
+  m_entries.clear();
+  m_expiries.clear();
+}
+
+int
+QcTileFreshnessStore::stale_count(qint64 now) const
+{
+  int count = 0;
+  for (auto it = m_expiries.constBegin(); it != m_expiries.constEnd() && it.key() <= now; ++it)
+    count++;
+  return count;
+}
+
+/*! Return at most \a max_count stale tiles, the longest expired first.
+ *
+ */
+QList<QcTileSpec>
+QcTileFreshnessStore::stale_tiles(qint64 now, int max_count, const QcTileKeySet & excluded) const
+{
+  QList<QcTileSpec> tile_specs;
+  for (auto it = m_expiries.constBegin();
+       it != m_expiries.constEnd() && it.key() <= now && tile_specs.size() < max_count;
+       ++it)
+    if (!excluded.contains(it->key()))
+      tile_specs << it.value();
+  return tile_specs;
+}
+
+bool
+QcTileFreshnessStore::write(const QString & filename) const
+{
+  QStringList plugins;
+  QHash<QString, int> plugin_indexes;
+
+  QByteArray records;
+  QDataStream record_stream(&records, QIODevice::WriteOnly);
+  record_stream.setByteOrder(QDataStream::LittleEndian);
+  for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+    const QcTileSpec & tile_spec = it.key();
+    int plugin_index = plugin_indexes.value(tile_spec.plugin(), -1);
+    if (plugin_index < 0) {
+      plugin_index = plugins.size();
+      plugins << tile_spec.plugin();
+      plugin_indexes.insert(tile_spec.plugin(), plugin_index);
+    }
+    QByteArray etag = it->etag.left(0xFFFF);
+    record_stream << static_cast<quint16>(plugin_index)
+                  << static_cast<qint32>(tile_spec.map_id())
+                  << static_cast<qint32>(tile_spec.level())
+                  << static_cast<qint32>(tile_spec.x())
+                  << static_cast<qint32>(tile_spec.y())
+                  << it->last_modified
+                  << it->fetched_at
+                  << it->expires_at
+                  << static_cast<quint16>(etag.size());
+    record_stream.writeRawData(etag.constData(), etag.size());
+  }
+
+  QByteArray header;
+  QDataStream stream(&header, QIODevice::WriteOnly);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream << FRESHNESS_MAGIC << FRESHNESS_VERSION;
+  stream << static_cast<quint32>(plugins.size());
+  for (const auto & plugin : plugins) {
+    QByteArray latin1 = plugin.toLatin1();
+    stream << static_cast<quint8>(latin1.size());
+    stream.writeRawData(latin1.constData(), latin1.size());
+  }
+  stream << static_cast<quint32>(m_entries.size());
+
+  QSaveFile file(filename);
+  if (!file.open(QIODevice::WriteOnly)) {
+    qWarning() << "Unable to write tile freshness" << filename;
+    return false;
+  }
+  file.write(header);
+  file.write(records);
+
+  return file.commit();
+}
+
+bool
+QcTileFreshnessStore::read(const QString & filename)
+{
+  clear();
+
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+  QByteArray data = file.readAll();
+  file.close();
+
+  QDataStream stream(data);
+  stream.setByteOrder(QDataStream::LittleEndian);
+
+  quint32 magic, version;
+  stream >> magic >> version;
+  if (stream.status() != QDataStream::Ok || magic != FRESHNESS_MAGIC || version != FRESHNESS_VERSION) {
+    qWarning() << "Invalid tile freshness" << filename;
+    return false;
+  }
+
+  quint32 number_of_plugins;
+  stream >> number_of_plugins;
+  QStringList plugins;
+  for (quint32 i = 0; i < number_of_plugins && stream.status() == QDataStream::Ok; i++) {
+    quint8 size;
+    stream >> size;
+    QByteArray latin1(size, '\0');
+    if (stream.readRawData(latin1.data(), size) != size)
+      stream.setStatus(QDataStream::ReadPastEnd);
+    plugins << QString::fromLatin1(latin1);
+  }
+
+  quint32 number_of_entries;
+  stream >> number_of_entries;
+  if (stream.status() != QDataStream::Ok) {
+    qWarning() << "Truncated tile freshness" << filename;
+    return false;
+  }
+
+  m_entries.reserve(number_of_entries);
+  for (quint32 i = 0; i < number_of_entries; i++) {
+    quint16 plugin_index, etag_size;
+    qint32 map_id, level, x, y;
+    QcTileFreshness freshness;
+    stream >> plugin_index >> map_id >> level >> x >> y
+           >> freshness.last_modified >> freshness.fetched_at >> freshness.expires_at
+           >> etag_size;
+    freshness.etag.resize(etag_size);
+    if (stream.status() != QDataStream::Ok || plugin_index >= plugins.size()
+        || stream.readRawData(freshness.etag.data(), etag_size) != etag_size) {
+      qWarning() << "Corrupted tile freshness" << filename;
+      clear();
+      return false;
+    }
+    insert(QcTileSpec(plugins[plugin_index], map_id, level, x, y), freshness);
+  }
+
+  return true;
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,138 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_FRESHNESS_H__
+#define __TILE_FRESHNESS_H__
+
+/**************************************************************************************************/
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QtCore/QMetaType>
+
+#include "qtcarto_global.h"
+#include "wmts/tile_spec.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* HTTP freshness metadata of a cached tile.
+ *
+ * Times are in ms since the epoch, -1 if unknown. A tile is stale once
+ * its expiry time is elapsed, it is then revalidated with a conditional
+ * request using the ETag and Last-Modified validators.
+ */
+class QC_EXPORT QcTileFreshness
+{
+public:
+  static const qint64 default_max_age; // when the server gives no hint
+  static const qint64 max_heuristic_age; // derived from Last-Modified
+
+public:
+  QcTileFreshness();
+
+  bool is_valid() const { return fetched_at >= 0; }
+  bool has_validators() const { return !etag.isEmpty() || last_modified >= 0; }
+  bool is_stale(qint64 now) const { return is_valid() && expires_at <= now; }
+
+  void update(const QcTileFreshness & other);
+
+  static QcTileFreshness from_http_headers(const QByteArray & etag,
+                                           const QByteArray & last_modified,
+                                           const QByteArray & cache_control,
+                                           const QByteArray & expires,
+                                           qint64 now);
+  static qint64 parse_http_date(const QByteArray & date);
+  static QByteArray to_http_date(qint64 time);
+
+public:
+  QByteArray etag;
+  qint64 last_modified;
+  qint64 fetched_at;
+  qint64 expires_at;
+};
+
+/**************************************************************************************************/
+
+/* Freshness metadata of the tiles of a cache.
+ *
+ * The metadata are kept aside the tile pack in a versioned binary file,
+ * so as to not change the layout of the pack and to support the one file
+ * per tile storage. A tile without metadata, e.g. cached by a previous
+ * version, is never considered as stale.
+ *
+ * The tiles are also indexed by expiry time, so as to only visit the
+ * expired tiles when the stale tiles are looked up.
+ */
+class QC_EXPORT QcTileFreshnessStore
+{
+public:
+  static const QString default_filename;
+
+public:
+  QcTileFreshnessStore();
+
+  int size() const { return m_entries.size(); }
+  bool contains(const QcTileSpec & tile_spec) const { return m_entries.contains(tile_spec); }
+  QcTileFreshness value(const QcTileSpec & tile_spec) const { return m_entries.value(tile_spec); }
+  void insert(const QcTileSpec & tile_spec, const QcTileFreshness & freshness);
+  void remove(const QcTileSpec & tile_spec);
+  void clear();
+
+  int stale_count(qint64 now) const;
+  QList<QcTileSpec> stale_tiles(qint64 now, int max_count, const QcTileKeySet & excluded = QcTileKeySet()) const;
+
+  bool read(const QString & filename);
+  bool write(const QString & filename) const;
+
+private:
+  QHash<QcTileSpec, QcTileFreshness> m_entries;
+  QMultiMap<qint64, QcTileSpec> m_expiries; // tiles by expiry time
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QcTileFreshness)
+
+#endif /* __TILE_FRESHNESS_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -107,6 +107,54 @@ read_tile_image(const QString & filename)
   return data;
 }
 
+QImage
+decode_tile_image(const QByteArray & bytes, QcTileImageFormat format)
+{
+  QImage image;
+  if (bytes.isEmpty() || !image.loadFromData(bytes))
+    return QImage();
+
+  // Convert here, on the decode thread, instead of at upload time
+  QImage::Format texture_format = TILE_TEXTURE_FORMAT;
+  if (format == QcTileImageFormat::Rgb565 && !image.hasAlphaChannel())
+    texture_format = OPAQUE_TILE_TEXTURE_FORMAT; // e.g. JPEG ortho photos
+  if (image.format() != texture_format)
+    image = image.convertToFormat(texture_format);
+  return image;
+}
+
+/**************************************************************************************************/
+
+QcMappedTileFile::QcMappedTileFile(const QString & filename)
+  : m_file(filename),
+    m_data(nullptr),
+    m_size(0)
+{
+  if (!m_file.open(QIODevice::ReadOnly))
+    return;
+
+  m_size = m_file.size();
+  if (m_size > 0)
+    m_data = m_file.map(0, m_size);
+  // the mapping is kept until unmap or the QFile is destroyed
+  m_file.close();
+}
+
+QcMappedTileFile::~QcMappedTileFile()
+{
+  if (m_data)
+    m_file.unmap(m_data);
+}
+
+QByteArray
+QcMappedTileFile::bytes() const
+{
+  if (m_data)
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(m_data), m_size);
+  else
+    return QByteArray();
+}
+
 /**************************************************************************************************/
 
 // QC_END_NAMESPACE
@@ -35,6 +35,8 @@
 
 #include <QString>
 #include <QByteArray>
+#include <QFile>
+#include <QImage>
 
 #include "wmts/tile_spec.h"
 
@@ -48,6 +50,46 @@ QcTileSpec filename_to_tile_spec(const QString & filename);
 void write_tile_image(const QString & filename, const QByteArray & bytes);
 QByteArray read_tile_image(const QString & filename);
 
+/* Pixel formats of the decoded tiles, they are uploaded as is by
+ * QcTileSGTexture: GL_RGBA and GL_UNSIGNED_BYTE, respectively GL_RGB and
+ * GL_UNSIGNED_SHORT_5_6_5.
+ */
+const QImage::Format TILE_TEXTURE_FORMAT = QImage::Format_RGBA8888_Premultiplied;
+const QImage::Format OPAQUE_TILE_TEXTURE_FORMAT = QImage::Format_RGB16;
+
+enum class QcTileImageFormat {
+  Rgba8888, // 4 bytes per pixel
+  Rgb565 // 2 bytes per pixel for opaque tiles, tiles having alpha are Rgba8888
+};
+
+/* Decode a PNG, JPEG tile and convert it to a texture format, return
+ * a null image on error.
+ */
+QImage decode_tile_image(const QByteArray & bytes, QcTileImageFormat format = QcTileImageFormat::Rgba8888);
+
+/**************************************************************************************************/
+
+/* Read only memory mapping of a tile file.
+ *
+ * The file descriptor is closed once the file is mapped, the mapping
+ * lives as long as the instance.
+ */
+class QcMappedTileFile
+{
+public:
+  QcMappedTileFile(const QString & filename);
+  ~QcMappedTileFile();
+
+  bool is_mapped() const { return m_data != nullptr; }
+  // View on the mapping, valid while this instance is alive
+  QByteArray bytes() const;
+
+private:
+  QFile m_file;
+  uchar * m_data;
+  qint64 m_size;
+};
+
 // QC_END_NAMESPACE
 
 /**************************************************************************************************/
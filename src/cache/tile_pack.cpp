@@ -0,0 +1,705 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_pack.h"
+#include "tile_image.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QtDebug>
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* Pack layout
+ *
+ * Header:
+ *   quint32 pack magic
+ *   quint32 version
+ *
+ * Record:
+ *   quint32 record magic
+ *   quint8  flags
+ *   quint8  plugin size
+ *   quint8  format size
+ *   quint8  reserved
+ *   qint32  map_id, level, x, y
+ *   qint32  data size
+ *   plugin, format, data
+ *
+ * Integers are stored in little endian.
+ */
+
+constexpr quint32 PACK_MAGIC = 0x50544351; // QCTP
+constexpr quint32 PACK_VERSION = 1;
+constexpr qint64 PACK_HEADER_SIZE = 2 * sizeof(quint32);
+
+constexpr quint32 RECORD_MAGIC = 0x454c4954; // TILE
+constexpr qint64 RECORD_HEADER_SIZE = sizeof(quint32) + 4 * sizeof(quint8) + 5 * sizeof(qint32);
+constexpr qint64 RECORD_FLAGS_OFFSET = sizeof(quint32);
+
+constexpr quint8 RECORD_DELETED = 0x01;
+
+const QString QcTilePack::default_filename = QLatin1Literal("tiles.pack");
+
+/**************************************************************************************************/
+
+QcTilePackEntry::QcTilePackEntry()
+  : offset(-1),
+    data_offset(-1),
+    size(0),
+    format()
+{}
+
+/**************************************************************************************************/
+
+static QByteArray
+record_header(const QcTileSpec & tile_spec, const QByteArray & plugin, const QByteArray & format, int size)
+{
+  QByteArray header;
+  QDataStream stream(&header, QIODevice::WriteOnly);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream << RECORD_MAGIC
+         << static_cast<quint8>(0)
+         << static_cast<quint8>(plugin.size())
+         << static_cast<quint8>(format.size())
+         << static_cast<quint8>(0)
+         << static_cast<qint32>(tile_spec.map_id())
+         << static_cast<qint32>(tile_spec.level())
+         << static_cast<qint32>(tile_spec.x())
+         << static_cast<qint32>(tile_spec.y())
+         << static_cast<qint32>(size);
+  return header;
+}
+
+/**************************************************************************************************/
+
+QcTilePack::QcTilePack(const QString & filename)
+  : m_filename(filename),
+    m_mutex(),
+    m_file(filename),
+    m_index(),
+    m_dead_size(0),
+    m_segments(),
+    m_mapped_size(0)
+{}
+
+QcTilePack::~QcTilePack()
+{
+  close();
+}
+
+/* Open the pack.
+ *
+ * If scan_records is false the index is left empty and must be set
+ * with merge_index().
+ */
+bool
+QcTilePack::open(bool scan_records)
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (m_file.isOpen())
+    return true;
+
+  QDir::root().mkpath(QFileInfo(m_filename).absolutePath());
+
+  if (!m_file.open(QIODevice::ReadWrite)) {
+    qWarning() << "Unable to open tile pack" << m_filename;
+    return false;
+  }
+
+  if (m_file.size() == 0)
+    return write_header();
+  else if (scan_records)
+    return scan();
+  else
+    return true;
+}
+
+void
+QcTilePack::close()
+{
+  QMutexLocker locker(&m_mutex);
+
+  unmap();
+  if (m_file.isOpen())
+    m_file.close();
+  m_index.clear();
+  m_dead_size = 0;
+}
+
+bool
+QcTilePack::write_header()
+{
+  QByteArray header;
+  QDataStream stream(&header, QIODevice::WriteOnly);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream << PACK_MAGIC << PACK_VERSION;
+
+  m_file.seek(0);
+  if (m_file.write(header) != PACK_HEADER_SIZE) {
+    qWarning() << "Unable to write tile pack header" << m_filename;
+    return false;
+  }
+  m_file.flush();
+
+  return true;
+}
+
+/* Read the record headers of a pack up to the offset end.
+ *
+ * Return the offset of the end of the last valid record or -1 if the
+ * pack header is invalid. This function is reentrant and can be used
+ * from a worker thread on its own file handle.
+ */
+qint64
+QcTilePack::scan_file(QIODevice & file, qint64 end,
+                      QHash<QcTileSpec, QcTilePackEntry> & index, qint64 & dead_size)
+{
+  file.seek(0);
+  QDataStream stream(&file);
+  stream.setByteOrder(QDataStream::LittleEndian);
+
+  quint32 magic, version;
+  stream >> magic >> version;
+  if (stream.status() != QDataStream::Ok || magic != PACK_MAGIC || version != PACK_VERSION)
+    return -1;
+
+  qint64 offset = PACK_HEADER_SIZE;
+  while (offset + RECORD_HEADER_SIZE <= end) {
+    quint8 flags, plugin_size, format_size, reserved;
+    qint32 map_id, level, x, y, size;
+    stream >> magic >> flags >> plugin_size >> format_size >> reserved
+           >> map_id >> level >> x >> y >> size;
+    if (stream.status() != QDataStream::Ok || magic != RECORD_MAGIC || size < 0)
+      break;
+
+    qint64 data_offset = offset + RECORD_HEADER_SIZE + plugin_size + format_size;
+    qint64 next_offset = data_offset + size;
+    if (next_offset > end)
+      break;
+
+    QByteArray plugin = file.read(plugin_size);
+    QByteArray format = file.read(format_size);
+
+    if (flags & RECORD_DELETED)
+      dead_size += next_offset - offset;
+    else {
+      QcTileSpec tile_spec(QString::fromLatin1(plugin), map_id, level, x, y);
+      // A record can be duplicated if the application was killed between an append and a delete
+      auto previous = index.constFind(tile_spec);
+      if (previous != index.constEnd())
+        dead_size += previous->data_offset + previous->size - previous->offset;
+      QcTilePackEntry entry;
+      entry.offset = offset;
+      entry.data_offset = data_offset;
+      entry.size = size;
+      entry.format = QString::fromLatin1(format);
+      index.insert(tile_spec, entry);
+    }
+
+    offset = next_offset;
+    file.seek(offset);
+  }
+
+  return offset;
+}
+
+/* Build the index from the records.
+ *
+ * A truncated record, e.g. due to a crash while appending, ends the
+ * scan and is discarded.
+ */
+bool
+QcTilePack::scan()
+{
+  m_index.clear();
+  m_dead_size = 0;
+
+  qint64 file_size = m_file.size();
+  qint64 offset = scan_file(m_file, file_size, m_index, m_dead_size);
+  if (offset < 0) {
+    qWarning() << "Invalid tile pack" << m_filename;
+    m_file.close();
+    return false;
+  }
+
+  if (offset != file_size) {
+    qWarning() << "Truncate tile pack" << m_filename << "at" << offset << "/" << file_size;
+    m_file.resize(offset);
+  }
+
+  // qInfo() << "Tile pack" << m_filename << m_index.size() << "tiles" << m_dead_size << "dead bytes";
+
+  return true;
+}
+
+bool
+QcTilePack::rescan()
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (!m_file.isOpen())
+    return false;
+
+  unmap();
+  return scan();
+}
+
+/* Merge an index loaded from an index file or built by a background
+ * scan, the entries inserted in the meantime take precedence.
+ */
+void
+QcTilePack::merge_index(const QHash<QcTileSpec, QcTilePackEntry> & index, qint64 dead_size)
+{
+  QMutexLocker locker(&m_mutex);
+
+  for (auto it = index.constBegin(); it != index.constEnd(); ++it) {
+    auto current = m_index.constFind(it.key());
+    if (current == m_index.constEnd())
+      m_index.insert(it.key(), it.value());
+    else if (current->offset != it->offset)
+      dead_size += it->data_offset + it->size - it->offset;
+  }
+  m_dead_size += dead_size;
+}
+
+/* Truncate the pack to size, the records beyond are removed from the index.
+ *
+ */
+bool
+QcTilePack::truncate(qint64 size)
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (!m_file.isOpen() || size < PACK_HEADER_SIZE)
+    return false;
+
+  qWarning() << "Truncate tile pack" << m_filename << "at" << size << "/" << m_file.size();
+  for (auto it = m_index.begin(); it != m_index.end(); )
+    if (it->data_offset + it->size > size)
+      it = m_index.erase(it);
+    else
+      ++it;
+  unmap();
+
+  return m_file.resize(size);
+}
+
+QHash<QcTileSpec, QcTilePackEntry>
+QcTilePack::index() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_index;
+}
+
+int
+QcTilePack::count() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_index.size();
+}
+
+qint64
+QcTilePack::size() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_file.size();
+}
+
+qint64
+QcTilePack::dead_size() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_dead_size;
+}
+
+bool
+QcTilePack::contains(const QcTileSpec & tile_spec) const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_index.contains(tile_spec);
+}
+
+bool
+QcTilePack::entry(const QcTileSpec & tile_spec, QcTilePackEntry & entry) const
+{
+  QMutexLocker locker(&m_mutex);
+
+  auto it = m_index.constFind(tile_spec);
+  if (it == m_index.constEnd())
+    return false;
+
+  entry = *it;
+  return true;
+}
+
+QList<QcTileSpec>
+QcTilePack::tile_specs() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_index.keys();
+}
+
+QByteArray
+QcTilePack::read(const QcTileSpec & tile_spec, QString * format) const
+{
+  QMutexLocker locker(&m_mutex);
+
+  auto it = m_index.constFind(tile_spec);
+  if (it == m_index.constEnd())
+    return QByteArray();
+
+  if (format)
+    *format = it->format;
+
+  if (!m_file.seek(it->data_offset))
+    return QByteArray();
+  return m_file.read(it->size);
+}
+
+/*! Return a view on the mapped tile data, the returned byte array
+ * doesn't own its data.
+ */
+QByteArray
+QcTilePack::read_view(const QcTileSpec & tile_spec, QString * format) const
+{
+  QMutexLocker locker(&m_mutex);
+
+  auto it = m_index.constFind(tile_spec);
+  if (it == m_index.constEnd())
+    return QByteArray();
+
+  const uchar * data = mapped_data(it->data_offset, it->size);
+  if (!data)
+    return QByteArray();
+
+  if (format)
+    *format = it->format;
+
+  return QByteArray::fromRawData(reinterpret_cast<const char *>(data), it->size);
+}
+
+// Records never cross a segment boundary since the file is mapped up to its size, which is at a record boundary
+const uchar *
+QcTilePack::mapped_data(qint64 offset, int size) const
+{
+  if (offset + size > m_mapped_size) {
+    qint64 file_size = m_file.size();
+    uchar * segment = m_file.map(m_mapped_size, file_size - m_mapped_size);
+    if (!segment) {
+      qWarning() << "Unable to map tile pack" << m_filename << m_file.errorString();
+      return nullptr;
+    }
+    m_segments.insert(m_mapped_size, segment);
+    m_mapped_size = file_size;
+  }
+
+  auto it = m_segments.upperBound(offset);
+  --it;
+  return it.value() + (offset - it.key());
+}
+
+void
+QcTilePack::unmap()
+{
+  for (auto * segment : m_segments)
+    m_file.unmap(segment);
+  m_segments.clear();
+  m_mapped_size = 0;
+}
+
+bool
+QcTilePack::insert(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format)
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (!m_file.isOpen())
+    return false;
+
+  QByteArray plugin = tile_spec.plugin().toLatin1();
+  QByteArray format_latin1 = format.toLatin1();
+  if (plugin.size() > 255 || format_latin1.size() > 255) {
+    qWarning() << "Plugin or format name too long" << tile_spec << format;
+    return false;
+  }
+
+  QByteArray record = record_header(tile_spec, plugin, format_latin1, bytes.size());
+  record += plugin;
+  record += format_latin1;
+  record += bytes;
+
+  qint64 offset = m_file.size();
+  m_file.seek(offset);
+  if (m_file.write(record) != record.size()) {
+    qWarning() << "Unable to write tile" << tile_spec << "in pack" << m_filename;
+    m_file.resize(offset);
+    return false;
+  }
+  m_file.flush();
+
+  // Append first, then delete the previous record: a crash in between is fixed by scan()
+  auto previous = m_index.constFind(tile_spec);
+  if (previous != m_index.constEnd())
+    mark_as_deleted(*previous);
+
+  QcTilePackEntry entry;
+  entry.offset = offset;
+  entry.data_offset = offset + RECORD_HEADER_SIZE + plugin.size() + format_latin1.size();
+  entry.size = bytes.size();
+  entry.format = format;
+  m_index.insert(tile_spec, entry);
+
+  return true;
+}
+
+bool
+QcTilePack::mark_as_deleted(const QcTilePackEntry & entry)
+{
+  const char flags = RECORD_DELETED;
+  if (!m_file.seek(entry.offset + RECORD_FLAGS_OFFSET) || m_file.write(&flags, 1) != 1) {
+    qWarning() << "Unable to delete record at" << entry.offset << "in pack" << m_filename;
+    return false;
+  }
+  m_file.flush();
+  m_dead_size += entry.data_offset + entry.size - entry.offset;
+
+  return true;
+}
+
+/* Remove a tile, if offset is given the record is only removed if it
+ * was not replaced in the meantime.
+ */
+bool
+QcTilePack::remove(const QcTileSpec & tile_spec, qint64 offset)
+{
+  QMutexLocker locker(&m_mutex);
+
+  auto it = m_index.find(tile_spec);
+  if (it == m_index.end() || (offset >= 0 && it->offset != offset))
+    return false;
+
+  bool status = mark_as_deleted(*it);
+  m_index.erase(it);
+
+  return status;
+}
+
+bool
+QcTilePack::clear()
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (!m_file.isOpen())
+    return false;
+
+  m_index.clear();
+  m_dead_size = 0;
+  unmap();
+  m_file.resize(0);
+
+  return write_header();
+}
+
+/* Copy a live record to a compacted pack and return its new location.
+ *
+ */
+static bool
+copy_record(QIODevice & file, const QcTileSpec & tile_spec, const QcTilePackEntry & entry,
+            QIODevice & compacted_file, qint64 & offset, QcTilePackEntry & compacted_entry)
+{
+  file.seek(entry.data_offset);
+  QByteArray bytes = file.read(entry.size);
+  if (bytes.size() != entry.size)
+    return false;
+
+  QByteArray plugin = tile_spec.plugin().toLatin1();
+  QByteArray format = entry.format.toLatin1();
+  QByteArray record = record_header(tile_spec, plugin, format, bytes.size());
+  record += plugin;
+  record += format;
+  record += bytes;
+  if (compacted_file.write(record) != record.size())
+    return false;
+
+  compacted_entry = entry;
+  compacted_entry.offset = offset;
+  compacted_entry.data_offset = offset + RECORD_HEADER_SIZE + plugin.size() + format.size();
+  offset += record.size();
+
+  return true;
+}
+
+/* Rewrite the pack without the deleted records.
+ *
+ * Since a record is never modified but for its deleted flag, the live
+ * records are copied without holding the lock and the pack can be
+ * read and written meanwhile. The records appended during the copy
+ * are then copied under the lock, and the records removed or replaced
+ * meanwhile are flagged as deleted in the compacted pack.
+ */
+bool
+QcTilePack::compact()
+{
+  QHash<QcTileSpec, QcTilePackEntry> index;
+  qint64 copied_size;
+  {
+    QMutexLocker locker(&m_mutex);
+    if (!m_file.isOpen())
+      return false;
+    if (m_dead_size == 0)
+      return true;
+    index = m_index;
+    copied_size = m_file.size();
+  }
+
+  QFile file(m_filename);
+  QSaveFile save_file(m_filename);
+  if (!file.open(QIODevice::ReadOnly) || !save_file.open(QIODevice::WriteOnly)) {
+    qWarning() << "Unable to compact tile pack" << m_filename;
+    return false;
+  }
+
+  QByteArray header;
+  QDataStream stream(&header, QIODevice::WriteOnly);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream << PACK_MAGIC << PACK_VERSION;
+  save_file.write(header);
+
+  // Map the copied records to their offset in the pack
+  QHash<QcTileSpec, QcTilePackEntry> compacted_index;
+  QHash<QcTileSpec, qint64> copied_offsets;
+  qint64 offset = PACK_HEADER_SIZE;
+  for (auto it = index.constBegin(); it != index.constEnd(); ++it) {
+    QcTilePackEntry entry;
+    if (!copy_record(file, it.key(), it.value(), save_file, offset, entry)) {
+      save_file.cancelWriting();
+      qWarning() << "Unable to copy tile" << it.key() << "in pack" << m_filename;
+      return false;
+    }
+    compacted_index.insert(it.key(), entry);
+    copied_offsets.insert(it.key(), it->offset);
+  }
+
+  QMutexLocker locker(&m_mutex);
+
+  // Records appended during the copy
+  for (auto it = m_index.constBegin(); it != m_index.constEnd(); ++it) {
+    if (it->offset < copied_size)
+      continue;
+    QcTilePackEntry entry;
+    if (!copy_record(file, it.key(), it.value(), save_file, offset, entry)) {
+      save_file.cancelWriting();
+      qWarning() << "Unable to copy tile" << it.key() << "in pack" << m_filename;
+      return false;
+    }
+    compacted_index.insert(it.key(), entry);
+    copied_offsets.remove(it.key());
+  }
+
+  // Records removed or replaced during the copy
+  qint64 dead_size = 0;
+  const char flags = RECORD_DELETED;
+  for (auto it = copied_offsets.constBegin(); it != copied_offsets.constEnd(); ++it) {
+    auto current = m_index.constFind(it.key());
+    if (current != m_index.constEnd() && current->offset == it.value())
+      continue;
+    QcTilePackEntry entry = compacted_index.take(it.key());
+    if (!save_file.seek(entry.offset + RECORD_FLAGS_OFFSET) || save_file.write(&flags, 1) != 1) {
+      save_file.cancelWriting();
+      qWarning() << "Unable to delete record at" << entry.offset << "in pack" << m_filename;
+      return false;
+    }
+    dead_size += entry.data_offset + entry.size - entry.offset;
+  }
+
+  file.close();
+  unmap();
+  m_file.close();
+  if (!save_file.commit()) {
+    qWarning() << "Unable to commit compacted tile pack" << m_filename;
+    if (m_file.open(QIODevice::ReadWrite))
+      scan();
+    return false;
+  }
+
+  if (!m_file.open(QIODevice::ReadWrite)) {
+    qWarning() << "Unable to reopen tile pack" << m_filename;
+    m_index.clear();
+    return false;
+  }
+  m_index = compacted_index;
+  m_dead_size = dead_size;
+
+  return true;
+}
+
+/* Move the tiles stored one per file in a directory into the pack.
+ *
+ * Return the number of imported tiles.
+ */
+int
+QcTilePack::import_files(const QString & directory_path, bool remove_files)
+{
+  QDir directory(directory_path);
+  QStringList files = directory.entryList(QStringList(QLatin1Literal("*-*-*-*.*")), QDir::Files);
+
+  int count = 0;
+  for (const auto & relative_filename : files) {
+    QcTileSpec tile_spec = filename_to_tile_spec(relative_filename);
+    if (tile_spec.level() == -1)
+      continue;
+    QString filename = directory.filePath(relative_filename);
+    QByteArray bytes = read_tile_image(filename);
+    if (bytes.isEmpty() || !insert(tile_spec, bytes, QFileInfo(filename).suffix()))
+      continue;
+    if (remove_files)
+      directory.remove(relative_filename);
+    count++;
+  }
+
+  if (count)
+    qInfo() << "Imported" << count << "tiles from" << directory_path << "into" << m_filename;
+
+  return count;
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,163 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_PACK_H__
+#define __TILE_PACK_H__
+
+/**************************************************************************************************/
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+
+#include "qtcarto_global.h"
+#include "wmts/tile_spec.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+// Layout of the cached tiles on disk
+enum class QcTileStorage {
+  Files, // one file per tile (legacy layout)
+  Packed // one pack file per cache
+};
+
+/**************************************************************************************************/
+
+/* Location of a tile in a pack file.
+ *
+ */
+class QcTilePackEntry
+{
+public:
+  QcTilePackEntry();
+
+public:
+  qint64 offset; // of the record header
+  qint64 data_offset;
+  int size;
+  QString format;
+};
+
+/**************************************************************************************************/
+
+/* Single file tile store.
+ *
+ * The pack is an append-only sequence of records, each made of a
+ * fixed size header, the plugin name, the image format and the
+ * encoded image. An index keyed by tile spec is built in memory when
+ * the pack is opened. A removed or replaced record is flagged as
+ * deleted in place, compact() rewrites the pack without these dead
+ * records.
+ *
+ * Reads and writes are serialised by a mutex and can be done from
+ * any thread. compact() only holds the lock to copy the records
+ * appended during the compaction and to swap the files, thus it can
+ * run on a worker thread while the pack is in use.
+ *
+ * read_view() returns a view on a memory mapping of the pack instead
+ * of a copy. Since the pack is append-only, the file is mapped by
+ * segments as it grows and a view remains valid until the pack is
+ * closed, cleared or compacted.
+ */
+class QC_EXPORT QcTilePack
+{
+public:
+  static const QString default_filename;
+
+public:
+  QcTilePack(const QString & filename);
+  ~QcTilePack();
+
+  const QString & filename() const { return m_filename; }
+
+  bool open(bool scan_records = true);
+  void close();
+  bool is_open() const { return m_file.isOpen(); }
+
+  int count() const;
+  qint64 size() const;
+  qint64 dead_size() const;
+
+  bool contains(const QcTileSpec & tile_spec) const;
+  bool entry(const QcTileSpec & tile_spec, QcTilePackEntry & entry) const;
+  QList<QcTileSpec> tile_specs() const;
+  QHash<QcTileSpec, QcTilePackEntry> index() const;
+  void merge_index(const QHash<QcTileSpec, QcTilePackEntry> & index, qint64 dead_size);
+  bool rescan();
+  bool truncate(qint64 size);
+
+  QByteArray read(const QcTileSpec & tile_spec, QString * format = nullptr) const;
+  QByteArray read_view(const QcTileSpec & tile_spec, QString * format = nullptr) const;
+  bool insert(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format);
+  bool remove(const QcTileSpec & tile_spec, qint64 offset = -1);
+  bool clear();
+  bool compact();
+
+  int import_files(const QString & directory, bool remove_files = true);
+
+  static qint64 scan_file(QIODevice & file, qint64 end,
+                          QHash<QcTileSpec, QcTilePackEntry> & index, qint64 & dead_size);
+
+private:
+  bool write_header();
+  bool scan();
+  bool mark_as_deleted(const QcTilePackEntry & entry);
+  const uchar * mapped_data(qint64 offset, int size) const;
+  void unmap();
+
+private:
+  QString m_filename;
+  mutable QMutex m_mutex;
+  mutable QFile m_file;
+  QHash<QcTileSpec, QcTilePackEntry> m_index;
+  qint64 m_dead_size;
+  mutable QMap<qint64, uchar *> m_segments; // mappings indexed by file offset
+  mutable qint64 m_mapped_size;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+#endif /* __TILE_PACK_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
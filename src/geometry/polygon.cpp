@@ -31,6 +31,7 @@
 #include <algorithm>
 #include <exception>
 
+#include <QMap>
 #include <QVector>
 
 #include "segment.h"
@@ -314,6 +315,10 @@ QcTiledPolygonRun::tile_indexes() const
 
 /**************************************************************************************************/
 
+QcTiledPolygon::QcTiledPolygon()
+  : m_polygon(), m_grid_step(0)
+{}
+
 QcTiledPolygon::QcTiledPolygon(const QcPolygon & polygon, double grid_step)
   : m_polygon(polygon), m_grid_step(grid_step)
 {
@@ -405,56 +410,78 @@ QcTiledPolygon::QcTiledPolygon(const QcPolygon & polygon, double grid_step)
   }
 }
 
+//! Group the runs by row, the intervals of a row are sorted by their lower bound
+static QMap<int, QList<QcIntervalInt>>
+runs_by_row(const QcTiledPolygonRunList & runs)
+{
+  QMap<int, QList<QcIntervalInt>> rows;
+  for (const QcTiledPolygonRun & run : runs)
+    rows[run.y()] << run.interval();
+  for (auto & intervals : rows)
+    std::sort(intervals.begin(), intervals.end(),
+              [](const QcIntervalInt & a, const QcIntervalInt & b) { return a.inf() < b.inf(); });
+  return rows;
+}
+
+/* Test whether x is in the sorted intervals.
+ *
+ * x must increase from a call to the next, index is the search cursor.
+ */
+static bool
+row_contains(const QList<QcIntervalInt> & intervals, int & index, int x)
+{
+  while (index < intervals.size() && intervals[index].sup() < x)
+    index++;
+  return index < intervals.size() && intervals[index].inf() <= x;
+}
+
+/* Compute the runs which are only in this polygon (new area), only in the
+ * old polygon (old area) and in both (same area).
+ *
+ * Each row is split at the bounds of the intervals of both polygons, the
+ * cost is proportional to the number of runs and not to the number of
+ * tiles.
+ */
 QcTiledPolygonDiff
-QcTiledPolygon::diff(const QcTiledPolygon & old_tiled_polygon)
+QcTiledPolygon::diff(const QcTiledPolygon & old_tiled_polygon) const
 {
   QcTiledPolygonDiff tiled_polygon_diff;
-  QcTiledPolygonRunList old_runs = old_tiled_polygon.m_runs;
-
-  bool exchanged;
-  QcIntervalInt intersection;
-  QcIntervalInt left;
-  QcIntervalInt right;
-  QVector<unsigned int> intersection_count(old_runs.size(), 0);
-
-  for (const QcTiledPolygonRun & new_run : m_runs) {
-    bool has_intersection = false;
-    int i = 0;
-    for (const QcTiledPolygonRun & old_run : old_runs) {
-      if (new_run.cut(old_run, intersection, left, right, exchanged)) {
-	int y = new_run.y();
-	qInfo() << y << intersection << left << right << exchanged;
-	has_intersection = true;
-	intersection_count[i] += 1;
-
-	tiled_polygon_diff.add_same_area(QcTiledPolygonRun(y, intersection));
-
-	if (left.is_not_empty()) {
-	  QcTiledPolygonRun run(y, left);
-	  if (exchanged)
-	    tiled_polygon_diff.add_old_area(run);
-	  else
-	    tiled_polygon_diff.add_new_area(run);
-	}
 
-	if (right.is_not_empty()) {
-	  QcTiledPolygonRun run(y, right);
-	  if (exchanged)
-	    tiled_polygon_diff.add_new_area(run);
-	  else
-	    tiled_polygon_diff.add_old_area(run);
-	}
-      }
-      i++;
+  QMap<int, QList<QcIntervalInt>> new_rows = runs_by_row(m_runs);
+  QMap<int, QList<QcIntervalInt>> old_rows = runs_by_row(old_tiled_polygon.m_runs);
+  QList<int> ys = new_rows.keys();
+  for (int y : old_rows.keys())
+    if (!new_rows.contains(y))
+      ys << y;
+  std::sort(ys.begin(), ys.end());
+
+  QVector<int> bounds;
+  for (int y : ys) {
+    const QList<QcIntervalInt> new_row = new_rows.value(y);
+    const QList<QcIntervalInt> old_row = old_rows.value(y);
+
+    bounds.clear();
+    for (const QcIntervalInt & interval : new_row)
+      bounds << interval.inf() << interval.sup() +1;
+    for (const QcIntervalInt & interval : old_row)
+      bounds << interval.inf() << interval.sup() +1;
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    int new_index = 0;
+    int old_index = 0;
+    for (int i = 0; i < bounds.size() -1; i++) {
+      int x = bounds[i];
+      bool in_new = row_contains(new_row, new_index, x);
+      bool in_old = row_contains(old_row, old_index, x);
+      QcTiledPolygonRun run(y, QcIntervalInt(x, bounds[i+1] -1));
+      if (in_new && in_old)
+        tiled_polygon_diff.add_same_area(run);
+      else if (in_new)
+        tiled_polygon_diff.add_new_area(run);
+      else if (in_old)
+        tiled_polygon_diff.add_old_area(run);
     }
-
-    if (!has_intersection)
-      tiled_polygon_diff.add_new_area(new_run);
-  }
-
-  for (int i = 0; i < old_runs.size(); i++) {
-    if (!intersection_count[i])
-      tiled_polygon_diff.add_old_area(old_runs[i]);
   }
 
   return tiled_polygon_diff;
@@ -103,18 +103,20 @@ class QC_EXPORT QcTiledPolygonRun
 class QC_EXPORT QcTiledPolygon
 {
  public:
+  QcTiledPolygon();
   QcTiledPolygon(const QcPolygon & polygon, double grid_step);
 
   inline const QcPolygon & polygon() const { return m_polygon; }
 
   inline double grid_step() const { return m_grid_step; }
 
-  inline const QList<QcTiledPolygonRun> runs() const { return m_runs; }
+  inline const QcTiledPolygonRunList & runs() const { return m_runs; }
+  inline bool is_empty() const { return m_runs.isEmpty(); }
 
-  QcTiledPolygonDiff diff(const QcTiledPolygon & polygon);
+  QcTiledPolygonDiff diff(const QcTiledPolygon & old_tiled_polygon) const;
 
  private:
-  const QcPolygon & m_polygon;
+  QcPolygon m_polygon; // a copy, the polygon is often a temporary
   double m_grid_step;
   QcTiledPolygonRunList m_runs;
 };
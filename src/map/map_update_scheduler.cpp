@@ -0,0 +1,113 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "map_update_scheduler.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcMapUpdateScheduler::QcMapUpdateScheduler(QObject * parent)
+  : QObject(parent),
+    m_viewport_dirty(false),
+    m_layer_updates(0),
+    m_requested_updates(0),
+    m_merged_updates(0),
+    m_dropped_updates(0),
+    m_processed_updates(0)
+{}
+
+void
+QcMapUpdateScheduler::request_update()
+{
+  m_requested_updates++;
+  if (is_pending())
+    m_merged_updates++;
+  else
+    emit update_requested();
+}
+
+void
+QcMapUpdateScheduler::request_viewport_update()
+{
+  request_update();
+  m_viewport_dirty = true;
+}
+
+void
+QcMapUpdateScheduler::request_layer_update()
+{
+  request_update();
+  m_layer_updates++;
+}
+
+/*! Take the pending update, return false if there is nothing to update.
+ *
+ *  The frame driver must call it once per frame.
+ */
+bool
+QcMapUpdateScheduler::begin_update(bool & viewport_changed)
+{
+  viewport_changed = m_viewport_dirty;
+  if (!is_pending())
+    return false;
+
+  if (m_viewport_dirty)
+    m_dropped_updates += m_layer_updates;
+  m_viewport_dirty = false;
+  m_layer_updates = 0;
+  m_processed_updates++;
+
+  // qInfo() << "updates requested" << m_requested_updates
+  //         << "merged" << m_merged_updates
+  //         << "dropped" << m_dropped_updates
+  //         << "processed" << m_processed_updates;
+
+  return true;
+}
+
+void
+QcMapUpdateScheduler::reset_statistics()
+{
+  m_requested_updates = 0;
+  m_merged_updates = 0;
+  m_dropped_updates = 0;
+  m_processed_updates = 0;
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,103 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __MAP_UPDATE_SCHEDULER_H__
+#define __MAP_UPDATE_SCHEDULER_H__
+
+/**************************************************************************************************/
+
+#include <QObject>
+
+#include "qtcarto_global.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* Coalesce the updates of a map view to at most one per frame.
+ *
+ * Viewport changes and layer changes mark the map dirty.  The first mark
+ * emits update_requested, the next ones are merged into the pending update
+ * until the frame driver processes it with begin_update.  A viewport update
+ * rebuilds all the layers, thus it supersedes the pending layer updates,
+ * which are counted as dropped.  A layer update only requires to update
+ * the scene graph, where the layer scenes track which of them are dirty.
+ */
+class QC_EXPORT QcMapUpdateScheduler : public QObject
+{
+  Q_OBJECT
+
+public:
+  QcMapUpdateScheduler(QObject * parent = nullptr);
+
+  bool is_pending() const { return m_viewport_dirty || m_layer_updates; }
+
+  void request_viewport_update();
+  void request_layer_update();
+
+  bool begin_update(bool & viewport_changed);
+
+  // Statistics
+  int requested_updates() const { return m_requested_updates; }
+  int merged_updates() const { return m_merged_updates; }
+  int dropped_updates() const { return m_dropped_updates; }
+  int processed_updates() const { return m_processed_updates; }
+  void reset_statistics();
+
+signals:
+  void update_requested();
+
+private:
+  void request_update();
+
+private:
+  bool m_viewport_dirty;
+  int m_layer_updates; // pending
+  int m_requested_updates;
+  int m_merged_updates;
+  int m_dropped_updates;
+  int m_processed_updates;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __MAP_UPDATE_SCHEDULER_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
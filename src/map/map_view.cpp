@@ -36,12 +36,15 @@
 
 // QC_BEGIN_NAMESPACE
 
-QcMapViewLayer::QcMapViewLayer(const QcWmtsPluginLayer * plugin_layer, QcViewport * viewport, QcMapLayerScene * layer_scene)
+QcMapViewLayer::QcMapViewLayer(const QcWmtsPluginLayer * plugin_layer, QcTileVisibility * visibility,
+                               QcMapLayerScene * layer_scene)
   : QObject(),
     m_plugin_layer(plugin_layer),
-    m_viewport(viewport),
+    m_visibility(visibility),
     m_layer_scene(layer_scene),
-    m_request_manager(new QcWmtsRequestManager(this, plugin()->wmts_manager()))
+    m_request_manager(new QcWmtsRequestManager(this, plugin()->wmts_manager())),
+    m_zoom_level(-1),
+    m_coverage_serial(-1)
 {}
 
 QcMapViewLayer::~QcMapViewLayer()
@@ -63,130 +66,190 @@ QcMapViewLayer::set_opacity(float opacity)
 }
 
 /*! Slot to add a tile to the layer scene
+ *
+ *  A tile of another level, e.g. a prefetched tile, can be drawn in place
+ *  of the visible tiles which are not yet loaded.
  */
 void
 QcMapViewLayer::update_tile(const QcTileSpec & tile_spec)
 {
   // qInfo() << tile_spec;
-  if (m_visible_tiles.contains(tile_spec)) {
+  if (m_layer_scene->visible_tiles().contains(tile_spec.key())) {
     QSharedPointer<QcTileTexture> texture = m_request_manager->tile_texture(tile_spec);
     if (!texture.isNull()) {
       m_layer_scene->add_tile(tile_spec, texture);
-      emit scene_graph_changed();
+      emit scene_graph_changed(); // scheduled by the map view
     }
-  }
-}
-
-//! Transform the polygon to the tile referential
-QcPolygon
-QcMapViewLayer::transform_polygon(const QcPolygon & polygon) // Fixme: const
-{
-  const QcTileMatrixSet & tile_matrix_set = plugin()->tile_matrix_set();
-  QcPolygon transformed_polygon;
-  QList<QcVectorDouble> vertexes;
-  for (const auto & vertex : polygon.vertexes()) {
-    // Fixme: [before in viewport] -1 else take tile on border
-    auto transformed_vertex = (vertex - tile_matrix_set.origin()) * tile_matrix_set.scale();
-    vertexes << transformed_vertex;
-    // transformed_polygon.add_vertex(transformed_vertex);
-  }
-  // Fixme: inverted y
-  transformed_polygon.add_vertex(vertexes[1]);
-  transformed_polygon.add_vertex(vertexes[0]);
-  transformed_polygon.add_vertex(vertexes[3]);
-  transformed_polygon.add_vertex(vertexes[2]);
-  return transformed_polygon;
+  } else if (tile_spec.level() != m_zoom_level)
+    update_placeholders();
 }
 
-QcTileSpecSet
-QcMapViewLayer::intersec_polygon_with_grid(const QcPolygon & polygon, double tile_length_m, int zoom_level)
+//! Return the keys of the tiles of the runs, the runs are clipped to the tile matrix
+QcTileKeySet
+QcMapViewLayer::run_tile_keys(const QcTiledPolygonRunList & runs, int zoom_level) const
 {
-  QcTileSpecSet visible_tiles;
-  QcTiledPolygon tiled_polygon = transform_polygon(polygon).intersec_with_grid(tile_length_m);
+  QcTileKeySet tile_keys;
   int number_of_tiles = 1 << zoom_level; // Fixme: cf. tile_matrix_set
   QcIntervalInt valid_interval(0, number_of_tiles -1);
-  for (const QcTiledPolygonRun & run: tiled_polygon.runs()) {
-    QcIntervalInt run_interval = run.interval(); // const &
+  for (const QcTiledPolygonRun & run : runs) {
     int y = run.y();
-    // qInfo() << "Run " << run.y() << " [" << run_interval.inf() << ", " << run_interval.sup() << "]";
-    if (!valid_interval.contains(y)) {
-      // It arises at large zoom, when the item eight is larger than the map.
-      // qWarning() << "Tile columns is out of range" << y;
-      y = qMax(qMin(y, number_of_tiles -1), 0); // Fixme: to func
-    }
+    // It arises at large zoom, when the item height is larger than the map.
+    // The rows outside the map are dropped, the border rows are in the polygon.
+    if (!valid_interval.contains(y))
+      continue;
     // It arises when the polygon vertexes are at the border
-    if (run_interval.sup() >= number_of_tiles)
-      run_interval.set_sup(valid_interval.sup());
-    // if (!run_interval.is_included_in(valid_interval)) {
-    //   // qWarning() << "Tile row is out of range" << run_interval;
-    //   run_interval &= valid_interval;
-    // }
+    QcIntervalInt run_interval = run.interval() & valid_interval;
+    if (run_interval.is_empty())
+      continue;
     for (int x = run_interval.inf(); x <= run_interval.sup(); x++)
-      visible_tiles.insert(m_plugin_layer->create_tile_spec(zoom_level, x, y));
+      tile_keys.insert(m_plugin_layer->create_tile_key(zoom_level, x, y));
   }
-  return visible_tiles;
+  return tile_keys;
 }
 
+//! Update the visible tiles of a viewport part from the runs entering and leaving it
 void
-QcMapViewLayer::update_scene()
+QcMapViewLayer::update_part(QcViewportPartKind part, const QcTiledPolygonRunList & new_runs, const QcTiledPolygonRunList & old_runs,
+                            int zoom_level, QcTileKeySet & added_tiles, QcTileKeySet & removed_tiles)
 {
-  // qInfo();
-
-  // Fixme: if layers share the same tile matrix ?
+  QcTileKeySet part_added_tiles = run_tile_keys(new_runs, zoom_level);
+  QcTileKeySet part_removed_tiles = run_tile_keys(old_runs, zoom_level);
 
-  // Compute visible tile set in viewport
+  if (!part_added_tiles.isEmpty() || !part_removed_tiles.isEmpty()) {
+    m_layer_scene->update_visible_tiles(part, part_added_tiles, part_removed_tiles);
+    added_tiles.unite(part_added_tiles);
+    removed_tiles.unite(part_removed_tiles);
+  }
+}
 
-  m_west_visible_tiles.clear();
-  m_central_visible_tiles.clear();
-  m_east_visible_tiles.clear();
-  m_visible_tiles.clear();
+//! Forget the visible tiles, e.g. when the zoom level changes
+void
+QcMapViewLayer::reset_visible_tiles(QcTileKeySet & removed_tiles)
+{
+  removed_tiles.unite(m_layer_scene->visible_tiles());
+  m_layer_scene->clear_visible_tiles();
+}
 
-  if (m_viewport->is_interval_defined()) {
-    // Fixme: Done in map scene !!!
-    QcTileMatrixSet tile_matrix_set = plugin()->tile_matrix_set();
-    int zoom_level = m_viewport->zoom_level();
-    const QcTileMatrix & tile_matrix = tile_matrix_set[zoom_level];
-    double tile_length_m = tile_matrix.tile_length_m();
+/*! Return the cached tiles of the other levels to draw until the tile is loaded.
+ *
+ *  The nearest cached ancestor is scaled up and the cached children are
+ *  drawn over it.  Only the texture tier of the cache is looked up, thus
+ *  no tile is loaded nor decoded.
+ */
+QcTilePlaceholderList
+QcMapViewLayer::find_placeholders(const QcTileKey & tile_key)
+{
+  QcTilePlaceholderList placeholders;
 
-    // Fixme: use if(m_viewport->west_part()) ?
-    if (m_viewport->cross_west_line())
-      m_west_visible_tiles = intersec_polygon_with_grid(m_viewport->west_part().polygon(), tile_length_m, zoom_level);
+  int level = tile_key.level();
+  for (int depth = 1; depth <= max_placeholder_depth && depth <= level; depth++) {
+    QSharedPointer<QcTileTexture> texture = m_request_manager->peek_tile_texture(tile_key.parent(depth));
+    if (!texture.isNull()) {
+      int mask = (1 << depth) - 1;
+      double scale = 1. / (1 << depth);
+      QRectF source_rect((tile_key.x() & mask) * scale, (tile_key.y() & mask) * scale, scale, scale);
+      placeholders << QcTilePlaceholder(texture, source_rect, QRectF(0, 0, 1, 1));
+      break;
+    }
+  }
 
-    m_central_visible_tiles = intersec_polygon_with_grid(m_viewport->central_part().polygon(), tile_length_m, zoom_level);
+  if (level + 1 < plugin()->tile_matrix_set().number_of_levels())
+    for (int i = 0; i < 2; i++)
+      for (int j = 0; j < 2; j++) {
+        QSharedPointer<QcTileTexture> texture = m_request_manager->peek_tile_texture(tile_key.child(i, j));
+        if (!texture.isNull())
+          placeholders << QcTilePlaceholder(texture, QRectF(0, 0, 1, 1), QRectF(i * .5, j * .5, .5, .5));
+      }
 
-    if (m_viewport->cross_east_line())
-      m_east_visible_tiles = intersec_polygon_with_grid(m_viewport->east_part().polygon(), tile_length_m, zoom_level);
+  return placeholders;
+}
 
-    QcTileSpecSet visible_tiles = m_east_visible_tiles + m_central_visible_tiles + m_west_visible_tiles;
-    // qInfo() << "visible west tiles: " << m_west_visible_tiles << '\n'
-    //         << "visible central tiles: " << m_central_visible_tiles << '\n'
-    //         << "visible east tiles: " << m_east_visible_tiles << '\n'
-    //         << "visible tiles: " << visible_tiles << '\n'
-    //         << "new visible tiles: " << visible_tiles - m_visible_tiles;
+//! Look up again the placeholders of the visible tiles which are not yet textured
+void
+QcMapViewLayer::update_placeholders()
+{
+  bool changed = false;
+  const QHash<QcTileKey, QcTilePlaceholderList> & scene_placeholders = m_layer_scene->placeholders();
+  for (const auto & tile_key : m_layer_scene->visible_tiles())
+    if (!m_layer_scene->is_textured(tile_key)) {
+      QcTilePlaceholderList placeholders = find_placeholders(tile_key);
+      if (!placeholders.isEmpty() && placeholders != scene_placeholders.value(tile_key)) {
+        m_layer_scene->set_placeholders(tile_key, placeholders);
+        changed = true;
+      }
+    }
+  if (changed)
+    emit scene_graph_changed();
+}
 
-    // bool new_tiles_introduced = !m_visible_tiles.contains(visible_tiles);
-    m_visible_tiles = visible_tiles;
+/*! Update the visible tiles from the coverage of the viewport.
+ *
+ *  The coverage is shared by the layers having the same tile grid.  During
+ *  a pan, only the tiles on the newly exposed and hidden edges are
+ *  processed, unless the layer missed an update.
+ */
+void
+QcMapViewLayer::update_scene()
+{
+  // qInfo();
 
-    // Fixme: better ?
-    m_layer_scene->set_visible_tiles(m_visible_tiles, m_west_visible_tiles, m_central_visible_tiles, m_east_visible_tiles);
+  QcTileKeySet added_tiles;
+  QcTileKeySet removed_tiles;
+
+  const QcTileCoverage & coverage = m_visibility->coverage(plugin()->tile_matrix_set());
+  static const QcViewportPartKind parts[] = {QcViewportPartKind::West, QcViewportPartKind::Central, QcViewportPartKind::East};
+  if (coverage.is_defined()) {
+    int zoom_level = coverage.zoom_level();
+    if (zoom_level != m_zoom_level || coverage.base_serial() != m_coverage_serial) {
+      reset_visible_tiles(removed_tiles);
+      m_zoom_level = zoom_level;
+      for (auto part : parts)
+        update_part(part, coverage.tiled_polygon(part).runs(), QcTiledPolygonRunList(), zoom_level, added_tiles, removed_tiles);
+    } else {
+      for (auto part : parts) {
+        const QcTiledPolygonDiff & diff = coverage.diff(part);
+        update_part(part, diff.new_area(), diff.old_area(), zoom_level, added_tiles, removed_tiles);
+      }
+    }
+    m_request_manager->update_request_focus(coverage.request_focus());
+    // qInfo() << "new visible tiles: " << added_tiles << '\n'
+    //         << "hidden tiles: " << removed_tiles;
+  } else if (m_zoom_level != -1) {
+    reset_visible_tiles(removed_tiles);
+    m_zoom_level = -1;
+  }
+  m_coverage_serial = coverage.serial();
+
+  // A tile can move from a part to another one
+  const QcTileKeySet & visible_tiles = m_layer_scene->visible_tiles();
+  QcTileSpecSet tiles_to_cancel;
+  for (const auto & tile_key : removed_tiles)
+    if (!visible_tiles.contains(tile_key))
+      tiles_to_cancel.insert(tile_key.to_tile_spec());
+
+  // Don't request tiles that are already built and textured
+  QcTileSpecSet tiles_to_request;
+  for (const auto & tile_key : added_tiles)
+    if (!m_layer_scene->is_textured(tile_key))
+      tiles_to_request.insert(tile_key.to_tile_spec());
+
+  if (!tiles_to_request.isEmpty() || !tiles_to_cancel.isEmpty()) {
+    QList<QSharedPointer<QcTileTexture> > cached_tiles = m_request_manager->update_tile_requests(tiles_to_request,
+                                                                                                tiles_to_cancel);
+    for (const auto & texture : cached_tiles)
+      m_layer_scene->add_tile(texture->tile_spec, texture);
+  }
 
-    // Don't request tiles that are already built and textured
-    QcTileSpecSet tile_to_request = m_visible_tiles - m_layer_scene->textured_tiles();
-    if (!tile_to_request.isEmpty()) {
-        QList<QSharedPointer<QcTileTexture> > cached_tiles = m_request_manager->request_tiles(tile_to_request);
-        for (const auto & texture : cached_tiles)
-          m_layer_scene->add_tile(texture->tile_spec, texture);
-        if (!cached_tiles.isEmpty())
-          emit scene_graph_changed();
+  // Draw the cached tiles of the other levels until the missing tiles are loaded
+  for (const auto & tile_key : added_tiles)
+    if (!m_layer_scene->is_textured(tile_key)) {
+      QcTilePlaceholderList placeholders = find_placeholders(tile_key);
+      if (!placeholders.isEmpty())
+        m_layer_scene->set_placeholders(tile_key, placeholders);
     }
-  } else {
-    // Fixme: code
-    m_layer_scene->set_visible_tiles(m_visible_tiles, m_east_visible_tiles, m_central_visible_tiles, m_west_visible_tiles);
-    emit scene_graph_changed();
- }
 
-  // Fixme: else pan doesn't work
-  emit scene_graph_changed();
+  // The geometry of the tiles depends on the viewport
+  m_layer_scene->set_dirty();
 }
 
 /**************************************************************************************************/
@@ -194,6 +257,9 @@ QcMapViewLayer::update_scene()
 QcMapView::QcMapView()
   : QObject(),
     m_viewport(nullptr), // initialised in ctor
+    m_visibility(nullptr), // initialised in ctor
+    m_scheduler(new QcMapUpdateScheduler(this)),
+    m_prefetcher(nullptr), // initialised in ctor
     m_map_scene(nullptr) // initialised in ctor
 {
   // Fixme: need to pass fake state
@@ -207,11 +273,14 @@ QcMapView::QcMapView()
   // Fixme: cf. add_layer
   m_viewport->set_projection(&QcWebMercatorCoordinate::cls_projection);
 
+  m_visibility = new QcTileVisibility(m_viewport);
+  m_prefetcher = new QcTilePrefetcher(m_viewport, m_scheduler, this);
   m_map_scene = new QcMapScene(m_viewport, m_location_circle_data); // parent
 
-  connect(m_viewport, SIGNAL(viewport_changed()),
-	  this, SLOT(update_scene()),
-	  Qt::QueuedConnection);
+  // Viewport changes are coalesced by the scheduler
+  connect(m_viewport, &QcViewport::viewport_changed,
+          m_scheduler, &QcMapUpdateScheduler::request_viewport_update);
+  set_frame_driven(false);
 }
 
 QcMapView::~QcMapView()
@@ -219,6 +288,7 @@ QcMapView::~QcMapView()
   for (auto * layer : m_layers)
     layer->deleteLater(); // Fixme: delete ?
   delete m_map_scene;
+  delete m_visibility;
   delete m_viewport;
 }
 
@@ -266,13 +336,12 @@ QcMapView::add_layer(const QcWmtsPluginLayer * plugin_layer)
     QString name = plugin_layer->hash_name();
     if (!m_layer_map.contains(name)) {
       QcMapLayerScene * layer_scene = m_map_scene->add_layer(plugin_layer);
-      QcMapViewLayer * layer = new QcMapViewLayer(plugin_layer, m_viewport, layer_scene);
+      QcMapViewLayer * layer = new QcMapViewLayer(plugin_layer, m_visibility, layer_scene);
       m_layers << layer;
       m_layer_map.insert(name, layer);
       update_zoom_level_interval();
-      connect(layer, SIGNAL(scene_graph_changed()),
-              this, SIGNAL(scene_graph_changed()),
-              Qt::QueuedConnection);
+      connect(layer, &QcMapViewLayer::scene_graph_changed,
+              this, &QcMapView::request_layer_update);
     }
   }
 }
@@ -287,8 +356,8 @@ QcMapView::remove_layer(const QcWmtsPluginLayer * plugin_layer)
     QString name = plugin_layer->hash_name();
     m_layer_map.remove(name);
     update_zoom_level_interval();
+    disconnect(layer, &QcMapViewLayer::scene_graph_changed, this, &QcMapView::request_layer_update);
     layer->deleteLater();
-    // Fixme: disconnect scene_graph_changed ?
   }
 }
 
@@ -326,10 +395,62 @@ QcMapView::set_opacity(const QcWmtsPluginLayer * plugin_layer, float opacity)
     layer->set_opacity(opacity);
 }
 
+/*! Select how the pending updates are processed.
+ *
+ *  A frame driver, e.g. the map item, calls process_updates once per frame
+ *  when the scheduler requests an update.  Else the update is processed by
+ *  the event loop, after the pending events which are merged into it.
+ */
+void
+QcMapView::set_frame_driven(bool enabled)
+{
+  disconnect(m_event_loop_connection);
+  if (!enabled)
+    m_event_loop_connection = connect(m_scheduler, &QcMapUpdateScheduler::update_requested,
+                                      this, &QcMapView::process_updates,
+                                      Qt::QueuedConnection);
+}
+
+/*! Prefetch the tiles of the viewport predicted from a gesture.
+ *
+ *  \a velocity is the velocity of the map on the screen in px/s and \a
+ *  zoom_direction the sign of the zoom change.
+ */
+void
+QcMapView::prefetch(const QcVectorDouble & velocity, int zoom_direction)
+{
+  m_prefetcher->prefetch(m_layers, velocity, zoom_direction);
+}
+
+void
+QcMapView::request_layer_update()
+{
+  m_scheduler->request_layer_update();
+}
+
+/*! Process the pending update, return true if the scene graph changed.
+ *
+ *  A viewport change updates the visible tiles of all the layers, a layer
+ *  change, e.g. a received tile, only requires to update the scene graph.
+ */
+bool
+QcMapView::process_updates()
+{
+  bool viewport_changed;
+  if (!m_scheduler->begin_update(viewport_changed))
+    return false;
+
+  if (viewport_changed)
+    update_scene();
+  emit scene_graph_changed();
+  return true;
+}
+
 void
 QcMapView::update_scene()
 {
   // qInfo();
+  m_visibility->begin_update();
   for (auto * layer : m_layers)
     layer->update_scene();
   m_map_scene->set_dirty_path(); // viewport changed thus update vertexes
@@ -37,6 +37,9 @@
 #include <QObject>
 
 #include "map/location_circle_data.h"
+#include "map/map_update_scheduler.h"
+#include "map/tile_prefetcher.h"
+#include "map/tile_visibility.h"
 #include "map/viewport.h"
 #include "qtcarto_global.h"
 #include "scene/map_scene.h"
@@ -60,7 +63,7 @@ class QC_EXPORT QcMapViewLayer : public QObject
   Q_OBJECT
 
  public:
-  QcMapViewLayer(const QcWmtsPluginLayer * plugin_layer, QcViewport * m_viewport, QcMapLayerScene * layer_scene);
+  QcMapViewLayer(const QcWmtsPluginLayer * plugin_layer, QcTileVisibility * visibility, QcMapLayerScene * layer_scene);
   ~QcMapViewLayer();
 
   const QcWmtsPluginLayer * plugin_layer() const { return m_plugin_layer; }
@@ -68,6 +71,7 @@ class QC_EXPORT QcMapViewLayer : public QObject
   int map_id() const { return m_plugin_layer->map_id(); }
 
   QcWmtsRequestManager * request_manager() { return m_request_manager; };
+  const QcTileKeySet & visible_tiles() const { return m_layer_scene->visible_tiles(); }
 
   float opacity() const;
   void set_opacity(float opacity);
@@ -75,24 +79,32 @@ class QC_EXPORT QcMapViewLayer : public QObject
   void update_tile(const QcTileSpec & tile_spec);
   void update_scene();
 
+  // Cached tiles of the other levels drawn until the tile is loaded
+  QcTilePlaceholderList find_placeholders(const QcTileKey & tile_key);
+  void update_placeholders();
+
  signals:
   void scene_graph_changed();
 
  private:
-  QcPolygon transform_polygon(const QcPolygon & polygon); // Fixme: const;
-  QcTileSpecSet intersec_polygon_with_grid(const QcPolygon & polygon, double tile_length_m, int zoom_level);
+  QcTileKeySet run_tile_keys(const QcTiledPolygonRunList & runs, int zoom_level) const;
+  void update_part(QcViewportPartKind part, const QcTiledPolygonRunList & new_runs, const QcTiledPolygonRunList & old_runs,
+                   int zoom_level, QcTileKeySet & added_tiles, QcTileKeySet & removed_tiles);
+  void reset_visible_tiles(QcTileKeySet & removed_tiles);
+
+ private:
+  static const int max_placeholder_depth = 4; // number of levels to search for a cached ancestor
 
  private:
   const QcWmtsPluginLayer * m_plugin_layer;
-  QcViewport * m_viewport;
+  QcTileVisibility * m_visibility;
   QcMapLayerScene * m_layer_scene;
 
   QcWmtsRequestManager * m_request_manager;
 
-  QcTileSpecSet m_west_visible_tiles;
-  QcTileSpecSet m_central_visible_tiles;
-  QcTileSpecSet m_east_visible_tiles;
-  QcTileSpecSet m_visible_tiles;
+  // Zoom level and serial of the last coverage, the visible tiles are updated from the next differences
+  int m_zoom_level;
+  int m_coverage_serial;
 };
 
 // typedef QSet<QcMapViewLayer *> QcMapViewLayerSet;
@@ -108,6 +120,10 @@ class QC_EXPORT QcMapView : public QObject
   ~QcMapView();
 
   QcViewport * viewport() { return m_viewport; };
+  QcMapUpdateScheduler * scheduler() { return m_scheduler; }
+  QcTilePrefetcher * prefetcher() { return m_prefetcher; }
+  void prefetch(const QcVectorDouble & velocity, int zoom_direction);
+  void set_frame_driven(bool enabled);
   const QcProjection & projection() const { return m_viewport->projection(); }
   void set_projection(const QcProjection * projection);
 
@@ -133,14 +149,20 @@ class QC_EXPORT QcMapView : public QObject
   void scene_graph_changed();
 
  public slots:
-  void update_scene();
+  bool process_updates();
 
  private:
+  void update_scene();
+  void request_layer_update();
   QcMapViewLayer * get_layer(const QcWmtsPluginLayer * plugin_layer);
   void update_zoom_level_interval();
 
  private:
   QcViewport * m_viewport;
+  QcTileVisibility * m_visibility;
+  QcMapUpdateScheduler * m_scheduler;
+  QcTilePrefetcher * m_prefetcher;
+  QMetaObject::Connection m_event_loop_connection;
   QcMapScene * m_map_scene;
   QcLocationCircleData m_location_circle_data;
   QList<QcMapViewLayer *> m_layers;
@@ -0,0 +1,261 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_prefetcher.h"
+
+#include <algorithm>
+
+#include <QtMath>
+
+#include "map/map_update_scheduler.h"
+#include "map/map_view.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcTilePrefetcher::QcTilePrefetcher(const QcViewport * viewport, const QcMapUpdateScheduler * scheduler, QObject * parent)
+  : QObject(parent),
+    m_viewport(viewport),
+    m_scheduler(scheduler),
+    m_enabled(true),
+    m_horizon(default_horizon),
+    m_bandwidth_budget(0), // set in ctor
+    m_budget(),
+    m_velocity(),
+    m_zoom_direction(0),
+    m_last_prefetch(),
+    m_warm_queue(),
+    m_idle_timer(),
+    m_prefetched_tiles(0),
+    m_over_budget_tiles(0),
+    m_warmed_tiles(0)
+{
+  set_bandwidth_budget(default_bandwidth_budget);
+  m_idle_timer.setInterval(idle_interval);
+  connect(&m_idle_timer, &QTimer::timeout, this, &QcTilePrefetcher::warm_tiles);
+}
+
+void
+QcTilePrefetcher::set_enabled(bool enabled)
+{
+  m_enabled = enabled;
+  if (!enabled) {
+    m_warm_queue.clear();
+    m_idle_timer.stop();
+  }
+}
+
+/*! Set the budget of the network prefetches in bytes per second, a null
+ *  budget means unlimited.
+ *
+ *  The size of the tiles is only known once they are fetched, thus the
+ *  budget is converted to tiles using an estimated size.  The burst is two
+ *  seconds of budget.
+ */
+void
+QcTilePrefetcher::set_bandwidth_budget(int bandwidth_budget)
+{
+  m_bandwidth_budget = qMax(bandwidth_budget, 0);
+  double rate = double(m_bandwidth_budget) / estimated_tile_size;
+  m_budget.set_rate(rate, 2 * rate);
+}
+
+/*! Prefetch the tiles of the viewport predicted from the motion.
+ *
+ *  \a velocity is the velocity of the map on the screen in px/s, e.g. of
+ *  a flick, and \a zoom_direction the sign of the zoom change of a pinch.
+ *  The prefetches of the previous prediction are canceled.
+ */
+void
+QcTilePrefetcher::prefetch(const QList<QcMapViewLayer *> & layers, const QcVectorDouble & velocity, int zoom_direction)
+{
+  // The same kind of motion was just predicted, e.g. during a pinch
+  if (m_last_prefetch.isValid() && m_last_prefetch.elapsed() < min_interval &&
+      zoom_direction == m_zoom_direction && velocity.is_null() == m_velocity.is_null())
+    return;
+  m_last_prefetch.start();
+  m_velocity = velocity;
+  m_zoom_direction = zoom_direction;
+
+  m_warm_queue.clear();
+  if (!m_enabled || !m_viewport->is_interval_defined()) {
+    for (auto * layer : layers)
+      layer->request_manager()->update_prefetch_requests(QcTileSpecSet());
+    m_idle_timer.stop();
+    return;
+  }
+
+  // Sample the path of the viewport centre every half viewport.
+  // The map follows the fingers, thus the viewport goes the other way,
+  // and the projected y axis is upward.
+  // Fixme: bearing
+  double time = m_horizon / 1000.;
+  QcVectorDouble displacement_px(-velocity.x() * time, velocity.y() * time);
+  double step_px = qMax(qMin(m_viewport->width(), m_viewport->height()) / 2., 1.);
+  int number_of_steps = qBound(1, qCeil(displacement_px.magnitude() / step_px), int(max_path_steps));
+  QcVectorDouble center = m_viewport->projected_center_coordinate();
+  QList<QcVectorDouble> path;
+  for (int i = 1; i <= number_of_steps; i++)
+    path << center + m_viewport->from_px(displacement_px * (double(i) / number_of_steps));
+
+  // A pinch is expected to reach the next level
+  int zoom_level = m_viewport->zoom_level_interval().truncate(m_viewport->zoom_level() + qBound(-1, zoom_direction, 1));
+
+  for (auto * layer : layers)
+    prefetch_layer(layer, path, zoom_level);
+
+  if (m_warm_queue.isEmpty())
+    m_idle_timer.stop();
+  else
+    m_idle_timer.start();
+}
+
+/* Add the tiles of the viewport centred at \a center at the given level,
+ * which are not yet visible.
+ *
+ * Candidates are ranked by \a rank, then by their distance to the centre.
+ */
+void
+QcTilePrefetcher::add_candidates(QcMapViewLayer * layer, const QcVectorDouble & center, int level, int rank,
+                                 QcTileKeySet & seen, QList<Candidate> & candidates) const
+{
+  const QcTileMatrixSet & tile_matrix_set = layer->plugin()->tile_matrix_set();
+  if (level < 0 || level >= tile_matrix_set.number_of_levels())
+    return;
+
+  // Transform the viewport to tile units at this level
+  double tile_length_m = tile_matrix_set[level].tile_length_m();
+  const QcVectorDouble & scale = tile_matrix_set.scale();
+  QcVectorDouble tile_center = (center - tile_matrix_set.origin()) * scale / tile_length_m;
+  QcVectorDouble half_size = m_viewport->area_size_m() * (.5 * qPow(2., int(m_viewport->zoom_level()) - level)) / tile_length_m;
+  double half_width = half_size.x() * qAbs(scale.x());
+  double half_height = half_size.y() * qAbs(scale.y());
+
+  int number_of_tiles = tile_matrix_set[level].mosaic_size();
+  int x_inf = qFloor(tile_center.x() - half_width);
+  int x_sup = qMin(qFloor(tile_center.x() + half_width), x_inf + number_of_tiles - 1);
+  int y_inf = qMax(qFloor(tile_center.y() - half_height), 0);
+  int y_sup = qMin(qFloor(tile_center.y() + half_height), number_of_tiles - 1);
+
+  const QcTileKeySet & visible_tiles = layer->visible_tiles();
+  for (int y = y_inf; y <= y_sup; y++)
+    for (int x = x_inf; x <= x_sup; x++) {
+      // The map wraps around the antimeridian
+      int wrapped_x = ((x % number_of_tiles) + number_of_tiles) % number_of_tiles;
+      QcTileSpec tile_spec = layer->plugin_layer()->create_tile_spec(level, wrapped_x, y);
+      QcTileKey tile_key = tile_spec.key();
+      if (visible_tiles.contains(tile_key) || seen.contains(tile_key))
+        continue;
+      seen.insert(tile_key);
+      double dx = x + .5 - tile_center.x();
+      double dy = y + .5 - tile_center.y();
+      quint64 distance = qMin((dx*dx + dy*dy) * 16., double(0xFFFFFFFF));
+      candidates << Candidate{(quint64(rank) << 32) | distance, tile_spec};
+    }
+}
+
+/* Prefetch the tiles along the path at the zoom level, then the tiles at
+ * the adjacent levels around the end of the path.
+ *
+ * Tiles on disk are queued to be warmed, the other ones are requested
+ * within the budget.
+ */
+void
+QcTilePrefetcher::prefetch_layer(QcMapViewLayer * layer, const QList<QcVectorDouble> & path, int zoom_level)
+{
+  QcTileKeySet seen;
+  QList<Candidate> candidates;
+  int rank = 0;
+  for (const auto & center : path)
+    add_candidates(layer, center, zoom_level, rank++, seen, candidates);
+  // Coarser tiles first, they are also drawn as placeholders, unless the pinch zooms in
+  int adjacent_levels[] = {zoom_level - 1, zoom_level + 1};
+  if (m_zoom_direction > 0)
+    std::swap(adjacent_levels[0], adjacent_levels[1]);
+  for (int level : adjacent_levels)
+    add_candidates(layer, path.last(), level, rank++, seen, candidates);
+  std::sort(candidates.begin(), candidates.end());
+
+  QcWmtsRequestManager * request_manager = layer->request_manager();
+  QcTileSpecSet prefetched_tiles;
+  bool over_budget = false;
+  for (const auto & candidate : candidates) {
+    const QcTileSpec & tile_spec = candidate.tile_spec;
+    if (request_manager->peek_tile_texture(tile_spec.key()))
+      continue; // ready to be drawn
+    if (request_manager->is_tile_cached(tile_spec))
+      m_warm_queue << WarmRequest{layer, tile_spec};
+    else if (request_manager->is_prefetched(tile_spec))
+      prefetched_tiles.insert(tile_spec); // still predicted
+    else if (!over_budget && m_budget.try_acquire()) {
+      prefetched_tiles.insert(tile_spec);
+      m_prefetched_tiles++;
+    } else {
+      over_budget = true;
+      m_over_budget_tiles++;
+    }
+  }
+
+  request_manager->update_prefetch_requests(prefetched_tiles);
+}
+
+/*! Read a batch of tiles on disk into the memory tier.
+ *
+ *  The batch is deferred while an update of the map view is pending.
+ */
+void
+QcTilePrefetcher::warm_tiles()
+{
+  if (m_scheduler->is_pending())
+    return;
+
+  int count = 0;
+  while (!m_warm_queue.isEmpty() && count < warm_batch_size) {
+    WarmRequest request = m_warm_queue.takeFirst();
+    if (!request.layer.isNull() && request.layer->request_manager()->warm_tile(request.tile_spec)) {
+      m_warmed_tiles++;
+      count++;
+    }
+  }
+
+  if (m_warm_queue.isEmpty())
+    m_idle_timer.stop();
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,155 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_PREFETCHER_H__
+#define __TILE_PREFETCHER_H__
+
+/**************************************************************************************************/
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+#include "geometry/vector.h"
+#include "map/viewport.h"
+#include "qtcarto_global.h"
+#include "wmts/tile_spec.h"
+#include "wmts/token_bucket.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+class QcMapUpdateScheduler;
+class QcMapViewLayer;
+
+/**************************************************************************************************/
+
+/* Prefetch the tiles of the viewport predicted from the gestures.
+ *
+ * The viewport is extrapolated from the flick velocity over the horizon,
+ * the tiles along the path are prefetched at the current zoom level and
+ * the tiles around the end at the adjacent zoom levels, the level towards
+ * which a pinch goes first.  The fetcher queues these requests after the
+ * visible tiles.
+ *
+ * New network requests are limited by a bandwidth budget.  Tiles which
+ * are on disk are read into the memory tier when the map view is idle, a
+ * tile is then only decoded when it becomes visible.
+ */
+class QC_EXPORT QcTilePrefetcher : public QObject
+{
+  Q_OBJECT
+
+public:
+  static const int default_horizon = 500; // ms
+  static const int default_bandwidth_budget = 512 * 1024; // bytes/s
+  static const int estimated_tile_size = 20 * 1024; // bytes, a 256 px PNG or JPEG tile
+  static const int max_path_steps = 8;
+  static const int min_interval = 100; // ms between two predictions of the same kind of motion
+  static const int idle_interval = 50; // ms
+  static const int warm_batch_size = 4;
+
+public:
+  QcTilePrefetcher(const QcViewport * viewport, const QcMapUpdateScheduler * scheduler, QObject * parent = nullptr);
+
+  bool is_enabled() const { return m_enabled; }
+  void set_enabled(bool enabled);
+  int horizon() const { return m_horizon; }
+  void set_horizon(int horizon) { m_horizon = qMax(horizon, 0); }
+  int bandwidth_budget() const { return m_bandwidth_budget; }
+  void set_bandwidth_budget(int bandwidth_budget);
+
+  const QcVectorDouble & velocity() const { return m_velocity; } // px/s
+  int zoom_direction() const { return m_zoom_direction; }
+
+  void prefetch(const QList<QcMapViewLayer *> & layers, const QcVectorDouble & velocity, int zoom_direction);
+
+  // Statistics
+  int prefetched_tiles() const { return m_prefetched_tiles; }
+  int over_budget_tiles() const { return m_over_budget_tiles; }
+  int warmed_tiles() const { return m_warmed_tiles; }
+  int pending_warm_tiles() const { return m_warm_queue.size(); }
+
+private slots:
+  void warm_tiles();
+
+private:
+  struct Candidate
+  {
+    quint64 priority;
+    QcTileSpec tile_spec;
+
+    bool operator<(const Candidate & other) const { return priority < other.priority; }
+  };
+
+  struct WarmRequest
+  {
+    QPointer<QcMapViewLayer> layer;
+    QcTileSpec tile_spec;
+  };
+
+private:
+  void add_candidates(QcMapViewLayer * layer, const QcVectorDouble & center, int level, int rank,
+                      QcTileKeySet & seen, QList<Candidate> & candidates) const;
+  void prefetch_layer(QcMapViewLayer * layer, const QList<QcVectorDouble> & path, int zoom_level);
+
+private:
+  const QcViewport * m_viewport;
+  const QcMapUpdateScheduler * m_scheduler;
+  bool m_enabled;
+  int m_horizon;
+  int m_bandwidth_budget;
+  QcTokenBucket m_budget; // in tiles
+  QcVectorDouble m_velocity;
+  int m_zoom_direction;
+  QElapsedTimer m_last_prefetch;
+  QList<WarmRequest> m_warm_queue;
+  QTimer m_idle_timer;
+  int m_prefetched_tiles;
+  int m_over_budget_tiles;
+  int m_warmed_tiles;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __TILE_PREFETCHER_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
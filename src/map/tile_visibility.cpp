@@ -0,0 +1,170 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_visibility.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcTileCoverage::QcTileCoverage()
+  : m_origin(),
+    m_scale(),
+    m_root_resolution(0),
+    m_tile_size(0),
+    m_number_of_levels(0),
+    m_zoom_level(-1),
+    m_serial(-1),
+    m_base_serial(-1),
+    m_request_focus()
+{}
+
+/**************************************************************************************************/
+
+QcTileVisibility::QcTileVisibility(const QcViewport * viewport)
+  : m_viewport(viewport),
+    m_serial(0),
+    m_coverages()
+{}
+
+//! Return the coverage of the tile grid, it is computed at most once per update
+const QcTileCoverage &
+QcTileVisibility::coverage(const QcTileMatrixSet & tile_matrix_set)
+{
+  QcTileCoverage & coverage = find_coverage(tile_matrix_set);
+  if (coverage.m_serial != m_serial)
+    update_coverage(coverage, tile_matrix_set);
+  return coverage;
+}
+
+/* Find the coverage of the tile grid.
+ *
+ * Tile matrix sets are compared by value, since each plugin has its own
+ * instance.
+ */
+QcTileCoverage &
+QcTileVisibility::find_coverage(const QcTileMatrixSet & tile_matrix_set)
+{
+  for (auto & coverage : m_coverages)
+    if (coverage.m_origin == tile_matrix_set.origin() &&
+        coverage.m_scale == tile_matrix_set.scale() &&
+        coverage.m_root_resolution == tile_matrix_set.root_resolution() &&
+        coverage.m_tile_size == tile_matrix_set.tile_size() &&
+        coverage.m_number_of_levels == tile_matrix_set.number_of_levels())
+      return coverage;
+
+  QcTileCoverage coverage;
+  coverage.m_origin = tile_matrix_set.origin();
+  coverage.m_scale = tile_matrix_set.scale();
+  coverage.m_root_resolution = tile_matrix_set.root_resolution();
+  coverage.m_tile_size = tile_matrix_set.tile_size();
+  coverage.m_number_of_levels = tile_matrix_set.number_of_levels();
+  m_coverages << coverage;
+  return m_coverages.last();
+}
+
+//! Transform the polygon to the tile referential
+QcPolygon
+QcTileVisibility::transform_polygon(const QcTileCoverage & coverage, const QcPolygon & polygon) const
+{
+  QcPolygon transformed_polygon;
+  QList<QcVectorDouble> vertexes;
+  for (const auto & vertex : polygon.vertexes()) {
+    // Fixme: [before in viewport] -1 else take tile on border
+    auto transformed_vertex = (vertex - coverage.m_origin) * coverage.m_scale;
+    vertexes << transformed_vertex;
+  }
+  // Fixme: inverted y
+  transformed_polygon.add_vertex(vertexes[1]);
+  transformed_polygon.add_vertex(vertexes[0]);
+  transformed_polygon.add_vertex(vertexes[3]);
+  transformed_polygon.add_vertex(vertexes[2]);
+  return transformed_polygon;
+}
+
+void
+QcTileVisibility::update_coverage(QcTileCoverage & coverage, const QcTileMatrixSet & tile_matrix_set)
+{
+  int zoom_level = m_viewport->zoom_level();
+  bool is_defined = m_viewport->is_interval_defined() && zoom_level < tile_matrix_set.number_of_levels();
+
+  // The difference is only meaningful at the same zoom level
+  if (!is_defined || zoom_level != coverage.m_zoom_level) {
+    for (auto & tiled_polygon : coverage.m_tiled_polygons)
+      tiled_polygon = QcTiledPolygon();
+    coverage.m_base_serial = -1;
+  } else
+    coverage.m_base_serial = coverage.m_serial;
+  coverage.m_serial = m_serial;
+
+  if (!is_defined) {
+    coverage.m_zoom_level = -1;
+    for (auto & diff : coverage.m_diffs)
+      diff = QcTiledPolygonDiff();
+    coverage.m_request_focus = QcTileRequestFocus();
+    return;
+  }
+  coverage.m_zoom_level = zoom_level;
+
+  double tile_length_m = tile_matrix_set[zoom_level].tile_length_m();
+  QcTiledPolygon tiled_polygons[3];
+  // Fixme: use if(m_viewport->west_part()) ?
+  if (m_viewport->cross_west_line())
+    tiled_polygons[int(QcViewportPartKind::West)] =
+      transform_polygon(coverage, m_viewport->west_part().polygon()).intersec_with_grid(tile_length_m);
+  QcPolygon central_polygon = transform_polygon(coverage, m_viewport->central_part().polygon());
+  tiled_polygons[int(QcViewportPartKind::Central)] = central_polygon.intersec_with_grid(tile_length_m);
+  if (m_viewport->cross_east_line())
+    tiled_polygons[int(QcViewportPartKind::East)] =
+      transform_polygon(coverage, m_viewport->east_part().polygon()).intersec_with_grid(tile_length_m);
+
+  for (int i = 0; i < 3; i++) {
+    coverage.m_diffs[i] = tiled_polygons[i].diff(coverage.m_tiled_polygons[i]);
+    coverage.m_tiled_polygons[i] = tiled_polygons[i];
+  }
+
+  // Fetch first the tiles at the centre of the viewport
+  const QcInterval2DDouble & central_interval = central_polygon.interval();
+  coverage.m_request_focus = QcTileRequestFocus(zoom_level,
+                                                central_interval.x().center() / tile_length_m,
+                                                central_interval.y().center() / tile_length_m,
+                                                central_interval.x().inf() / tile_length_m,
+                                                central_interval.x().sup() / tile_length_m);
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
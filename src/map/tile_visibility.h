@@ -0,0 +1,138 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_VISIBILITY_H__
+#define __TILE_VISIBILITY_H__
+
+/**************************************************************************************************/
+
+#include <QList>
+
+#include "geometry/polygon.h"
+#include "map/viewport.h"
+#include "qtcarto_global.h"
+#include "wmts/tile_matrix_set.h"
+#include "wmts/tile_request_queue.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+enum class QcViewportPartKind {
+  West,
+  Central,
+  East
+};
+
+/**************************************************************************************************/
+
+/* Tile coverage of the viewport for a tile grid and a zoom level.
+ *
+ * It holds the tiled polygon of each viewport part and its difference with
+ * the previous update.  The difference is relative to the update numbered
+ * base_serial, a consumer which didn't see this update must rebuild its
+ * tiles from the tiled polygons.
+ */
+class QC_EXPORT QcTileCoverage
+{
+public:
+  QcTileCoverage();
+
+  bool is_defined() const { return m_zoom_level >= 0; }
+  int zoom_level() const { return m_zoom_level; }
+  int serial() const { return m_serial; }
+  int base_serial() const { return m_base_serial; }
+
+  const QcTiledPolygon & tiled_polygon(QcViewportPartKind part) const { return m_tiled_polygons[int(part)]; }
+  const QcTiledPolygonDiff & diff(QcViewportPartKind part) const { return m_diffs[int(part)]; }
+  const QcTileRequestFocus & request_focus() const { return m_request_focus; }
+
+private:
+  friend class QcTileVisibility;
+
+  QcVectorDouble m_origin;
+  QcVectorDouble m_scale;
+  double m_root_resolution;
+  int m_tile_size;
+  int m_number_of_levels;
+
+  int m_zoom_level;
+  int m_serial;
+  int m_base_serial;
+  QcTiledPolygon m_tiled_polygons[3];
+  QcTiledPolygonDiff m_diffs[3];
+  QcTileRequestFocus m_request_focus;
+};
+
+/**************************************************************************************************/
+
+/* Compute the tile coverage of the viewport once per tile grid.
+ *
+ * Layers sharing the same tile grid, e.g. the layers of a provider, share
+ * the rasterisation of the viewport polygons and map the runs to their own
+ * tiles.  The number of levels is part of the grid, since the coverage is
+ * undefined beyond the last level.
+ */
+class QC_EXPORT QcTileVisibility
+{
+public:
+  QcTileVisibility(const QcViewport * viewport);
+
+  void begin_update() { m_serial++; }
+
+  const QcTileCoverage & coverage(const QcTileMatrixSet & tile_matrix_set);
+  int number_of_coverages() const { return m_coverages.size(); }
+
+private:
+  QcTileCoverage & find_coverage(const QcTileMatrixSet & tile_matrix_set);
+  QcPolygon transform_polygon(const QcTileCoverage & coverage, const QcPolygon & polygon) const;
+  void update_coverage(QcTileCoverage & coverage, const QcTileMatrixSet & tile_matrix_set);
+
+private:
+  const QcViewport * m_viewport;
+  int m_serial;
+  QList<QcTileCoverage> m_coverages;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __TILE_VISIBILITY_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -36,9 +36,9 @@
 /**************************************************************************************************/
 
 void
-QcMapSideNode::add_child(const QcTileSpec & tile_spec, QSGSimpleTextureNode * texture_node)
+QcMapSideNode::add_child(const QcTileKey & tile_key, QSGSimpleTextureNode * texture_node)
 {
-  texture_nodes.insert(tile_spec, texture_node);
+  texture_nodes.insert(tile_key, texture_node);
   appendChildNode(texture_node);
 }
 
@@ -64,9 +64,7 @@ QcMapLayerRootNode::QcMapLayerRootNode(const QcTileMatrixSet & tile_matrix_set,
 }
 
 QcMapLayerRootNode::~QcMapLayerRootNode()
-{
-  qDeleteAll(textures);
-}
+{}
 
 void
 QcMapLayerRootNode::update_central_maps()
@@ -92,7 +90,7 @@ QcMapLayerRootNode::update_central_maps()
 void
 QcMapLayerRootNode::update_tiles(QcMapLayerScene * map_scene,
                                  QcMapSideNode * map_side_node,
-                                 const QcTileSpecSet & visible_tiles,
+                                 const QcTileKeySet & visible_tiles,
                                  const QcPolygon & polygon,
                                  const QcViewportPart & part)
 {
@@ -108,9 +106,9 @@ QcMapLayerRootNode::update_tiles(QcMapLayerScene * map_scene,
   map_side_node->setMatrix(space_matrix);
   // qInfo() << "map side space matrix" << space_matrix;
 
-  QcTileSpecSet tiles_in_scene = QcTileSpecSet::fromList(map_side_node->texture_nodes.keys()); // Fixme: cf. textured_tiles
-  QcTileSpecSet to_remove = tiles_in_scene - visible_tiles;
-  QcTileSpecSet to_add = visible_tiles - tiles_in_scene;
+  QcTileKeySet tiles_in_scene = QcTileKeySet::fromList(map_side_node->texture_nodes.keys()); // Fixme: cf. textured_tiles
+  QcTileKeySet to_remove = tiles_in_scene - visible_tiles;
+  QcTileKeySet to_add = visible_tiles - tiles_in_scene;
 
   // qInfo() << "Offset" << x_offset
   //         << "tiles_in_scene" << tiles_in_scene
@@ -118,21 +116,21 @@ QcMapLayerRootNode::update_tiles(QcMapLayerScene * map_scene,
   //         << "\nto_remove" << to_remove
   //         << "\nto_add" << to_add;
 
-  for (const auto & tile_spec : to_remove)
-    delete map_side_node->texture_nodes.take(tile_spec);
+  for (const auto & tile_key : to_remove)
+    delete map_side_node->texture_nodes.take(tile_key);
 
   // Update tile geometries
   // for (auto * texture_node : map_side_node->texture_nodes) {
-  for (QHash<QcTileSpec, QSGSimpleTextureNode *>::iterator it = map_side_node->texture_nodes.begin();
+  for (QHash<QcTileKey, QSGSimpleTextureNode *>::iterator it = map_side_node->texture_nodes.begin();
        it != map_side_node->texture_nodes.end(); ) {
-    const QcTileSpec & tile_spec = it.key();
+    const QcTileKey & tile_key = it.key();
     QSGSimpleTextureNode * texture_node = it.value();
-    // qInfo() << "texture nodes loop" << tile_spec;
+    // qInfo() << "texture nodes loop" << tile_key;
 
     // Compute new geometry
     QSGGeometry visual_geometry(QSGGeometry::defaultAttributes_TexturedPoint2D(), 4);
     QSGGeometry::TexturedPoint2D * vertexes = visual_geometry.vertexDataAsTexturedPoint2D();
-    bool ok = map_scene->build_geometry(tile_spec, vertexes, polygon); // && qgeotiledmapscene_isTileInViewport(v, map_side_node->matrix())
+    bool ok = map_scene->build_geometry(tile_key, vertexes, polygon); // && qgeotiledmapscene_isTileInViewport(v, map_side_node->matrix())
 
     QSGNode::DirtyState dirty_bits = 0;
     // Check and handle changes to vertex data.
@@ -142,7 +140,7 @@ QcMapLayerRootNode::update_tiles(QcMapLayerScene * map_scene,
         ok = false;
       } else {
         // void *memcpy(void *dest, const void *src, int n);
-        // qInfo() << "update geometry" << tile_spec;
+        // qInfo() << "update geometry" << tile_key;
         memcpy(texture_node->geometry()->vertexData(), vertexes, 4 * sizeof(QSGGeometry::TexturedPoint2D));
         dirty_bits |= QSGNode::DirtyGeometry;
       }
@@ -158,23 +156,94 @@ QcMapLayerRootNode::update_tiles(QcMapLayerScene * map_scene,
     }
   }
 
-  for (const auto & tile_spec : to_add) {
+  for (const auto & tile_key : to_add) {
     // Fixme: code !!!
-    QcTileTexture * tile_texture = map_scene->m_tile_textures.value(tile_spec).data(); // Fixme: m_tile_textures public
-    // qInfo() << "texture to add" << tile_spec << tile_texture;
-    if (tile_texture && !tile_texture->image.isNull()) {
-      // qInfo() << "create texture" << tile_spec;
+    QcTileTexture * tile_texture = map_scene->m_tile_textures.value(tile_key).data(); // Fixme: m_tile_textures public
+    QSharedPointer<QcPooledTileTexture> pooled_texture = textures.value(tile_key);
+    // qInfo() << "texture to add" << tile_key << tile_texture;
+    if (tile_texture && !tile_texture->image.isNull() && pooled_texture) {
+      // qInfo() << "create texture" << tile_key;
       QSGSimpleTextureNode * tile_node = new QSGSimpleTextureNode();
       // note: setTexture will update coordinates so do it here, before we buildGeometry
-      tile_node->setTexture(textures.value(tile_spec));
-      if (map_scene->build_geometry(tile_spec, tile_node->geometry()->vertexDataAsTexturedPoint2D(), polygon)) {
+      tile_node->setTexture(pooled_texture->texture);
+      if (map_scene->build_geometry(tile_key, tile_node->geometry()->vertexDataAsTexturedPoint2D(), polygon)) {
         // && qgeotiledmapscene_isTileInViewport(tileNode->geometry()->vertexDataAsTexturedPoint2D(), map_side_node->matrix())
         tile_node->setFiltering(QSGTexture::Linear);
-        map_side_node->add_child(tile_spec, tile_node);
+        map_side_node->add_child(tile_key, tile_node);
       } else
         delete tile_node;
     }
   }
+
+  update_placeholders(map_scene, map_side_node, visible_tiles, polygon);
+}
+
+/*! Draw the placeholders of the visible tiles which are not yet textured.
+ *
+ *  A placeholder is a part of a cached tile of another level, its node is
+ *  removed as soon as the tile is textured.
+ */
+void
+QcMapLayerRootNode::update_placeholders(QcMapLayerScene * map_scene,
+                                        QcMapSideNode * map_side_node,
+                                        const QcTileKeySet & visible_tiles,
+                                        const QcPolygon & polygon)
+{
+  const QHash<QcTileKey, QcTilePlaceholderList> & placeholders = map_scene->placeholders();
+
+  for (auto it = map_side_node->placeholder_nodes.begin(); it != map_side_node->placeholder_nodes.end(); ) {
+    const QcTileKey & tile_key = it.key();
+    if (map_side_node->texture_nodes.contains(tile_key) ||
+        !visible_tiles.contains(tile_key) ||
+        placeholders.value(tile_key).size() != it.value().size()) {
+      qDeleteAll(it.value());
+      it = map_side_node->placeholder_nodes.erase(it);
+    } else
+      it++;
+  }
+
+  for (auto it = placeholders.cbegin(); it != placeholders.cend(); it++) {
+    const QcTileKey & tile_key = it.key();
+    if (map_side_node->texture_nodes.contains(tile_key) || !visible_tiles.contains(tile_key))
+      continue;
+    const QcTilePlaceholderList & tile_placeholders = it.value();
+    // Skip the tile if a texture is not resident, its nodes would be stale
+    QList<QSharedPointer<QcPooledTileTexture> > pooled_textures;
+    for (const auto & placeholder : tile_placeholders) {
+      QSharedPointer<QcPooledTileTexture> pooled_texture =
+        placeholder_textures.value(placeholder.texture->tile_spec.key());
+      if (!pooled_texture)
+        break;
+      pooled_textures << pooled_texture;
+    }
+    if (pooled_textures.size() != tile_placeholders.size()) {
+      auto nodes_it = map_side_node->placeholder_nodes.find(tile_key);
+      if (nodes_it != map_side_node->placeholder_nodes.end()) {
+        qDeleteAll(nodes_it.value());
+        map_side_node->placeholder_nodes.erase(nodes_it);
+      }
+      continue;
+    }
+    QList<QSGSimpleTextureNode *> & nodes = map_side_node->placeholder_nodes[tile_key];
+    for (int i = 0; i < tile_placeholders.size(); i++) {
+      const QcTilePlaceholder & placeholder = tile_placeholders[i];
+      const QSharedPointer<QcPooledTileTexture> & pooled_texture = pooled_textures[i];
+      QSGSimpleTextureNode * node;
+      if (i < nodes.size())
+        node = nodes[i];
+      else {
+        node = new QSGSimpleTextureNode();
+        node->setFiltering(QSGTexture::Linear);
+        map_side_node->appendChildNode(node);
+        nodes << node;
+      }
+      if (node->texture() != pooled_texture->texture)
+        node->setTexture(pooled_texture->texture);
+      map_scene->build_geometry(tile_key, node->geometry()->vertexDataAsTexturedPoint2D(), polygon,
+                                placeholder.tile_rect, placeholder.source_rect);
+      node->markDirty(QSGNode::DirtyGeometry);
+    }
+  }
 }
 
 /**************************************************************************************************/
@@ -185,6 +254,7 @@ QcMapLayerScene::QcMapLayerScene(const QcWmtsPluginLayer * plugin_layer, const Q
     m_viewport(viewport),
     m_tile_matrix_set(plugin_layer->plugin()->tile_matrix_set()),
     m_opacity(1.),
+    m_dirty(true),
     m_scene_graph_node(nullptr)
 {
   // qInfo();
@@ -196,46 +266,92 @@ QcMapLayerScene::~QcMapLayerScene()
 void
 QcMapLayerScene::add_tile(const QcTileSpec & tile_spec, QSharedPointer<QcTileTexture> texture)
 {
-  if (m_visible_tiles.contains(tile_spec)) { // Don't add the geometry if it isn't visible
-    m_tile_textures.insert(tile_spec, texture);
+  QcTileKey tile_key = tile_spec.key();
+  if (m_visible_tiles.contains(tile_key)) { // Don't add the geometry if it isn't visible
+    m_tile_textures.insert(tile_key, texture);
+    m_placeholders.remove(tile_key);
+    m_dirty = true;
     // qInfo() << "add_tile" << tile_spec << "inserted";
   }
   // else
   //   qInfo() << "add_tile" << tile_spec << "already there";
 }
 
+QcTileKeySet &
+QcMapLayerScene::part_visible_tiles(QcViewportPartKind part)
+{
+  switch (part) {
+  case QcViewportPartKind::West:
+    return m_west_visible_tiles;
+  case QcViewportPartKind::East:
+    return m_east_visible_tiles;
+  default:
+    return m_central_visible_tiles;
+  }
+}
+
+/*! Update the visible tiles of a viewport part.
+ *
+ * Only the tiles entering and leaving the part are passed, the textures of
+ * the tiles which are no longer visible in any part are released.
+ */
+void
+QcMapLayerScene::update_visible_tiles(QcViewportPartKind part,
+                                      const QcTileKeySet & added_tiles,
+                                      const QcTileKeySet & removed_tiles)
+{
+  QcTileKeySet & visible_tiles = part_visible_tiles(part);
+  m_dirty = true;
+  visible_tiles.subtract(removed_tiles);
+  visible_tiles.unite(added_tiles);
+  m_visible_tiles.unite(added_tiles);
+
+  for (const auto & tile_key : removed_tiles)
+    if (!m_west_visible_tiles.contains(tile_key) &&
+        !m_central_visible_tiles.contains(tile_key) &&
+        !m_east_visible_tiles.contains(tile_key)) {
+      m_visible_tiles.remove(tile_key);
+      m_tile_textures.remove(tile_key);
+      m_placeholders.remove(tile_key);
+    }
+}
+
 void
-QcMapLayerScene::set_visible_tiles(const QcTileSpecSet & tile_specs,
-                                   const QcTileSpecSet & west_tile_specs,
-                                   const QcTileSpecSet & central_tile_specs,
-                                   const QcTileSpecSet & east_tile_specs)
+QcMapLayerScene::clear_visible_tiles()
 {
-  QcTileSpecSet to_remove = m_visible_tiles - tile_specs;
-  if (!to_remove.isEmpty())
-    remove_tiles(to_remove);
-  m_visible_tiles = tile_specs;
-  // Fixme: better ?
-  m_west_visible_tiles = west_tile_specs;
-  m_central_visible_tiles = central_tile_specs;
-  m_east_visible_tiles = east_tile_specs;
+  m_visible_tiles.clear();
+  m_west_visible_tiles.clear();
+  m_central_visible_tiles.clear();
+  m_east_visible_tiles.clear();
+  m_tile_textures.clear();
+  m_placeholders.clear();
+  m_dirty = true;
 }
 
+//! Set the placeholders of a visible tile which is not yet textured
 void
-QcMapLayerScene::remove_tiles(const QcTileSpecSet & old_tiles)
+QcMapLayerScene::set_placeholders(const QcTileKey & tile_key, const QcTilePlaceholderList & placeholders)
 {
-  // qInfo() << old_tiles;
-  for (auto tile_spec : old_tiles)
-    m_tile_textures.remove(tile_spec);
+  if (m_visible_tiles.contains(tile_key) && !m_tile_textures.contains(tile_key) && !placeholders.isEmpty()) {
+    m_placeholders.insert(tile_key, placeholders);
+    m_dirty = true;
+  }
 }
 
-QcTileSpecSet
+QcTileKeySet
 QcMapLayerScene::textured_tiles() const
 {
-  return QcTileSpecSet::fromList(m_tile_textures.keys());
+  return QcTileKeySet::fromList(m_tile_textures.keys());
 }
 
+/*! Build the geometry of a tile.
+ *
+ *  \a tile_rect is the normalised part of the tile to draw and \a
+ *  source_rect the normalised part of the texture.
+ */
 bool
-QcMapLayerScene::build_geometry(const QcTileSpec & tile_spec, QSGGeometry::TexturedPoint2D * vertices, const QcPolygon & polygon)
+QcMapLayerScene::build_geometry(const QcTileKey & tile_key, QSGGeometry::TexturedPoint2D * vertices, const QcPolygon & polygon,
+                                const QRectF & tile_rect, const QRectF & source_rect)
 {
   int tile_size = m_tile_matrix_set.tile_size();
   const QcTileMatrix & tile_matrix = m_tile_matrix_set[m_viewport->zoom_level()];
@@ -250,21 +366,26 @@ QcMapLayerScene::build_geometry(const QcTileSpec & tile_spec, QSGGeometry::Textu
   double y_inf_px = y_inf_m / resolution;
   //double y_sup_px = y_sup_m / resolution;
 
-  double x = tile_spec.x() * tile_size;
-  double y = tile_spec.y() * tile_size;
+  double x = tile_key.x() * tile_size;
+  double y = tile_key.y() * tile_size;
+
+  double x1 = (x - x_inf_px) + tile_rect.x() * tile_size;
+  double y1 = (y - y_inf_px) + tile_rect.y() * tile_size;
+  double x2 = x1 + tile_rect.width() * tile_size;
+  double y2 = y1 + tile_rect.height() * tile_size;
 
-  double x1 = (x - x_inf_px) * 1;
-  double y1 = (y - y_inf_px) * 1;
-  double x2 = x1 + 1.0 * tile_size * 1;
-  double y2 = y1 + 1.0 * tile_size * 1;
+  float u1 = source_rect.left();
+  float v1 = source_rect.top();
+  float u2 = source_rect.right();
+  float v2 = source_rect.bottom();
 
   // Texture coordinate order for veritcal flip of texture
-  vertices[0].set(x1, y1, 0, 0);
-  vertices[1].set(x1, y2, 0, 1);
-  vertices[2].set(x2, y1, 1, 0);
-  vertices[3].set(x2, y2, 1, 1);
+  vertices[0].set(x1, y1, u1, v1);
+  vertices[1].set(x1, y2, u1, v2);
+  vertices[2].set(x2, y1, u2, v1);
+  vertices[3].set(x2, y2, u2, v2);
 
-  // qInfo() << "geometry" << tile_spec << "x" << x1 << x2 << "  y" << y1 << y2;
+  // qInfo() << "geometry" << tile_key << "x" << x1 << x2 << "  y" << y1 << y2;
 
   return true;
 }
@@ -296,28 +417,43 @@ QcMapLayerScene::update_scene_graph(QcMapLayerRootNode * map_root_node, QQuickWi
 
   if (map_root_node->opacity() != m_opacity)
     map_root_node->setOpacity(m_opacity);
-  // dirty
+  m_dirty = false;
 
   // Fixme: duplicated code?
-  QcTileSpecSet textures_in_scene = QcTileSpecSet::fromList(map_root_node->textures.keys()); // cf. textured_tiles
-  QcTileSpecSet to_remove = textures_in_scene - m_visible_tiles;
-  QcTileSpecSet to_add = m_visible_tiles - textures_in_scene;
+  QcTileKeySet textures_in_scene = QcTileKeySet::fromList(map_root_node->textures.keys()); // cf. textured_tiles
+  QcTileKeySet to_remove = textures_in_scene - m_visible_tiles;
+  QcTileKeySet to_add = m_visible_tiles - textures_in_scene;
   // qInfo() << "textures in scene" << textures_in_scene
   //         << "to remove:" << to_remove
   //         << "to add" << to_add;
-  for (const auto & tile_spec : to_remove)
-    map_root_node->textures.take(tile_spec)->deleteLater();
-  for (const auto & tile_spec : to_add) {
-    QcTileTexture * tile_texture = m_tile_textures.value(tile_spec).data();
+  // The textures stay resident in the pool, they are uploaded again only if they were evicted
+  QcTileTexturePool * texture_pool = QcTileTexturePool::instance(window);
+  for (const auto & tile_key : to_remove)
+    map_root_node->textures.remove(tile_key);
+  for (const auto & tile_key : to_add) {
+    QcTileTexture * tile_texture = m_tile_textures.value(tile_key).data();
     if (tile_texture && !tile_texture->image.isNull()) {
-      // qInfo() << "create texture from image" << tile_spec;
-      QSGTexture * texture = window->createTextureFromImage(tile_texture->image);
-      map_root_node->textures.insert(tile_spec, texture);
+      // qInfo() << "acquire texture" << tile_key;
+      map_root_node->textures.insert(tile_key, texture_pool->acquire(tile_key, tile_texture->image));
     }
   }
 
-  const QcTileMatrix & tile_matrix = m_tile_matrix_set[m_viewport->zoom_level()];
-  // double resolution = tile_matrix.resolution(); // [m/px]
+  // Keep resident the textures of the placeholders
+  QSet<QcTileKey> placeholder_sources;
+  for (const auto & placeholders : m_placeholders)
+    for (const auto & placeholder : placeholders) {
+      QcTileKey source_key = placeholder.texture->tile_spec.key();
+      placeholder_sources.insert(source_key);
+      if (!map_root_node->placeholder_textures.contains(source_key))
+        map_root_node->placeholder_textures.insert(source_key,
+                                                   texture_pool->acquire(source_key, placeholder.texture->image));
+    }
+  for (auto it = map_root_node->placeholder_textures.begin(); it != map_root_node->placeholder_textures.end(); ) {
+    if (placeholder_sources.contains(it.key()))
+      it++;
+    else
+      it = map_root_node->placeholder_textures.erase(it);
+  }
 
   // Fixme: should be called when west_part is true
   // when we cross west line
@@ -142,9 +142,11 @@ QcMapScene::update_scene_graph(QSGNode * old_node, QQuickWindow * window)
   for (auto * layer : m_layers) {
     QcMapLayerRootNode * layer_node = nullptr;
     QString name = layer->name();
-    if (map_root_node->layers.contains(name))
+    if (map_root_node->layers.contains(name)) {
       layer_node = map_root_node->layers[name];
-    else {
+      if (!layer->is_dirty())
+        continue;
+    } else {
       layer_node = layer->make_node();
       map_root_node->layers.insert(name, layer_node);
       map_root_node->root->insertChildNodeBefore(layer_node, map_root_node->location_circle_node);
@@ -36,6 +36,7 @@
 #include "cache/file_tile_cache.h"
 #include "map/decorated_path.h"
 #include "map/location_circle_data.h"
+#include "map/tile_visibility.h"
 #include "map/viewport.h"
 #include "wmts/tile_matrix_set.h"
 #include "wmts/tile_spec.h"
@@ -43,6 +44,7 @@
 
 #include <QHash>
 #include <QObject>
+#include <QRectF>
 #include <QQuickWindow>
 #include <QSGNode>
 #include <QString>
@@ -65,6 +67,31 @@ class QcMapLayerRootNode;
 
 /**************************************************************************************************/
 
+/* Part of a cached tile of another level drawn in place of a missing tile.
+ *
+ * The rectangles are normalised, source_rect is the part of the texture
+ * and tile_rect the part of the missing tile it covers.
+ */
+class QcTilePlaceholder
+{
+public:
+  QcTilePlaceholder(const QSharedPointer<QcTileTexture> & texture, const QRectF & source_rect, const QRectF & tile_rect)
+    : texture(texture), source_rect(source_rect), tile_rect(tile_rect)
+  {}
+
+  bool operator==(const QcTilePlaceholder & other) const {
+    return texture == other.texture && source_rect == other.source_rect && tile_rect == other.tile_rect;
+  }
+
+  QSharedPointer<QcTileTexture> texture;
+  QRectF source_rect;
+  QRectF tile_rect;
+};
+
+typedef QList<QcTilePlaceholder> QcTilePlaceholderList;
+
+/**************************************************************************************************/
+
 class QcMapLayerScene : public QObject
 {
   Q_OBJECT
@@ -80,30 +107,40 @@ public:
   float height() { return m_viewport->height(); }
 
   float opacity() const { return m_opacity; };
-  void set_opacity(float opacity) { m_opacity = opacity; };
+  void set_opacity(float opacity) { m_opacity = opacity; m_dirty = true; };
+
+  // The scene graph of a layer is only updated when the layer is dirty
+  bool is_dirty() const { return m_dirty; }
+  void set_dirty() { m_dirty = true; }
 
   void add_tile(const QcTileSpec & tile_spec, QSharedPointer<QcTileTexture> texture);
 
-  void set_visible_tiles(const QcTileSpecSet & tile_specs,
-                         const QcTileSpecSet & west_tile_specs,
-                         const QcTileSpecSet & central_tile_specs,
-                         const QcTileSpecSet & east_tile_specs);
-  const QcTileSpecSet & visible_tiles() const { return m_visible_tiles; };
-  QcTileSpecSet textured_tiles() const;
+  void update_visible_tiles(QcViewportPartKind part,
+                            const QcTileKeySet & added_tiles,
+                            const QcTileKeySet & removed_tiles);
+  void clear_visible_tiles();
+  const QcTileKeySet & visible_tiles() const { return m_visible_tiles; };
+  QcTileKeySet textured_tiles() const;
+  bool is_textured(const QcTileKey & tile_key) const { return m_tile_textures.contains(tile_key); }
+
+  void set_placeholders(const QcTileKey & tile_key, const QcTilePlaceholderList & placeholders);
+  const QHash<QcTileKey, QcTilePlaceholderList> & placeholders() const { return m_placeholders; }
 
   QcMapLayerRootNode * make_node();
   void update_scene_graph(QcMapLayerRootNode * map_root_node, QQuickWindow * window);
   QcPolygon transform_polygon(const QcPolygon & polygon) const;
-  bool build_geometry(const QcTileSpec & tile_spec, QSGGeometry::TexturedPoint2D * vertices, const QcPolygon & polygon);
+  bool build_geometry(const QcTileKey & tile_key, QSGGeometry::TexturedPoint2D * vertices, const QcPolygon & polygon,
+                      const QRectF & tile_rect = QRectF(0, 0, 1, 1), const QRectF & source_rect = QRectF(0, 0, 1, 1));
 
   // Fixme: protected
   QcMapLayerRootNode * scene_graph_node() { return m_scene_graph_node; }
 
 private:
-  void remove_tiles(const QcTileSpecSet & old_tiles);
+  QcTileKeySet & part_visible_tiles(QcViewportPartKind part);
 
 public:
-  QHash<QcTileSpec, QSharedPointer<QcTileTexture> > m_tile_textures;
+  QHash<QcTileKey, QSharedPointer<QcTileTexture> > m_tile_textures;
+  QHash<QcTileKey, QcTilePlaceholderList> m_placeholders; // of the visible tiles without texture
 
 private:
   const QcWmtsPluginLayer * m_plugin_layer;
@@ -111,12 +148,13 @@ private:
 
   const QcTileMatrixSet & m_tile_matrix_set;
 
-  QcTileSpecSet m_visible_tiles;
-  QcTileSpecSet m_west_visible_tiles;
-  QcTileSpecSet m_central_visible_tiles;
-  QcTileSpecSet m_east_visible_tiles;
+  QcTileKeySet m_visible_tiles;
+  QcTileKeySet m_west_visible_tiles;
+  QcTileKeySet m_central_visible_tiles;
+  QcTileKeySet m_east_visible_tiles;
 
   float m_opacity;
+  bool m_dirty;
 
   QcMapLayerRootNode * m_scene_graph_node;
 };
@@ -35,6 +35,7 @@
 
 #include "location_circle_node.h"
 #include "path_node.h"
+#include "tile_texture_pool.h"
 
 /**************************************************************************************************/
 
@@ -45,9 +46,10 @@
 class QcMapSideNode : public QSGTransformNode
 {
 public:
-  void add_child(const QcTileSpec & tile_spec, QSGSimpleTextureNode * node);
+  void add_child(const QcTileKey & tile_key, QSGSimpleTextureNode * node);
 
-  QHash<QcTileSpec, QSGSimpleTextureNode *> texture_nodes;
+  QHash<QcTileKey, QSGSimpleTextureNode *> texture_nodes;
+  QHash<QcTileKey, QList<QSGSimpleTextureNode *> > placeholder_nodes; // drawn until the tile is textured
 };
 
 /**************************************************************************************************/
@@ -60,8 +62,10 @@ public:
 
   void update_central_maps();
   void update_tiles(QcMapLayerScene * map_scene,
-                    QcMapSideNode * map_side_node, const QcTileSpecSet & visible_tiles, const QcPolygon & polygon,
+                    QcMapSideNode * map_side_node, const QcTileKeySet & visible_tiles, const QcPolygon & polygon,
                     const QcViewportPart & part);
+  void update_placeholders(QcMapLayerScene * map_scene,
+                           QcMapSideNode * map_side_node, const QcTileKeySet & visible_tiles, const QcPolygon & polygon);
 
 private:
   const QcTileMatrixSet & m_tile_matrix_set;
@@ -73,7 +77,8 @@ public:
   QcMapSideNode * central_map_node;
   QcMapSideNode * east_map_node;
   QList<QcMapSideNode *> central_map_nodes;
-  QHash<QcTileSpec, QSGTexture *> textures;
+  QHash<QcTileKey, QSharedPointer<QcPooledTileTexture> > textures; // resident in the window texture pool
+  QHash<QcTileKey, QSharedPointer<QcPooledTileTexture> > placeholder_textures; // keyed by the tile of the texture
 };
 
 /**************************************************************************************************/
@@ -0,0 +1,273 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_texture_pool.h"
+#include "cache/tile_image.h"
+
+#include <QMutexLocker>
+#include <QOpenGLContext>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+QcTileSGTexture::QcTileSGTexture()
+  : QSGTexture(),
+    m_texture_id(0),
+    m_image(),
+    m_image_size(),
+    m_image_format(QImage::Format_Invalid),
+    m_texture_size(),
+    m_texture_format(QImage::Format_Invalid),
+    m_image_key(0),
+    m_has_alpha(false),
+    m_dirty(false),
+    m_dirty_options(true)
+{}
+
+QcTileSGTexture::~QcTileSGTexture()
+{
+  // The context is gone if the scene graph was invalidated first
+  if (m_texture_id && QOpenGLContext::currentContext())
+    QOpenGLContext::currentContext()->functions()->glDeleteTextures(1, &m_texture_id);
+}
+
+void
+QcTileSGTexture::set_image(const QImage & image)
+{
+  if (image.format() == TILE_TEXTURE_FORMAT || image.format() == OPAQUE_TILE_TEXTURE_FORMAT)
+    m_image = image;
+  else
+    m_image = image.convertToFormat(TILE_TEXTURE_FORMAT); // a tile which wasn't decoded by the cache
+  m_image_size = image.size();
+  m_image_format = m_image.format();
+  m_image_key = image.cacheKey();
+  m_has_alpha = image.hasAlphaChannel();
+  m_dirty = true;
+}
+
+void
+QcTileSGTexture::create_texture() const
+{
+  QcTileSGTexture * me = const_cast<QcTileSGTexture *>(this);
+  me->initializeOpenGLFunctions();
+  me->glGenTextures(1, &m_texture_id);
+}
+
+int
+QcTileSGTexture::textureId() const
+{
+  if (!m_texture_id)
+    create_texture();
+  return m_texture_id;
+}
+
+void
+QcTileSGTexture::bind()
+{
+  if (!m_texture_id)
+    create_texture();
+
+  glBindTexture(GL_TEXTURE_2D, m_texture_id);
+  updateBindOptions(m_dirty_options);
+  m_dirty_options = false;
+
+  if (m_dirty && !m_image.isNull()) {
+    int width = m_image.width();
+    int height = m_image.height();
+    // QImage scan lines are 32-bit aligned as the default GL_UNPACK_ALIGNMENT
+    GLenum format = GL_RGBA;
+    GLenum type = GL_UNSIGNED_BYTE;
+    if (m_image_format == OPAQUE_TILE_TEXTURE_FORMAT) {
+      // The GPU samples RGB565 natively, the texture keeps half the VRAM
+      format = GL_RGB;
+      type = GL_UNSIGNED_SHORT_5_6_5;
+    }
+    if (m_texture_size == m_image.size() && m_texture_format == m_image_format)
+      // Recycled texture: reuse the storage
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, m_image.constBits());
+    else {
+      glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, type, m_image.constBits());
+      m_texture_size = m_image.size();
+      m_texture_format = m_image_format;
+    }
+    m_image = QImage(); // the texture cache holds the image
+    m_dirty = false;
+  }
+}
+
+/**************************************************************************************************/
+
+QcPooledTileTexture::~QcPooledTileTexture()
+{
+  if (pool)
+    pool->recycle(texture);
+  else
+    delete texture;
+}
+
+/**************************************************************************************************/
+
+void
+QcTileTexturePoolEvictionPolicy::about_to_be_removed(const QcTileKey & key, QSharedPointer<QcPooledTileTexture> obj)
+{
+  Q_UNUSED(key);
+  // the pool is cleared, delete the texture when it is released
+  obj->pool = nullptr;
+}
+
+void
+QcTileTexturePoolEvictionPolicy::about_to_be_evicted(const QcTileKey & key, QSharedPointer<QcPooledTileTexture> obj)
+{
+  Q_UNUSED(key);
+  Q_UNUSED(obj);
+  // keep the pool so as to recycle the texture
+}
+
+/**************************************************************************************************/
+
+int QcTileTexturePool::default_budget = 64 * 1024 * 1024; // 256 tiles of 256x256 RGBA
+int QcTileTexturePool::max_recycled_textures = 64;
+
+QMutex QcTileTexturePool::m_instance_mutex;
+QHash<QQuickWindow *, QcTileTexturePool *> QcTileTexturePool::m_instances;
+
+QcTileTexturePool *
+QcTileTexturePool::instance(QQuickWindow * window)
+{
+  QMutexLocker locker(&m_instance_mutex);
+  QcTileTexturePool * pool = m_instances.value(window);
+  if (!pool) {
+    pool = new QcTileTexturePool(window);
+    m_instances.insert(window, pool);
+  }
+  return pool;
+}
+
+QcTileTexturePool::QcTileTexturePool(QQuickWindow * window)
+  : QObject(),
+    m_window(window),
+    m_textures(default_budget),
+    m_free_textures(),
+    m_number_of_uploads(0),
+    m_number_of_recycled(0),
+    m_number_of_reused(0)
+{
+  // Emitted on the render thread while the context is current
+  connect(window, &QQuickWindow::sceneGraphInvalidated,
+          this, &QcTileTexturePool::release,
+          Qt::DirectConnection);
+}
+
+QcTileTexturePool::~QcTileTexturePool()
+{
+  {
+    QMutexLocker locker(&m_instance_mutex);
+    m_instances.remove(m_window);
+  }
+  m_textures.clear();
+  qDeleteAll(m_free_textures);
+}
+
+void
+QcTileTexturePool::release()
+{
+  // qInfo() << "uploads" << m_number_of_uploads << "recycled" << m_number_of_recycled << "reused" << m_number_of_reused;
+  delete this;
+}
+
+void
+QcTileTexturePool::set_budget(int budget)
+{
+  m_textures.set_max_cost(budget);
+}
+
+QSharedPointer<QcPooledTileTexture>
+QcTileTexturePool::acquire(const QcTileKey & tile_key, const QImage & image)
+{
+  QSharedPointer<QcPooledTileTexture> pooled_texture = m_textures.object(tile_key);
+  if (pooled_texture) {
+    if (pooled_texture->texture->image_key() == image.cacheKey()) {
+      m_number_of_reused++;
+      return pooled_texture;
+    }
+    // The tile was updated
+    pooled_texture->texture->set_image(image);
+    m_number_of_uploads++;
+    return pooled_texture;
+  }
+
+  QcTileSGTexture * texture = take_free_texture(image);
+  if (texture)
+    m_number_of_recycled++;
+  else
+    texture = new QcTileSGTexture();
+  texture->set_image(image);
+  texture->setFiltering(QSGTexture::Linear);
+  m_number_of_uploads++;
+
+  pooled_texture = QSharedPointer<QcPooledTileTexture>(new QcPooledTileTexture);
+  pooled_texture->tile_key = tile_key;
+  pooled_texture->texture = texture;
+  pooled_texture->pool = this;
+  int cost = image.width() * image.height() * (image.format() == OPAQUE_TILE_TEXTURE_FORMAT ? 2 : 4);
+  m_textures.insert(tile_key, pooled_texture, cost);
+
+  return pooled_texture;
+}
+
+void
+QcTileTexturePool::recycle(QcTileSGTexture * texture)
+{
+  if (m_free_textures.size() < max_recycled_textures)
+    m_free_textures << texture;
+  else
+    delete texture;
+}
+
+QcTileSGTexture *
+QcTileTexturePool::take_free_texture(const QImage & image)
+{
+  // A tile which wasn't decoded by the cache is converted to TILE_TEXTURE_FORMAT
+  QImage::Format format = image.format() == OPAQUE_TILE_TEXTURE_FORMAT ? OPAQUE_TILE_TEXTURE_FORMAT : TILE_TEXTURE_FORMAT;
+  for (int i = 0; i < m_free_textures.size(); i++)
+    if (m_free_textures[i]->textureSize() == image.size() &&
+        m_free_textures[i]->image_format() == format)
+      return m_free_textures.takeAt(i);
+  return nullptr;
+}
+
+// QC_END_NAMESPACE
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,194 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_TEXTURE_POOL_H__
+#define __TILE_TEXTURE_POOL_H__
+
+/**************************************************************************************************/
+
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QOpenGLFunctions>
+#include <QPointer>
+#include <QQuickWindow>
+#include <QSGTexture>
+#include <QSharedPointer>
+
+#include "cache/cache3q.h"
+#include "wmts/tile_key.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+class QcTileTexturePool;
+
+/**************************************************************************************************/
+
+/* Scene graph texture for a tile image.
+ *
+ * The image is expected in TILE_TEXTURE_FORMAT or OPAQUE_TILE_TEXTURE_FORMAT
+ * and is uploaded without conversion.  A texture can be recycled for
+ * another image of the same size and format, the storage is then updated
+ * in place by glTexSubImage2D.
+ *
+ * Must be used on the render thread.
+ */
+class QcTileSGTexture : public QSGTexture, protected QOpenGLFunctions
+{
+  Q_OBJECT
+
+public:
+  QcTileSGTexture();
+  ~QcTileSGTexture();
+
+  void set_image(const QImage & image);
+  qint64 image_key() const { return m_image_key; }
+  QImage::Format image_format() const { return m_image_format; }
+
+  int textureId() const override;
+  QSize textureSize() const override { return m_image_size; }
+  bool hasAlphaChannel() const override { return m_has_alpha; }
+  bool hasMipmaps() const override { return false; }
+  void bind() override;
+
+private:
+  void create_texture() const;
+
+private:
+  mutable GLuint m_texture_id;
+  QImage m_image; // pending upload
+  QSize m_image_size;
+  QImage::Format m_image_format;
+  QSize m_texture_size; // size of the allocated storage
+  QImage::Format m_texture_format; // format of the allocated storage
+  qint64 m_image_key;
+  bool m_has_alpha;
+  bool m_dirty;
+  bool m_dirty_options;
+};
+
+/**************************************************************************************************/
+
+// Texture resident in the pool, it is recycled when the last reference is dropped
+class QcPooledTileTexture
+{
+public:
+  ~QcPooledTileTexture();
+
+  QcTileKey tile_key;
+  QcTileSGTexture * texture;
+  QPointer<QcTileTexturePool> pool;
+};
+
+/**************************************************************************************************/
+
+// Don't recycle the textures when the pool is cleared
+class QcTileTexturePoolEvictionPolicy : public QcCache3QDefaultEvictionPolicy<QcTileKey, QcPooledTileTexture>
+{
+protected:
+  void about_to_be_removed(const QcTileKey & key, QSharedPointer<QcPooledTileTexture> obj);
+  void about_to_be_evicted(const QcTileKey & key, QSharedPointer<QcPooledTileTexture> obj);
+};
+
+/**************************************************************************************************/
+
+/* Per window pool of tile textures.
+ *
+ * Textures stay resident while they fit in the VRAM budget, so a tile
+ * which leaves then reenters the viewport is not uploaded again.
+ * Textures which are evicted and no longer referenced by a node are
+ * kept in a free list to be recycled for the next uploads.
+ *
+ * The pool lives on the render thread of its window and is deleted when
+ * the scene graph is invalidated.
+ */
+class QcTileTexturePool : public QObject
+{
+  Q_OBJECT
+
+public:
+  static QcTileTexturePool * instance(QQuickWindow * window);
+
+  static int default_budget; // bytes
+  static int max_recycled_textures;
+
+public:
+  QcTileTexturePool(QQuickWindow * window);
+  ~QcTileTexturePool();
+
+  QSharedPointer<QcPooledTileTexture> acquire(const QcTileKey & tile_key, const QImage & image);
+
+  void set_budget(int budget);
+  int budget() const { return m_textures.max_cost(); }
+  int usage() const { return m_textures.total_cost(); }
+  int size() const { return m_textures.size(); }
+
+  // Statistics
+  int number_of_uploads() const { return m_number_of_uploads; }
+  int number_of_recycled() const { return m_number_of_recycled; }
+  int number_of_reused() const { return m_number_of_reused; }
+  int number_of_free_textures() const { return m_free_textures.size(); }
+
+  void recycle(QcTileSGTexture * texture);
+
+private slots:
+  void release();
+
+private:
+  QcTileSGTexture * take_free_texture(const QImage & image);
+
+private:
+  static QMutex m_instance_mutex;
+  static QHash<QQuickWindow *, QcTileTexturePool *> m_instances;
+
+  QQuickWindow * m_window;
+  QcCache3Q<QcTileKey, QcPooledTileTexture, QcTileTexturePoolEvictionPolicy> m_textures;
+  QList<QcTileSGTexture *> m_free_textures;
+  int m_number_of_uploads;
+  int m_number_of_recycled;
+  int m_number_of_reused;
+};
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __TILE_TEXTURE_POOL_H__ */
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
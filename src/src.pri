@@ -21,7 +21,11 @@ SOURCES += \
   cache/file_tile_cache.cpp \
   cache/offline_cache.cpp \
   cache/offline_cache_database.cpp \
-  cache/tile_image.cpp
+  cache/tile_cache_index.cpp \
+  cache/tile_cache_metrics.cpp \
+  cache/tile_freshness.cpp \
+  cache/tile_image.cpp \
+  cache/tile_pack.cpp
 
 SOURCES += \
   configuration/configuration.cpp
@@ -50,8 +54,11 @@ SOURCES += \
   map/location_circle_data.cpp \
   map/map_event_router.cpp \
   map/map_path_editor.cpp \
+  map/map_update_scheduler.cpp \
   map/map_view.cpp \
   map/path_property.cpp \
+  map/tile_prefetcher.cpp \
+  map/tile_visibility.cpp \
   map/viewport.cpp \
   map/decorated_path.cpp
 
@@ -67,7 +74,8 @@ SOURCES += \
   scene/map_scene.cpp \
   scene/path_material_shader.cpp \
   scene/path_node.cpp \
-  scene/point_material_shader.cpp
+  scene/point_material_shader.cpp \
+  scene/tile_texture_pool.cpp
 
 SOURCES += \
   tools/debug_data.cpp \
@@ -75,10 +83,12 @@ SOURCES += \
   tools/platform.cpp
 
 SOURCES += \
+  wmts/circuit_breaker.cpp \
   wmts/elevation_service_reply.cpp \
   wmts/location_service_query.cpp \
   wmts/location_service_reply.cpp \
   wmts/network_reply.cpp \
+  wmts/offline_area_downloader.cpp \
   wmts/providers/artic_web_map/artic_web_map_plugin.cpp \
   wmts/providers/austria/austria_plugin.cpp \
   wmts/providers/esri/esri_plugin.cpp \
@@ -92,9 +102,14 @@ SOURCES += \
   wmts/providers/swiss_confederation/swiss_confederation_plugin.cpp \
   wmts/tile_matrix_index.cpp \
   wmts/tile_matrix_set.cpp \
+  wmts/tile_refresher.cpp \
+  wmts/tile_request_queue.cpp \
+  wmts/tile_key.cpp \
   wmts/tile_spec.cpp \
+  wmts/token_bucket.cpp \
   wmts/wmts_manager.cpp \
   wmts/wmts_network_reply.cpp \
+  wmts/wmts_network_settings.cpp \
   wmts/wmts_network_tile_fetcher.cpp \
   wmts/wmts_plugin.cpp \
   wmts/wmts_plugin_manager.cpp \
@@ -106,7 +121,11 @@ HEADERS += \
   cache/file_tile_cache.h \
   cache/offline_cache.h \
   cache/offline_cache_database.h \
-  cache/tile_image.h
+  cache/tile_cache_index.h \
+  cache/tile_cache_metrics.h \
+  cache/tile_freshness.h \
+  cache/tile_image.h \
+  cache/tile_pack.h
 
 HEADERS += \
   configuration/configuration.h
@@ -134,8 +153,11 @@ HEADERS += \
   map/location_circle_data.h \
   map/map_event_router.h \
   map/map_path_editor.h \
+  map/map_update_scheduler.h \
   map/map_view.h \
   map/path_property.h \
+  map/tile_prefetcher.h \
+  map/tile_visibility.h \
   map/viewport.h \
   map/decorated_path.h
 
@@ -150,7 +172,8 @@ HEADERS += \
   scene/map_scene.h \
   scene/path_material_shader.h \
   scene/path_node.h \
-  scene/point_material_shader.h
+  scene/point_material_shader.h \
+  scene/tile_texture_pool.h
 
 HEADERS += \
   tools/debug_data.h \
@@ -158,10 +181,12 @@ HEADERS += \
   tools/platform.h
 
 HEADERS += \
+  wmts/circuit_breaker.h \
   wmts/elevation_service_reply.h \
   wmts/location_service_query.h \
   wmts/location_service_reply.h \
   wmts/network_reply.h \
+  wmts/offline_area_downloader.h \
   wmts/providers/artic_web_map/artic_web_map_plugin.h \
   wmts/providers/austria/austria_plugin.h \
   wmts/providers/geoportail/geoportail_elevation_service_reply.h \
@@ -174,9 +199,14 @@ HEADERS += \
   wmts/providers/swiss_confederation/swiss_confederation_plugin.h \
   wmts/tile_matrix_index.h \
   wmts/tile_matrix_set.h \
+  wmts/tile_refresher.h \
+  wmts/tile_request_queue.h \
+  wmts/tile_key.h \
   wmts/tile_spec.h \
+  wmts/token_bucket.h \
   wmts/wmts_manager.h \
   wmts/wmts_network_reply.h \
+  wmts/wmts_network_settings.h \
   wmts/wmts_network_tile_fetcher.h \
   wmts/wmts_plugin.h \
   wmts/wmts_plugin_manager.h \
@@ -0,0 +1,137 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "circuit_breaker.h"
+
+#include <QtGlobal>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcCircuitBreaker::QcCircuitBreaker(int failure_threshold, int open_duration, int max_open_duration)
+  : m_state(Closed),
+    m_failure_threshold(failure_threshold),
+    m_open_duration(open_duration),
+    m_max_open_duration(max_open_duration),
+    m_failures(0),
+    m_consecutive_opens(0),
+    m_trips(0),
+    m_probe_in_flight(false),
+    m_retry_at(0),
+    m_timer()
+{
+  m_timer.start();
+}
+
+void
+QcCircuitBreaker::set_open_duration(int duration, int max_duration)
+{
+  m_open_duration = duration;
+  m_max_open_duration = max_duration;
+}
+
+void
+QcCircuitBreaker::open()
+{
+  // Exponential cooldown with +/- 25 % of jitter
+  qint64 duration = qMin(qint64(m_open_duration) << qMin(m_consecutive_opens, 20), qint64(m_max_open_duration));
+  double jitter = .75 + .5 * qrand() / double(RAND_MAX);
+  m_retry_at = m_timer.elapsed() + qint64(duration * jitter);
+
+  m_state = Open;
+  m_consecutive_opens++;
+  m_trips++;
+  m_failures = 0;
+  m_probe_in_flight = false;
+}
+
+/*! Return true if a request can be sent.
+ *
+ *  When the cooldown is elapsed, the first call switches the circuit to
+ *  half-open and returns true for the probe request.
+ */
+bool
+QcCircuitBreaker::allow_request()
+{
+  switch (m_state) {
+  case Closed:
+    return true;
+  case Open:
+    if (m_timer.elapsed() < m_retry_at)
+      return false;
+    m_state = HalfOpen;
+    m_probe_in_flight = true;
+    return true;
+  case HalfOpen:
+    if (m_probe_in_flight)
+      return false;
+    m_probe_in_flight = true;
+    return true;
+  }
+  return false;
+}
+
+void
+QcCircuitBreaker::record_success()
+{
+  m_state = Closed;
+  m_failures = 0;
+  m_consecutive_opens = 0;
+  m_probe_in_flight = false;
+}
+
+void
+QcCircuitBreaker::record_failure()
+{
+  if (m_state == HalfOpen)
+    open();
+  else if (m_state == Closed && ++m_failures >= m_failure_threshold)
+    open();
+}
+
+int
+QcCircuitBreaker::time_to_retry() const
+{
+  if (m_state != Open)
+    return 0;
+  return int(qMax(m_retry_at - m_timer.elapsed(), qint64(0)));
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,108 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __CIRCUIT_BREAKER_H__
+#define __CIRCUIT_BREAKER_H__
+
+/**************************************************************************************************/
+
+#include <QElapsedTimer>
+
+#include "qtcarto_global.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* Circuit breaker for a provider.
+ *
+ * The circuit opens after consecutive failures and rejects the requests
+ * during a cooldown, then it is half-open and lets a single probe request
+ * pass.  A success closes the circuit, a failure opens it again for a
+ * longer cooldown.  Cooldowns grow exponentially and are jittered so as
+ * to not synchronise the clients.
+ */
+class QC_EXPORT QcCircuitBreaker
+{
+public:
+  enum State {
+    Closed,
+    Open,
+    HalfOpen
+  };
+
+public:
+  QcCircuitBreaker(int failure_threshold = 5, int open_duration = 5000, int max_open_duration = 300000);
+
+  State state() const { return m_state; }
+  bool is_closed() const { return m_state == Closed; }
+  int failure_threshold() const { return m_failure_threshold; }
+  void set_failure_threshold(int count) { m_failure_threshold = count; }
+  int open_duration() const { return m_open_duration; } // ms
+  void set_open_duration(int duration, int max_duration);
+  int trips() const { return m_trips; }
+
+  bool allow_request();
+  void record_success();
+  void record_failure();
+  int time_to_retry() const; // ms until half-open
+
+private:
+  void open();
+
+private:
+  State m_state;
+  int m_failure_threshold;
+  int m_open_duration;
+  int m_max_open_duration;
+  int m_failures;
+  int m_consecutive_opens;
+  int m_trips;
+  bool m_probe_in_flight;
+  qint64 m_retry_at;
+  QElapsedTimer m_timer;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __CIRCUIT_BREAKER_H__ */
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
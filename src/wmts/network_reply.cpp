@@ -101,6 +101,9 @@
         No error has occurred.
     \value CommunicationError
         An error occurred while communicating with the service provider.
+    \value ContentNotFoundError
+        The service provider has not the requested content, e.g. a tile
+        outside its coverage.
     \value ParseError
         The response from the service provider was in an unrecognizable format
         supported by the service provider.
@@ -188,6 +191,10 @@ QcNetworkReply::QcNetworkReply(QNetworkReply * reply)
   : QcNetworkFuture(),
     m_reply(reply)
 {
+  // A reply can wait for the network reply of another one
+  if (!m_reply)
+    return;
+
   connect(m_reply, SIGNAL(finished()),
 	  this, SLOT(network_reply_finished()));
 
@@ -240,7 +247,9 @@ QcNetworkReply::network_reply_error(QNetworkReply::NetworkError error)
   if (!m_reply)
     return;
 
-  if (error != QNetworkReply::OperationCanceledError)
+  if (error == QNetworkReply::ContentNotFoundError)
+    set_error(QcNetworkReply::ContentNotFoundError, m_reply->errorString());
+  else if (error != QNetworkReply::OperationCanceledError)
     set_error(QcNetworkReply::CommunicationError, m_reply->errorString());
 
   cleanup();
@@ -90,6 +90,7 @@ class QC_EXPORT QcNetworkFuture : public QObject
   enum Error { // Fixme: check
     NoError,
     CommunicationError,
+    ContentNotFoundError,
     ParseError,
     UnknownError
   };
@@ -0,0 +1,771 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "offline_area_downloader.h"
+#include "cache/file_tile_cache.h"
+#include "wmts/wmts_manager.h"
+#include "wmts/wmts_plugin.h"
+
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QtDebug>
+#include <QtMath>
+
+#include <algorithm>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcOfflineArea::QcOfflineArea()
+  : m_polygons()
+{}
+
+QcOfflineArea::QcOfflineArea(const QcPolygon & polygon)
+  : m_polygons()
+{
+  add_polygon(polygon);
+}
+
+void
+QcOfflineArea::add_polygon(const QcPolygon & polygon)
+{
+  if (polygon.number_of_vertexes() >= 3)
+    m_polygons << polygon;
+  else
+    qWarning() << "Degenerated polygon";
+}
+
+/*! Cover a track by a rectangle around each segment.
+ *
+ * The pseudo web mercator scale factor is 1 / cos(latitude), the buffer
+ * is scaled at the first point of the segment.
+ */
+QcOfflineArea
+QcOfflineArea::from_track(const QList<QcWgsCoordinate> & coordinates, double buffer_m)
+{
+  QcOfflineArea area;
+
+  int number_of_segments = qMax(coordinates.size() - 1, 1);
+  for (int i = 0; i < coordinates.size() && i < number_of_segments; i++) {
+    const QcWgsCoordinate & coordinate = coordinates[i];
+    QcVectorDouble point1 = coordinate.pseudo_web_mercator().vector();
+    QcVectorDouble point2 = i + 1 < coordinates.size() ? coordinates[i + 1].pseudo_web_mercator().vector() : point1;
+    double buffer = buffer_m / qCos(qDegreesToRadians(coordinate.latitude()));
+
+    QcVectorDouble direction = point2 - point1;
+    if (direction.magnitude() > 0)
+      direction = direction.normalised() * buffer;
+    else
+      direction = QcVectorDouble(buffer, 0);
+    QcVectorDouble normal = direction.rotate_counter_clockwise_90();
+
+    QcPolygon polygon;
+    polygon.add_vertex(point1 - direction - normal);
+    polygon.add_vertex(point2 + direction - normal);
+    polygon.add_vertex(point2 + direction + normal);
+    polygon.add_vertex(point1 - direction + normal);
+    area.add_polygon(polygon);
+  }
+
+  return area;
+}
+
+QcOfflineArea
+QcOfflineArea::from_track(const QcTrack & track, double buffer_m)
+{
+  QcOfflineArea area;
+
+  for (const QcWayPointList & segment : track.segments()) {
+    QList<QcWgsCoordinate> coordinates;
+    for (const QcWayPoint & waypoint : segment)
+      coordinates << waypoint.coordinate();
+    for (const QcPolygon & polygon : from_track(coordinates, buffer_m).polygons())
+      area.add_polygon(polygon);
+  }
+
+  return area;
+}
+
+QcTiledPolygonRunList
+QcOfflineArea::tile_runs(const QcTileMatrixSet & tile_matrix_set, int level) const
+{
+  const QcTileMatrix & tile_matrix = tile_matrix_set[level];
+  int last_index = tile_matrix.mosaic_size() -1;
+  const QcVectorDouble & origin = tile_matrix_set.origin();
+  const QcVectorDouble & scale = tile_matrix_set.scale();
+
+  QMap<int, QList<QcIntervalInt>> rows;
+  for (const QcPolygon & polygon : m_polygons) {
+    // Transform the polygon to the tile referential
+    QcPolygon::VertexListType vertexes;
+    for (const auto & vertex : polygon.vertexes())
+      vertexes << (vertex - origin) * scale;
+    // The grid intersection expects a clockwise polygon
+    if (QcPolygon(vertexes).area() > 0)
+      std::reverse(vertexes.begin(), vertexes.end());
+    QcPolygon transformed_polygon(vertexes);
+    QcTiledPolygon tiled_polygon = transformed_polygon.intersec_with_grid(tile_matrix.tile_length_m());
+    for (const QcTiledPolygonRun & run : tiled_polygon.runs()) {
+      if (run.y() < 0 || run.y() > last_index)
+        continue;
+      int inf = qMax(run.interval().inf(), 0);
+      int sup = qMin(run.interval().sup(), last_index);
+      if (inf <= sup)
+        rows[run.y()] << QcIntervalInt(inf, sup);
+    }
+  }
+
+  // Merge the overlapping and adjacent runs of each row
+  QcTiledPolygonRunList runs;
+  for (auto it = rows.begin(); it != rows.end(); ++it) {
+    QList<QcIntervalInt> & intervals = it.value();
+    std::sort(intervals.begin(), intervals.end(),
+              [](const QcIntervalInt & a, const QcIntervalInt & b) { return a.inf() < b.inf(); });
+    QcIntervalInt merged = intervals.first();
+    for (const QcIntervalInt & interval : intervals) {
+      if (interval.inf() <= merged.sup() + 1) {
+        if (interval.sup() > merged.sup())
+          merged.set_sup(interval.sup());
+      } else {
+        runs << QcTiledPolygonRun(it.key(), merged);
+        merged = interval;
+      }
+    }
+    runs << QcTiledPolygonRun(it.key(), merged);
+  }
+
+  return runs;
+}
+
+QJsonArray
+QcOfflineArea::to_json() const
+{
+  QJsonArray json_polygons;
+  for (const QcPolygon & polygon : m_polygons) {
+    QJsonArray json_vertexes;
+    for (const auto & vertex : polygon.vertexes())
+      json_vertexes << QJsonArray({vertex.x(), vertex.y()});
+    json_polygons << json_vertexes;
+  }
+  return json_polygons;
+}
+
+QcOfflineArea
+QcOfflineArea::from_json(const QJsonArray & array)
+{
+  QcOfflineArea area;
+  for (const QJsonValue & json_polygon : array) {
+    QcPolygon polygon;
+    for (const QJsonValue & json_vertex : json_polygon.toArray()) {
+      QJsonArray coordinates = json_vertex.toArray();
+      polygon.add_vertex(QcVectorDouble(coordinates[0].toDouble(), coordinates[1].toDouble()));
+    }
+    area.add_polygon(polygon);
+  }
+  return area;
+}
+
+/**************************************************************************************************/
+
+/*! The tiles are requested to the manager of the plugin and stored in
+ *  its offline cache, unless others are given.  Fresh tiles of the disk
+ *  cache of the plugin are copied when the offline cache is the plugin
+ *  one.
+ */
+QcOfflineAreaDownloader::QcOfflineAreaDownloader(const QcWmtsPluginLayer * layer,
+                                                 QcWmtsManager * manager,
+                                                 QcOfflineTileCache * offline_cache)
+  : QObject(),
+    m_layer(layer),
+    m_manager(manager),
+    m_offline_cache(offline_cache),
+    m_tile_cache(nullptr),
+    m_area(),
+    m_min_level(0),
+    m_max_level(0),
+    m_max_pending(default_max_pending),
+    m_tile_counts(),
+    m_number_of_tiles(0),
+    m_state(Idle),
+    m_job_id(-1),
+    m_bitmaps(),
+    m_done_tiles(),
+    m_dirty_levels(),
+    m_level(0),
+    m_run_index(0),
+    m_x(0),
+    m_index(0),
+    m_runs(),
+    m_pending(),
+    m_retry_tiles(),
+    m_retries(),
+    m_tile_indexes(),
+    m_downloaded_tiles(0),
+    m_skipped_tiles(0),
+    m_missing_tiles(0),
+    m_failed_tiles(0),
+    m_received_bytes(0),
+    m_request_scheduled(false),
+    m_timer(),
+    m_clock(),
+    m_save_time(0)
+{
+  QcWmtsPlugin * plugin = m_layer->plugin();
+  if (!m_manager)
+    m_manager = plugin->wmts_manager();
+  if (!m_offline_cache) {
+    m_tile_cache = m_manager->tile_cache();
+    m_offline_cache = m_tile_cache->offline_cache();
+  }
+
+  m_timer.setInterval(timer_interval);
+  connect(&m_timer, &QTimer::timeout, this, &QcOfflineAreaDownloader::timer_expired);
+  m_clock.start();
+
+  update_estimate();
+}
+
+QcOfflineAreaDownloader::~QcOfflineAreaDownloader()
+{
+  if (m_state == Running) {
+    cancel_requests();
+    save_job();
+  }
+}
+
+void
+QcOfflineAreaDownloader::set_area(const QcOfflineArea & area)
+{
+  m_area = area;
+  update_estimate();
+}
+
+void
+QcOfflineAreaDownloader::set_levels(int min_level, int max_level)
+{
+  int last_level = m_layer->plugin()->tile_matrix_set().number_of_levels() -1;
+  m_min_level = qMax(qMin(min_level, last_level), 0);
+  m_max_level = qMax(qMin(max_level, last_level), m_min_level);
+  update_estimate();
+}
+
+void
+QcOfflineAreaDownloader::update_estimate()
+{
+  const QcTileMatrixSet & tile_matrix_set = m_layer->plugin()->tile_matrix_set();
+
+  m_tile_counts.clear();
+  m_number_of_tiles = 0;
+  for (int level = m_min_level; level <= m_max_level; level++) {
+    int number_of_tiles = 0;
+    for (const QcTiledPolygonRun & run : m_area.tile_runs(tile_matrix_set, level))
+      number_of_tiles += run.interval().sup() - run.interval().inf() + 1;
+    m_tile_counts << number_of_tiles;
+    m_number_of_tiles += number_of_tiles;
+  }
+}
+
+//! Return the size of the received tiles plus an estimation for the remaining tiles
+qint64
+QcOfflineAreaDownloader::estimated_size() const
+{
+  // Mean size of the received tiles, else a typical size
+  qint64 tile_size = m_downloaded_tiles ? m_received_bytes / m_downloaded_tiles : default_tile_size;
+  return m_received_bytes + qMax(m_number_of_tiles - processed_tiles(), 0) * tile_size;
+}
+
+void
+QcOfflineAreaDownloader::set_state(State state)
+{
+  if (m_state != state) {
+    m_state = state;
+    emit state_changed(m_state);
+  }
+}
+
+/**************************************************************************************************/
+
+void
+QcOfflineAreaDownloader::start()
+{
+  if (m_state == Running)
+    return;
+  if (!m_offline_cache) {
+    qWarning() << "No offline cache";
+    return;
+  }
+
+  if (m_state != Paused) {
+    m_retry_tiles.clear();
+    m_retries.clear();
+    m_tile_indexes.clear();
+    m_downloaded_tiles = 0;
+    m_skipped_tiles = 0;
+    m_missing_tiles = 0;
+    m_failed_tiles = 0;
+    m_received_bytes = 0;
+    // Resume the job, the failed tiles are requested again
+    if (m_job_id < 0 || !load_job_progress())
+      create_job();
+    set_cursor(m_min_level, 0, 0);
+  }
+
+  set_state(Running);
+  m_save_time = m_clock.elapsed();
+  m_timer.start();
+  request_tiles();
+}
+
+void
+QcOfflineAreaDownloader::pause()
+{
+  if (m_state != Running)
+    return;
+
+  cancel_requests();
+  m_timer.stop();
+  set_state(Paused);
+  save_job();
+}
+
+void
+QcOfflineAreaDownloader::cancel()
+{
+  if (m_state == Running)
+    cancel_requests();
+  m_retry_tiles.clear();
+  m_retries.clear();
+  m_tile_indexes.clear();
+  m_timer.stop();
+  if (m_job_id >= 0) {
+    m_offline_cache->database()->delete_job(m_job_id);
+    m_job_id = -1;
+  }
+  set_state(Idle);
+}
+
+//! Cancel the outstanding requests, they are requested first on resume
+void
+QcOfflineAreaDownloader::cancel_requests()
+{
+  // The manager goes on with the tiles a map view waits for
+  QcTileSpecSet tiles_removed;
+  for (auto it = m_pending.cbegin(); it != m_pending.cend(); ++it) {
+    tiles_removed << it.key();
+    m_retry_tiles.prepend(it.key());
+  }
+  m_pending.clear();
+  m_manager->update_download_requests(this, QcTileSpecSet(), tiles_removed);
+}
+
+/**************************************************************************************************/
+
+bool
+QcOfflineAreaDownloader::set_job(int job_id)
+{
+  if (m_state == Running || m_state == Paused) {
+    qWarning() << "Download in progress";
+    return false;
+  }
+
+  QcOfflineDownloadJob job;
+  if (!m_offline_cache->database()->load_job(job_id, job)) {
+    qWarning() << "Unknown download job" << job_id;
+    return false;
+  }
+  if (job.provider != m_layer->plugin_name() || job.map_id != m_layer->map_id()) {
+    qWarning() << "Download job of another layer" << job_id;
+    return false;
+  }
+
+  m_job_id = job_id;
+  m_area = QcOfflineArea::from_json(QJsonDocument::fromJson(job.area).array());
+  set_levels(job.min_level, job.max_level);
+  set_state(Idle);
+  return true;
+}
+
+void
+QcOfflineAreaDownloader::create_job()
+{
+  QcOfflineDownloadJob job;
+  job.provider = m_layer->plugin_name();
+  job.map_id = m_layer->map_id();
+  job.min_level = m_min_level;
+  job.max_level = m_max_level;
+  job.area = QJsonDocument(m_area.to_json()).toJson(QJsonDocument::Compact);
+  job.state = Running;
+  job.number_of_tiles = m_number_of_tiles;
+  m_job_id = m_offline_cache->database()->create_job(job, m_tile_counts);
+
+  m_bitmaps.clear();
+  for (int number_of_tiles : m_tile_counts)
+    m_bitmaps << QByteArray((number_of_tiles + 7) / 8, 0);
+  m_done_tiles.fill(0, m_tile_counts.size());
+  m_dirty_levels.fill(false, m_tile_counts.size());
+}
+
+//! Load the counters and the bitmaps of the job
+bool
+QcOfflineAreaDownloader::load_job_progress()
+{
+  QcOfflineCacheDatabase * database = m_offline_cache->database();
+
+  QcOfflineDownloadJob job;
+  if (!database->load_job(m_job_id, job))
+    return false;
+
+  m_bitmaps.clear();
+  m_done_tiles.clear();
+  for (int i = 0; i < m_tile_counts.size(); i++) {
+    int done_tiles = 0;
+    QByteArray bitmap = database->job_bitmap(m_job_id, m_min_level + i, &done_tiles);
+    if (bitmap.size() != (m_tile_counts[i] + 7) / 8) {
+      qWarning() << "Inconsistent download job" << m_job_id;
+      return false;
+    }
+    m_bitmaps << bitmap;
+    m_done_tiles << done_tiles;
+  }
+  m_dirty_levels.fill(false, m_tile_counts.size());
+
+  m_downloaded_tiles = job.downloaded_tiles;
+  m_skipped_tiles = job.skipped_tiles;
+  m_missing_tiles = job.missing_tiles;
+  m_received_bytes = job.received_bytes;
+
+  qInfo() << "Resume download job" << m_job_id << processed_tiles() << "/" << m_number_of_tiles;
+  return true;
+}
+
+//! Save the counters, the state and the modified bitmaps of the job
+void
+QcOfflineAreaDownloader::save_job()
+{
+  if (m_job_id < 0)
+    return;
+
+  QcOfflineCacheDatabase * database = m_offline_cache->database();
+
+  QcOfflineDownloadJob job;
+  job.job_id = m_job_id;
+  job.state = m_state;
+  job.downloaded_tiles = m_downloaded_tiles;
+  job.skipped_tiles = m_skipped_tiles;
+  job.missing_tiles = m_missing_tiles;
+  job.received_bytes = m_received_bytes;
+
+  // The progress is committed with the pending tiles of the offline cache
+  database->update_job(job);
+  for (int i = 0; i < m_dirty_levels.size(); i++)
+    if (m_dirty_levels[i]) {
+      database->update_job_level(m_job_id, m_min_level + i, m_bitmaps[i], m_done_tiles[i]);
+      m_dirty_levels[i] = false;
+    }
+  database->flush();
+}
+
+bool
+QcOfflineAreaDownloader::is_done(int level, int index) const
+{
+  const QByteArray & bitmap = m_bitmaps[level - m_min_level];
+  return bitmap[index >> 3] & (1 << (index & 7));
+}
+
+void
+QcOfflineAreaDownloader::set_done(const QcTileSpec & tile_spec)
+{
+  int index = m_tile_indexes.take(tile_spec);
+  int i = tile_spec.level() - m_min_level;
+  QByteArray & bitmap = m_bitmaps[i];
+  bitmap[index >> 3] = bitmap[index >> 3] | (1 << (index & 7));
+  m_done_tiles[i]++;
+  m_dirty_levels[i] = true;
+}
+
+/**************************************************************************************************/
+
+void
+QcOfflineAreaDownloader::set_cursor(int level, int run_index, int x)
+{
+  m_level = level;
+  m_run_index = run_index;
+  m_x = x;
+  m_index = 0;
+  m_runs.clear();
+  if (m_level <= m_max_level)
+    m_runs = m_area.tile_runs(m_layer->plugin()->tile_matrix_set(), m_level);
+}
+
+//! Move the cursor to the next tile of the area, return false at the end
+bool
+QcOfflineAreaDownloader::next_tile(QcTileSpec & tile_spec, int & index)
+{
+  while (m_level <= m_max_level) {
+    if (m_run_index < m_runs.size()) {
+      const QcTiledPolygonRun & run = m_runs[m_run_index];
+      int x = qMax(m_x, run.interval().inf());
+      if (x <= run.interval().sup()) {
+        m_x = x + 1;
+        index = m_index++;
+        tile_spec = m_layer->create_tile_spec(m_level, x, run.y());
+        return true;
+      }
+      m_run_index++;
+      m_x = 0;
+    } else
+      set_cursor(m_level + 1, 0, 0);
+  }
+  return false;
+}
+
+/*! Copy a tile of the disk cache to the offline cache, stale tiles are
+ *  not copied unless they were revalidated, cf. \a freshness.
+ */
+bool
+QcOfflineAreaDownloader::copy_from_tile_cache(const QcTileSpec & tile_spec, const QcTileFreshness & freshness)
+{
+  if (!m_tile_cache)
+    return false;
+
+  QcTileFreshness tile_freshness = m_tile_cache->freshness(tile_spec);
+  if (freshness.is_valid())
+    tile_freshness.update(freshness);
+  else if (tile_freshness.is_stale(QDateTime::currentMSecsSinceEpoch()))
+    return false;
+
+  QString format;
+  QByteArray bytes = m_tile_cache->read(tile_spec, &format);
+  if (bytes.isEmpty())
+    return false;
+  m_offline_cache->insert(tile_spec, bytes, format, tile_freshness);
+  return true;
+}
+
+/*! Fill the request window.
+ *
+ * The tiles done are skipped using the bitmaps.  The lookups in the
+ * caches are bounded per event loop turn, so as to not freeze the
+ * application on an area mostly available offline.
+ */
+void
+QcOfflineAreaDownloader::request_tiles()
+{
+  m_request_scheduled = false;
+  if (m_state != Running)
+    return;
+  // Hold the requests while the provider is unavailable, the timer resumes them
+  if (!m_manager->circuit_breaker().is_closed()) {
+    m_offline_cache->database()->flush();
+    return;
+  }
+
+  QcTileSpecSet tiles_added;
+  int number_of_checks = 0;
+  while (m_pending.size() < m_max_pending) {
+    if (number_of_checks >= max_checks_per_turn) {
+      m_request_scheduled = true;
+      QTimer::singleShot(0, this, SLOT(request_tiles()));
+      break;
+    }
+    QcTileSpec tile_spec;
+    if (!m_retry_tiles.isEmpty())
+      tile_spec = m_retry_tiles.takeFirst();
+    else {
+      int index;
+      if (!next_tile(tile_spec, index))
+        break;
+      if (is_done(m_level, index))
+        continue;
+      m_tile_indexes.insert(tile_spec, index);
+    }
+    number_of_checks++;
+    if (m_offline_cache->contains(tile_spec) || copy_from_tile_cache(tile_spec)) {
+      m_retries.remove(tile_spec);
+      m_skipped_tiles++;
+      set_done(tile_spec);
+    } else {
+      m_pending.insert(tile_spec, m_clock.elapsed());
+      tiles_added << tile_spec;
+    }
+  }
+  if (!tiles_added.isEmpty())
+    m_manager->update_download_requests(this, tiles_added, QcTileSpecSet());
+
+  emit progress_changed(processed_tiles(), m_number_of_tiles);
+
+  // Nothing is in flight, commit the tiles received so far
+  if (m_pending.isEmpty())
+    m_offline_cache->database()->flush();
+
+  if (m_pending.isEmpty() && m_retry_tiles.isEmpty() && m_level > m_max_level) {
+    qInfo() << "Download finished" << m_layer->plugin_name() << m_layer->title()
+            << "downloaded" << m_downloaded_tiles << "skipped" << m_skipped_tiles
+            << "missing" << m_missing_tiles << "failed" << m_failed_tiles;
+    m_timer.stop();
+    set_state(Finished);
+    save_job();
+    emit finished();
+  }
+}
+
+void
+QcOfflineAreaDownloader::tile_processed()
+{
+  if (m_state == Running && !m_request_scheduled) {
+    m_request_scheduled = true;
+    QTimer::singleShot(0, this, SLOT(request_tiles()));
+  }
+}
+
+void
+QcOfflineAreaDownloader::retry(const QcTileSpec & tile_spec)
+{
+  int & retries = m_retries[tile_spec];
+  if (++retries < max_retries)
+    m_retry_tiles << tile_spec;
+  else {
+    // The tile is left to the next run of the job
+    m_retries.remove(tile_spec);
+    m_tile_indexes.remove(tile_spec);
+    m_failed_tiles++;
+  }
+  tile_processed();
+}
+
+/*! Request again the tiles waiting for too long, the requests could be
+ *  lost.
+ */
+void
+QcOfflineAreaDownloader::timer_expired()
+{
+  qint64 now = m_clock.elapsed();
+  QcTileSpecSet tiles_removed;
+  for (auto it = m_pending.begin(); it != m_pending.end();) {
+    if (now - it.value() > request_timeout) {
+      tiles_removed << it.key();
+      m_retry_tiles << it.key();
+      it = m_pending.erase(it);
+    } else
+      ++it;
+  }
+  if (!tiles_removed.isEmpty())
+    m_manager->update_download_requests(this, QcTileSpecSet(), tiles_removed);
+
+  // The tiles received since the last tick are committed
+  if (now - m_save_time > save_interval) {
+    save_job();
+    m_save_time = now;
+  } else
+    m_offline_cache->database()->flush();
+
+  request_tiles();
+}
+
+/**************************************************************************************************/
+
+void
+QcOfflineAreaDownloader::fetcher_tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes,
+                                               const QString & format, const QcTileFreshness & freshness)
+{
+  if (!m_pending.remove(tile_spec))
+    return;
+
+  m_offline_cache->insert(tile_spec, bytes, format, freshness);
+  m_retries.remove(tile_spec);
+  m_downloaded_tiles++;
+  m_received_bytes += bytes.size();
+  set_done(tile_spec);
+  tile_processed();
+}
+
+//! The request was conditional since the tile is in the disk cache
+void
+QcOfflineAreaDownloader::fetcher_tile_not_modified(const QcTileSpec & tile_spec, const QcTileFreshness & freshness)
+{
+  if (!m_pending.remove(tile_spec))
+    return;
+
+  if (copy_from_tile_cache(tile_spec, freshness)) {
+    m_retries.remove(tile_spec);
+    m_skipped_tiles++;
+    set_done(tile_spec);
+    tile_processed();
+  } else
+    retry(tile_spec);
+}
+
+void
+QcOfflineAreaDownloader::fetcher_tile_error(const QcTileSpec & tile_spec, const QString & error_string)
+{
+  if (!m_pending.remove(tile_spec))
+    return;
+
+  qWarning() << "Download error" << tile_spec << error_string;
+  retry(tile_spec);
+}
+
+void
+QcOfflineAreaDownloader::fetcher_tile_not_found(const QcTileSpec & tile_spec)
+{
+  if (!m_pending.remove(tile_spec))
+    return;
+
+  m_retries.remove(tile_spec);
+  m_missing_tiles++;
+  set_done(tile_spec);
+  tile_processed();
+}
+
+/* The provider is unavailable and the request was canceled, the tile is
+ * requested again once it recovers.  It doesn't count as a retry.
+ */
+void
+QcOfflineAreaDownloader::fetcher_tile_withdrawn(const QcTileSpec & tile_spec)
+{
+  if (!m_pending.remove(tile_spec))
+    return;
+
+  m_retry_tiles << tile_spec;
+  tile_processed();
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
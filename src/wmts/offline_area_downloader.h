@@ -0,0 +1,262 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __OFFLINE_AREA_DOWNLOADER_H__
+#define __OFFLINE_AREA_DOWNLOADER_H__
+
+/**************************************************************************************************/
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+#include "qtcarto_global.h"
+#include "cache/offline_cache.h"
+#include "cache/tile_freshness.h"
+#include "coordinate/wgs84.h"
+#include "geo_data_format/route.h"
+#include "geometry/polygon.h"
+#include "wmts/tile_matrix_set.h"
+#include "wmts/tile_spec.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+class QcFileTileCache;
+class QcWmtsManager;
+class QcWmtsPluginLayer;
+
+/**************************************************************************************************/
+
+/* Area to be downloaded, as a list of polygons in pseudo web mercator coordinates, in any
+ * vertex order.
+ *
+ * A track is covered by a rectangle around each of its segments, the
+ * buffer is the half width of the rectangle on the ground.
+ */
+class QC_EXPORT QcOfflineArea
+{
+public:
+  QcOfflineArea();
+  QcOfflineArea(const QcPolygon & polygon);
+
+  static QcOfflineArea from_track(const QList<QcWgsCoordinate> & coordinates, double buffer_m);
+  static QcOfflineArea from_track(const QcTrack & track, double buffer_m);
+
+  bool is_empty() const { return m_polygons.isEmpty(); }
+  const QList<QcPolygon> & polygons() const { return m_polygons; }
+  void add_polygon(const QcPolygon & polygon);
+
+  // Return the tiles of a level as runs merged over the polygons and clipped to the mosaic
+  QcTiledPolygonRunList tile_runs(const QcTileMatrixSet & tile_matrix_set, int level) const;
+
+  QJsonArray to_json() const;
+  static QcOfflineArea from_json(const QJsonArray & array);
+
+private:
+  QList<QcPolygon> m_polygons;
+};
+
+/**************************************************************************************************/
+
+/* Download the tiles of an area for a range of levels to the offline cache.
+ *
+ * The tiles are streamed to the WMTS manager by batches, so as to keep
+ * at most max_pending tiles queued or in flight, the fetcher applies
+ * its own limits per provider and host.  The downloader is a waiter of
+ * the manager like the map views, thus a tile is fetched once for both
+ * and a request is only cancelled when nobody waits for it anymore.
+ * Requests are held while the circuit breaker of the provider is open.  Tiles already in the
+ * offline cache are skipped and fresh tiles of the disk cache are
+ * copied.
+ *
+ * The progress is saved to a download job of the offline cache
+ * database, as a bitmap of the tiles done per level.  Thus a paused or
+ * interrupted download resumes where it stopped, even after a restart,
+ * cf. set_job.
+ */
+class QC_EXPORT QcOfflineAreaDownloader : public QObject
+{
+  Q_OBJECT
+
+public:
+  enum State {
+    Idle,
+    Running,
+    Paused,
+    Finished
+  };
+
+  static const int default_max_pending = 32;
+  static const int default_tile_size = 20 * 1024; // bytes, until tiles are received
+  static const int max_retries = 3;
+  static const int max_checks_per_turn = 1024; // tiles looked up in the caches
+  static const int timer_interval = 1000; // ms
+  static const int request_timeout = 2 * 60 * 1000; // ms, the request could be lost
+  static const int save_interval = 10 * 1000; // ms
+
+public:
+  QcOfflineAreaDownloader(const QcWmtsPluginLayer * layer,
+                          QcWmtsManager * manager = nullptr,
+                          QcOfflineTileCache * offline_cache = nullptr);
+  ~QcOfflineAreaDownloader();
+
+  const QcWmtsPluginLayer * layer() const { return m_layer; }
+
+  const QcOfflineArea & area() const { return m_area; }
+  void set_area(const QcOfflineArea & area);
+  int min_level() const { return m_min_level; }
+  int max_level() const { return m_max_level; }
+  void set_levels(int min_level, int max_level);
+
+  int max_pending() const { return m_max_pending; }
+  void set_max_pending(int count) { m_max_pending = qMax(count, 1); }
+
+  // Disk cache where the tiles are copied from, none if null
+  void set_tile_cache(QcFileTileCache * tile_cache) { m_tile_cache = tile_cache; }
+
+  // Download job, -1 until the download starts
+  int job_id() const { return m_job_id; }
+  // Resume a job of the layer, its area and levels replace the current ones
+  bool set_job(int job_id);
+
+  // Estimation
+  const QVector<int> & tile_counts() const { return m_tile_counts; } // per level from min_level
+  int number_of_tiles() const { return m_number_of_tiles; }
+  qint64 estimated_size() const; // bytes
+
+  // Progress
+  State state() const { return m_state; }
+  int processed_tiles() const { return m_downloaded_tiles + m_skipped_tiles + m_missing_tiles + m_failed_tiles; }
+  int downloaded_tiles() const { return m_downloaded_tiles; }
+  int skipped_tiles() const { return m_skipped_tiles; } // already offline or copied from the disk cache
+  int missing_tiles() const { return m_missing_tiles; }
+  int failed_tiles() const { return m_failed_tiles; }
+  int pending_tiles() const { return m_pending.size(); }
+  qint64 received_bytes() const { return m_received_bytes; }
+
+public slots:
+  // Start or resume the download
+  void start();
+  void pause();
+  // Stop the download and delete the job
+  void cancel();
+
+signals:
+  void state_changed(State state);
+  void progress_changed(int processed_tiles, int number_of_tiles);
+  void finished();
+
+private slots:
+  void request_tiles();
+  void timer_expired();
+
+private:
+  // Called by the manager
+  void fetcher_tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format,
+                             const QcTileFreshness & freshness);
+  void fetcher_tile_not_modified(const QcTileSpec & tile_spec, const QcTileFreshness & freshness);
+  void fetcher_tile_error(const QcTileSpec & tile_spec, const QString & error_string);
+  void fetcher_tile_not_found(const QcTileSpec & tile_spec);
+  void fetcher_tile_withdrawn(const QcTileSpec & tile_spec);
+
+  void set_state(State state);
+  void update_estimate();
+  void set_cursor(int level, int run_index, int x);
+  bool next_tile(QcTileSpec & tile_spec, int & index);
+  bool is_done(int level, int index) const;
+  void set_done(const QcTileSpec & tile_spec);
+  bool copy_from_tile_cache(const QcTileSpec & tile_spec, const QcTileFreshness & freshness = QcTileFreshness());
+  void retry(const QcTileSpec & tile_spec);
+  void tile_processed();
+  void cancel_requests();
+  void create_job();
+  bool load_job_progress();
+  void save_job();
+
+  friend class QcWmtsManager;
+
+private:
+  const QcWmtsPluginLayer * m_layer;
+  QcWmtsManager * m_manager;
+  QcOfflineTileCache * m_offline_cache;
+  QcFileTileCache * m_tile_cache;
+  QcOfflineArea m_area;
+  int m_min_level;
+  int m_max_level;
+  int m_max_pending;
+  QVector<int> m_tile_counts;
+  int m_number_of_tiles;
+  State m_state;
+  int m_job_id;
+  // Progress per level from min_level
+  QVector<QByteArray> m_bitmaps;
+  QVector<int> m_done_tiles;
+  QVector<bool> m_dirty_levels;
+  // Cursor
+  int m_level;
+  int m_run_index;
+  int m_x;
+  int m_index; // of the tile in the level
+  QcTiledPolygonRunList m_runs;
+  QHash<QcTileSpec, qint64> m_pending; // request time
+  QList<QcTileSpec> m_retry_tiles;
+  QHash<QcTileSpec, int> m_retries;
+  QHash<QcTileSpec, int> m_tile_indexes; // of the pending and retried tiles
+  int m_downloaded_tiles;
+  int m_skipped_tiles;
+  int m_missing_tiles;
+  int m_failed_tiles;
+  qint64 m_received_bytes;
+  bool m_request_scheduled;
+  QTimer m_timer;
+  QElapsedTimer m_clock;
+  qint64 m_save_time;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __OFFLINE_AREA_DOWNLOADER_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,125 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_key.h"
+#include "tile_spec.h"
+
+#include <QReadLocker>
+#include <QWriteLocker>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+QcTilePluginRegistry &
+QcTilePluginRegistry::instance()
+{
+  static QcTilePluginRegistry registry;
+  return registry;
+}
+
+QcTilePluginRegistry::QcTilePluginRegistry()
+  : m_lock(),
+    m_ids(),
+    m_names()
+{
+  m_ids.insert(QString(), 0);
+  m_names << QString();
+}
+
+int
+QcTilePluginRegistry::id(const QString & plugin)
+{
+  {
+    QReadLocker locker(&m_lock);
+    auto it = m_ids.constFind(plugin);
+    if (it != m_ids.constEnd())
+      return *it;
+  }
+
+  QWriteLocker locker(&m_lock);
+  auto it = m_ids.constFind(plugin); // registered meanwhile
+  if (it != m_ids.constEnd())
+    return *it;
+
+  int plugin_id = m_names.size();
+  if (plugin_id >= (1 << QcTileKey::plugin_bits)) {
+    qWarning() << "Too many tile plugins, cannot register" << plugin;
+    return 0;
+  }
+  m_ids.insert(plugin, plugin_id);
+  m_names << plugin;
+  return plugin_id;
+}
+
+QString
+QcTilePluginRegistry::name(int id) const
+{
+  QReadLocker locker(&m_lock);
+  return m_names.value(id);
+}
+
+int
+QcTilePluginRegistry::size() const
+{
+  QReadLocker locker(&m_lock);
+  return m_names.size();
+}
+
+/**************************************************************************************************/
+
+QcTileSpec
+QcTileKey::to_tile_spec() const
+{
+  return QcTileSpec(*this);
+}
+
+#ifndef QT_NO_DEBUG_STREAM
+QDebug
+operator<<(QDebug debug, const QcTileKey & key)
+{
+  QDebugStateSaver saver(debug);
+  debug.nospace() << "QcTileKey("
+                  << key.plugin_id() << ", "
+                  << key.map_id() << ", "
+                  << key.level() << ", "
+                  << key.x() << ", "
+                  << key.y() << ')';
+
+  return debug;
+}
+#endif
+
+// QC_END_NAMESPACE
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,166 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_KEY_H__
+#define __TILE_KEY_H__
+
+/**************************************************************************************************/
+
+#include <QDebug>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include "qtcarto_global.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+class QcTileSpec;
+
+/**************************************************************************************************/
+
+/*! Process-wide mapping between plugin names and the small integer ids
+ *  used in tile keys.  Id 0 is reserved for the empty plugin name.
+ */
+class QC_EXPORT QcTilePluginRegistry
+{
+ public:
+  static QcTilePluginRegistry & instance();
+
+  int id(const QString & plugin);
+  QString name(int id) const;
+  int size() const;
+
+ private:
+  QcTilePluginRegistry();
+
+ private:
+  mutable QReadWriteLock m_lock;
+  QHash<QString, int> m_ids;
+  QStringList m_names;
+};
+
+/**************************************************************************************************/
+
+/*! Tile spec packed in a 64-bit integer, to be used as a key of the
+ *  hash tables of the tile path.
+ *
+ *  Layout from the most significant bit: plugin id (8), map id (8),
+ *  level (6), x (21), y (21).
+ */
+class QC_EXPORT QcTileKey
+{
+ public:
+  static const int plugin_bits = 8;
+  static const int map_id_bits = 8;
+  static const int level_bits = 6;
+  static const int coordinate_bits = 21;
+
+ public:
+  QcTileKey()
+    : m_key(0)
+  {}
+  explicit QcTileKey(quint64 key)
+    : m_key(key)
+  {}
+  QcTileKey(int plugin_id, int map_id, int level, int x, int y)
+    : m_key((field(plugin_id, plugin_bits) << (map_id_bits + level_bits + 2*coordinate_bits)) |
+            (field(map_id, map_id_bits) << (level_bits + 2*coordinate_bits)) |
+            (field(level, level_bits) << (2*coordinate_bits)) |
+            (field(x, coordinate_bits) << coordinate_bits) |
+            field(y, coordinate_bits))
+  {}
+
+  quint64 value() const { return m_key; }
+
+  int plugin_id() const { return extract(map_id_bits + level_bits + 2*coordinate_bits, plugin_bits); }
+  int map_id() const { return extract(level_bits + 2*coordinate_bits, map_id_bits); }
+  int level() const { return extract(2*coordinate_bits, level_bits); }
+  int x() const { return extract(coordinate_bits, coordinate_bits); }
+  int y() const { return extract(0, coordinate_bits); }
+
+  bool is_valid() const { return plugin_id() != 0; }
+
+  // Tiles of the other levels which cover this tile
+  QcTileKey parent(int depth = 1) const {
+    return QcTileKey(plugin_id(), map_id(), level() - depth, x() >> depth, y() >> depth);
+  }
+  QcTileKey child(int i, int j) const {
+    return QcTileKey(plugin_id(), map_id(), level() + 1, 2*x() + i, 2*y() + j);
+  }
+
+  QcTileSpec to_tile_spec() const;
+
+  bool operator==(const QcTileKey & other) const { return m_key == other.m_key; }
+  bool operator!=(const QcTileKey & other) const { return m_key != other.m_key; }
+  bool operator<(const QcTileKey & other) const { return m_key < other.m_key; }
+
+ private:
+  static quint64 field(int value, int bits) {
+    return quint64(value) & ((Q_UINT64_C(1) << bits) - 1);
+  }
+  int extract(int shift, int bits) const {
+    return int((m_key >> shift) & ((Q_UINT64_C(1) << bits) - 1));
+  }
+
+ private:
+  quint64 m_key;
+};
+
+inline uint
+qHash(const QcTileKey & key, uint seed = 0)
+{
+  return qHash(key.value(), seed);
+}
+
+#ifndef QT_NO_DEBUG_STREAM
+QC_EXPORT QDebug operator<<(QDebug debug, const QcTileKey & key);
+#endif
+
+typedef QSet<QcTileKey> QcTileKeySet;
+
+// QC_END_NAMESPACE
+
+Q_DECLARE_TYPEINFO(QcTileKey, Q_PRIMITIVE_TYPE);
+
+/**************************************************************************************************/
+
+#endif /* __TILE_KEY_H__ */
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
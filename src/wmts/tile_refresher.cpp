@@ -0,0 +1,164 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_refresher.h"
+#include "cache/file_tile_cache.h"
+#include "wmts/wmts_manager.h"
+
+#include <QDateTime>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcTileRefresher::QcTileRefresher(QcWmtsManager * manager)
+  : QObject(),
+    m_manager(manager),
+    m_tile_cache(nullptr),
+    m_enabled(true),
+    m_batch_size(default_batch_size),
+    m_timer(),
+    m_in_flight(),
+    m_failures(),
+    m_modified_tiles(0),
+    m_not_modified_tiles(0),
+    m_failed_tiles(0)
+{
+  m_timer.setInterval(default_interval);
+  connect(&m_timer, &QTimer::timeout, this, &QcTileRefresher::refresh);
+}
+
+QcTileRefresher::~QcTileRefresher()
+{}
+
+//! The refresher is started once the tile cache of the provider is opened
+void
+QcTileRefresher::set_tile_cache(QcFileTileCache * tile_cache)
+{
+  m_tile_cache = tile_cache;
+  update_timer();
+}
+
+void
+QcTileRefresher::set_enabled(bool enabled)
+{
+  m_enabled = enabled;
+  update_timer();
+}
+
+void
+QcTileRefresher::update_timer()
+{
+  if (m_enabled && m_tile_cache)
+    m_timer.start();
+  else
+    m_timer.stop();
+}
+
+void
+QcTileRefresher::refresh()
+{
+  QcWmtsTileFetcher * tile_fetcher = m_manager->tile_fetcher();
+  if (!m_enabled || !m_tile_cache || !tile_fetcher)
+    return;
+
+  // Yield to the requests of the views and to a provider in trouble
+  if (!m_manager->circuit_breaker().is_closed() || tile_fetcher->queue_depth())
+    return;
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+  // The request was canceled or dropped by the fetcher
+  for (auto it = m_in_flight.begin(); it != m_in_flight.end(); )
+    if (it.value() + in_flight_timeout <= now)
+      it = m_in_flight.erase(it);
+    else
+      ++it;
+
+  int count = m_batch_size - m_in_flight.size();
+  if (count <= 0)
+    return;
+
+  QcTileKeySet excluded;
+  for (auto it = m_in_flight.constBegin(); it != m_in_flight.constEnd(); ++it)
+    excluded.insert(it.key());
+  for (auto it = m_failures.begin(); it != m_failures.end(); )
+    if (it.value() <= now)
+      it = m_failures.erase(it);
+    else {
+      excluded.insert(it.key());
+      ++it;
+    }
+
+  QcTileSpecSet requested_tiles;
+  for (const auto & tile_spec : m_tile_cache->stale_tiles(count, excluded)) {
+    m_in_flight.insert(tile_spec.key(), now);
+    requested_tiles.insert(tile_spec);
+  }
+
+  // qInfo() << "Refresh" << requested_tiles;
+  if (!requested_tiles.isEmpty())
+    tile_fetcher->update_tile_requests(requested_tiles, QcTileSpecSet());
+}
+
+bool
+QcTileRefresher::tile_refreshed(const QcTileKey & tile_key, bool modified)
+{
+  if (!m_in_flight.remove(tile_key))
+    return false;
+
+  if (modified)
+    m_modified_tiles++;
+  else
+    m_not_modified_tiles++;
+  return true;
+}
+
+bool
+QcTileRefresher::tile_failed(const QcTileKey & tile_key)
+{
+  if (!m_in_flight.remove(tile_key))
+    return false;
+
+  m_failed_tiles++;
+  m_failures.insert(tile_key, QDateTime::currentMSecsSinceEpoch() + failure_delay);
+  return true;
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,129 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_REFRESHER_H__
+#define __TILE_REFRESHER_H__
+
+/**************************************************************************************************/
+
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+
+#include "qtcarto_global.h"
+#include "wmts/tile_spec.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+class QcFileTileCache;
+class QcWmtsManager;
+
+/**************************************************************************************************/
+
+/* Background revalidation of the stale tiles of a provider.
+ *
+ * The refresher periodically requests a small batch of stale tiles on
+ * disk, the longest expired first. These requests are conditional, an
+ * unchanged tile thus costs a 304 response without body.
+ *
+ * Refresh requests have a low priority: they are only sent when no tile
+ * is queued for the views, and they are paused while the circuit of the
+ * provider is not closed. A tile which failed to refresh is tried again
+ * after a delay.
+ */
+class QC_EXPORT QcTileRefresher : public QObject
+{
+  Q_OBJECT
+
+public:
+  static const int default_interval = 10 * 1000; // ms
+  static const int default_batch_size = 4;
+  static const int failure_delay = 10 * 60 * 1000;
+  static const int in_flight_timeout = 2 * 60 * 1000; // forget a lost request
+
+public:
+  explicit QcTileRefresher(QcWmtsManager * manager);
+  ~QcTileRefresher();
+
+  void set_tile_cache(QcFileTileCache * tile_cache);
+
+  bool is_enabled() const { return m_enabled; }
+  void set_enabled(bool enabled);
+  int interval() const { return m_timer.interval(); }
+  void set_interval(int interval) { m_timer.setInterval(interval); }
+  int batch_size() const { return m_batch_size; }
+  void set_batch_size(int count) { m_batch_size = qMax(count, 1); }
+
+  bool is_refreshing(const QcTileKey & tile_key) const { return m_in_flight.contains(tile_key); }
+  int in_flight_count() const { return m_in_flight.size(); }
+
+  // Statistics
+  int modified_tiles() const { return m_modified_tiles; }
+  int not_modified_tiles() const { return m_not_modified_tiles; }
+  int failed_tiles() const { return m_failed_tiles; }
+
+  // Outcome of a request, return true if the tile was refreshed by us
+  bool tile_refreshed(const QcTileKey & tile_key, bool modified);
+  bool tile_failed(const QcTileKey & tile_key);
+
+public slots:
+  void refresh();
+
+private:
+  void update_timer();
+
+private:
+  QcWmtsManager * m_manager;
+  QcFileTileCache * m_tile_cache;
+  bool m_enabled;
+  int m_batch_size;
+  QTimer m_timer;
+  QHash<QcTileKey, qint64> m_in_flight; // request time
+  QHash<QcTileKey, qint64> m_failures; // time of the next attempt
+  int m_modified_tiles;
+  int m_not_modified_tiles;
+  int m_failed_tiles;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __TILE_REFRESHER_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,263 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "tile_request_queue.h"
+
+#include <algorithm>
+
+#include <QtMath>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcTileRequestFocus::QcTileRequestFocus()
+  : level(-1),
+    x(0),
+    y(0),
+    central_x_inf(0),
+    central_x_sup(0)
+{}
+
+QcTileRequestFocus::QcTileRequestFocus(int level, double x, double y, double central_x_inf, double central_x_sup)
+  : level(level),
+    x(x),
+    y(y),
+    central_x_inf(central_x_inf),
+    central_x_sup(central_x_sup)
+{}
+
+/**************************************************************************************************/
+
+QcTileRequestQueue::QcTileRequestQueue()
+  : m_focus(),
+    m_heap(),
+    m_index(),
+    m_sequence(0)
+{}
+
+/* The priority packs from the most significant bits the prefetch flag,
+ * the level distance, the clone flag and the squared distance to the
+ * centre in 1/16 tile units.  The lower is the first.
+ */
+quint64
+QcTileRequestQueue::priority(const QcTileSpec & tile_spec, bool prefetch) const
+{
+  quint64 prefetch_bit = quint64(prefetch) << 63;
+  if (!m_focus.is_valid())
+    return prefetch_bit;
+
+  int level = tile_spec.level();
+  quint64 level_distance = qMin(qAbs(level - m_focus.level), 0x7F);
+
+  // Scale the focus to the tile level
+  double scale = qPow(2., level - m_focus.level);
+  double x = tile_spec.x() + .5;
+  double y = tile_spec.y() + .5;
+  bool is_clone = (tile_spec.x() + 1) <= m_focus.central_x_inf * scale || tile_spec.x() >= m_focus.central_x_sup * scale;
+
+  // Clones wrap around the antimeridian
+  double number_of_tiles = qPow(2., level);
+  double dx = qAbs(x - m_focus.x * scale);
+  dx = qMin(dx, number_of_tiles - dx);
+  double dy = y - m_focus.y * scale;
+  double distance = qMin((dx*dx + dy*dy) * 16., double(Q_UINT64_C(0xFFFFFFFFFFFF)));
+
+  return prefetch_bit | (level_distance << 56) | (quint64(is_clone) << 48) | quint64(distance);
+}
+
+void
+QcTileRequestQueue::move_entry(int from, int to)
+{
+  m_heap[to] = m_heap[from];
+  m_index[m_heap[to].tile_key] = to;
+}
+
+void
+QcTileRequestQueue::sift_up(int i)
+{
+  Entry entry = m_heap[i];
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!(entry < m_heap[parent]))
+      break;
+    move_entry(parent, i);
+    i = parent;
+  }
+  m_heap[i] = entry;
+  m_index[entry.tile_key] = i;
+}
+
+void
+QcTileRequestQueue::sift_down(int i)
+{
+  int size = m_heap.size();
+  Entry entry = m_heap[i];
+  for (;;) {
+    int child = 2*i + 1;
+    if (child >= size)
+      break;
+    if (child + 1 < size && m_heap[child + 1] < m_heap[child])
+      child++;
+    if (!(m_heap[child] < entry))
+      break;
+    move_entry(child, i);
+    i = child;
+  }
+  m_heap[i] = entry;
+  m_index[entry.tile_key] = i;
+}
+
+void
+QcTileRequestQueue::remove_at(int i)
+{
+  m_index.remove(m_heap[i].tile_key);
+  int last = m_heap.size() - 1;
+  if (i != last) {
+    QcTileKey moved_key = m_heap[last].tile_key;
+    move_entry(last, i);
+    m_heap.removeLast();
+    // The moved entry can go either way
+    sift_up(i);
+    if (m_index.value(moved_key) == i)
+      sift_down(i);
+  } else
+    m_heap.removeLast();
+}
+
+void
+QcTileRequestQueue::set_focus(const QcTileRequestFocus & focus)
+{
+  m_focus = focus;
+
+  for (auto & entry : m_heap)
+    entry.priority = priority(entry.tile_spec, entry.prefetch);
+  // Bottom-up heap construction
+  for (int i = m_heap.size() / 2 - 1; i >= 0; i--)
+    sift_down(i);
+}
+
+/*! Queue a tile, return false if it is already queued.
+ *
+ *  A prefetched tile which is requested for the viewport is moved up
+ *  with the viewport tiles.
+ */
+bool
+QcTileRequestQueue::push(const QcTileSpec & tile_spec, bool prefetch)
+{
+  QcTileKey tile_key = tile_spec.key();
+  auto it = m_index.constFind(tile_key);
+  if (it != m_index.constEnd()) {
+    int i = it.value();
+    if (m_heap[i].prefetch && !prefetch) {
+      m_heap[i].prefetch = false;
+      m_heap[i].priority = priority(tile_spec);
+      sift_up(i);
+    }
+    return false;
+  }
+
+  m_heap.append(Entry{priority(tile_spec, prefetch), m_sequence++, tile_key, tile_spec, prefetch});
+  sift_up(m_heap.size() - 1);
+  return true;
+}
+
+bool
+QcTileRequestQueue::is_prefetch(const QcTileSpec & tile_spec) const
+{
+  auto it = m_index.constFind(tile_spec.key());
+  return it != m_index.constEnd() && m_heap[it.value()].prefetch;
+}
+
+QcTileSpec
+QcTileRequestQueue::pop()
+{
+  QcTileSpec tile_spec = m_heap.first().tile_spec;
+  remove_at(0);
+  return tile_spec;
+}
+
+bool
+QcTileRequestQueue::remove(const QcTileSpec & tile_spec)
+{
+  auto it = m_index.constFind(tile_spec.key());
+  if (it == m_index.constEnd())
+    return false;
+
+  remove_at(it.value());
+  return true;
+}
+
+//! Update the priority of a tile after a change of its score
+bool
+QcTileRequestQueue::reprioritise(const QcTileSpec & tile_spec)
+{
+  auto it = m_index.constFind(tile_spec.key());
+  if (it == m_index.constEnd())
+    return false;
+
+  int i = it.value();
+  quint64 old_priority = m_heap[i].priority;
+  m_heap[i].priority = priority(tile_spec, m_heap[i].prefetch);
+  if (m_heap[i].priority < old_priority)
+    sift_up(i);
+  else
+    sift_down(i);
+  return true;
+}
+
+void
+QcTileRequestQueue::clear()
+{
+  m_heap.clear();
+  m_index.clear();
+}
+
+QList<QcTileSpec>
+QcTileRequestQueue::to_list() const
+{
+  QVector<Entry> entries = m_heap;
+  std::sort(entries.begin(), entries.end());
+  QList<QcTileSpec> tile_specs;
+  for (const auto & entry : entries)
+    tile_specs << entry.tile_spec;
+  return tile_specs;
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
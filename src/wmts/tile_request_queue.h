@@ -0,0 +1,145 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TILE_REQUEST_QUEUE_H__
+#define __TILE_REQUEST_QUEUE_H__
+
+/**************************************************************************************************/
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+#include "qtcarto_global.h"
+#include "wmts/tile_key.h"
+#include "wmts/tile_spec.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* Viewport focus of a provider, in tile units at the current level.
+ *
+ * The central interval is the x range of the central part of the
+ * viewport, tiles outside are west or east clones.
+ */
+struct QC_EXPORT QcTileRequestFocus
+{
+  QcTileRequestFocus();
+  QcTileRequestFocus(int level, double x, double y, double central_x_inf, double central_x_sup);
+
+  bool is_valid() const { return level >= 0; }
+
+  int level;
+  double x;
+  double y;
+  double central_x_inf;
+  double central_x_sup;
+};
+
+/**************************************************************************************************/
+
+/* Priority queue of tile requests.
+ *
+ * Prefetched tiles come after the tiles requested for a viewport.  Then
+ * tiles are ordered by their distance to the current zoom level, then
+ * central part before clones, then by their distance to the viewport
+ * centre.  Without focus the queue is FIFO.  Moving the focus re-scores
+ * the queue in linear time.
+ *
+ * The heap is indexed by tile key, so that a tile can be removed or
+ * re-prioritised in O(log n) and looked up in O(1).
+ */
+class QC_EXPORT QcTileRequestQueue
+{
+public:
+  QcTileRequestQueue();
+
+  const QcTileRequestFocus & focus() const { return m_focus; }
+  void set_focus(const QcTileRequestFocus & focus);
+  quint64 priority(const QcTileSpec & tile_spec, bool prefetch = false) const;
+
+  bool is_empty() const { return m_heap.isEmpty(); }
+  int size() const { return m_heap.size(); }
+  bool contains(const QcTileSpec & tile_spec) const { return m_index.contains(tile_spec.key()); }
+
+  bool push(const QcTileSpec & tile_spec, bool prefetch = false);
+  bool is_prefetch(const QcTileSpec & tile_spec) const;
+  const QcTileSpec & top() const { return m_heap.first().tile_spec; }
+  QcTileSpec pop();
+  bool remove(const QcTileSpec & tile_spec);
+  bool reprioritise(const QcTileSpec & tile_spec);
+  void clear();
+
+  QList<QcTileSpec> to_list() const; // in priority order
+
+private:
+  struct Entry
+  {
+    quint64 priority;
+    quint64 sequence; // FIFO order for equal priorities
+    QcTileKey tile_key;
+    QcTileSpec tile_spec;
+    bool prefetch;
+
+    bool operator<(const Entry & other) const {
+      return priority < other.priority || (priority == other.priority && sequence < other.sequence);
+    }
+  };
+
+private:
+  void move_entry(int from, int to);
+  void sift_up(int i);
+  void sift_down(int i);
+  void remove_at(int i);
+
+private:
+  QcTileRequestFocus m_focus;
+  QVector<Entry> m_heap; // min heap
+  QHash<QcTileKey, int> m_index; // position in heap
+  quint64 m_sequence;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __TILE_REQUEST_QUEUE_H__ */
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
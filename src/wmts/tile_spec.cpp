@@ -72,17 +72,27 @@
 
 QcTileSpec::QcTileSpec()
   : QcTileMatrixIndex(),
-    m_plugin(), m_map_id(-1), m_level(-1)
+    m_plugin(), m_plugin_id(0), m_map_id(-1), m_level(-1)
 {}
 
 QcTileSpec::QcTileSpec(const QString & plugin, int map_id, int level, int x, int y)
   : QcTileMatrixIndex(x, y),
-    m_plugin(plugin), m_map_id(map_id), m_level(level)
+    m_plugin(plugin),
+    m_plugin_id(QcTilePluginRegistry::instance().id(plugin)),
+    m_map_id(map_id), m_level(level)
+{}
+
+QcTileSpec::QcTileSpec(const QcTileKey & key)
+  : QcTileMatrixIndex(key.x(), key.y()),
+    m_plugin(QcTilePluginRegistry::instance().name(key.plugin_id())),
+    m_plugin_id(key.plugin_id()),
+    m_map_id(key.map_id()), m_level(key.level())
 {}
 
 QcTileSpec::QcTileSpec(const QcTileSpec & other)
   : QcTileMatrixIndex(other),
-    m_plugin(other.m_plugin), m_map_id(other.m_map_id), m_level(other.m_level)
+    m_plugin(other.m_plugin), m_plugin_id(other.m_plugin_id),
+    m_map_id(other.m_map_id), m_level(other.m_level)
 {}
 
 QcTileSpec::~QcTileSpec()
@@ -94,6 +104,7 @@ QcTileSpec::operator=(const QcTileSpec & other)
   if (this != &other) {
     QcTileMatrixIndex::operator=(other);
     m_plugin = other.m_plugin;
+    m_plugin_id = other.m_plugin_id;
     m_map_id = other.m_map_id;
     m_level = other.m_level;
   }
@@ -101,11 +112,19 @@ QcTileSpec::operator=(const QcTileSpec & other)
   return *this;
 }
 
+void
+QcTileSpec::set_plugin(const QString & plugin)
+{
+  m_plugin = plugin;
+  m_plugin_id = QcTilePluginRegistry::instance().id(plugin);
+}
+
 bool
 QcTileSpec::operator==(const QcTileSpec & rhs) const
 {
+  // The plugin id identifies the plugin name, don't compare the strings
   return (QcTileMatrixIndex::operator==(rhs)
-	  && m_plugin == rhs.m_plugin
+	  && m_plugin_id == rhs.m_plugin_id
 	  && m_map_id == rhs.m_map_id
 	  && m_level == rhs.m_level);
 }
@@ -145,23 +164,7 @@ bool QcTileSpec::operator<(const QcTileSpec & rhs) const
 unsigned int
 qHash(const QcTileSpec & tile_spec)
 {
-  // 31 is coded on 5-bit
-  unsigned int result = (qHash(tile_spec.plugin()) * 13) % 31;
-  result += ((tile_spec.map_id() * 17) % 31) << 5;
-  result += ((tile_spec.level() * 19) % 31) << 10;
-  result += ((tile_spec.x() * 23) % 31) << 15;
-  result += ((tile_spec.y() * 29) % 31) << 20;
-  // QString filename = tile_spec.plugin();
-  // filename += QLatin1Literal("-");
-  // filename += QString::number(tile_spec.map_id());
-  // filename += QLatin1Literal("-");
-  // filename += QString::number(tile_spec.level());
-  // filename += QLatin1Literal("-");
-  // filename += QString::number(tile_spec.x());
-  // filename += QLatin1Literal("-");
-  // filename += QString::number(tile_spec.y());
-  // unsigned int result = qHash(filename);
-  return result;
+  return qHash(tile_spec.key());
 }
 
 QDebug
@@ -38,6 +38,7 @@
 #include <QtCore/QMetaType>
 
 #include "qtcarto_global.h"
+#include "wmts/tile_key.h"
 #include "wmts/tile_matrix_index.h"
 
 /**************************************************************************************************/
@@ -50,6 +51,7 @@ class QC_EXPORT QcTileSpec : public QcTileMatrixIndex
   QcTileSpec();
   QcTileSpec(const QcTileSpec & other);
   QcTileSpec(const QString & plugin, int map_id, int level, int x, int y);
+  explicit QcTileSpec(const QcTileKey & key);
   ~QcTileSpec();
 
   QcTileSpec & operator=(const QcTileSpec & other);
@@ -57,8 +59,9 @@ class QC_EXPORT QcTileSpec : public QcTileMatrixIndex
   inline const QString & plugin() const {
     return m_plugin;
   }
-  void set_plugin(const QString & plugin) {
-    m_plugin = plugin;
+  void set_plugin(const QString & plugin);
+  int plugin_id() const {
+    return m_plugin_id;
   }
 
   int level() const {
@@ -75,11 +78,17 @@ class QC_EXPORT QcTileSpec : public QcTileMatrixIndex
     m_map_id = map_id;
   }
 
+  //! Return the packed key to be used in hash tables
+  QcTileKey key() const {
+    return QcTileKey(m_plugin_id, m_map_id, m_level, x(), y());
+  }
+
   bool operator==(const QcTileSpec & rhs) const;
   // bool operator<(const QcTileSpec & rhs) const;
 
  private:
   QString m_plugin;
+  int m_plugin_id; // id of m_plugin in QcTilePluginRegistry
   int m_map_id;
   int m_level;
 };
@@ -0,0 +1,104 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "token_bucket.h"
+
+#include <QtMath>
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcTokenBucket::QcTokenBucket(double rate, double burst)
+  : m_rate(rate),
+    m_burst(qMax(burst, 1.)),
+    m_tokens(m_burst),
+    m_timer()
+{
+  m_timer.start();
+}
+
+void
+QcTokenBucket::set_rate(double rate, double burst)
+{
+  m_rate = rate;
+  m_burst = qMax(burst, 1.);
+  m_tokens = qMin(m_tokens, m_burst);
+}
+
+void
+QcTokenBucket::refill()
+{
+  qint64 elapsed = m_timer.restart(); // ms
+  m_tokens = qMin(m_burst, m_tokens + m_rate * elapsed / 1000.);
+}
+
+double
+QcTokenBucket::tokens()
+{
+  refill();
+  return m_tokens;
+}
+
+bool
+QcTokenBucket::try_acquire()
+{
+  if (!is_limited())
+    return true;
+
+  refill();
+  if (m_tokens < 1.)
+    return false;
+  m_tokens -= 1.;
+  return true;
+}
+
+int
+QcTokenBucket::time_to_next_token()
+{
+  if (!is_limited())
+    return 0;
+
+  refill();
+  if (m_tokens >= 1.)
+    return 0;
+  return qCeil((1. - m_tokens) * 1000. / m_rate);
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,89 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __TOKEN_BUCKET_H__
+#define __TOKEN_BUCKET_H__
+
+/**************************************************************************************************/
+
+#include <QElapsedTimer>
+
+#include "qtcarto_global.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* Token bucket rate limiter.
+ *
+ * The bucket is refilled at rate tokens per second up to burst tokens,
+ * a request is allowed when it can take one token.  A null rate means
+ * unlimited.
+ */
+class QC_EXPORT QcTokenBucket
+{
+public:
+  QcTokenBucket(double rate = 0, double burst = 1);
+
+  double rate() const { return m_rate; }
+  double burst() const { return m_burst; }
+  void set_rate(double rate, double burst);
+  bool is_limited() const { return m_rate > 0; }
+
+  double tokens();
+  bool try_acquire();
+  int time_to_next_token(); // ms
+
+private:
+  void refill();
+
+private:
+  double m_rate;
+  double m_burst;
+  double m_tokens;
+  QElapsedTimer m_timer;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __TOKEN_BUCKET_H__ */
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
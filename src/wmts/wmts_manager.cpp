@@ -64,6 +64,7 @@
 
 #include "wmts_manager.h"
 #include "map/map_view.h" // circular
+#include "wmts/offline_area_downloader.h"
 
 #include <QDir>
 #include <QLocale>
@@ -78,8 +79,16 @@ QcWmtsManager::QcWmtsManager(const QString & plugin_name)
   : QObject(),
     m_plugin_name(plugin_name),
     m_tile_cache(nullptr), // created by a call to tile_cache()
-    m_tile_fetcher(nullptr) // must call set_tile_fetcher() !!!
-{}
+    m_tile_fetcher(nullptr), // must call set_tile_fetcher() !!!
+    m_circuit_breaker(),
+    m_refresher(this),
+    m_retry_timer()
+{
+  m_clock.start();
+  m_retry_timer.setSingleShot(true);
+  connect(&m_retry_timer, &QTimer::timeout,
+          this, &QcWmtsManager::process_retries);
+}
 
 /*!
   Destroys this mapping manager.
@@ -98,12 +107,21 @@ QcWmtsManager::set_tile_fetcher(QcWmtsTileFetcher * tile_fetcher)
   qRegisterMetaType<QcTileSpec>();
 
   // Connect tile fetcher signals
-  connect(m_tile_fetcher, SIGNAL(tile_finished(QcTileSpec, QByteArray, QString)),
-	  this, SLOT(fetcher_tile_finished(QcTileSpec, QByteArray, QString)),
+  connect(m_tile_fetcher, SIGNAL(tile_finished(QcTileSpec, QByteArray, QString, QcTileFreshness)),
+	  this, SLOT(fetcher_tile_finished(QcTileSpec, QByteArray, QString, QcTileFreshness)),
+	  Qt::QueuedConnection);
+  connect(m_tile_fetcher, SIGNAL(tile_not_modified(QcTileSpec, QcTileFreshness)),
+	  this, SLOT(fetcher_tile_not_modified(QcTileSpec, QcTileFreshness)),
 	  Qt::QueuedConnection);
   connect(m_tile_fetcher, SIGNAL(tile_error(QcTileSpec, QString)),
 	  this, SLOT(fetcher_tile_error(QcTileSpec, QString)),
 	  Qt::QueuedConnection);
+  connect(m_tile_fetcher, SIGNAL(tile_not_found(QcTileSpec)),
+	  this, SLOT(fetcher_tile_not_found(QcTileSpec)),
+	  Qt::QueuedConnection);
+
+  if (m_tile_cache)
+    m_tile_fetcher->set_metrics(m_tile_cache->metrics());
 
   // engine_initialized();
 }
@@ -120,6 +138,21 @@ QcWmtsManager::set_tile_cache(QcFileTileCache * cache)
   // Fixme: delete, legacy from Qt ???
   Q_ASSERT_X(!m_tile_cache, Q_FUNC_INFO, "This should be called only once");
   m_tile_cache = cache;
+  connect_tile_cache();
+}
+
+void
+QcWmtsManager::connect_tile_cache()
+{
+  connect(m_tile_cache, SIGNAL(tile_decoded(QcTileSpec)),
+          this, SLOT(cache_tile_decoded(QcTileSpec)));
+  connect(m_tile_cache, SIGNAL(tile_decode_error(QcTileSpec)),
+          this, SLOT(cache_tile_decode_error(QcTileSpec)));
+
+  if (m_tile_fetcher)
+    m_tile_fetcher->set_metrics(m_tile_cache->metrics());
+
+  m_refresher.set_tile_cache(m_tile_cache);
 }
 
 QcFileTileCache *
@@ -128,6 +161,7 @@ QcWmtsManager::tile_cache()
   if (!m_tile_cache) {
     QString cache_directory = QcFileTileCache::base_cache_directory() + QDir::separator() + m_plugin_name;
     m_tile_cache = new QcFileTileCache(cache_directory);
+    connect_tile_cache();
   }
   return m_tile_cache;
 }
@@ -137,19 +171,20 @@ QcWmtsManager::remove_tile_spec(const QcTileSpec & tile_spec)
 {
   // Remove tile_spec in sets
 
-  QcMapViewLayerPointerSet map_view_layers = m_tile_hash.value(tile_spec);
+  QcTileKey tile_key = tile_spec.key();
+  QcMapViewLayerPointerSet map_view_layers = m_tile_hash.value(tile_key);
 
   // Fixme: inplace update ?
   for (auto map_view_layer : map_view_layers) {
-    QcTileSpecSet tile_set = m_map_view_layer_hash.value(map_view_layer);
-    tile_set.remove(tile_spec);
+    QcTileKeySet tile_set = m_map_view_layer_hash.value(map_view_layer);
+    tile_set.remove(tile_key);
     if (tile_set.isEmpty())
       m_map_view_layer_hash.remove(map_view_layer);
     else
       m_map_view_layer_hash.insert(map_view_layer, tile_set);
   }
 
-  m_tile_hash.remove(tile_spec);
+  m_tile_hash.remove(tile_key);
 }
 
 void
@@ -157,37 +192,66 @@ QcWmtsManager::release_map(QcMapViewLayer * map_view_layer)
 {
   m_map_view_layer_hash.remove(map_view_layer);
 
+  for (auto & map_view_layers : m_decode_hash)
+    map_view_layers.remove(map_view_layer);
+
   // Update m_tile_hash
-  QHash<QcTileSpec, QcMapViewLayerPointerSet > new_tile_hash = m_tile_hash;
-  // for (auto & tile_spec : m_tile_hash.keys())
-  typedef QHash<QcTileSpec, QcMapViewLayerPointerSet >::const_iterator hash_iterator;
+  QcTileSpecSet canceled_tiles;
+  QHash<QcTileKey, QcMapViewLayerPointerSet > new_tile_hash = m_tile_hash;
+  // for (auto & tile_key : m_tile_hash.keys())
+  typedef QHash<QcTileKey, QcMapViewLayerPointerSet >::const_iterator hash_iterator;
   hash_iterator iter = m_tile_hash.constBegin();
   hash_iterator iter_end = m_tile_hash.constEnd();
   for (; iter != iter_end; ++iter) { // Fixme: cxx11
     QcMapViewLayerPointerSet map_view_layers = iter.value();
     if (map_view_layers.contains(map_view_layer)) {
       map_view_layers.remove(map_view_layer);
-      if (map_view_layers.isEmpty())
+      if (map_view_layers.isEmpty()) {
 	new_tile_hash.remove(iter.key());
-      else
+	m_retries.remove(iter.key());
+	// The request goes on for the refresher or a download
+	if (!m_refresher.is_refreshing(iter.key()) && !is_downloading(iter.key()))
+	  canceled_tiles.insert(iter.key().to_tile_spec());
+      } else
 	new_tile_hash.insert(iter.key(), map_view_layers); // Fixme: inplace update ?
     }
   }
   m_tile_hash = new_tile_hash;
+
+  // Nobody waits for these tiles anymore
+  if (!canceled_tiles.isEmpty() && m_tile_fetcher)
+    m_tile_fetcher->update_tile_requests(QcTileSpecSet(), canceled_tiles);
 }
 
+/*! Update the requests of a map view layer.
+ *
+ *  Prefetched tiles are fetched after the visible tiles, a prefetched tile
+ *  which is requested again as visible is moved up in the fetcher queue.
+ */
 void
 QcWmtsManager::update_tile_requests(QcMapViewLayer * map_view_layer,
-				    const QcTileSpecSet & tiles_added,
-				    const QcTileSpecSet & tiles_removed)
+				    const QcTileSpecSet & tiles_to_add,
+				    const QcTileSpecSet & tiles_removed,
+				    bool prefetch)
 {
   typedef QcTileSpecSet::const_iterator tile_iter;
   tile_iter iter, iter_end;
 
+  // Known missing tiles are never requested again
+  QcTileSpecSet tiles_added = tiles_to_add;
+  QcTileSpecSet missing_tiles;
+  for (const auto & tile_spec : tiles_to_add)
+    if (is_negatively_cached(tile_spec.key())) {
+      tiles_added.remove(tile_spec);
+      missing_tiles.insert(tile_spec);
+    }
+
   // add and remove tiles from tileset for this map_view_layer
-  QcTileSpecSet old_tiles = m_map_view_layer_hash.value(map_view_layer);
-  old_tiles += tiles_added;
-  old_tiles -= tiles_removed;
+  QcTileKeySet old_tiles = m_map_view_layer_hash.value(map_view_layer);
+  for (const auto & tile_spec : tiles_added)
+    old_tiles.insert(tile_spec.key());
+  for (const auto & tile_spec : tiles_removed)
+    old_tiles.remove(tile_spec.key());
   m_map_view_layer_hash.insert(map_view_layer, old_tiles);
 
   // add and remove map from mapset for the tiles
@@ -195,68 +259,368 @@ QcWmtsManager::update_tile_requests(QcMapViewLayer * map_view_layer,
   // Fixme: duplicated code, inplace update ?
   QcTileSpecSet canceled_tiles;
   for (auto & tile_spec : tiles_removed) {
-    QcMapViewLayerPointerSet map_view_layer_set = m_tile_hash.value(tile_spec);
+    QcTileKey tile_key = tile_spec.key();
+    QcMapViewLayerPointerSet map_view_layer_set = m_tile_hash.value(tile_key);
     map_view_layer_set.remove(map_view_layer);
     if (map_view_layer_set.isEmpty()) {
-      m_tile_hash.remove(tile_spec);
-      canceled_tiles.insert(tile_spec);
+      m_tile_hash.remove(tile_key);
+      m_retries.remove(tile_key);
+      if (!m_refresher.is_refreshing(tile_key) && !is_downloading(tile_key))
+        canceled_tiles.insert(tile_spec);
     } else {
-      m_tile_hash.insert(tile_spec, map_view_layer_set);
+      m_tile_hash.insert(tile_key, map_view_layer_set);
     }
   }
 
+  // Single flight: a tile already fetched or waiting for a retry for
+  // another layer, or downloaded, only gets a new waiter
   QcTileSpecSet requested_tiles;
+  QcTileSpecSet promoted_tiles;
   for (auto & tile_spec : tiles_added) {
-    QcMapViewLayerPointerSet map_view_layer_set = m_tile_hash.value(tile_spec);
-    if (map_view_layer_set.isEmpty()) {
+    QcTileKey tile_key = tile_spec.key();
+    QcMapViewLayerPointerSet map_view_layer_set = m_tile_hash.value(tile_key);
+    if (map_view_layer_set.isEmpty() && !is_downloading(tile_key)) {
       requested_tiles.insert(tile_spec);
-    }
+    } else if (!prefetch)
+      promoted_tiles.insert(tile_spec);
     map_view_layer_set.insert(map_view_layer);
-    m_tile_hash.insert(tile_spec, map_view_layer_set);
+    m_tile_hash.insert(tile_key, map_view_layer_set);
   }
 
   // Fixme: why ?
   canceled_tiles -= requested_tiles;
 
-  // async call
-  // qInfo() << "async call update_tile_requests +" << requested_tiles << "-" << canceled_tiles;
-  QMetaObject::invokeMethod(m_tile_fetcher, "update_tile_requests",
-			    Qt::DirectConnection,
-			    // Fixme: segfault requested_tiles ???
-  			    // Qt::QueuedConnection,
-  			    Q_ARG(QSet<QcTileSpec>, requested_tiles), // QcTileSpecSet
-  			    Q_ARG(QSet<QcTileSpec>, canceled_tiles));
-  // qInfo() << "end of";
+  // Wait for the provider to recover
+  if (!m_circuit_breaker.is_closed()) {
+    for (const auto & tile_spec : requested_tiles)
+      schedule_retry(tile_spec.key(), 0);
+    requested_tiles.clear();
+    arm_retry_timer();
+  }
+
+  if (prefetch)
+    m_tile_fetcher->update_prefetch_requests(requested_tiles, canceled_tiles);
+  else {
+    if (!promoted_tiles.isEmpty())
+      m_tile_fetcher->promote_tile_requests(promoted_tiles);
+    // async call
+    // qInfo() << "async call update_tile_requests +" << requested_tiles << "-" << canceled_tiles;
+    QMetaObject::invokeMethod(m_tile_fetcher, "update_tile_requests",
+                              Qt::DirectConnection,
+                              // Fixme: segfault requested_tiles ???
+                              // Qt::QueuedConnection,
+                              Q_ARG(QSet<QcTileSpec>, requested_tiles), // QcTileSpecSet
+                              Q_ARG(QSet<QcTileSpec>, canceled_tiles));
+    // qInfo() << "end of";
+  }
+
+  for (const auto & tile_spec : missing_tiles)
+    map_view_layer->request_manager()->tile_error(tile_spec, QStringLiteral("tile not found"));
+}
+
+/*! Reorder the pending requests so as to fetch first the tiles at the
+ *  centre of the viewport.
+ */
+void
+QcWmtsManager::update_request_focus(const QcTileRequestFocus & focus)
+{
+  if (m_tile_fetcher)
+    m_tile_fetcher->set_request_focus(m_plugin_name, focus);
+}
+
+/*! Register \a downloader as a waiter for the tiles to add.
+ *
+ *  A tile already requested by a map view or the refresher is not
+ *  requested again, and a tile removed by the downloader is only
+ *  cancelled if nobody else waits for it.
+ */
+void
+QcWmtsManager::update_download_requests(QcOfflineAreaDownloader * downloader,
+                                        const QcTileSpecSet & tiles_added,
+                                        const QcTileSpecSet & tiles_removed)
+{
+  QcTileSpecSet canceled_tiles;
+  for (const auto & tile_spec : tiles_removed) {
+    QcTileKey tile_key = tile_spec.key();
+    auto it = m_download_hash.find(tile_key);
+    if (it == m_download_hash.end())
+      continue;
+    it->remove(downloader);
+    if (it->isEmpty()) {
+      m_download_hash.erase(it);
+      if (!m_tile_hash.contains(tile_key) && !m_refresher.is_refreshing(tile_key))
+        canceled_tiles.insert(tile_spec);
+    }
+  }
+
+  QcTileSpecSet requested_tiles;
+  for (const auto & tile_spec : tiles_added) {
+    QcTileKey tile_key = tile_spec.key();
+    if (!m_tile_hash.contains(tile_key) && !is_downloading(tile_key) && !m_refresher.is_refreshing(tile_key))
+      requested_tiles.insert(tile_spec);
+    m_download_hash[tile_key].insert(downloader);
+  }
+
+  canceled_tiles -= requested_tiles;
+  if (m_tile_fetcher && (!requested_tiles.isEmpty() || !canceled_tiles.isEmpty()))
+    m_tile_fetcher->update_tile_requests(requested_tiles, canceled_tiles);
 }
 
 // Fixme: name
 void
-QcWmtsManager::fetcher_tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format)
+QcWmtsManager::fetcher_tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format,
+                                     const QcTileFreshness & freshness)
 {
   // qInfo();
+  QcTileKey tile_key = tile_spec.key();
+  record_success();
+  m_retries.remove(tile_key);
+  bool refreshed = m_refresher.tile_refreshed(tile_key, true);
+  for (QcOfflineAreaDownloader * downloader : m_download_hash.take(tile_key))
+    downloader->fetcher_tile_finished(tile_spec, bytes, format, freshness);
   // Is tile requested by a map view ?
-  if (m_tile_hash.contains(tile_spec)) {
-    QcMapViewLayerPointerSet map_view_layers = m_tile_hash.value(tile_spec);
-    remove_tile_spec(tile_spec);
-    tile_cache()->insert(tile_spec, bytes, format);
-    for (QcMapViewLayer * map_view_layer : map_view_layers)
-      map_view_layer->request_manager()->tile_fetched(tile_spec);
-  }
+  if (m_tile_hash.contains(tile_key)) {
+    tile_cache()->insert(tile_spec, bytes, format, freshness);
+    deliver_tile(tile_spec);
+  } else if (refreshed)
+    tile_cache()->insert(tile_spec, bytes, format, freshness);
   // else
   //   qInfo() << "any client" << tile_spec;
 }
 
+/*! The cached tile was revalidated by the server, only its freshness
+ *  is updated.
+ */
+void
+QcWmtsManager::fetcher_tile_not_modified(const QcTileSpec & tile_spec, const QcTileFreshness & freshness)
+{
+  QcTileKey tile_key = tile_spec.key();
+  record_success();
+  m_retries.remove(tile_key);
+  m_refresher.tile_refreshed(tile_key, false);
+  tile_cache()->update_freshness(tile_spec, freshness);
+  for (QcOfflineAreaDownloader * downloader : m_download_hash.take(tile_key))
+    downloader->fetcher_tile_not_modified(tile_spec, freshness);
+
+  if (m_tile_hash.contains(tile_key)) {
+    if (tile_cache()->freshness(tile_spec).is_valid())
+      deliver_tile(tile_spec);
+    else if (m_tile_fetcher)
+      // The tile was evicted meanwhile, fetch it in full
+      m_tile_fetcher->update_tile_requests(QcTileSpecSet() << tile_spec, QcTileSpecSet());
+  }
+}
+
+//! Notify the layers waiting for a tile which is in the cache
+void
+QcWmtsManager::deliver_tile(const QcTileSpec & tile_spec)
+{
+  QcTileKey tile_key = tile_spec.key();
+  QcMapViewLayerPointerSet map_view_layers = m_tile_hash.value(tile_key);
+  remove_tile_spec(tile_spec);
+  // Decode the image off the GUI thread, layers are notified by cache_tile_decoded
+  bool pending = false;
+  tile_cache()->get_async(tile_spec, pending);
+  if (pending)
+    m_decode_hash[tile_key] += map_view_layers;
+  else
+    for (QcMapViewLayer * map_view_layer : map_view_layers)
+      map_view_layer->request_manager()->tile_fetched(tile_spec);
+}
+
+/*! Retry an errored tile with a jittered exponential backoff.
+ *
+ *  The retry state is shared by the layers waiting for the tile, they
+ *  stay registered meanwhile so as to not queue the tile twice, and are
+ *  notified when the manager gives up.  The failure is reported to the
+ *  circuit breaker of the provider.
+ */
 void
 QcWmtsManager::fetcher_tile_error(const QcTileSpec & tile_spec, const QString & error_string)
 {
   // qInfo();
-  QcMapViewLayerPointerSet map_view_layers = m_tile_hash.value(tile_spec);
-  remove_tile_spec(tile_spec);
+  record_failure();
+
+  QcTileKey tile_key = tile_spec.key();
+  m_refresher.tile_failed(tile_key);
+  // The downloaders retry on their own
+  for (QcOfflineAreaDownloader * downloader : m_download_hash.take(tile_key))
+    downloader->fetcher_tile_error(tile_spec, error_string);
+  QcMapViewLayerPointerSet map_view_layers = m_tile_hash.value(tile_key);
+
+  if (!map_view_layers.isEmpty()) {
+    int count = m_retries.value(tile_key, 0);
+    if (count < max_retries) {
+      m_retries.insert(tile_key, count + 1);
+      // qInfo() << "Retry x" << count << tile_spec;
+      schedule_retry(tile_key, retry_delay(count));
+      arm_retry_timer();
+    } else {
+      qWarning("QcWmtsManager: Failed to fetch tile (%d,%d,%d) %d times, giving up. "
+               "Last error message was: '%s'",
+               tile_spec.x(), tile_spec.y(), tile_spec.level(), max_retries + 1, qPrintable(error_string));
+      give_up(tile_spec, error_string, error_ttl);
+    }
+  }
+
+  emit tile_error(tile_spec, error_string);
+}
+
+/*! The tile is outside the coverage of the provider, it is not requested
+ *  again during the session.
+ */
+void
+QcWmtsManager::fetcher_tile_not_found(const QcTileSpec & tile_spec)
+{
+  // The provider answered
+  record_success();
+  m_refresher.tile_failed(tile_spec.key());
+  for (QcOfflineAreaDownloader * downloader : m_download_hash.take(tile_spec.key()))
+    downloader->fetcher_tile_not_found(tile_spec);
+
+  QString error_string = QStringLiteral("tile not found");
+  give_up(tile_spec, error_string, -1);
+  emit tile_error(tile_spec, error_string);
+}
+
+void
+QcWmtsManager::give_up(const QcTileSpec & tile_spec, const QString & error_string, int ttl)
+{
+  QcTileKey tile_key = tile_spec.key();
+  m_negative_cache.insert(tile_key, ttl < 0 ? -1 : m_clock.elapsed() + ttl);
 
+  QcMapViewLayerPointerSet map_view_layers = m_tile_hash.value(tile_key);
+  m_retries.remove(tile_key);
+  remove_tile_spec(tile_spec);
   for (QcMapViewLayer * map_view_layer : map_view_layers)
     map_view_layer->request_manager()->tile_error(tile_spec, error_string);
+}
 
-  emit tile_error(tile_spec, error_string);
+bool
+QcWmtsManager::is_negatively_cached(const QcTileKey & tile_key)
+{
+  auto it = m_negative_cache.find(tile_key);
+  if (it == m_negative_cache.end())
+    return false;
+  if (it.value() >= 0 && it.value() <= m_clock.elapsed()) {
+    m_negative_cache.erase(it);
+    return false;
+  }
+  return true;
+}
+
+//! Return the retry delay in ms, +/- 50 % of jitter avoid retry waves
+int
+QcWmtsManager::retry_delay(int count) const
+{
+  int delay = retry_base_delay << qMin(count, 16);
+  if (delay > max_retry_delay)
+    delay = max_retry_delay;
+  return int(delay * (.5 + qrand() / double(RAND_MAX)));
+}
+
+void
+QcWmtsManager::record_success()
+{
+  m_circuit_breaker.record_success();
+  // Flush the tiles deferred while the circuit was open
+  if (!m_retry_queue.isEmpty())
+    process_retries();
+}
+
+void
+QcWmtsManager::record_failure()
+{
+  bool was_closed = m_circuit_breaker.is_closed();
+  m_circuit_breaker.record_failure();
+  if (!was_closed || m_circuit_breaker.is_closed())
+    return;
+
+  // The circuit just opened: withdraw the pending requests from the
+  // fetcher, they are sent again when the provider recovers
+  qWarning() << "QcWmtsManager: too many errors for" << m_plugin_name
+             << ", pause requests for" << m_circuit_breaker.time_to_retry() << "ms";
+  QcTileSpecSet canceled_tiles;
+  for (auto it = m_tile_hash.constBegin(); it != m_tile_hash.constEnd(); ++it)
+    if (!m_scheduled_retries.contains(it.key())) {
+      canceled_tiles.insert(it.key().to_tile_spec());
+      schedule_retry(it.key(), 0);
+    }
+  // The tiles only waited by downloaders go back to their retry lists
+  QList<QcTileKey> download_keys;
+  for (auto it = m_download_hash.constBegin(); it != m_download_hash.constEnd(); ++it)
+    if (!m_tile_hash.contains(it.key()) && !m_refresher.is_refreshing(it.key()))
+      download_keys << it.key();
+  for (const auto & tile_key : download_keys) {
+    QcTileSpec tile_spec = tile_key.to_tile_spec();
+    canceled_tiles.insert(tile_spec);
+    for (QcOfflineAreaDownloader * downloader : m_download_hash.take(tile_key))
+      downloader->fetcher_tile_withdrawn(tile_spec);
+  }
+  if (m_tile_fetcher && !canceled_tiles.isEmpty())
+    m_tile_fetcher->update_tile_requests(QcTileSpecSet(), canceled_tiles);
+  arm_retry_timer();
+}
+
+void
+QcWmtsManager::schedule_retry(const QcTileKey & tile_key, int delay)
+{
+  if (m_scheduled_retries.contains(tile_key))
+    return;
+  m_scheduled_retries.insert(tile_key);
+  m_retry_queue.insert(m_clock.elapsed() + delay, tile_key);
+}
+
+/* A single timer drives the retries of the provider.  It waits for the
+ * end of the cooldown when the circuit is open, and times out the probe
+ * request when it is half-open.
+ */
+void
+QcWmtsManager::arm_retry_timer()
+{
+  if (m_circuit_breaker.state() == QcCircuitBreaker::HalfOpen) {
+    m_retry_timer.start(probe_timeout);
+    return;
+  }
+  if (m_retry_queue.isEmpty()) {
+    m_retry_timer.stop();
+    return;
+  }
+
+  qint64 delay = qMax(m_retry_queue.firstKey() - m_clock.elapsed(), qint64(0));
+  if (m_circuit_breaker.state() == QcCircuitBreaker::Open)
+    delay = qMax(delay, qint64(m_circuit_breaker.time_to_retry()));
+  m_retry_timer.start(int(delay));
+}
+
+void
+QcWmtsManager::process_retries()
+{
+  // The probe request was canceled or is lost
+  if (m_circuit_breaker.state() == QcCircuitBreaker::HalfOpen) {
+    m_circuit_breaker.record_failure();
+    arm_retry_timer();
+    return;
+  }
+
+  qint64 now = m_clock.elapsed();
+  QcTileSpecSet requested_tiles;
+  while (!m_retry_queue.isEmpty() && m_retry_queue.firstKey() <= now) {
+    QcTileKey tile_key = m_retry_queue.first();
+    // The tile could have been canceled or fetched meanwhile
+    if (m_tile_hash.contains(tile_key) || is_downloading(tile_key)) {
+      if (!m_circuit_breaker.allow_request())
+        break;
+      requested_tiles.insert(tile_key.to_tile_spec());
+    }
+    m_retry_queue.erase(m_retry_queue.begin());
+    m_scheduled_retries.remove(tile_key);
+  }
+
+  if (m_tile_fetcher && !requested_tiles.isEmpty())
+    m_tile_fetcher->update_tile_requests(requested_tiles, QcTileSpecSet());
+
+  arm_retry_timer();
 }
 
 QSharedPointer<QcTileTexture>
@@ -265,14 +629,52 @@ QcWmtsManager::get_tile_texture(const QcTileSpec & tile_spec)
   return m_tile_cache->get(tile_spec);
 }
 
+/*! Return the texture if it is decoded, else a decode job is
+ *  scheduled when the tile is cached and \a pending is set. The
+ *  layer is then notified by tile_fetched().
+ */
+QSharedPointer<QcTileTexture>
+QcWmtsManager::get_tile_texture_async(QcMapViewLayer * map_view_layer,
+                                      const QcTileSpec & tile_spec,
+                                      bool & pending)
+{
+  QSharedPointer<QcTileTexture> texture = tile_cache()->get_async(tile_spec, pending);
+  if (pending)
+    m_decode_hash[tile_spec.key()].insert(map_view_layer);
+  return texture;
+}
+
+void
+QcWmtsManager::cache_tile_decoded(const QcTileSpec & tile_spec)
+{
+  QcMapViewLayerPointerSet map_view_layers = m_decode_hash.take(tile_spec.key());
+  for (QcMapViewLayer * map_view_layer : map_view_layers)
+    map_view_layer->request_manager()->tile_fetched(tile_spec);
+}
+
+void
+QcWmtsManager::cache_tile_decode_error(const QcTileSpec & tile_spec)
+{
+  // The cached image is unusable, fall back to the network
+  QcMapViewLayerPointerSet map_view_layers = m_decode_hash.take(tile_spec.key());
+  for (QcMapViewLayer * map_view_layer : map_view_layers)
+    map_view_layer->request_manager()->tile_decode_error(tile_spec);
+}
+
 void
 QcWmtsManager::dump() const
 {
   qInfo() << "Dump";
-  for (auto & tile_spec : m_tile_hash.keys())
-    qInfo() << tile_spec << "--->" << m_tile_hash[tile_spec];
+  for (auto & tile_key : m_tile_hash.keys())
+    qInfo() << tile_key << "--->" << m_tile_hash[tile_key];
   for (auto & map_view_layer : m_map_view_layer_hash.keys())
     qInfo() << map_view_layer << "--->" << m_map_view_layer_hash[map_view_layer];
+  for (auto & tile_key : m_retries.keys())
+    qInfo() << tile_key << "retry" << m_retries[tile_key];
+  qInfo() << "circuit" << m_circuit_breaker.state() << "negative cache" << m_negative_cache.size();
+  qInfo() << "refresh" << m_refresher.in_flight_count()
+          << "modified" << m_refresher.modified_tiles()
+          << "not modified" << m_refresher.not_modified_tiles();
 }
 
 /**************************************************************************************************/
@@ -69,14 +69,19 @@
 
 /**************************************************************************************************/
 
+#include <QElapsedTimer>
 #include <QHash>
+#include <QMap>
 #include <QObject>
 #include <QPair>
 #include <QSet>
 #include <QSize>
+#include <QTimer>
 
 #include "cache/file_tile_cache.h"
 #include "qtcarto_global.h"
+#include "wmts/circuit_breaker.h"
+#include "wmts/tile_refresher.h"
 #include "wmts/wmts_tile_fetcher.h"
 // #include "map_view.h" // circular
 
@@ -87,6 +92,9 @@
 class QcMapViewLayer;
 typedef QSet<QcMapViewLayer *> QcMapViewLayerPointerSet;
 
+class QcOfflineAreaDownloader;
+typedef QSet<QcOfflineAreaDownloader *> QcOfflineAreaDownloaderPointerSet;
+
 /**************************************************************************************************/
 
 /*! This class implements a WMTS Manager for a WTMS provide.
@@ -108,6 +116,13 @@ class QC_EXPORT QcWmtsManager : public QObject
   };
   Q_DECLARE_FLAGS(CacheAreas, CacheArea)
 
+ public:
+  static const int max_retries = 5;
+  static const int retry_base_delay = 500; // ms
+  static const int max_retry_delay = 60 * 1000;
+  static const int error_ttl = 5 * 60 * 1000; // negative cache of tiles given up
+  static const int probe_timeout = 30 * 1000;
+
  public:
   explicit QcWmtsManager(const QString & plugin_name);
   virtual ~QcWmtsManager();
@@ -116,19 +131,40 @@ class QC_EXPORT QcWmtsManager : public QObject
 
   QcWmtsTileFetcher * tile_fetcher();
   QcFileTileCache * tile_cache();
+  QcTileRefresher * tile_refresher() { return &m_refresher; }
 
   void update_tile_requests(QcMapViewLayer * map_view_layer,
-			    const QcTileSpecSet & tiles_added,
-			    const QcTileSpecSet & tiles_removed);
+			    const QcTileSpecSet & tiles_to_add,
+			    const QcTileSpecSet & tiles_removed,
+			    bool prefetch = false);
+  void update_request_focus(const QcTileRequestFocus & focus);
+
+  // Offline downloads share the requests of the map views
+  void update_download_requests(QcOfflineAreaDownloader * downloader,
+                                const QcTileSpecSet & tiles_added,
+                                const QcTileSpecSet & tiles_removed);
+  bool is_downloading(const QcTileKey & tile_key) const { return m_download_hash.contains(tile_key); }
+
+  const QcCircuitBreaker & circuit_breaker() const { return m_circuit_breaker; }
+  int negative_cache_size() const { return m_negative_cache.size(); }
 
   QSharedPointer<QcTileTexture> get_tile_texture(const QcTileSpec & tile_spec);
+  QSharedPointer<QcTileTexture> get_tile_texture_async(QcMapViewLayer * map_view_layer,
+                                                       const QcTileSpec & tile_spec,
+                                                       bool & pending);
 
   void dump() const;
 
  private slots:
   // Fixme: name
-  void fetcher_tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format);
+  void fetcher_tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format,
+                             const QcTileFreshness & freshness);
+  void fetcher_tile_not_modified(const QcTileSpec & tile_spec, const QcTileFreshness & freshness);
   void fetcher_tile_error(const QcTileSpec & tile_spec, const QString & error_string);
+  void fetcher_tile_not_found(const QcTileSpec & tile_spec);
+  void process_retries();
+  void cache_tile_decoded(const QcTileSpec & tile_spec);
+  void cache_tile_decode_error(const QcTileSpec & tile_spec);
 
  signals:
   void tile_error(const QcTileSpec & tile_spec, const QString & error_string);
@@ -141,6 +177,15 @@ class QC_EXPORT QcWmtsManager : public QObject
 
  private:
   void remove_tile_spec(const QcTileSpec & tile_spec);
+  void deliver_tile(const QcTileSpec & tile_spec);
+  void give_up(const QcTileSpec & tile_spec, const QString & error_string, int ttl);
+  bool is_negatively_cached(const QcTileKey & tile_key);
+  int retry_delay(int count) const;
+  void record_success();
+  void record_failure();
+  void schedule_retry(const QcTileKey & tile_key, int delay);
+  void arm_retry_timer();
+  void connect_tile_cache();
 
   Q_DISABLE_COPY(QcWmtsManager);
 
@@ -148,10 +193,20 @@ class QC_EXPORT QcWmtsManager : public QObject
 
  private:
   QString m_plugin_name; // needed by cache directory
-  QHash<QcMapViewLayer *, QcTileSpecSet > m_map_view_layer_hash;
-  QHash<QcTileSpec, QcMapViewLayerPointerSet > m_tile_hash;
+  QHash<QcMapViewLayer *, QcTileKeySet > m_map_view_layer_hash;
+  QHash<QcTileKey, QcMapViewLayerPointerSet > m_tile_hash;
+  QHash<QcTileKey, QcMapViewLayerPointerSet > m_decode_hash; // layers waiting for a tile decode
+  QHash<QcTileKey, QcOfflineAreaDownloaderPointerSet > m_download_hash; // downloaders waiting for a tile
+  QHash<QcTileKey, int> m_retries; // shared by the layers
+  QMultiMap<qint64, QcTileKey> m_retry_queue; // by due time
+  QcTileKeySet m_scheduled_retries;
+  QHash<QcTileKey, qint64> m_negative_cache; // expiry time, -1 for the session
   QcFileTileCache * m_tile_cache;
   QcWmtsTileFetcher * m_tile_fetcher;
+  QcCircuitBreaker m_circuit_breaker;
+  QcTileRefresher m_refresher;
+  QTimer m_retry_timer;
+  QElapsedTimer m_clock;
 };
 
 // Q_DECLARE_OPERATORS_FOR_FLAGS(QcWmtsManager::CacheAreas)
@@ -28,6 +28,8 @@
 
 #include "wmts/wmts_network_reply.h"
 
+#include <QDateTime>
+
 /**************************************************************************************************/
 
 QcWmtsNetworkReply::QcWmtsNetworkReply(QNetworkReply * reply,
@@ -40,12 +42,28 @@ QcWmtsNetworkReply::QcWmtsNetworkReply(QNetworkReply * reply,
 QcWmtsNetworkReply::~QcWmtsNetworkReply()
 {}
 
-/*! Handle a successful request : store image data
+/*! Handle a successful request : store image data and its freshness
+ *
+ * A 304 response to a conditional request has no data, the cached
+ * tile is still valid.
  */
 void
 QcWmtsNetworkReply::process_payload()
 {
-  set_map_image_data(network_reply()->readAll());
+  QNetworkReply * reply = network_reply();
+
+  set_freshness(QcTileFreshness::from_http_headers(reply->rawHeader("ETag"),
+                                                   reply->rawHeader("Last-Modified"),
+                                                   reply->rawHeader("Cache-Control"),
+                                                   reply->rawHeader("Expires"),
+                                                   QDateTime::currentMSecsSinceEpoch()));
+
+  if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304) {
+    set_not_modified(true);
+    return;
+  }
+
+  set_map_image_data(reply->readAll());
   set_map_image_format(m_format);
 }
 
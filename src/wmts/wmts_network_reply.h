@@ -45,7 +45,7 @@
 
 // Fixme: clarify API
 
-class QcWmtsNetworkReply : public QcWmtsReply
+class QC_EXPORT QcWmtsNetworkReply : public QcWmtsReply
 {
   Q_OBJECT
 
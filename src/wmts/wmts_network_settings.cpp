@@ -0,0 +1,82 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include "wmts_network_settings.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+QcWmtsNetworkSettings::QcWmtsNetworkSettings()
+  : http2_enabled(true),
+    pipelining_enabled(false),
+    max_connections_per_host(6),
+    max_http2_streams_per_host(32),
+    max_requests_in_flight(32)
+{}
+
+/**************************************************************************************************/
+
+QcWmtsNetworkStatistics::QcWmtsNetworkStatistics()
+  : requests(0),
+    replies(0),
+    errors(0),
+    http2_replies(0),
+    cached_replies(0),
+    conditional_requests(0),
+    not_modified_replies(0),
+    bytes_received(0)
+{}
+
+QJsonObject
+QcWmtsNetworkStatistics::to_json() const
+{
+  QJsonObject object;
+  object["requests"] = requests;
+  object["replies"] = replies;
+  object["errors"] = errors;
+  object["http2_replies"] = http2_replies;
+  object["cached_replies"] = cached_replies;
+  object["conditional_requests"] = conditional_requests;
+  object["not_modified_replies"] = not_modified_replies;
+  object["bytes_received"] = double(bytes_received);
+  return object;
+}
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
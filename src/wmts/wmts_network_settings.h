@@ -0,0 +1,96 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __WMTS_NETWORK_SETTINGS_H__
+#define __WMTS_NETWORK_SETTINGS_H__
+
+/**************************************************************************************************/
+
+#include <QJsonObject>
+
+#include "qtcarto_global.h"
+
+/**************************************************************************************************/
+
+// QC_BEGIN_NAMESPACE
+
+/**************************************************************************************************/
+
+/* Network settings of a WMTS provider.
+ *
+ * Qt opens at most 6 connections per host and reuses them, the pool size
+ * is thus enforced by the tile fetcher as the number of requests in
+ * flight per host.  When the server speaks HTTP/2, requests are
+ * multiplexed on one connection and up to max_http2_streams are sent.
+ */
+struct QC_EXPORT QcWmtsNetworkSettings
+{
+  QcWmtsNetworkSettings();
+
+  bool http2_enabled;
+  bool pipelining_enabled; // HTTP/1.1
+  int max_connections_per_host;
+  int max_http2_streams_per_host;
+  int max_requests_in_flight; // per provider, 0 means unlimited
+};
+
+/**************************************************************************************************/
+
+//! Transfer counters of a WMTS provider
+struct QC_EXPORT QcWmtsNetworkStatistics
+{
+  QcWmtsNetworkStatistics();
+
+  QJsonObject to_json() const;
+
+  int requests;
+  int replies;
+  int errors;
+  int http2_replies;
+  int cached_replies;
+  int conditional_requests; // revalidation of a cached tile
+  int not_modified_replies; // 304, without body
+  qint64 bytes_received;
+};
+
+/**************************************************************************************************/
+
+// QC_END_NAMESPACE
+
+/**************************************************************************************************/
+
+#endif /* __WMTS_NETWORK_SETTINGS_H__ */
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
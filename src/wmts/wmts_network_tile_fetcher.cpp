@@ -52,11 +52,19 @@ QcWmtsNetworkTileFetcher::get_tile_image(const QcTileSpec & tile_spec)
 {
   const QcWmtsPluginLayer * layer = m_plugin->layer(tile_spec);
   QUrl url = layer->url(tile_spec);
-  qInfo() << url.toEncoded();
 
-  QNetworkReply *reply = m_plugin->get(url);
+  // Revalidate a tile on disk, the server answers 304 if it is unchanged
+  QcTileFreshness validators = m_plugin->wmts_manager()->tile_cache()->freshness(tile_spec);
+  QNetworkReply *reply = m_plugin->get(url, validators);
+  QcWmtsNetworkReply * wmts_reply = new QcWmtsNetworkReply(reply, tile_spec, layer->image_format());
 
-  return new QcWmtsNetworkReply(reply, tile_spec, layer->image_format());
+  return wmts_reply;
+}
+
+QString
+QcWmtsNetworkTileFetcher::tile_host(const QcTileSpec & tile_spec) const
+{
+  return m_plugin->layer(tile_spec)->url(tile_spec).host();
 }
 
 /**************************************************************************************************/
@@ -33,6 +33,7 @@
 
 /**************************************************************************************************/
 
+#include "wmts/wmts_network_reply.h"
 #include "wmts/wmts_tile_fetcher.h"
 
 /**************************************************************************************************/
@@ -55,6 +56,7 @@ public:
 
 private:
   QcWmtsReply * get_tile_image(const QcTileSpec & tile_spec);
+  QString tile_host(const QcTileSpec & tile_spec) const override;
 
 private:
   QcWmtsPlugin * m_plugin;
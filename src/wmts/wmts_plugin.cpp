@@ -94,20 +94,31 @@ QcWmtsPluginLayer::create_tile_spec(int level, int x, int y) const
   return m_plugin->create_tile_spec(m_map_id, level, x, y);
 }
 
+QcTileKey
+QcWmtsPluginLayer::create_tile_key(int level, int x, int y) const
+{
+  return m_plugin->create_tile_key(m_map_id, level, x, y);
+}
+
 /**************************************************************************************************/
 
 QcWmtsPlugin::QcWmtsPlugin(const QString & name, const QString & title, QcTileMatrixSet * tile_matrix_set)
   : QObject(),
     m_name(name),
+    m_plugin_id(QcTilePluginRegistry::instance().id(name)),
     m_title(title),
     m_tile_matrix_set(tile_matrix_set),
     m_user_agent("QtCarto based application"),
+    m_network_settings(),
+    m_network_statistics(),
+    m_http2_used(false),
     m_network_manager(new QNetworkAccessManager()), // Fixme: delete ?, segfault if this is parent
     m_tile_fetcher(this),
     m_wmts_manager(name)
 {
   wmts_manager()->set_tile_fetcher(&m_tile_fetcher);
   wmts_manager()->tile_cache(); // create a file tile cache
+  update_fetcher_limits();
 
   // wmts_manager()->tile_cache()->clear_all();
 }
@@ -154,16 +165,88 @@ QcWmtsPlugin::make_layer_url(const QcTileSpec & tile_spec) const
   return layer(tile_spec)->url(tile_spec);
 }
 
-QNetworkReply *
-QcWmtsPlugin::get(const QUrl & url)
+void
+QcWmtsPlugin::set_network_settings(const QcWmtsNetworkSettings & settings)
+{
+  m_network_settings = settings;
+  update_fetcher_limits();
+}
+
+/* The connection pool is enforced by the fetcher as a number of requests
+ * in flight per host, it is raised to the number of HTTP/2 streams once
+ * the server is known to multiplex the requests.
+ */
+void
+QcWmtsPlugin::update_fetcher_limits()
+{
+  bool multiplexed = m_network_settings.http2_enabled && m_http2_used;
+  int max_in_flight_per_host = multiplexed ?
+    m_network_settings.max_http2_streams_per_host : m_network_settings.max_connections_per_host;
+  m_tile_fetcher.set_max_in_flight_per_host(max_in_flight_per_host);
+  m_tile_fetcher.set_max_in_flight_per_provider(m_network_settings.max_requests_in_flight);
+}
+
+QNetworkRequest
+QcWmtsPlugin::make_request(const QUrl & url) const
 {
   QNetworkRequest request;
-  request.setRawHeader("User-Agent", m_user_agent);
+  request.setHeader(QNetworkRequest::UserAgentHeader, m_user_agent);
   request.setUrl(url);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+  request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, m_network_settings.http2_enabled);
+#endif
+  request.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, m_network_settings.pipelining_enabled);
+  return request;
+}
+
+void
+QcWmtsPlugin::count_transfer(QNetworkReply * reply)
+{
+  m_network_statistics.requests++;
+
+  connect(reply, &QNetworkReply::downloadProgress, this, [this, reply](qint64 bytes_received, qint64) {
+      // progress is cumulative
+      qint64 last_bytes_received = reply->property("qc_bytes_received").toLongLong();
+      m_network_statistics.bytes_received += bytes_received - last_bytes_received;
+      reply->setProperty("qc_bytes_received", bytes_received);
+    });
+
+  connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+      m_network_statistics.replies++;
+      if (reply->error() != QNetworkReply::NoError)
+        m_network_statistics.errors++;
+      if (reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool())
+        m_network_statistics.cached_replies++;
+      if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304)
+        m_network_statistics.not_modified_replies++;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+      if (reply->attribute(QNetworkRequest::HTTP2WasUsedAttribute).toBool()) {
+        m_network_statistics.http2_replies++;
+        if (!m_http2_used) {
+          m_http2_used = true;
+          update_fetcher_limits();
+        }
+      }
+#endif
+    });
+}
+
+QNetworkReply *
+QcWmtsPlugin::get(const QUrl & url, const QcTileFreshness & validators)
+{
+  QNetworkRequest request = make_request(url);
+  if (validators.has_validators()) {
+    if (!validators.etag.isEmpty())
+      request.setRawHeader("If-None-Match", validators.etag);
+    if (validators.last_modified >= 0)
+      request.setRawHeader("If-Modified-Since", QcTileFreshness::to_http_date(validators.last_modified));
+    m_network_statistics.conditional_requests++;
+  }
 
   QNetworkReply * reply = m_network_manager->get(request);
   if (reply->error() != QNetworkReply::NoError)
     qWarning() << __FUNCTION__ << reply->errorString();
+  count_transfer(reply);
 
   return reply;
 }
@@ -171,14 +254,13 @@ QcWmtsPlugin::get(const QUrl & url)
 QNetworkReply *
 QcWmtsPlugin::post(const QUrl & url, const QByteArray & data)
 {
-  QNetworkRequest request;
-  request.setHeader(QNetworkRequest::UserAgentHeader, m_user_agent);
+  QNetworkRequest request = make_request(url);
   request.setHeader(QNetworkRequest::ContentTypeHeader, "text/xml;charset=UTF-8");
-  request.setUrl(url);
 
   QNetworkReply * reply = m_network_manager->post(request, data);
   if (reply->error() != QNetworkReply::NoError)
     qWarning() << __FUNCTION__ << reply->errorString();
+  count_transfer(reply);
 
   return reply;
 }
@@ -33,12 +33,14 @@
 
 /**************************************************************************************************/
 
+#include "cache/tile_freshness.h"
 #include "coordinate/mercator.h"
 #include "wmts/elevation_service_reply.h"
 #include "wmts/location_service_query.h"
 #include "wmts/location_service_reply.h"
 #include "wmts/tile_matrix_set.h"
 #include "wmts/wmts_manager.h"
+#include "wmts/wmts_network_settings.h"
 #include "wmts/wmts_network_tile_fetcher.h"
 
 #include <QNetworkAccessManager>
@@ -81,6 +83,7 @@ public:
 
   QString hash_name() const;
   QcTileSpec create_tile_spec(int level, int x, int y) const;
+  QcTileKey create_tile_key(int level, int x, int y) const;
 
   virtual QUrl url(const QcTileSpec & tile_spec) const = 0;
 
@@ -104,6 +107,7 @@ public:
   ~QcWmtsPlugin();
 
   const QString & name() const { return m_name; }
+  int plugin_id() const { return m_plugin_id; }
   const QString & title() const { return m_title; }
   QcTileMatrixSet & tile_matrix_set() { return *m_tile_matrix_set; } // Fixme: const ?
   const QcProjection & projection() const { return m_tile_matrix_set->projection(); }
@@ -115,6 +119,10 @@ public:
 
   void set_user_agent(const QByteArray & user_agent) { m_user_agent = user_agent; }
 
+  const QcWmtsNetworkSettings & network_settings() const { return m_network_settings; }
+  void set_network_settings(const QcWmtsNetworkSettings & settings);
+  const QcWmtsNetworkStatistics & network_statistics() const { return m_network_statistics; }
+
   void add_layer(const QcWmtsPluginLayer * layer);
   const QList<const QcWmtsPluginLayer *> & layers() const { return m_layers; }
   // Fimxe: * vs & ?
@@ -126,6 +134,9 @@ public:
   QcTileSpec create_tile_spec(int map_id, int level, int x, int y) const {
     return QcTileSpec(m_name, map_id, level, x, y);
   }
+  QcTileKey create_tile_key(int map_id, int level, int x, int y) const {
+    return QcTileKey(m_plugin_id, map_id, level, x, y);
+  }
   // Fixme: usefull ?
   QUrl make_layer_url(const QcTileSpec & tile_spec) const;
 
@@ -139,18 +150,28 @@ public:
 
   // Fixme: protect ?
   // Fixme: networking could be moved in a dedicated class (QcWmtsNetworkTileFetcher but ols)
-  QNetworkReply * get(const QUrl & url);
+  // A conditional request is sent if validators are given
+  QNetworkReply * get(const QUrl & url, const QcTileFreshness & validators = QcTileFreshness());
   QNetworkReply * post(const QUrl & url, const QByteArray & data);
 
   // off-line cache : load tiles from a polygon
 
+private:
+  QNetworkRequest make_request(const QUrl & url) const;
+  void count_transfer(QNetworkReply * reply);
+  void update_fetcher_limits();
+
 private:
   QString m_name;
+  int m_plugin_id;
   QString m_title;
   QList<const QcWmtsPluginLayer *> m_layers;
   QHash<int, const QcWmtsPluginLayer *> m_layer_map;
   QSharedPointer<QcTileMatrixSet> m_tile_matrix_set;
   QByteArray m_user_agent;
+  QcWmtsNetworkSettings m_network_settings;
+  QcWmtsNetworkStatistics m_network_statistics;
+  bool m_http2_used; // by the server
   QNetworkAccessManager * m_network_manager; // share network manager for all requests: tile, ols, ...
   QcWmtsNetworkTileFetcher m_tile_fetcher;
   QcWmtsManager m_wmts_manager;
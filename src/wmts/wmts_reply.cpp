@@ -83,8 +83,11 @@
 */
 QcWmtsReply::QcWmtsReply(QNetworkReply * reply, const QcTileSpec & tile_spec)
   : QcNetworkReply(reply),
-    m_tile_spec(tile_spec)
-{}
+    m_tile_spec(tile_spec),
+    m_not_modified(false)
+{
+  m_timer.start();
+}
 
 /*!
   Destroys this tiled map reply object.
@@ -69,11 +69,13 @@
 
 /**************************************************************************************************/
 
+#include "cache/tile_freshness.h"
 #include "qtcarto_global.h"
 #include "wmts/network_reply.h"
 #include "wmts/tile_spec.h"
 
 #include <QByteArray>
+#include <QElapsedTimer>
 #include <QObject>
 #include <QString>
 
@@ -100,12 +102,20 @@ class QC_EXPORT QcWmtsReply : public QcNetworkReply // QcNetworkFuture
   QByteArray map_image_data() const { return m_map_image_data; }
   // Returns the format of the tile image.
   QString map_image_format() const { return m_map_image_format; }
+  //! Returns the HTTP freshness of the tile.
+  const QcTileFreshness & freshness() const { return m_freshness; }
+  //! Returns true if the cached tile was revalidated, the reply has no data.
+  bool is_not_modified() const { return m_not_modified; }
+  //! Returns the time elapsed since the request was sent in us.
+  qint64 elapsed() const { return m_timer.nsecsElapsed() / 1000; }
 
  protected:
   //! Sets the tile image data to \a data.
   void set_map_image_data(const QByteArray & data) { m_map_image_data = data; }
   //! Sets the format of the tile image to \a format.
   void set_map_image_format(const QString & format) { m_map_image_format = format; }
+  void set_freshness(const QcTileFreshness & freshness) { m_freshness = freshness; }
+  void set_not_modified(bool not_modified) { m_not_modified = not_modified; }
 
  private:
   Q_DISABLE_COPY(QcWmtsReply);
@@ -114,6 +124,9 @@ class QC_EXPORT QcWmtsReply : public QcNetworkReply // QcNetworkFuture
   QcTileSpec m_tile_spec;
   QByteArray m_map_image_data;
   QString m_map_image_format;
+  QcTileFreshness m_freshness;
+  bool m_not_modified;
+  QElapsedTimer m_timer;
 };
 
 /**************************************************************************************************/
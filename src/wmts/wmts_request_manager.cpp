@@ -70,25 +70,6 @@
 
 /**************************************************************************************************/
 
-QcRetryFuture::QcRetryFuture(const QcTileSpec & tile_spec, QcMapViewLayer * map_view_layer, QcWmtsManager * wmts_manager)
-  : QObject(),
-    m_tile_spec(tile_spec),
-    m_map_view_layer(map_view_layer),
-    m_wmts_manager(wmts_manager)
-{}
-
-void
-QcRetryFuture::retry()
-{
-  if (!m_wmts_manager.isNull()) {
-    QcTileSpecSet request_tiles = {m_tile_spec};
-    QcTileSpecSet cancel_tiles;
-    m_wmts_manager->update_tile_requests(m_map_view_layer, request_tiles, cancel_tiles);
-  }
-}
-
-/**************************************************************************************************/
-
 QcWmtsRequestManager::QcWmtsRequestManager(QcMapViewLayer * map_view_layer, QcWmtsManager * wmts_manager)
   : m_map_view_layer(map_view_layer),
     m_wmts_manager(wmts_manager)
@@ -112,43 +93,95 @@ QcWmtsRequestManager::request_tiles(const QcTileSpecSet & tile_specs)
   // Fixme: m_wmts_manager.isNull()?
 
   QcTileSpecSet canceled_tiles = m_requested - tile_specs;
-  QcTileSpecSet requested_tiles = tile_specs - m_requested;
+  return update_tile_requests(tile_specs, canceled_tiles);
+}
+
+/*! Request the tiles which became visible and cancel the tiles which are no
+ *  longer visible, the cost is proportional to the size of the changes.
+ *
+ *  Return the textures which are already available.
+ */
+QList<QSharedPointer<QcTileTexture> >
+QcWmtsRequestManager::update_tile_requests(const QcTileSpecSet & added_tiles,
+                                           const QcTileSpecSet & removed_tiles)
+{
+  QcTileSpecSet canceled_tiles;
+  for (const auto & tile_spec : removed_tiles)
+    if (m_requested.contains(tile_spec) && !added_tiles.contains(tile_spec))
+      canceled_tiles.insert(tile_spec);
+  QcTileSpecSet requested_tiles;
+  for (const auto & tile_spec : added_tiles)
+    if (!m_requested.contains(tile_spec))
+      requested_tiles.insert(tile_spec);
 
   // Remove tiles in cache from request tiles
+  // Tiles which are being decoded are delivered later by tile_fetched
   QcTileSpecSet cached_tiles;
   QList<QSharedPointer<QcTileTexture> > cached_textures;
   if (!m_wmts_manager.isNull()) {
     for (auto & tile_spec : requested_tiles) {
-      QSharedPointer<QcTileTexture> texture = m_wmts_manager->get_tile_texture(tile_spec);
+      bool pending = false;
+      QSharedPointer<QcTileTexture> texture =
+        m_wmts_manager->get_tile_texture_async(m_map_view_layer, tile_spec, pending);
       if (texture) {
 	cached_tiles.insert(tile_spec);
 	cached_textures << texture;
-      }
+      } else if (pending)
+	cached_tiles.insert(tile_spec);
     }
   }
   requested_tiles -= cached_tiles;
 
   m_requested -= canceled_tiles;
   m_requested += requested_tiles;
+  // The visible tiles are no longer prefetched
+  m_prefetched -= added_tiles;
 
   // qInfo() << "currently requested" << m_requested << "\ncached" << cached_tiles << "\n+" << requested_tiles << "\n-" << canceled_tiles;
 
   if ((!requested_tiles.isEmpty() || !canceled_tiles.isEmpty())
       && (!m_wmts_manager.isNull())) {
     m_wmts_manager->update_tile_requests(m_map_view_layer, requested_tiles, canceled_tiles);
-
-    // Fixme: ??? place ???
-    // Remove any cancelled tiles from the error retry hash to avoid
-    // re-using the numbers for a totally different request cycle.
-    for (auto & tile_spec : canceled_tiles) {
-      m_retries.remove(tile_spec);
-      m_futures.remove(tile_spec);
-    }
   }
 
   return cached_textures;
 }
 
+//! Forward the viewport focus used to prioritise the tile requests.
+void
+QcWmtsRequestManager::update_request_focus(const QcTileRequestFocus & focus)
+{
+  if (!m_wmts_manager.isNull())
+    m_wmts_manager->update_request_focus(focus);
+}
+
+/*! Request the tiles of a predicted viewport and cancel the previous
+ *  prefetches which are no longer predicted.
+ *
+ *  Tiles which are already requested for the viewport are skipped, as well
+ *  as new prefetches while the provider is in trouble.
+ */
+void
+QcWmtsRequestManager::update_prefetch_requests(const QcTileSpecSet & tile_specs)
+{
+  if (m_wmts_manager.isNull())
+    return;
+
+  QcTileSpecSet canceled_tiles = m_prefetched - tile_specs;
+  QcTileSpecSet requested_tiles;
+  if (m_wmts_manager->circuit_breaker().is_closed())
+    for (const auto & tile_spec : tile_specs)
+      if (!m_prefetched.contains(tile_spec) && !m_requested.contains(tile_spec))
+        requested_tiles.insert(tile_spec);
+
+  m_prefetched -= canceled_tiles;
+  m_prefetched += requested_tiles;
+
+  // qInfo() << "prefetch +" << requested_tiles << "-" << canceled_tiles;
+  if (!requested_tiles.isEmpty() || !canceled_tiles.isEmpty())
+    m_wmts_manager->update_tile_requests(m_map_view_layer, requested_tiles, canceled_tiles, true);
+}
+
 /*! Notify the map view that a tile is fetched.
  *
  */
@@ -158,37 +191,32 @@ QcWmtsRequestManager::tile_fetched(const QcTileSpec & tile_spec)
   // qInfo();
   m_map_view_layer->update_tile(tile_spec);
   m_requested.remove(tile_spec);
-  m_retries.remove(tile_spec);
-  m_futures.remove(tile_spec);
+  m_prefetched.remove(tile_spec);
 }
 
-/*! Retry to fetch an errored tile request.
+/*! Forget a tile request that the WMTS Manager gave up.
  *
  */
 void
 QcWmtsRequestManager::tile_error(const QcTileSpec & tile_spec, const QString & error_string)
 {
   // qInfo();
-  if (m_requested.contains(tile_spec)) {
-    int count = m_retries.value(tile_spec, 0);
-    m_retries.insert(tile_spec, count + 1);
-
-    if (count >= 5) {
-      qWarning("QcWmtsRequestManager: Failed to fetch tile (%d,%d,%d) 5 times, giving up. "
-	       "Last error message was: '%s'",
-           tile_spec.x(), tile_spec.y(), tile_spec.level(), qPrintable(error_string));
-      m_requested.remove(tile_spec);
-      m_retries.remove(tile_spec);
-      m_futures.remove(tile_spec);
-    } else {
-      qDebug() << "Retry x" << count << tile_spec;
-      // Exponential time backoff when retrying
-      int delay = (1 << count) * 500;
-      QSharedPointer<QcRetryFuture> future(new QcRetryFuture(tile_spec, m_map_view_layer, m_wmts_manager));
-      m_futures.insert(tile_spec, future);
-      QTimer::singleShot(delay, future.data(), SLOT(retry()));
-      // Passing .data() to singleShot is ok -- Qt will clean up the connection if the target qobject is deleted
-    }
+  Q_UNUSED(error_string);
+  m_requested.remove(tile_spec);
+  m_prefetched.remove(tile_spec);
+}
+
+/*! Fetch a tile from the network when its cached image cannot be decoded.
+ *
+ */
+void
+QcWmtsRequestManager::tile_decode_error(const QcTileSpec & tile_spec)
+{
+  if (!m_wmts_manager.isNull()) {
+    QcTileSpecSet request_tiles = {tile_spec};
+    QcTileSpecSet cancel_tiles;
+    m_requested.insert(tile_spec);
+    m_wmts_manager->update_tile_requests(m_map_view_layer, request_tiles, cancel_tiles);
   }
 }
 
@@ -204,6 +232,39 @@ QcWmtsRequestManager::tile_texture(const QcTileSpec & tile_spec)
     return QSharedPointer<QcTileTexture>();
 }
 
+/*! Return the texture if it is in the texture tier of the cache.
+ *
+ *  Unlike tile_texture, it never loads nor decodes the tile.
+ */
+QSharedPointer<QcTileTexture>
+QcWmtsRequestManager::peek_tile_texture(const QcTileKey & tile_key)
+{
+  if (!m_wmts_manager.isNull())
+    return m_wmts_manager->tile_cache()->peek_texture(tile_key);
+  else
+    return QSharedPointer<QcTileTexture>();
+}
+
+//! Return true if the tile is in a tier of the cache
+bool
+QcWmtsRequestManager::is_tile_cached(const QcTileSpec & tile_spec)
+{
+  if (!m_wmts_manager.isNull())
+    return m_wmts_manager->tile_cache()->contains(tile_spec);
+  else
+    return false;
+}
+
+//! Read a tile on disk into the memory tier of the cache
+bool
+QcWmtsRequestManager::warm_tile(const QcTileSpec & tile_spec)
+{
+  if (!m_wmts_manager.isNull())
+    return m_wmts_manager->tile_cache()->warm(tile_spec);
+  else
+    return false;
+}
+
 /**************************************************************************************************/
 
 // #include "wmts_request_manager.moc"
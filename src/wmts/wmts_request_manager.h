@@ -89,27 +89,16 @@ class QcMapViewLayer; // circular
 
 /**************************************************************************************************/
 
-// Represents a tile that needs to be retried after a certain period of time
-class QcRetryFuture : public QObject
-{
-  Q_OBJECT
-
- public:
-  QcRetryFuture(const QcTileSpec & tile_spec, QcMapViewLayer * map_view_layer, QcWmtsManager * wmts_manager);
-
- public slots:
-  void retry();
-
- private:
-  QcTileSpec m_tile_spec;
-  QcMapViewLayer * m_map_view_layer;
-  QPointer<QcWmtsManager> m_wmts_manager;
-};
-
 /*! This class implements a WMTS Request Manager for a map view.
  *
  * It works as a proxy between the map view and WTMS Request Manager.
  *
+ * Errored requests are retried by the WMTS Manager, the retry state is
+ * shared by the map views requesting a tile.
+ *
+ * Prefetched tiles are requested for a predicted viewport, a prefetch
+ * becomes a regular request when the tile becomes visible.
+ *
  */
 class QcWmtsRequestManager : public QObject
 {
@@ -120,11 +109,20 @@ class QcWmtsRequestManager : public QObject
   ~QcWmtsRequestManager();
 
   QList<QSharedPointer<QcTileTexture> > request_tiles(const QcTileSpecSet & tile_specs);
+  QList<QSharedPointer<QcTileTexture> > update_tile_requests(const QcTileSpecSet & added_tiles,
+                                                               const QcTileSpecSet & removed_tiles);
+  void update_request_focus(const QcTileRequestFocus & focus);
+  void update_prefetch_requests(const QcTileSpecSet & tile_specs);
+  bool is_prefetched(const QcTileSpec & tile_spec) const { return m_prefetched.contains(tile_spec); }
 
   void tile_fetched(const QcTileSpec & tile_spec);
   void tile_error(const QcTileSpec & tile_spec, const QString & error_string);
+  void tile_decode_error(const QcTileSpec & tile_spec);
 
   QSharedPointer<QcTileTexture> tile_texture(const QcTileSpec & tile_spec);
+  QSharedPointer<QcTileTexture> peek_tile_texture(const QcTileKey & tile_key);
+  bool is_tile_cached(const QcTileSpec & tile_spec);
+  bool warm_tile(const QcTileSpec & tile_spec);
 
  private:
   Q_DISABLE_COPY(QcWmtsRequestManager)
@@ -132,9 +130,8 @@ class QcWmtsRequestManager : public QObject
  private:
   QcMapViewLayer * m_map_view_layer;
   QPointer<QcWmtsManager> m_wmts_manager;
-  QHash<QcTileSpec, int> m_retries;
-  QHash<QcTileSpec, QSharedPointer<QcRetryFuture> > m_futures;
   QcTileSpecSet m_requested;
+  QcTileSpecSet m_prefetched; // requested ahead of the viewport
 };
 
 // QC_END_NAMESPACE
@@ -63,6 +63,7 @@
 /**************************************************************************************************/
 
 #include "wmts_tile_fetcher.h"
+#include "cache/tile_cache_metrics.h"
 
 #include <QtCore/QTimerEvent>
 
@@ -72,8 +73,17 @@
 
 QcWmtsTileFetcher::QcWmtsTileFetcher()
   : QObject(),
-    m_enabled(true)
+    m_enabled(true),
+    m_queue_size(0),
+    m_max_in_flight_per_provider(8),
+    m_max_in_flight_per_host(6),
+    m_batch_size(8),
+    m_max_queue_depth(0),
+    m_max_in_flight_count(0),
+    m_metrics(nullptr)
 {
+  qRegisterMetaType<QcTileFreshness>();
+
   // Fixme: useless ?
   // if (!m_queue.isEmpty())
   //   m_timer.start(0, this);
@@ -82,6 +92,45 @@ QcWmtsTileFetcher::QcWmtsTileFetcher()
 QcWmtsTileFetcher::~QcWmtsTileFetcher()
 {}
 
+QString
+QcWmtsTileFetcher::tile_host(const QcTileSpec & tile_spec) const
+{
+  Q_UNUSED(tile_spec);
+  return QString();
+}
+
+void
+QcWmtsTileFetcher::set_rate_limit(const QString & provider, double rate, double burst)
+{
+  QMutexLocker mutex_locker(&m_queue_mutex);
+
+  if (rate > 0)
+    m_rate_limiters[provider].set_rate(rate, burst);
+  else
+    m_rate_limiters.remove(provider);
+}
+
+int
+QcWmtsTileFetcher::queue_depth() const
+{
+  QMutexLocker mutex_locker(&m_queue_mutex);
+  return m_queue_size;
+}
+
+int
+QcWmtsTileFetcher::in_flight_count() const
+{
+  QMutexLocker mutex_locker(&m_queue_mutex);
+  return m_invmap.size();
+}
+
+int
+QcWmtsTileFetcher::in_flight_count(const QString & provider) const
+{
+  QMutexLocker mutex_locker(&m_queue_mutex);
+  return m_in_flight_per_provider.value(provider);
+}
+
 void
 QcWmtsTileFetcher::update_tile_requests(const QcTileSpecSet & tiles_added,
 					const QcTileSpecSet & tiles_removed)
@@ -90,13 +139,57 @@ QcWmtsTileFetcher::update_tile_requests(const QcTileSpecSet & tiles_added,
   // << tiles_added;
   // << tiles_removed;
 
+  int depth, in_flight;
+  {
+    QMutexLocker mutex_locker(&m_queue_mutex);
+    cancel_tile_requests(tiles_removed);
+    add_tile_requests(tiles_added, false);
+    update_queue_metrics(depth, in_flight);
+  }
+  emit queue_changed(depth, in_flight);
+}
+
+//! Same as update_tile_requests for tiles which are not yet visible
+void
+QcWmtsTileFetcher::update_prefetch_requests(const QcTileSpecSet & tiles_added,
+                                            const QcTileSpecSet & tiles_removed)
+{
+  int depth, in_flight;
+  {
+    QMutexLocker mutex_locker(&m_queue_mutex);
+    cancel_tile_requests(tiles_removed);
+    add_tile_requests(tiles_added, true);
+    update_queue_metrics(depth, in_flight);
+  }
+  emit queue_changed(depth, in_flight);
+}
+
+/*! Move up the queued prefetches which became visible.
+ *
+ *  The other tiles are left unchanged, in particular a tile waiting for a
+ *  retry is not queued.
+ */
+void
+QcWmtsTileFetcher::promote_tile_requests(const QcTileSpecSet & tiles)
+{
   QMutexLocker mutex_locker(&m_queue_mutex);
 
-  cancel_tile_requests(tiles_removed);
-  m_queue += tiles_added.toList();
+  for (const QcTileSpec & tile_spec: tiles) {
+    auto it = m_queues.find(tile_spec.plugin());
+    if (it != m_queues.end() && it->is_prefetch(tile_spec))
+      it->push(tile_spec);
+  }
+}
+
+void
+QcWmtsTileFetcher::add_tile_requests(const QcTileSpecSet & tile_specs, bool prefetch)
+{
+  for (const QcTileSpec & tile_spec: tile_specs)
+    if (!m_invmap.contains(tile_spec) && m_queues[tile_spec.plugin()].push(tile_spec, prefetch))
+      m_queue_size++;
 
   // Start timer to fetch tiles from queue
-  if (m_enabled && !m_queue.isEmpty() && !m_timer.isActive()) {
+  if (m_enabled && m_queue_size && !m_timer.isActive()) {
     m_timer.start(0, this);
   }
 }
@@ -109,51 +202,185 @@ QcWmtsTileFetcher::cancel_tile_requests(const QcTileSpecSet & tiles)
     QcWmtsReply * reply = m_invmap.value(tile_spec, nullptr);
     if (reply) {
       m_invmap.remove(tile_spec);
+      release_slot(tile_spec);
       reply->abort();
       if (reply->is_finished())
 	reply->deleteLater();
     }
     // Fixme: else ?
-    m_queue.removeAll(tile_spec);
+    auto it = m_queues.find(tile_spec.plugin());
+    if (it != m_queues.end() && it->remove(tile_spec))
+      m_queue_size--;
   }
 }
 
 void
-QcWmtsTileFetcher::request_next_tile()
+QcWmtsTileFetcher::set_request_focus(const QString & provider, const QcTileRequestFocus & focus)
 {
-  // qInfo();
-
   QMutexLocker mutex_locker(&m_queue_mutex);
+  m_queues[provider].set_focus(focus);
+}
 
-  if (!m_enabled || m_queue.isEmpty())
-    return;
+/* Check the in flight limits and the rate limit of a queued tile.
+ *
+ * Set delay to the time to wait for a token if the tile is rate
+ * limited, the host is computed once the provider has a free slot.
+ */
+QcWmtsTileFetcher::DispatchStatus
+QcWmtsTileFetcher::can_dispatch(const QcTileSpec & tile_spec, QString & host, int & delay)
+{
+  const QString & provider = tile_spec.plugin();
+  if (m_max_in_flight_per_provider > 0 &&
+      m_in_flight_per_provider.value(provider) >= m_max_in_flight_per_provider)
+    return ProviderBusy;
+
+  host = tile_host(tile_spec);
+  if (!host.isEmpty() && m_max_in_flight_per_host > 0 &&
+      m_in_flight_per_host.value(host) >= m_max_in_flight_per_host)
+    return HostBusy;
+
+  auto it = m_rate_limiters.find(provider);
+  if (it != m_rate_limiters.end() && !it->try_acquire()) {
+    delay = it->time_to_next_token();
+    return RateLimited;
+  }
 
-  QcTileSpec tile_spec = m_queue.takeFirst();
+  return Dispatchable;
+}
 
+/* Send the request of a tile.
+ *
+ * A reply which is already finished is added to finished_replies, it is
+ * handled once the mutex is released.
+ */
+void
+QcWmtsTileFetcher::dispatch(const QcTileSpec & tile_spec, const QString & host,
+                            QList<QcWmtsReply *> & finished_replies)
+{
   // qInfo() << tile_spec;
   QcWmtsReply *wmts_reply = get_tile_image(tile_spec);
 
   // If the request is already finished then handle it
   // Else connect the finished signal
   if (wmts_reply->is_finished()) {
-    handle_reply(wmts_reply, tile_spec);
+    finished_replies << wmts_reply;
   } else {
     connect(wmts_reply, SIGNAL(finished()),
-	    this, SLOT(finished()),
-	    Qt::QueuedConnection);
+            this, SLOT(finished()),
+            Qt::QueuedConnection);
     m_invmap.insert(tile_spec, wmts_reply);
+    m_in_flight_hosts.insert(tile_spec, host);
+    m_in_flight_per_provider[tile_spec.plugin()]++;
+    if (!host.isEmpty())
+      m_in_flight_per_host[host]++;
   }
+}
 
-  if (m_queue.isEmpty())
-    m_timer.stop();
+void
+QcWmtsTileFetcher::release_slot(const QcTileSpec & tile_spec)
+{
+  QString host = m_in_flight_hosts.take(tile_spec);
+
+  const QString & provider = tile_spec.plugin();
+  if (--m_in_flight_per_provider[provider] <= 0)
+    m_in_flight_per_provider.remove(provider);
+
+  if (!host.isEmpty() && --m_in_flight_per_host[host] <= 0)
+    m_in_flight_per_host.remove(host);
 }
 
+/* Record the depth of the queue and the number of requests in flight.
+ *
+ * The caller emits queue_changed once the mutex is released, a slot can
+ * call back the fetcher.
+ */
 void
-QcWmtsTileFetcher::finished()
+QcWmtsTileFetcher::update_queue_metrics(int & depth, int & in_flight)
+{
+  depth = m_queue_size;
+  in_flight = m_invmap.size();
+  m_max_queue_depth = qMax(m_max_queue_depth, depth);
+  m_max_in_flight_count = qMax(m_max_in_flight_count, in_flight);
+
+  if (m_metrics)
+    m_metrics->record_fetch_queue(depth, in_flight);
+}
+
+void
+QcWmtsTileFetcher::request_next_tile()
 {
   // qInfo();
 
-  QMutexLocker mutex_locker(&m_queue_mutex);
+  QList<QcWmtsReply *> finished_replies;
+  int depth, in_flight;
+  {
+    QMutexLocker mutex_locker(&m_queue_mutex);
+
+    if (!m_enabled || !m_queue_size) {
+      m_timer.stop();
+      return;
+    }
+
+    // Dispatch a batch of tiles in priority order, one tile per provider
+    // and per round.  Tiles which are blocked by a limit keep their place.
+    int dispatched = 0;
+    int delay = 0; // to wait for a token
+    bool progress = true;
+    while (progress && dispatched < m_batch_size) {
+      progress = false;
+      for (auto it = m_queues.begin(); it != m_queues.end() && dispatched < m_batch_size; ++it) {
+        QcTileRequestQueue & queue = it.value();
+        QList<QcTileSpec> skipped;
+        while (!queue.is_empty()) {
+          QString host;
+          int token_delay = 0;
+          DispatchStatus status = can_dispatch(queue.top(), host, token_delay);
+          if (status == Dispatchable) {
+            QcTileSpec tile_spec = queue.pop();
+            m_queue_size--;
+            dispatch(tile_spec, host, finished_replies);
+            dispatched++;
+            progress = true;
+            break;
+          } else if (status == RateLimited) {
+            delay = delay ? qMin(delay, token_delay) : token_delay;
+            break;
+          } else if (status == ProviderBusy) {
+            break;
+          }
+          // Only this host is busy, look a bit further for another host
+          skipped << queue.pop();
+          if (skipped.size() >= m_batch_size)
+            break;
+        }
+        for (const auto & tile_spec : skipped)
+          queue.push(tile_spec);
+      }
+    }
+
+    // Continue on the next turn if the batch is full, else wait for a
+    // token or for a request to finish
+    if (!m_queue_size)
+      m_timer.stop();
+    else if (dispatched == m_batch_size)
+      m_timer.start(0, this);
+    else if (delay)
+      m_timer.start(delay, this);
+    else
+      m_timer.stop();
+
+    update_queue_metrics(depth, in_flight);
+  }
+
+  for (auto * wmts_reply : finished_replies)
+    handle_reply(wmts_reply, wmts_reply->tile_spec());
+  emit queue_changed(depth, in_flight);
+}
+
+void
+QcWmtsTileFetcher::finished()
+{
+  // qInfo();
 
   QcWmtsReply *wmts_reply = qobject_cast<QcWmtsReply *>(sender());
   if (!wmts_reply) // Fixme: when ?
@@ -161,14 +388,28 @@ QcWmtsTileFetcher::finished()
 
   QcTileSpec tile_spec = wmts_reply->tile_spec();
 
-  if (!m_invmap.contains(tile_spec)) { // Fixme: when ?
-    wmts_reply->deleteLater();
-    return;
-  }
+  int depth, in_flight;
+  {
+    QMutexLocker mutex_locker(&m_queue_mutex);
 
-  m_invmap.remove(tile_spec);
+    if (!m_invmap.contains(tile_spec)) { // Fixme: when ?
+      wmts_reply->deleteLater();
+      return;
+    }
 
+    m_invmap.remove(tile_spec);
+    release_slot(tile_spec);
+
+    // A slot is free
+    if (m_enabled && m_queue_size)
+      m_timer.start(0, this);
+
+    update_queue_metrics(depth, in_flight);
+  }
+
+  // The slots can call back the fetcher
   handle_reply(wmts_reply, tile_spec);
+  emit queue_changed(depth, in_flight);
 }
 
 void
@@ -178,13 +419,14 @@ QcWmtsTileFetcher::timerEvent(QTimerEvent * event)
   if (event->timerId() != m_timer.timerId()) { // Fixme: when ?
     QObject::timerEvent(event);
     return;
-  } else if (m_queue.isEmpty()) {
+  } else if (!m_queue_size) {
     m_timer.stop();
     return;
   } else
     request_next_tile();
 }
 
+// Emit the signal of a finished reply, the queue mutex must not be held
 void
 QcWmtsTileFetcher::handle_reply(QcWmtsReply * wmts_reply, const QcTileSpec & tile_spec)
 {
@@ -195,10 +437,19 @@ QcWmtsTileFetcher::handle_reply(QcWmtsReply * wmts_reply, const QcTileSpec & til
     return;
   }
 
+  if (m_metrics)
+    m_metrics->record_fetch(tile_spec.plugin(), wmts_reply->elapsed(),
+                            wmts_reply->error() != QcWmtsReply::NoError);
+
   // emit signal according to the reply status
-  if (wmts_reply->error() == QcWmtsReply::NoError) {
+  if (wmts_reply->error() == QcWmtsReply::NoError && wmts_reply->is_not_modified()) {
+    emit tile_not_modified(tile_spec, wmts_reply->freshness());
+  } else if (wmts_reply->error() == QcWmtsReply::NoError) {
     // qInfo() << "emit tile_finished" << tile_spec;
-    emit tile_finished(tile_spec, wmts_reply->map_image_data(), wmts_reply->map_image_format());
+    emit tile_finished(tile_spec, wmts_reply->map_image_data(), wmts_reply->map_image_format(),
+                       wmts_reply->freshness());
+  } else if (wmts_reply->error() == QcWmtsReply::ContentNotFoundError) {
+    emit tile_not_found(tile_spec);
   } else {
     // qInfo() << "emit tile_error" << tile_spec;
     emit tile_error(tile_spec, wmts_reply->error_string());
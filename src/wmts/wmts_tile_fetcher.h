@@ -78,13 +78,17 @@
 #include <QTimer>
 
 #include "qtcarto_global.h"
+#include "wmts/tile_request_queue.h"
 #include "wmts/tile_spec.h"
+#include "wmts/token_bucket.h"
 #include "wmts/wmts_reply.h"
 
 /**************************************************************************************************/
 
 // QC_BEGIN_NAMESPACE
 
+class QcTileCacheMetrics;
+
 /**************************************************************************************************/
 
 /*! This class implements a WMTS Tile Fetcher abstract class for WMTS
@@ -94,6 +98,15 @@
  * It manages a request queue, schedule requests and
  * emit a signal when a request finishes or failes.
  *
+ * Requests are queued per provider and ordered by priority according
+ * to the viewport focus, cf. QcTileRequestQueue.  Prefetched tiles are
+ * queued after the tiles of the viewports.
+ *
+ * The scheduler dispatches a batch of requests per event loop turn,
+ * caps the number of requests in flight per provider and per host, and
+ * limits the request rate per provider using a token bucket.  Queued
+ * requests wait until a slot is released or a token is available.
+ *
  */
 class QC_EXPORT QcWmtsTileFetcher : public QObject
 {
@@ -103,26 +116,66 @@ class QC_EXPORT QcWmtsTileFetcher : public QObject
   QcWmtsTileFetcher();
   virtual ~QcWmtsTileFetcher();
 
+  // Record the fetch latencies, per provider
+  void set_metrics(QcTileCacheMetrics * metrics) { m_metrics = metrics; }
+
+  int max_in_flight_per_provider() const { return m_max_in_flight_per_provider; }
+  void set_max_in_flight_per_provider(int count) { m_max_in_flight_per_provider = count; }
+  int max_in_flight_per_host() const { return m_max_in_flight_per_host; }
+  void set_max_in_flight_per_host(int count) { m_max_in_flight_per_host = count; }
+  int batch_size() const { return m_batch_size; }
+  void set_batch_size(int count) { m_batch_size = qMax(count, 1); }
+  // Requests per second, 0 means unlimited
+  void set_rate_limit(const QString & provider, double rate, double burst = 1);
+
+  int queue_depth() const;
+  int in_flight_count() const;
+  int in_flight_count(const QString & provider) const;
+  int max_queue_depth() const { return m_max_queue_depth; }
+  int max_in_flight_count() const { return m_max_in_flight_count; }
+
  public slots:
   // void update_tile_requests(const QcTileSpecSet & tiles_added, const QcTileSpecSet & tiles_removed);
   void update_tile_requests(const QSet<QcTileSpec> & tiles_added, const QSet<QcTileSpec> & tiles_removed);
+  void update_prefetch_requests(const QSet<QcTileSpec> & tiles_added, const QSet<QcTileSpec> & tiles_removed);
+  void promote_tile_requests(const QSet<QcTileSpec> & tiles);
+  void set_request_focus(const QString & provider, const QcTileRequestFocus & focus);
 
  private slots:
   void cancel_tile_requests(const QcTileSpecSet & tile_specs);
+  void add_tile_requests(const QcTileSpecSet & tile_specs, bool prefetch);
   void request_next_tile();
   void finished();
 
  signals:
-  void tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format);
+  void tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format,
+                     const QcTileFreshness & freshness);
+  void tile_not_modified(const QcTileSpec & tile_spec, const QcTileFreshness & freshness);
   void tile_error(const QcTileSpec & tile_spec, const QString & errorString);
+  void tile_not_found(const QcTileSpec & tile_spec);
+  void queue_changed(int queue_depth, int in_flight_count);
 
  protected:
   void timerEvent(QTimerEvent * event);
   // QGeoTiledMappingManagerEngine::CacheAreas cache_hint() const;
 
+ private:
+  enum DispatchStatus {
+    Dispatchable,
+    ProviderBusy,
+    HostBusy,
+    RateLimited
+  };
+
  private:
   virtual QcWmtsReply * get_tile_image(const QcTileSpec & tile_spec) = 0;
+  // Host used for the per host limit, none if empty
+  virtual QString tile_host(const QcTileSpec & tile_spec) const;
   void handle_reply(QcWmtsReply * wmts_reply, const QcTileSpec & tile_spec);
+  DispatchStatus can_dispatch(const QcTileSpec & tile_spec, QString & host, int & delay);
+  void dispatch(const QcTileSpec & tile_spec, const QString & host, QList<QcWmtsReply *> & finished_replies);
+  void release_slot(const QcTileSpec & tile_spec);
+  void update_queue_metrics(int & depth, int & in_flight);
 
   // Q_DECLARE_PRIVATE(QcWmtsTileFetcher);
   // Q_DISABLE_COPY(QcWmtsTileFetcher);
@@ -130,9 +183,20 @@ class QC_EXPORT QcWmtsTileFetcher : public QObject
  private:
   bool m_enabled;
   QBasicTimer m_timer;
-  QMutex m_queue_mutex;
-  QList<QcTileSpec> m_queue;
+  mutable QMutex m_queue_mutex;
+  QHash<QString, QcTileRequestQueue> m_queues; // per provider
+  int m_queue_size;
   QHash<QcTileSpec, QcWmtsReply *> m_invmap;
+  QHash<QcTileSpec, QString> m_in_flight_hosts;
+  QHash<QString, int> m_in_flight_per_provider;
+  QHash<QString, int> m_in_flight_per_host;
+  QHash<QString, QcTokenBucket> m_rate_limiters;
+  int m_max_in_flight_per_provider;
+  int m_max_in_flight_per_host;
+  int m_batch_size;
+  int m_max_queue_depth;
+  int m_max_in_flight_count;
+  QcTileCacheMetrics * m_metrics;
 };
 
 /**************************************************************************************************/
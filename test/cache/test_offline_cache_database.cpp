@@ -27,6 +27,7 @@
 /**************************************************************************************************/
 
 #include <QtTest/QtTest>
+#include <QTemporaryDir>
 #include <QtDebug>
 
 /**************************************************************************************************/
@@ -41,6 +42,9 @@ class TestQcOfflineCacheDatabase: public QObject
 
 private slots:
   void constructor();
+  void download_job();
+  void batched_writes();
+  void write_delay();
 };
 
 void TestQcOfflineCacheDatabase::constructor()
@@ -55,6 +59,90 @@ void TestQcOfflineCacheDatabase::constructor()
   QVERIFY(database.has_tile(tile_spec) == 2);
 }
 
+void TestQcOfflineCacheDatabase::download_job()
+{
+  QTemporaryDir directory;
+  QString sqlite_path = directory.filePath("offline_cache.sqlite");
+  int job_id = -1;
+
+  {
+    QcOfflineCacheDatabase database(sqlite_path);
+    QcOfflineDownloadJob job;
+    job.provider = "foo";
+    job.map_id = 1;
+    job.min_level = 2;
+    job.max_level = 3;
+    job.area = "[]";
+    job.number_of_tiles = 30;
+    job_id = database.create_job(job, QVector<int>({10, 20}));
+    QVERIFY(job_id >= 0);
+    QCOMPARE(database.missing_job_tiles(job_id), 30);
+
+    QByteArray bitmap = database.job_bitmap(job_id, 3);
+    QCOMPARE(bitmap, QByteArray(3, 0));
+    bitmap[0] = 0x0F;
+    database.update_job_level(job_id, 3, bitmap, 4);
+    job.downloaded_tiles = 4;
+    database.update_job(job);
+  }
+
+  // The jobs are persistent
+  QcOfflineCacheDatabase database(sqlite_path);
+  QCOMPARE(database.job_ids(), QList<int>() << job_id);
+  QcOfflineDownloadJob job;
+  QVERIFY(database.load_job(job_id, job));
+  QCOMPARE(job.provider, QString("foo"));
+  QCOMPARE(job.max_level, 3);
+  QCOMPARE(job.downloaded_tiles, 4);
+  int done_tiles = 0;
+  QCOMPARE(database.job_bitmap(job_id, 3, &done_tiles)[0], char(0x0F));
+  QCOMPARE(done_tiles, 4);
+  QCOMPARE(database.missing_job_tiles(job_id), 26);
+
+  database.delete_job(job_id);
+  QVERIFY(!database.load_job(job_id, job));
+}
+
+void TestQcOfflineCacheDatabase::batched_writes()
+{
+  QTemporaryDir directory;
+  QString sqlite_path = directory.filePath("offline_cache.sqlite");
+  int number_of_tiles = 2 * QcOfflineCacheDatabase::batch_size + 10;
+
+  {
+    QcOfflineCacheDatabase database(sqlite_path);
+    for (int i = 0; i < number_of_tiles; i++)
+      database.insert_tile(QcTileSpec("foo", 1, 16, i, i));
+    database.insert_tile(QcTileSpec("foo", 1, 16, 0, 0));
+    QCOMPARE(database.has_tile(QcTileSpec("foo", 1, 16, 0, 0)), 2); // pending writes are visible
+  } // the last batch is committed by the destructor
+
+  QcOfflineCacheDatabase database(sqlite_path);
+  QCOMPARE(database.has_tile(QcTileSpec("foo", 1, 16, number_of_tiles - 1, number_of_tiles - 1)), 1);
+  database.delete_tile(QcTileSpec("foo", 1, 16, 0, 0));
+  QCOMPARE(database.has_tile(QcTileSpec("foo", 1, 16, 0, 0)), 1);
+  database.delete_tile(QcTileSpec("foo", 1, 16, 0, 0));
+  QCOMPARE(database.has_tile(QcTileSpec("foo", 1, 16, 0, 0)), 0);
+}
+
+void TestQcOfflineCacheDatabase::write_delay()
+{
+  QTemporaryDir directory;
+  QcOfflineCacheDatabase database(directory.filePath("offline_cache.sqlite"));
+
+  database.insert_tile(QcTileSpec("foo", 1, 16, 0, 0));
+  QVERIFY(database.has_pending_writes());
+  database.flush();
+  QVERIFY(!database.has_pending_writes());
+
+  // A batch which is not full is committed once its first write is too old
+  database.insert_tile(QcTileSpec("foo", 1, 16, 1, 1));
+  QTest::qWait(QcOfflineCacheDatabase::max_write_delay + 100);
+  QVERIFY(database.has_pending_writes());
+  database.insert_tile(QcTileSpec("foo", 1, 16, 2, 2));
+  QVERIFY(!database.has_pending_writes());
+}
+
 /***************************************************************************************************/
 
 QTEST_MAIN(TestQcOfflineCacheDatabase)
@@ -41,6 +41,7 @@ class TestQcPolygon: public QObject
 private slots:
   void contains();
   void intersec_with_grid();
+  void diff();
 };
 
 void
@@ -111,6 +112,35 @@ TestQcPolygon::intersec_with_grid()
   }
 }
 
+void
+TestQcPolygon::diff()
+{
+  // Pan a square of 4x4 tiles by one tile to the right and one tile to the bottom
+  QcPolygon polygon1(QVector<double>({0.5, 0.5, 0.5, 4.5, 4.5, 4.5, 4.5, 0.5}));
+  QcPolygon polygon2(QVector<double>({1.5, 1.5, 1.5, 5.5, 5.5, 5.5, 5.5, 1.5}));
+  QcTiledPolygon tiled_polygon1 = polygon1.intersec_with_grid(1.);
+  QcTiledPolygon tiled_polygon2 = polygon2.intersec_with_grid(1.);
+
+  auto count_tiles = [](const QcTiledPolygonRunList & runs) {
+    int number_of_tiles = 0;
+    for (const QcTiledPolygonRun & run : runs)
+      number_of_tiles += run.interval().length();
+    return number_of_tiles;
+  };
+
+  QcTiledPolygonDiff tiled_polygon_diff = tiled_polygon2.diff(tiled_polygon1);
+  QCOMPARE(count_tiles(tiled_polygon_diff.same_area()), 4*4);
+  QCOMPARE(count_tiles(tiled_polygon_diff.new_area()), 5*5 - 4*4);
+  QCOMPARE(count_tiles(tiled_polygon_diff.old_area()), 5*5 - 4*4);
+  QVERIFY(tiled_polygon_diff.new_area().contains(QcTiledPolygonRun(5, QcIntervalInt(1, 5))));
+  QVERIFY(tiled_polygon_diff.old_area().contains(QcTiledPolygonRun(0, QcIntervalInt(0, 4))));
+
+  // A diff with an empty polygon
+  tiled_polygon_diff = tiled_polygon1.diff(QcTiledPolygon());
+  QCOMPARE(count_tiles(tiled_polygon_diff.new_area()), 5*5);
+  QVERIFY(tiled_polygon_diff.old_area().isEmpty());
+}
+
 /***************************************************************************************************/
 
 QTEST_MAIN(TestQcPolygon)
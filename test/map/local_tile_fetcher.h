@@ -0,0 +1,100 @@
+// -*- mode: c++ -*-
+
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#ifndef __LOCAL_TILE_FETCHER_H__
+#define __LOCAL_TILE_FETCHER_H__
+
+/**************************************************************************************************/
+
+#include <QBuffer>
+#include <QImage>
+#include <QNetworkAccessManager>
+
+#include "wmts/wmts_network_reply.h"
+#include "wmts/wmts_tile_fetcher.h"
+
+/***************************************************************************************************/
+
+// Stand-in fetcher for the tests, it answers a constant tile from a data URL
+// and counts the requests
+class LocalTileFetcher : public QcWmtsTileFetcher
+{
+public:
+  LocalTileFetcher(const QByteArray & bytes = QByteArray("tile"))
+    : QcWmtsTileFetcher(),
+      m_number_of_requests(0)
+  {
+    set_tile_bytes(bytes);
+  }
+
+  // A white PNG tile, which can be decoded to a texture
+  static QByteArray png_tile() {
+    QImage image(256, 256, QImage::Format_RGB32);
+    image.fill(Qt::white);
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "PNG");
+    return bytes;
+  }
+
+  void set_tile_bytes(const QByteArray & bytes) {
+    m_url = QUrl(QStringLiteral("data:image/png;base64,") + QString::fromLatin1(bytes.toBase64()));
+  }
+
+  int number_of_requests() const { return m_number_of_requests; }
+
+private:
+  QcWmtsReply * get_tile_image(const QcTileSpec & tile_spec) override {
+    m_number_of_requests++;
+    QNetworkReply * reply = m_manager.get(QNetworkRequest(m_url));
+    return new QcWmtsNetworkReply(reply, tile_spec, QStringLiteral("png"));
+  }
+
+  QString tile_host(const QcTileSpec & tile_spec) const override {
+    Q_UNUSED(tile_spec);
+    return QStringLiteral("localhost");
+  }
+
+private:
+  QNetworkAccessManager m_manager;
+  QUrl m_url;
+  int m_number_of_requests;
+};
+
+/**************************************************************************************************/
+
+#endif /* __LOCAL_TILE_FETCHER_H__ */
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -32,6 +32,11 @@
 /**************************************************************************************************/
 
 #include "cache/cache3q.h"
+#include "cache/concurrent_cache3q.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
 
 /***************************************************************************************************/
 
@@ -41,6 +46,9 @@ class TestQcCache3Q: public QObject
 
 private slots:
   void constructor();
+  void serialize_queues();
+  void concurrent();
+  void shard_sizing();
 };
 
 class MyObject: public QObject
@@ -79,6 +87,145 @@ void TestQcCache3Q::constructor()
   QVERIFY(cache.total_cost() == 0);
 }
 
+void TestQcCache3Q::serialize_queues()
+{
+  QcCache3Q<int, MyObject> cache(100, -1, -1);
+
+  QList<int> keys1, keys2;
+  QList<QSharedPointer<MyObject> > values1, values2;
+  QList<int> costs1, costs2;
+  for (int i = 0; i < 3; i++) {
+    keys1 << i;
+    values1 << QSharedPointer<MyObject>(new MyObject(i));
+    costs1 << 1;
+    keys2 << 10 + i;
+    values2 << QSharedPointer<MyObject>(new MyObject(10 + i));
+    costs2 << 1;
+  }
+
+  // Deserializing a queue must not clear the previous ones
+  cache.deserialize_queue(1, keys1, values1, costs1);
+  cache.deserialize_queue(2, keys2, values2, costs2);
+  QVERIFY(cache.total_cost() == 6);
+
+  QList<QSharedPointer<MyObject> > queue;
+  cache.serialize_queue(1, queue);
+  QCOMPARE(queue.size(), 3);
+  for (int i = 0; i < 3; i++)
+    QCOMPARE(queue[i]->value, i);
+}
+
+void TestQcCache3Q::concurrent()
+{
+  int number_of_items = 1000;
+  QcConcurrentCache3Q<int, MyObject> cache(number_of_items, 6);
+  QCOMPARE(cache.number_of_shards(), 8);
+
+  // Insert and look up from several threads
+  int number_of_threads = 4;
+  std::atomic<int> errors(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < number_of_threads; t++)
+    threads.emplace_back([&cache, &errors, t, number_of_threads, number_of_items]() {
+        for (int key = t; key < number_of_items; key += number_of_threads) {
+          cache.insert(key, QSharedPointer<MyObject>(new MyObject(key)));
+          QSharedPointer<MyObject> object = cache.object(key);
+          if (object && object->value != key)
+            errors++;
+        }
+      });
+  for (auto & thread : threads)
+    thread.join();
+  QCOMPARE(errors.load(), 0);
+
+  QVERIFY(cache.total_cost() <= cache.max_cost());
+  QVERIFY(cache.hit_count() > 0);
+  int hit_count = 0;
+  for (int i = 0; i < cache.number_of_shards(); i++)
+    hit_count += cache.hit_count(i);
+  QCOMPARE(hit_count, cache.hit_count());
+
+  // peek doesn't count
+  cache.peek(0);
+  QCOMPARE(cache.hit_count() + cache.miss_count(), number_of_items);
+
+  cache.clear();
+  QCOMPARE(cache.total_cost(), 0);
+}
+
+/* Look up tiles of a drifting viewport with a popular set of tiles,
+ * insert the missed ones and return the hit rate.
+ */
+template <class Cache>
+double
+hit_rate(Cache & cache, int number_of_keys, int number_of_lookups, int cost)
+{
+  qsrand(1);
+  int hits = 0;
+  for (int i = 0; i < number_of_lookups; i++) {
+    int key;
+    if (qrand() % 4)
+      key = i / 10 + qrand() % number_of_keys;
+    else
+      key = -1 - qrand() % (number_of_keys / 4);
+    if (cache.object(key))
+      hits++;
+    else
+      cache.insert(key, QSharedPointer<MyObject>(new MyObject(key)), cost);
+  }
+  return double(hits) / number_of_lookups;
+}
+
+void TestQcCache3Q::shard_sizing()
+{
+  int mega = 1024 * 1024;
+  int min_shard_cost = 16 * mega;
+
+  // Default texture tier: 16 MiB of 256 px textures
+  {
+    int max_cost = 16 * mega;
+    int cost = 256 * 1024;
+    int number_of_keys = 2 * max_cost / cost;
+    QcCache3Q<int, MyObject> cache(max_cost);
+    QcConcurrentCache3Q<int, MyObject> concurrent_cache(max_cost, 8, min_shard_cost);
+    QCOMPARE(concurrent_cache.number_of_shards(), 1);
+    double rate = hit_rate(cache, number_of_keys, 10000, cost);
+    double concurrent_rate = hit_rate(concurrent_cache, number_of_keys, 10000, cost);
+    qInfo() << "texture tier hit rate" << rate << concurrent_rate;
+    QVERIFY(rate > .1);
+    QCOMPARE(concurrent_rate, rate);
+
+    // A 512 px texture fits
+    QVERIFY(concurrent_cache.insert(0, QSharedPointer<MyObject>(new MyObject(0)), 4 * cost));
+  }
+
+  // Default memory tier: 128 MiB of 20 kiB encoded tiles
+  {
+    int max_cost = 128 * mega;
+    int cost = 20 * 1024;
+    int number_of_keys = 2 * max_cost / cost;
+    QcCache3Q<int, MyObject> cache(max_cost);
+    QcConcurrentCache3Q<int, MyObject> concurrent_cache(max_cost, 8, min_shard_cost);
+    QCOMPARE(concurrent_cache.number_of_shards(), 8);
+    double rate = hit_rate(cache, number_of_keys, 100000, cost);
+    double concurrent_rate = hit_rate(concurrent_cache, number_of_keys, 100000, cost);
+    qInfo() << "memory tier hit rate" << rate << concurrent_rate;
+    QVERIFY(rate > .1);
+    QVERIFY(qAbs(concurrent_rate - rate) < .02);
+  }
+
+  // The number of shards follows the maximum cost
+  QcConcurrentCache3Q<int, MyObject> cache(16 * mega, 8, min_shard_cost);
+  cache.insert(1, QSharedPointer<MyObject>(new MyObject(1)));
+  cache.set_max_cost(64 * mega);
+  QCOMPARE(cache.number_of_shards(), 4);
+  QVERIFY(!cache.peek(1));
+  cache.insert(1, QSharedPointer<MyObject>(new MyObject(1)));
+  QCOMPARE(cache.peek(1)->value, 1);
+  cache.set_max_cost(1024 * mega);
+  QCOMPARE(cache.number_of_shards(), 8);
+}
+
 /***************************************************************************************************/
 
 QTEST_MAIN(TestQcCache3Q)
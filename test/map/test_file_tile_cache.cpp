@@ -27,6 +27,10 @@
 /**************************************************************************************************/
 
 #include <QtTest/QtTest>
+#include <QBuffer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
 #include <QtDebug>
 
 /**************************************************************************************************/
@@ -41,6 +45,13 @@ class TestQcFileTileCache: public QObject
 
 private slots:
   void constructor();
+  void get_async();
+  void disk_eviction();
+  void mapped_compaction();
+  void texture_format();
+  void metrics();
+  void freshness();
+  void warm();
 };
 
 void TestQcFileTileCache::constructor()
@@ -61,6 +72,274 @@ void TestQcFileTileCache::constructor()
   QVERIFY(tile_texture->tile_spec == tile_spec);
 }
 
+void TestQcFileTileCache::get_async()
+{
+  QcFileTileCache file_tile_cache;
+  file_tile_cache.clear_all();
+
+  QcTileSpec tile_spec("geoportail", 1, 16, 33886, 23658);
+
+  QImage image(256, 256, QImage::Format_RGB32);
+  image.fill(Qt::red);
+  QByteArray bytes;
+  QBuffer buffer(&bytes);
+  buffer.open(QIODevice::WriteOnly);
+  image.save(&buffer, "PNG");
+  file_tile_cache.insert(tile_spec, bytes, QStringLiteral("png"));
+
+  QSignalSpy spy(&file_tile_cache, SIGNAL(tile_decoded(QcTileSpec)));
+  bool pending = false;
+  QSharedPointer<QcTileTexture> tile_texture = file_tile_cache.get_async(tile_spec, pending);
+  QVERIFY(tile_texture.isNull());
+  QVERIFY(pending);
+  QVERIFY(file_tile_cache.is_decoding(tile_spec));
+
+  QVERIFY(spy.wait());
+  QVERIFY(!file_tile_cache.is_decoding(tile_spec));
+  tile_texture = file_tile_cache.get_async(tile_spec, pending);
+  QVERIFY(!pending);
+  QVERIFY(tile_texture->tile_spec == tile_spec);
+  QVERIFY(tile_texture->image.size() == image.size());
+  QCOMPARE(tile_texture->image.format(), TILE_TEXTURE_FORMAT); // converted by the decode job
+}
+
+void TestQcFileTileCache::disk_eviction()
+{
+  QTemporaryDir directory;
+  QcFileTileCache file_tile_cache(directory.path());
+
+  int tile_size = 10 * 1024;
+  int number_of_tiles = 100;
+  file_tile_cache.set_max_disk_usage(20 * tile_size);
+  for (int i = 0; i < number_of_tiles; i++)
+    file_tile_cache.insert(QcTileSpec("osm", 1, 16, i, i), QByteArray(tile_size, 'a'), QStringLiteral("png"));
+
+  // The pack is compacted online, the file on disk shrinks within the budget
+  QString pack_filename = QDir(directory.path()).filePath(QcTilePack::default_filename);
+  QTRY_VERIFY(QFileInfo(pack_filename).size() <= file_tile_cache.max_disk_usage());
+  QTRY_COMPARE(file_tile_cache.tile_pack()->count() + file_tile_cache.evicted_tiles(), number_of_tiles);
+  QTRY_COMPARE(file_tile_cache.tile_pack()->dead_size(), qint64(0));
+  QCOMPARE(qint64(file_tile_cache.disk_usage()), QFileInfo(pack_filename).size());
+  QVERIFY(file_tile_cache.tile_pack()->count() * tile_size <= file_tile_cache.max_disk_usage());
+  QVERIFY(file_tile_cache.reclaimed_bytes() >= qint64(file_tile_cache.evicted_tiles()) * tile_size);
+}
+
+void TestQcFileTileCache::mapped_compaction()
+{
+  QTemporaryDir directory;
+  QcFileTileCache file_tile_cache(directory.path());
+  file_tile_cache.set_memory_mapped(true);
+  file_tile_cache.set_max_memory_usage(0); // decode jobs hold the views on the pack
+
+  QImage image(256, 256, QImage::Format_RGB32);
+  image.fill(Qt::red);
+  QByteArray bytes;
+  QBuffer buffer(&bytes);
+  buffer.open(QIODevice::WriteOnly);
+  image.save(&buffer, "PNG");
+
+  int number_of_tiles = 100;
+  int number_of_decodes = 10;
+  file_tile_cache.set_max_disk_usage(20 * bytes.size());
+  for (int i = 0; i < number_of_decodes; i++)
+    file_tile_cache.insert(QcTileSpec("osm", 1, 16, i, i), bytes, QStringLiteral("png"));
+
+  QSignalSpy spy(&file_tile_cache, SIGNAL(tile_decoded(QcTileSpec)));
+  for (int i = 0; i < number_of_decodes; i++) {
+    bool pending = false;
+    file_tile_cache.get_async(QcTileSpec("osm", 1, 16, i, i), pending);
+    QVERIFY(pending);
+  }
+
+  // The compaction waits for the decode jobs without blocking the event loop
+  for (int i = number_of_decodes; i < number_of_tiles; i++)
+    file_tile_cache.insert(QcTileSpec("osm", 1, 16, i, i), bytes, QStringLiteral("png"));
+  QTRY_COMPARE(spy.count(), number_of_decodes);
+  QTRY_VERIFY(file_tile_cache.evicted_tiles() > 0);
+  QTRY_COMPARE(file_tile_cache.tile_pack()->dead_size(), qint64(0));
+
+  // The pack is mapped again
+  QcTileSpec tile_spec("osm", 1, 16, number_of_tiles - 1, number_of_tiles - 1);
+  bool pending = false;
+  QVERIFY(file_tile_cache.get_async(tile_spec, pending).isNull());
+  QVERIFY(pending);
+  QTRY_COMPARE(spy.count(), number_of_decodes + 1);
+  QVERIFY(!file_tile_cache.get(tile_spec).isNull());
+}
+
+void TestQcFileTileCache::texture_format()
+{
+  QTemporaryDir directory;
+  QcFileTileCache file_tile_cache(directory.path());
+  file_tile_cache.set_texture_format(QcTileImageFormat::Rgb565);
+
+  QImage image(256, 256, QImage::Format_RGB32);
+  image.fill(Qt::blue);
+  QByteArray bytes;
+  QBuffer buffer(&bytes);
+  buffer.open(QIODevice::WriteOnly);
+  image.save(&buffer, "JPG");
+
+  QcTileSpec tile_spec("geoportail", 1, 16, 33887, 23658);
+  file_tile_cache.insert(tile_spec, bytes, QStringLiteral("jpg"));
+  QSharedPointer<QcTileTexture> tile_texture = file_tile_cache.get(tile_spec);
+  QVERIFY(!tile_texture.isNull());
+  QCOMPARE(tile_texture->image.format(), OPAQUE_TILE_TEXTURE_FORMAT);
+  QCOMPARE(file_tile_cache.texture_usage(), 256 * 256 * 2);
+
+  // Tiles having an alpha channel keep 8 bits per channel
+  QImage transparent_image(256, 256, QImage::Format_ARGB32);
+  transparent_image.fill(Qt::transparent);
+  QByteArray transparent_bytes;
+  QBuffer transparent_buffer(&transparent_bytes);
+  transparent_buffer.open(QIODevice::WriteOnly);
+  transparent_image.save(&transparent_buffer, "PNG");
+  QCOMPARE(decode_tile_image(transparent_bytes, QcTileImageFormat::Rgb565).format(), TILE_TEXTURE_FORMAT);
+}
+
+void TestQcFileTileCache::metrics()
+{
+  QcLatencyHistogram histogram;
+  for (int latency : {1, 3, 3, 100, 5000})
+    histogram.add(latency);
+  QCOMPARE(histogram.count(), 5);
+  QCOMPARE(histogram.max(), qint64(5000));
+  QCOMPARE(histogram.bucket(0), 1);
+  QCOMPARE(histogram.bucket(2), 2); // ]2, 4]
+  QCOMPARE(histogram.percentile(50), qint64(4));
+  QCOMPARE(histogram.percentile(100), qint64(5000));
+
+  QTemporaryDir directory;
+  QcFileTileCache file_tile_cache(directory.path());
+  QcTileSpec tile_spec("osm", 1, 16, 1, 1);
+  QVERIFY(file_tile_cache.get(tile_spec).isNull()); // miss
+  file_tile_cache.insert(tile_spec, QByteArray(100, 'a'), QStringLiteral("png"));
+  file_tile_cache.metrics()->record_fetch(QStringLiteral("osm"), 2000, false);
+  file_tile_cache.metrics()->record_fetch(QStringLiteral("osm"), 4000, true);
+
+  QcTileCacheMetrics * metrics = file_tile_cache.metrics();
+  QSignalSpy spy(metrics, SIGNAL(snapshot_ready(QByteArray)));
+  QString snapshot_path = directory.filePath(QStringLiteral("metrics.json"));
+  metrics->set_snapshot_path(snapshot_path);
+  metrics->set_snapshot_interval(10);
+  QVERIFY(spy.wait());
+  QCOMPARE(metrics->texture_misses(), 1);
+  QCOMPARE(metrics->memory_usage(), qint64(100));
+  QCOMPARE(metrics->fetch_latencies().value(QStringLiteral("osm")).toDouble(), 3000.);
+
+  QFile file(snapshot_path);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+  QCOMPARE(json["tiers"].toObject()["memory"].toObject()["tiles"].toInt(), 1);
+  QCOMPARE(json["fetch_latency_us"].toObject()["osm"].toObject()["errors"].toInt(), 1);
+
+  // The counters are read by QML through the properties
+  QImage image(256, 256, QImage::Format_RGB32);
+  image.fill(Qt::red);
+  QByteArray bytes;
+  QBuffer buffer(&bytes);
+  buffer.open(QIODevice::WriteOnly);
+  image.save(&buffer, "PNG");
+  QcTileSpec decoded_tile("osm", 1, 16, 2, 1);
+  file_tile_cache.insert(decoded_tile, bytes, QStringLiteral("png"));
+  metrics->update();
+  int texture_hits = metrics->property("texture_hits").toInt();
+  int texture_misses = metrics->property("texture_misses").toInt();
+  int memory_hits = metrics->property("memory_hits").toInt();
+  QVERIFY(!file_tile_cache.get(decoded_tile).isNull()); // decoded from the memory tier
+  QVERIFY(!file_tile_cache.get(decoded_tile).isNull()); // texture hit
+  QVERIFY(file_tile_cache.get(QcTileSpec("osm", 1, 16, 3, 1)).isNull()); // miss
+  QSignalSpy updated_spy(metrics, SIGNAL(updated()));
+  metrics->update();
+  QCOMPARE(updated_spy.count(), 1);
+  QCOMPARE(metrics->property("texture_hits").toInt(), texture_hits + 1);
+  QCOMPARE(metrics->property("texture_misses").toInt(), texture_misses + 2);
+  QCOMPARE(metrics->property("memory_hits").toInt(), memory_hits + 1);
+  QVERIFY(metrics->property("disk_misses").toInt() >= 1);
+  QCOMPARE(metrics->property("texture_usage").toLongLong(), qint64(file_tile_cache.texture_usage()));
+  QCOMPARE(metrics->property("memory_usage").toLongLong(), qint64(file_tile_cache.memory_usage()));
+}
+
+void TestQcFileTileCache::freshness()
+{
+  qint64 now = QcTileFreshness::parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT");
+  QCOMPARE(now, qint64(784111777) * 1000);
+  QCOMPARE(QcTileFreshness::to_http_date(now), QByteArray("Sun, 06 Nov 1994 08:49:37 GMT"));
+
+  QcTileFreshness freshness = QcTileFreshness::from_http_headers("\"v1\"", QByteArray(),
+                                                                 "public, max-age=3600", "0", now);
+  QCOMPARE(freshness.expires_at, now + 3600 * 1000); // max-age takes precedence over Expires
+  QVERIFY(!freshness.is_stale(now));
+  QVERIFY(freshness.is_stale(now + 3600 * 1000));
+  QCOMPARE(QcTileFreshness::from_http_headers(QByteArray(), QByteArray(), "no-cache", QByteArray(), now).expires_at, now);
+  QcTileFreshness heuristic = QcTileFreshness::from_http_headers(QByteArray(), "Sat, 05 Nov 1994 08:49:37 GMT",
+                                                                 QByteArray(), QByteArray(), now);
+  QCOMPARE(heuristic.expires_at - now, qint64(24 * 3600 * 100)); // a tenth of a day
+
+  QTemporaryDir directory;
+  QcTileSpec fresh_tile("osm", 1, 16, 1, 1);
+  QcTileSpec stale_tile("osm", 1, 16, 2, 1);
+  qint64 current_time = QDateTime::currentMSecsSinceEpoch();
+  QcTileFreshness expired = QcTileFreshness::from_http_headers("\"v1\"", QByteArray(), "max-age=60",
+                                                               QByteArray(), current_time - 3600 * 1000);
+  {
+    QcFileTileCache file_tile_cache(directory.path());
+    file_tile_cache.insert(fresh_tile, QByteArray(100, 'a'), QStringLiteral("png"),
+                           QcTileFreshness::from_http_headers("\"v1\"", QByteArray(), "max-age=60",
+                                                              QByteArray(), current_time));
+    file_tile_cache.insert(stale_tile, QByteArray(100, 'b'), QStringLiteral("png"), expired);
+    file_tile_cache.insert(QcTileSpec("osm", 1, 16, 3, 1), QByteArray(100, 'c'), QStringLiteral("png"));
+    QCOMPARE(file_tile_cache.stale_tiles(10), QList<QcTileSpec>() << stale_tile);
+  }
+
+  // The metadata are persistent
+  QcFileTileCache file_tile_cache(directory.path());
+  QTRY_COMPARE(file_tile_cache.stale_tiles(10), QList<QcTileSpec>() << stale_tile);
+  QCOMPARE(file_tile_cache.freshness(stale_tile).etag, QByteArray("\"v1\""));
+
+  // A 304 response renews the tile and keeps its validators
+  file_tile_cache.update_freshness(stale_tile, QcTileFreshness::from_http_headers(QByteArray(), QByteArray(), "max-age=60",
+                                                                                  QByteArray(), current_time));
+  QVERIFY(file_tile_cache.stale_tiles(10).isEmpty());
+  QCOMPARE(file_tile_cache.freshness(stale_tile).etag, QByteArray("\"v1\""));
+
+  // The stale tiles are ordered by expiry, an updated tile is indexed again
+  QcTileFreshnessStore store;
+  QcTileSpec older_tile("osm", 1, 16, 5, 1);
+  QcTileFreshness older = expired;
+  older.expires_at -= 1000;
+  store.insert(stale_tile, expired);
+  store.insert(older_tile, older);
+  store.insert(fresh_tile, file_tile_cache.freshness(stale_tile));
+  QCOMPARE(store.stale_count(current_time), 2);
+  QCOMPARE(store.stale_tiles(current_time, 10), QList<QcTileSpec>() << older_tile << stale_tile);
+  QCOMPARE(store.stale_tiles(current_time, 1), QList<QcTileSpec>() << older_tile);
+  store.insert(older_tile, file_tile_cache.freshness(stale_tile));
+  QCOMPARE(store.stale_tiles(current_time, 10), QList<QcTileSpec>() << stale_tile);
+  store.remove(stale_tile);
+  QCOMPARE(store.stale_count(current_time), 0);
+  QCOMPARE(store.size(), 2);
+}
+
+void TestQcFileTileCache::warm()
+{
+  QTemporaryDir directory;
+  QcTileSpec tile_spec("osm", 1, 16, 4, 1);
+  {
+    QcFileTileCache file_tile_cache(directory.path());
+    file_tile_cache.insert(tile_spec, QByteArray(100, 'a'), QStringLiteral("png"));
+  }
+
+  QcFileTileCache file_tile_cache(directory.path());
+  QTRY_VERIFY(file_tile_cache.contains(tile_spec));
+  QVERIFY(!file_tile_cache.contains(QcTileSpec("osm", 1, 16, 5, 1)));
+  QCOMPARE(file_tile_cache.memory_usage(), 0);
+  QVERIFY(file_tile_cache.warm(tile_spec));
+  QCOMPARE(file_tile_cache.memory_usage(), 100);
+  QVERIFY(!file_tile_cache.warm(tile_spec)); // already in the memory tier
+  QVERIFY(file_tile_cache.peek_texture(tile_spec).isNull()); // not decoded
+}
+
 /***************************************************************************************************/
 
 QTEST_MAIN(TestQcFileTileCache)
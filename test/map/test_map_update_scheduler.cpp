@@ -0,0 +1,87 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+#include "map/map_update_scheduler.h"
+
+/***************************************************************************************************/
+
+class TestQcMapUpdateScheduler: public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void coalesce();
+};
+
+void TestQcMapUpdateScheduler::coalesce()
+{
+  QcMapUpdateScheduler scheduler;
+  QSignalSpy spy(&scheduler, SIGNAL(update_requested()));
+  bool viewport_changed;
+
+  // A flick emits many viewport changes during a frame
+  for (int i = 0; i < 10; i++)
+    scheduler.request_viewport_update();
+  scheduler.request_layer_update();
+  QCOMPARE(spy.count(), 1);
+  QVERIFY(scheduler.begin_update(viewport_changed));
+  QVERIFY(viewport_changed);
+  QVERIFY(!scheduler.begin_update(viewport_changed));
+  QCOMPARE(scheduler.requested_updates(), 11);
+  QCOMPARE(scheduler.merged_updates(), 10);
+  QCOMPARE(scheduler.dropped_updates(), 1); // superseded by the viewport update
+  QCOMPARE(scheduler.processed_updates(), 1);
+
+  // Received tiles only update the scene graph
+  for (int i = 0; i < 3; i++)
+    scheduler.request_layer_update();
+  QCOMPARE(spy.count(), 2);
+  QVERIFY(scheduler.is_pending());
+  QVERIFY(scheduler.begin_update(viewport_changed));
+  QVERIFY(!viewport_changed);
+  QVERIFY(!scheduler.is_pending());
+  QCOMPARE(scheduler.merged_updates(), 12);
+  QCOMPARE(scheduler.dropped_updates(), 1);
+  QCOMPARE(scheduler.processed_updates(), 2);
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcMapUpdateScheduler)
+#include "test_map_update_scheduler.moc"
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
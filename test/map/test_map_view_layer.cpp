@@ -0,0 +1,200 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include <QtTest>
+#include <QBuffer>
+#include <QImage>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+#include "earth.h"
+#include "map/map_view.h"
+#include "map/tile_visibility.h"
+#include "map/viewport.h"
+#include "scene/map_scene.h"
+#include "wmts/providers/osm/osm_plugin.h"
+
+/***************************************************************************************************/
+
+class TestQcMapViewLayer : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void initTestCase();
+  void cleanupTestCase();
+  void init();
+  void ancestor_placeholder();
+  void child_placeholders();
+  void delivered_placeholder();
+
+private:
+  void cache_tile(const QcTileKey & tile_key);
+
+private:
+  QcOsmPlugin * m_plugin;
+  QByteArray m_png_bytes;
+};
+
+void
+TestQcMapViewLayer::initTestCase()
+{
+  // Keep the tile cache of the plugin away from the user cache
+  QStandardPaths::setTestModeEnabled(true);
+
+  QImage image(256, 256, QImage::Format_RGB32);
+  image.fill(Qt::white);
+  QBuffer buffer(&m_png_bytes);
+  buffer.open(QIODevice::WriteOnly);
+  image.save(&buffer, "PNG");
+
+  m_plugin = new QcOsmPlugin();
+}
+
+void
+TestQcMapViewLayer::cleanupTestCase()
+{
+  delete m_plugin;
+}
+
+void
+TestQcMapViewLayer::init()
+{
+  m_plugin->wmts_manager()->tile_cache()->clear_all();
+}
+
+// Insert a tile and decode it in the texture tier
+void
+TestQcMapViewLayer::cache_tile(const QcTileKey & tile_key)
+{
+  QcFileTileCache * tile_cache = m_plugin->wmts_manager()->tile_cache();
+  QcTileSpec tile_spec = tile_key.to_tile_spec();
+  tile_cache->insert(tile_spec, m_png_bytes, QStringLiteral("png"));
+  QVERIFY(!tile_cache->get(tile_spec).isNull());
+  QVERIFY(!tile_cache->peek_texture(tile_key).isNull());
+}
+
+void
+TestQcMapViewLayer::ancestor_placeholder()
+{
+  const QcWmtsPluginLayer * plugin_layer = m_plugin->layers().first();
+  QcViewport viewport(QcViewportState(QcWgsCoordinate(0, 0), QcTiledZoomLevel(EQUATORIAL_PERIMETER, 256, 0), 0), QSize(0, 0));
+  QcTileVisibility visibility(&viewport);
+  QcMapLayerScene layer_scene(plugin_layer, &viewport);
+  QcMapViewLayer layer(plugin_layer, &visibility, &layer_scene);
+
+  // x = 0b01101, y = 0b10110
+  QcTileKey tile_key = plugin_layer->create_tile_key(5, 13, 22);
+  QVERIFY(layer.find_placeholders(tile_key).isEmpty());
+
+  // The parent is missing, the grandparent is scaled up by 4
+  cache_tile(tile_key.parent(2));
+  QcTilePlaceholderList placeholders = layer.find_placeholders(tile_key);
+  QCOMPARE(placeholders.size(), 1);
+  QCOMPARE(placeholders[0].source_rect, QRectF(.25, .5, .25, .25));
+  QCOMPARE(placeholders[0].tile_rect, QRectF(0, 0, 1, 1));
+
+  // The nearest cached ancestor is preferred
+  cache_tile(tile_key.parent());
+  placeholders = layer.find_placeholders(tile_key);
+  QCOMPARE(placeholders.size(), 1);
+  QCOMPARE(placeholders[0].source_rect, QRectF(.5, 0, .5, .5));
+  QCOMPARE(placeholders[0].tile_rect, QRectF(0, 0, 1, 1));
+  QVERIFY(placeholders[0].texture == m_plugin->wmts_manager()->tile_cache()->peek_texture(tile_key.parent()));
+
+  // A tile of the first level has no ancestor
+  QVERIFY(layer.find_placeholders(plugin_layer->create_tile_key(0, 0, 0)).isEmpty());
+}
+
+void
+TestQcMapViewLayer::child_placeholders()
+{
+  const QcWmtsPluginLayer * plugin_layer = m_plugin->layers().first();
+  QcViewport viewport(QcViewportState(QcWgsCoordinate(0, 0), QcTiledZoomLevel(EQUATORIAL_PERIMETER, 256, 0), 0), QSize(0, 0));
+  QcTileVisibility visibility(&viewport);
+  QcMapLayerScene layer_scene(plugin_layer, &viewport);
+  QcMapViewLayer layer(plugin_layer, &visibility, &layer_scene);
+
+  // The children of the level before the last one are drawn in their quadrant
+  int last_level = m_plugin->tile_matrix_set().number_of_levels() - 1;
+  QcTileKey tile_key = plugin_layer->create_tile_key(last_level - 1, 5, 3);
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      cache_tile(tile_key.child(i, j));
+  QcTilePlaceholderList placeholders = layer.find_placeholders(tile_key);
+  QCOMPARE(placeholders.size(), 4);
+  QList<QRectF> tile_rects;
+  for (const QcTilePlaceholder & placeholder : placeholders) {
+    QCOMPARE(placeholder.source_rect, QRectF(0, 0, 1, 1));
+    tile_rects << placeholder.tile_rect;
+  }
+  QCOMPARE(tile_rects, QList<QRectF>({QRectF(0, 0, .5, .5), QRectF(0, .5, .5, .5),
+                                      QRectF(.5, 0, .5, .5), QRectF(.5, .5, .5, .5)}));
+
+  // The tiles of the last level have no child, even if a deeper tile is cached
+  QcTileKey last_tile_key = tile_key.child(1, 1);
+  cache_tile(last_tile_key.child(0, 0));
+  QVERIFY(layer.find_placeholders(last_tile_key).isEmpty());
+}
+
+void
+TestQcMapViewLayer::delivered_placeholder()
+{
+  const QcWmtsPluginLayer * plugin_layer = m_plugin->layers().first();
+  QcViewport viewport(QcViewportState(QcWgsCoordinate(0, 0), QcTiledZoomLevel(EQUATORIAL_PERIMETER, 256, 0), 0), QSize(0, 0));
+  QcTileVisibility visibility(&viewport);
+  QcMapLayerScene layer_scene(plugin_layer, &viewport);
+  QcMapViewLayer layer(plugin_layer, &visibility, &layer_scene);
+  QSignalSpy spy(&layer, SIGNAL(scene_graph_changed()));
+
+  // The tile is visible, its parent is delivered afterwards
+  QcTileKey tile_key = plugin_layer->create_tile_key(5, 13, 22);
+  layer_scene.update_visible_tiles(QcViewportPartKind::Central, QcTileKeySet() << tile_key, QcTileKeySet());
+  QVERIFY(layer_scene.placeholders().isEmpty());
+  cache_tile(tile_key.parent());
+  layer.update_tile(tile_key.parent().to_tile_spec());
+  QCOMPARE(layer_scene.placeholders().value(tile_key).size(), 1);
+  QCOMPARE(layer_scene.placeholders().value(tile_key)[0].source_rect, QRectF(.5, 0, .5, .5));
+  QCOMPARE(spy.count(), 1);
+
+  // The placeholders are unchanged
+  layer.update_tile(tile_key.parent().to_tile_spec());
+  QCOMPARE(spy.count(), 1);
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcMapViewLayer)
+#include "test_map_view_layer.moc"
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
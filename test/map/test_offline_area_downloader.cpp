@@ -0,0 +1,250 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+#include "cache/file_tile_cache.h"
+#include "cache/offline_cache.h"
+#include "wmts/offline_area_downloader.h"
+#include "wmts/providers/osm/osm_plugin.h"
+#include "wmts/wmts_manager.h"
+
+#include "local_tile_fetcher.h"
+
+/***************************************************************************************************/
+
+// Manager of the local fetcher with a temporary disk cache
+class LocalWmtsManager : public QcWmtsManager
+{
+public:
+  LocalWmtsManager(QcWmtsTileFetcher * tile_fetcher)
+    : QcWmtsManager(QStringLiteral("local"))
+  {
+    set_tile_fetcher(tile_fetcher);
+    set_tile_cache(new QcFileTileCache(m_directory.path()));
+  }
+
+private:
+  QTemporaryDir m_directory;
+};
+
+/***************************************************************************************************/
+
+class TestQcOfflineAreaDownloader: public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void area();
+  void download();
+  void pause_resume();
+  void circuit_breaker();
+
+private:
+  QcOfflineArea square(double longitude, double latitude, double radius_m);
+};
+
+QcOfflineArea
+TestQcOfflineAreaDownloader::square(double longitude, double latitude, double radius_m)
+{
+  QcVectorDouble center = QcWgsCoordinate(longitude, latitude).pseudo_web_mercator().vector();
+  QcVectorDouble half_diagonal_m(radius_m, radius_m);
+  QcPolygon polygon;
+  polygon.add_vertex(center + half_diagonal_m.rotate_180());
+  polygon.add_vertex(center + half_diagonal_m.mirror_x());
+  polygon.add_vertex(center + half_diagonal_m);
+  polygon.add_vertex(center + half_diagonal_m.mirror_y());
+  return QcOfflineArea(polygon);
+}
+
+void
+TestQcOfflineAreaDownloader::area()
+{
+  QcOsmPlugin plugin;
+  const QcTileMatrixSet & tile_matrix_set = plugin.tile_matrix_set();
+
+  QcOfflineArea area = square(2.816, 45.54, 20 * 1000);
+  QcTiledPolygonRunList runs = area.tile_runs(tile_matrix_set, 0);
+  QCOMPARE(runs.size(), 1);
+  QCOMPARE(runs[0].interval(), QcIntervalInt(0, 0));
+  // A 40 km square spans at most two tiles of 78 km at level 9
+  for (const QcTiledPolygonRun & run : area.tile_runs(tile_matrix_set, 9))
+    QVERIFY(run.interval().sup() - run.interval().inf() <= 1);
+
+  QCOMPARE(QcOfflineArea::from_json(area.to_json()).to_json(), area.to_json());
+
+  // The rectangles of overlapping segments are merged
+  QList<QcWgsCoordinate> coordinates;
+  coordinates << QcWgsCoordinate(2.80, 45.54) << QcWgsCoordinate(2.81, 45.54) << QcWgsCoordinate(2.82, 45.55);
+  QcOfflineArea track_area = QcOfflineArea::from_track(coordinates, 500);
+  QCOMPARE(track_area.polygons().size(), 2);
+  QcTiledPolygonRunList track_runs = track_area.tile_runs(tile_matrix_set, 12);
+  for (int i = 1; i < track_runs.size(); i++)
+    QVERIFY(track_runs[i].y() != track_runs[i-1].y() ||
+            track_runs[i].interval().inf() > track_runs[i-1].interval().sup() + 1);
+
+  LocalTileFetcher tile_fetcher;
+  LocalWmtsManager wmts_manager(&tile_fetcher);
+  QTemporaryDir directory;
+  QcOfflineTileCache offline_cache(directory.path());
+  QcOfflineAreaDownloader downloader(plugin.layers().first(), &wmts_manager, &offline_cache);
+  downloader.set_area(area);
+  downloader.set_levels(0, 2);
+  QCOMPARE(downloader.tile_counts(), QVector<int>({1, 1, 1}));
+  QCOMPARE(downloader.number_of_tiles(), 3);
+  QCOMPARE(downloader.estimated_size(), qint64(3 * QcOfflineAreaDownloader::default_tile_size));
+}
+
+void
+TestQcOfflineAreaDownloader::download()
+{
+  QcOsmPlugin plugin;
+  LocalTileFetcher tile_fetcher;
+  LocalWmtsManager wmts_manager(&tile_fetcher);
+  QTemporaryDir directory;
+  QcOfflineTileCache offline_cache(directory.path());
+
+  const QcWmtsPluginLayer * layer = plugin.layers().first();
+  QcOfflineArea area = square(2.816, 45.54, 2 * 1000);
+  QcOfflineAreaDownloader downloader(layer, &wmts_manager, &offline_cache);
+  downloader.set_area(area);
+  downloader.set_levels(0, 12);
+  downloader.set_max_pending(4);
+  // A tile is already available offline
+  QcTileSpec offline_tile = layer->create_tile_spec(0, 0, 0);
+  offline_cache.insert(offline_tile, QByteArray("tile"), QStringLiteral("png"));
+
+  QSignalSpy spy(&downloader, SIGNAL(finished()));
+  downloader.start();
+  QCOMPARE(downloader.state(), QcOfflineAreaDownloader::Running);
+  QVERIFY(downloader.pending_tiles() <= 4);
+  QVERIFY(spy.wait());
+  QCOMPARE(downloader.state(), QcOfflineAreaDownloader::Finished);
+  QCOMPARE(downloader.skipped_tiles(), 1);
+  QCOMPARE(downloader.downloaded_tiles(), downloader.number_of_tiles() - 1);
+  QCOMPARE(downloader.received_bytes(), qint64(4 * downloader.downloaded_tiles()));
+  for (const QcTiledPolygonRun & run : area.tile_runs(plugin.tile_matrix_set(), 12))
+    for (int x = run.interval().inf(); x <= run.interval().sup(); x++)
+      QCOMPARE(offline_cache.read(layer->create_tile_spec(12, x, run.y())), QByteArray("tile"));
+}
+
+void
+TestQcOfflineAreaDownloader::pause_resume()
+{
+  QcOsmPlugin plugin;
+  const QcWmtsPluginLayer * layer = plugin.layers().first();
+  LocalTileFetcher tile_fetcher;
+  LocalWmtsManager wmts_manager(&tile_fetcher);
+  QTemporaryDir directory;
+  int number_of_tiles = 0;
+  int job_id = -1;
+
+  {
+    QcOfflineTileCache offline_cache(directory.path());
+    QcOfflineAreaDownloader downloader(layer, &wmts_manager, &offline_cache);
+    downloader.set_area(square(2.816, 45.54, 2 * 1000));
+    downloader.set_levels(0, 14);
+    downloader.set_max_pending(2);
+    number_of_tiles = downloader.number_of_tiles();
+    connect(&downloader, &QcOfflineAreaDownloader::progress_changed, [&downloader]() {
+        if (downloader.downloaded_tiles() >= 4)
+          downloader.pause();
+      });
+    downloader.start();
+    QTRY_COMPARE(downloader.state(), QcOfflineAreaDownloader::Paused);
+    QCOMPARE(downloader.pending_tiles(), 0);
+    job_id = downloader.job_id();
+    QVERIFY(job_id >= 0);
+    QCOMPARE(offline_cache.database()->missing_job_tiles(job_id), number_of_tiles - downloader.processed_tiles());
+    QVERIFY(downloader.processed_tiles() < number_of_tiles);
+  }
+
+  // The area and the levels are restored from the job after a restart
+  QcOfflineTileCache offline_cache(directory.path());
+  QCOMPARE(offline_cache.database()->job_ids(), QList<int>() << job_id);
+  QcOfflineAreaDownloader downloader(layer, &wmts_manager, &offline_cache);
+  QVERIFY(downloader.set_job(job_id));
+  QCOMPARE(downloader.number_of_tiles(), number_of_tiles);
+  QCOMPARE(downloader.max_level(), 14);
+  QSignalSpy spy(&downloader, SIGNAL(finished()));
+  downloader.start();
+  QVERIFY(spy.wait());
+  QCOMPARE(downloader.processed_tiles(), number_of_tiles);
+  QCOMPARE(downloader.failed_tiles(), 0);
+  QCOMPARE(offline_cache.database()->missing_job_tiles(job_id), 0);
+
+  downloader.cancel();
+  QVERIFY(offline_cache.database()->job_ids().isEmpty());
+}
+
+void
+TestQcOfflineAreaDownloader::circuit_breaker()
+{
+  QcOsmPlugin plugin;
+  const QcWmtsPluginLayer * layer = plugin.layers().first();
+  LocalTileFetcher tile_fetcher;
+  LocalWmtsManager wmts_manager(&tile_fetcher);
+  QTemporaryDir directory;
+  QcOfflineTileCache offline_cache(directory.path());
+
+  QcOfflineAreaDownloader downloader(layer, &wmts_manager, &offline_cache);
+  downloader.set_area(square(2.816, 45.54, 2 * 1000));
+  downloader.set_levels(12, 14);
+  downloader.set_max_pending(4);
+  downloader.start();
+  QCOMPARE(downloader.pending_tiles(), 4);
+  QCOMPARE(tile_fetcher.queue_depth(), 4);
+
+  // Other requests of the provider fail until the circuit opens
+  QcTileSpec failed_tile = layer->create_tile_spec(0, 0, 0);
+  for (int i = 0; i < wmts_manager.circuit_breaker().failure_threshold(); i++)
+    QMetaObject::invokeMethod(&wmts_manager, "fetcher_tile_error", Qt::DirectConnection,
+                              Q_ARG(QcTileSpec, failed_tile), Q_ARG(QString, QStringLiteral("error")));
+  QVERIFY(!wmts_manager.circuit_breaker().is_closed());
+
+  // The downloads are withdrawn and kept for later, without counting a failure
+  QCOMPARE(downloader.pending_tiles(), 0);
+  QCOMPARE(tile_fetcher.queue_depth(), 0);
+  QCOMPARE(downloader.failed_tiles(), 0);
+  QCOMPARE(downloader.state(), QcOfflineAreaDownloader::Running);
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcOfflineAreaDownloader)
+#include "test_offline_area_downloader.moc"
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
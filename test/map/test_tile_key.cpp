@@ -0,0 +1,105 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+#include "wmts/tile_key.h"
+#include "wmts/tile_spec.h"
+
+/***************************************************************************************************/
+
+class TestQcTileKey: public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void registry();
+  void pack();
+  void tile_spec();
+};
+
+void TestQcTileKey::registry()
+{
+  QcTilePluginRegistry & registry = QcTilePluginRegistry::instance();
+  QCOMPARE(registry.id(QString()), 0);
+  int osm_id = registry.id(QStringLiteral("osm"));
+  QVERIFY(osm_id > 0);
+  QCOMPARE(registry.id(QStringLiteral("osm")), osm_id);
+  QVERIFY(registry.id(QStringLiteral("geoportail")) != osm_id);
+  QCOMPARE(registry.name(osm_id), QStringLiteral("osm"));
+}
+
+void TestQcTileKey::pack()
+{
+  int max_coordinate = (1 << QcTileKey::coordinate_bits) - 1;
+  QcTileKey tile_key(3, 7, 21, max_coordinate, 12345);
+  QVERIFY(tile_key.is_valid());
+  QCOMPARE(tile_key.plugin_id(), 3);
+  QCOMPARE(tile_key.map_id(), 7);
+  QCOMPARE(tile_key.level(), 21);
+  QCOMPARE(tile_key.x(), max_coordinate);
+  QCOMPARE(tile_key.y(), 12345);
+
+  QVERIFY(!QcTileKey().is_valid());
+  QVERIFY(QcTileKey(3, 7, 21, 1, 2) != QcTileKey(3, 7, 21, 2, 1));
+  QVERIFY(QcTileKey(3, 7, 20, 1, 2) < QcTileKey(3, 7, 21, 1, 2));
+}
+
+void TestQcTileKey::tile_spec()
+{
+  QcTileSpec tile_spec("geoportail", 1, 16, 33885, 23658);
+  QcTileKey tile_key = tile_spec.key();
+  QCOMPARE(tile_key.plugin_id(), tile_spec.plugin_id());
+  QCOMPARE(tile_key.to_tile_spec(), tile_spec);
+  QCOMPARE(tile_key.to_tile_spec().plugin(), tile_spec.plugin());
+  QCOMPARE(qHash(tile_spec), qHash(tile_key));
+
+  QcTileSpec other_tile_spec("osm", 1, 16, 33885, 23658);
+  QVERIFY(!(other_tile_spec == tile_spec));
+  QVERIFY(other_tile_spec.key() != tile_key);
+  other_tile_spec.set_plugin("geoportail");
+  QVERIFY(other_tile_spec == tile_spec);
+
+  QcTileKeySet tile_keys;
+  tile_keys << tile_key << other_tile_spec.key();
+  QCOMPARE(tile_keys.size(), 1);
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcTileKey)
+#include "test_tile_key.moc"
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,217 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+#include "cache/tile_cache_index.h"
+#include "cache/tile_image.h"
+#include "cache/tile_pack.h"
+
+/***************************************************************************************************/
+
+class TestQcTilePack: public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void insert_read();
+  void remove_compact();
+  void read_view();
+  void import_files();
+  void index();
+};
+
+void TestQcTilePack::insert_read()
+{
+  QTemporaryDir directory;
+  QString filename = QDir(directory.path()).filePath(QcTilePack::default_filename);
+
+  QcTileSpec tile_spec1("geoportail", 1, 16, 33885, 23658);
+  QcTileSpec tile_spec2("osm", 2, 10, 511, 340);
+  QByteArray bytes1("tile1");
+  QByteArray bytes2("another tile");
+
+  {
+    QcTilePack tile_pack(filename);
+    QVERIFY(tile_pack.open());
+    QVERIFY(tile_pack.insert(tile_spec1, bytes1, QStringLiteral("jpeg")));
+    QVERIFY(tile_pack.insert(tile_spec2, bytes2, QStringLiteral("png")));
+    QCOMPARE(tile_pack.count(), 2);
+  }
+
+  QcTilePack tile_pack(filename);
+  QVERIFY(tile_pack.open());
+  QCOMPARE(tile_pack.count(), 2);
+  QVERIFY(tile_pack.contains(tile_spec1));
+  QString format;
+  QCOMPARE(tile_pack.read(tile_spec1, &format), bytes1);
+  QCOMPARE(format, QStringLiteral("jpeg"));
+  QCOMPARE(tile_pack.read(tile_spec2, &format), bytes2);
+  QCOMPARE(format, QStringLiteral("png"));
+
+  // Replace
+  QByteArray bytes3("updated tile");
+  QVERIFY(tile_pack.insert(tile_spec1, bytes3, QStringLiteral("jpeg")));
+  QCOMPARE(tile_pack.count(), 2);
+  QCOMPARE(tile_pack.read(tile_spec1), bytes3);
+  QVERIFY(tile_pack.dead_size() > 0);
+}
+
+void TestQcTilePack::remove_compact()
+{
+  QTemporaryDir directory;
+  QString filename = QDir(directory.path()).filePath(QcTilePack::default_filename);
+
+  QcTilePack tile_pack(filename);
+  QVERIFY(tile_pack.open());
+  for (int i = 0; i < 10; i++)
+    tile_pack.insert(QcTileSpec("osm", 1, 10, i, i), QByteArray(100, 'a' + i), QStringLiteral("png"));
+  qint64 size = tile_pack.size();
+
+  for (int i = 0; i < 10; i += 2)
+    QVERIFY(tile_pack.remove(QcTileSpec("osm", 1, 10, i, i)));
+  QCOMPARE(tile_pack.count(), 5);
+  QVERIFY(tile_pack.compact());
+  QVERIFY(tile_pack.size() < size);
+  QCOMPARE(tile_pack.dead_size(), qint64(0));
+  QCOMPARE(tile_pack.read(QcTileSpec("osm", 1, 10, 3, 3)), QByteArray(100, 'a' + 3));
+
+  // Reopen after compaction
+  tile_pack.close();
+  QVERIFY(tile_pack.open());
+  QCOMPARE(tile_pack.count(), 5);
+  QVERIFY(!tile_pack.contains(QcTileSpec("osm", 1, 10, 2, 2)));
+}
+
+void TestQcTilePack::read_view()
+{
+  QTemporaryDir directory;
+  QcTilePack tile_pack(QDir(directory.path()).filePath(QcTilePack::default_filename));
+  QVERIFY(tile_pack.open());
+
+  QcTileSpec tile_spec1("osm", 1, 10, 1, 1);
+  QcTileSpec tile_spec2("osm", 1, 10, 2, 2);
+  tile_pack.insert(tile_spec1, QByteArray("first"), QStringLiteral("png"));
+  QString format;
+  QByteArray view1 = tile_pack.read_view(tile_spec1, &format);
+  QCOMPARE(view1, QByteArray("first"));
+  QCOMPARE(format, QStringLiteral("png"));
+
+  // Appended after the first mapping
+  tile_pack.insert(tile_spec2, QByteArray("second"), QStringLiteral("png"));
+  QCOMPARE(tile_pack.read_view(tile_spec2), QByteArray("second"));
+  QCOMPARE(view1, QByteArray("first"));
+
+  QcTileSpec tile_spec3("osm", 1, 10, 3, 3);
+  QString tile_filename = tile_spec_to_filename(tile_spec3, QStringLiteral("png"), directory.path());
+  write_tile_image(tile_filename, QByteArray("third"));
+  QcMappedTileFile mapped_file(tile_filename);
+  QVERIFY(mapped_file.is_mapped());
+  QCOMPARE(mapped_file.bytes(), QByteArray("third"));
+}
+
+void TestQcTilePack::import_files()
+{
+  QTemporaryDir directory;
+  QcTileSpec tile_spec("geoportail", 1, 16, 33885, 23658);
+  QString tile_filename = tile_spec_to_filename(tile_spec, QStringLiteral("jpeg"), directory.path());
+  write_tile_image(tile_filename, QByteArray("tile"));
+
+  QcTilePack tile_pack(QDir(directory.path()).filePath(QcTilePack::default_filename));
+  QVERIFY(tile_pack.open());
+  QCOMPARE(tile_pack.import_files(directory.path()), 1);
+  QVERIFY(!QFile::exists(tile_filename));
+  QString format;
+  QCOMPARE(tile_pack.read(tile_spec, &format), QByteArray("tile"));
+  QCOMPARE(format, QStringLiteral("jpeg"));
+}
+
+void TestQcTilePack::index()
+{
+  QTemporaryDir directory;
+  QString filename = QDir(directory.path()).filePath(QcTilePack::default_filename);
+  QString index_filename = QDir(directory.path()).filePath(QcTileCacheIndex::default_filename);
+
+  QcTilePack tile_pack(filename);
+  QVERIFY(tile_pack.open());
+  for (int i = 0; i < 100; i++)
+    tile_pack.insert(QcTileSpec(i % 2 ? "osm" : "geoportail", 1, 16, i, 2*i), QByteArray(i + 1, 'a'),
+                     QStringLiteral("png"));
+
+  QcTileCacheIndexEntryList entries;
+  QHash<QcTileSpec, QcTilePackEntry> pack_index = tile_pack.index();
+  for (auto it = pack_index.constBegin(); it != pack_index.constEnd(); ++it) {
+    QcTileCacheIndexEntry entry;
+    entry.tile_spec = it.key();
+    entry.format = it->format;
+    entry.size = it->size;
+    entry.queue = it.key().x() % 4 + 1;
+    entry.offset = it->offset;
+    entry.data_offset = it->data_offset;
+    entries << entry;
+  }
+  QVERIFY(QcTileCacheIndex::write(index_filename, entries, tile_pack.size(), tile_pack.dead_size()));
+
+  QcTileCacheIndexEntryList read_entries;
+  qint64 pack_size, dead_size;
+  QVERIFY(QcTileCacheIndex::read(index_filename, read_entries, pack_size, dead_size));
+  QCOMPARE(pack_size, tile_pack.size());
+  QCOMPARE(read_entries.size(), entries.size());
+
+  // Open without scan and use the index
+  QHash<QcTileSpec, QcTilePackEntry> index;
+  for (const auto & entry : read_entries) {
+    QCOMPARE(entry.queue, entry.tile_spec.x() % 4 + 1);
+    QcTilePackEntry pack_entry;
+    pack_entry.offset = entry.offset;
+    pack_entry.data_offset = entry.data_offset;
+    pack_entry.size = entry.size;
+    pack_entry.format = entry.format;
+    index.insert(entry.tile_spec, pack_entry);
+  }
+  tile_pack.close();
+  QVERIFY(tile_pack.open(false));
+  QCOMPARE(tile_pack.count(), 0);
+  tile_pack.merge_index(index, dead_size);
+  QCOMPARE(tile_pack.count(), 100);
+  QCOMPARE(tile_pack.read(QcTileSpec("osm", 1, 16, 51, 102)), QByteArray(52, 'a'));
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcTilePack)
+#include "test_tile_pack.moc"
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
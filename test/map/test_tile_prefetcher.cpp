@@ -0,0 +1,204 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QtMath>
+
+/**************************************************************************************************/
+
+#include "coordinate/mercator.h"
+#include "earth.h"
+#include "map/map_update_scheduler.h"
+#include "map/map_view.h"
+#include "map/tile_prefetcher.h"
+#include "map/tile_visibility.h"
+#include "map/viewport.h"
+#include "scene/map_scene.h"
+#include "wmts/providers/osm/osm_plugin.h"
+
+/***************************************************************************************************/
+
+class TestQcTilePrefetcher : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void initTestCase();
+  void cleanupTestCase();
+  void init();
+  void cleanup();
+  void candidates();
+  void budget();
+  void stale_predictions();
+
+private:
+  QcTileSpec tile_at(const QcVectorDouble & point, int level) const;
+
+private:
+  QcOsmPlugin * m_plugin;
+  const QcWmtsPluginLayer * m_plugin_layer;
+  QcViewport * m_viewport;
+  QcTileVisibility * m_visibility;
+  QcMapLayerScene * m_layer_scene;
+  QcMapViewLayer * m_layer;
+  QcMapUpdateScheduler * m_scheduler;
+  QcTilePrefetcher * m_prefetcher;
+};
+
+void
+TestQcTilePrefetcher::initTestCase()
+{
+  // Keep the tile cache of the plugin away from the user cache
+  QStandardPaths::setTestModeEnabled(true);
+  m_plugin = new QcOsmPlugin();
+  m_plugin_layer = m_plugin->layers().first();
+}
+
+void
+TestQcTilePrefetcher::cleanupTestCase()
+{
+  delete m_plugin;
+}
+
+// A 512 px map view at level 10 on Paris, without visible tile
+void
+TestQcTilePrefetcher::init()
+{
+  m_plugin->wmts_manager()->tile_cache()->clear_all();
+
+  m_viewport = new QcViewport(QcViewportState(QcWgsCoordinate(0, 0), QcTiledZoomLevel(EQUATORIAL_PERIMETER, 256, 10), 0),
+                              QSize(0, 0));
+  m_viewport->set_projection(&QcWebMercatorCoordinate::cls_projection);
+  m_viewport->set_zoom_level_interval(QcIntervalInt(0, m_plugin->tile_matrix_set().number_of_levels() - 1), 256);
+  m_viewport->set_viewport_size(QSize(512, 512), 1);
+  m_viewport->set_center(QcWgsCoordinate(2.35, 48.85));
+  QCOMPARE(int(m_viewport->zoom_level()), 10);
+
+  m_visibility = new QcTileVisibility(m_viewport);
+  m_layer_scene = new QcMapLayerScene(m_plugin_layer, m_viewport);
+  m_layer = new QcMapViewLayer(m_plugin_layer, m_visibility, m_layer_scene);
+  m_scheduler = new QcMapUpdateScheduler();
+  m_prefetcher = new QcTilePrefetcher(m_viewport, m_scheduler);
+  m_prefetcher->set_bandwidth_budget(0); // unlimited
+}
+
+void
+TestQcTilePrefetcher::cleanup()
+{
+  m_plugin->wmts_manager()->release_map(m_layer);
+  delete m_prefetcher;
+  delete m_scheduler;
+  delete m_layer;
+  delete m_layer_scene;
+  delete m_visibility;
+  delete m_viewport;
+}
+
+QcTileSpec
+TestQcTilePrefetcher::tile_at(const QcVectorDouble & point, int level) const
+{
+  const QcTileMatrixSet & tile_matrix_set = m_plugin->tile_matrix_set();
+  QcVectorDouble position = (point - tile_matrix_set.origin()) * tile_matrix_set.scale() / tile_matrix_set[level].tile_length_m();
+  return m_plugin_layer->create_tile_spec(level, qFloor(position.x()), qFloor(position.y()));
+}
+
+void
+TestQcTilePrefetcher::candidates()
+{
+  QcWmtsRequestManager * request_manager = m_layer->request_manager();
+  QcVectorDouble center = m_viewport->projected_center_coordinate();
+
+  // Without motion, the viewport is prefetched at its level and the adjacent ones
+  m_prefetcher->prefetch({m_layer}, QcVectorDouble(0, 0), 0);
+  for (int level : {9, 10, 11})
+    QVERIFY(request_manager->is_prefetched(tile_at(center, level)));
+  QVERIFY(!request_manager->is_prefetched(tile_at(center, 12)));
+  QVERIFY(m_prefetcher->prefetched_tiles() > 3);
+  QCOMPARE(m_prefetcher->over_budget_tiles(), 0);
+  QCOMPARE(m_plugin->tile_fetcher()->queue_depth(), m_prefetcher->prefetched_tiles());
+
+  // A flick to the west moves the viewport to the east, the path is
+  // prefetched at the current level and only its end at the other levels
+  QcVectorDouble path_end = center + m_viewport->from_px(QcVectorDouble(2000, 0));
+  m_prefetcher->prefetch({m_layer}, QcVectorDouble(-4000, 0), 0);
+  QVERIFY(request_manager->is_prefetched(tile_at(center + m_viewport->from_px(QcVectorDouble(1000, 0)), 10)));
+  QVERIFY(request_manager->is_prefetched(tile_at(path_end, 10)));
+  QVERIFY(request_manager->is_prefetched(tile_at(path_end, 9)));
+  QVERIFY(request_manager->is_prefetched(tile_at(path_end, 11)));
+  QVERIFY(!request_manager->is_prefetched(tile_at(center + m_viewport->from_px(QcVectorDouble(-1000, 0)), 10)));
+}
+
+void
+TestQcTilePrefetcher::budget()
+{
+  // One tile per second with a burst of two tiles
+  m_prefetcher->set_bandwidth_budget(QcTilePrefetcher::estimated_tile_size);
+  m_prefetcher->prefetch({m_layer}, QcVectorDouble(0, 0), 0);
+  QVERIFY(m_prefetcher->prefetched_tiles() >= 1);
+  QVERIFY(m_prefetcher->prefetched_tiles() <= 2);
+  QVERIFY(m_prefetcher->over_budget_tiles() > 0);
+  QCOMPARE(m_plugin->tile_fetcher()->queue_depth(), m_prefetcher->prefetched_tiles());
+
+  // The nearest tile of the viewport level is prefetched first
+  QVERIFY(m_layer->request_manager()->is_prefetched(tile_at(m_viewport->projected_center_coordinate(), 10)));
+}
+
+void
+TestQcTilePrefetcher::stale_predictions()
+{
+  QcWmtsRequestManager * request_manager = m_layer->request_manager();
+  QcVectorDouble center = m_viewport->projected_center_coordinate();
+  QcTileSpec east_tile = tile_at(center + m_viewport->from_px(QcVectorDouble(2000, 0)), 10);
+
+  m_prefetcher->prefetch({m_layer}, QcVectorDouble(-4000, 0), 0);
+  QVERIFY(request_manager->is_prefetched(east_tile));
+  int flick_tiles = m_plugin->tile_fetcher()->queue_depth();
+
+  // The flick stops, the prefetches of the path are canceled
+  m_prefetcher->prefetch({m_layer}, QcVectorDouble(0, 0), 0);
+  QVERIFY(!request_manager->is_prefetched(east_tile));
+  QVERIFY(request_manager->is_prefetched(tile_at(center, 10)));
+  QVERIFY(m_plugin->tile_fetcher()->queue_depth() < flick_tiles);
+
+  // A disabled prefetcher cancels all its prefetches
+  m_prefetcher->set_enabled(false);
+  m_prefetcher->prefetch({m_layer}, QcVectorDouble(0, 0), 1);
+  QVERIFY(!request_manager->is_prefetched(tile_at(center, 10)));
+  QCOMPARE(m_plugin->tile_fetcher()->queue_depth(), 0);
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcTilePrefetcher)
+#include "test_tile_prefetcher.moc"
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,193 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+
+/**************************************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+#include "wmts/tile_request_queue.h"
+
+/***************************************************************************************************/
+
+class TestQcTileRequestQueue: public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void priority();
+  void prefetch();
+  void indexed_heap();
+  void continuous_pan();
+};
+
+void TestQcTileRequestQueue::priority()
+{
+  QcTileRequestQueue queue;
+  QcTileSpec corner("osm", 1, 4, 0, 0);
+  QcTileSpec center("osm", 1, 4, 8, 8);
+  QcTileSpec near_center("osm", 1, 4, 9, 8);
+  QcTileSpec clone("osm", 1, 4, 15, 8);
+  QcTileSpec parent("osm", 1, 3, 4, 4);
+  for (const auto & tile_spec : {corner, parent, clone, near_center, center})
+    QVERIFY(queue.push(tile_spec));
+  QVERIFY(!queue.push(center));
+  QCOMPARE(queue.size(), 5);
+
+  // FIFO without focus
+  QCOMPARE(queue.top(), corner);
+
+  // Current level first, then central part, then distance to the centre
+  queue.set_focus(QcTileRequestFocus(4, 8.5, 8.5, 0, 12));
+  QList<QcTileSpec> expected = {center, near_center, corner, clone, parent};
+  QCOMPARE(queue.to_list(), expected);
+
+  // The viewport moves to the north west
+  queue.set_focus(QcTileRequestFocus(4, .5, .5, 0, 12));
+  QCOMPARE(queue.top(), corner);
+
+  QVERIFY(queue.remove(corner));
+  QVERIFY(!queue.contains(corner));
+  QCOMPARE(queue.pop(), center);
+  QCOMPARE(queue.size(), 3);
+}
+
+void TestQcTileRequestQueue::prefetch()
+{
+  QcTileRequestQueue queue;
+  QcTileSpec corner("osm", 1, 4, 0, 0);
+  QcTileSpec near_center("osm", 1, 4, 9, 8);
+  QcTileSpec parent("osm", 1, 3, 4, 4);
+
+  // Prefetches come after the FIFO tiles without focus
+  QVERIFY(queue.push(near_center, true));
+  QVERIFY(queue.push(corner));
+  QVERIFY(queue.is_prefetch(near_center));
+  QVERIFY(!queue.is_prefetch(corner));
+  QCOMPARE(queue.top(), corner);
+
+  // A prefetch near the centre comes after a visible tile in the corner
+  queue.set_focus(QcTileRequestFocus(4, 8.5, 8.5, 0, 12));
+  QVERIFY(queue.push(parent));
+  QList<QcTileSpec> expected = {corner, parent, near_center};
+  QCOMPARE(queue.to_list(), expected);
+
+  // The prefetch becomes visible
+  QVERIFY(!queue.push(near_center));
+  QVERIFY(!queue.is_prefetch(near_center));
+  QCOMPARE(queue.top(), near_center);
+  QCOMPARE(queue.size(), 3);
+
+  // A visible tile is not demoted
+  QVERIFY(!queue.push(near_center, true));
+  QVERIFY(!queue.is_prefetch(near_center));
+}
+
+void TestQcTileRequestQueue::indexed_heap()
+{
+  // Compare with a sorted reference under random operations
+  QcTileRequestQueue queue;
+  queue.set_focus(QcTileRequestFocus(10, 512, 512, 0, 1024));
+  QMap<quint64, QcTileSpec> reference; // (priority, x) -> tile
+  auto reference_key = [&queue](const QcTileSpec & tile_spec) {
+    return (queue.priority(tile_spec) << 10) | quint64(tile_spec.x()); // unique for a row
+  };
+  qsrand(1);
+  for (int i = 0; i < 10000; i++) {
+    QcTileSpec tile_spec("osm", 1, 10, qrand() % 1024, 500);
+    switch (qrand() % 3) {
+    case 0: {
+      bool contained = reference.contains(reference_key(tile_spec));
+      QCOMPARE(queue.push(tile_spec), !contained);
+      reference.insert(reference_key(tile_spec), tile_spec);
+      break;
+    }
+    case 1:
+      QCOMPARE(queue.remove(tile_spec), reference.remove(reference_key(tile_spec)) > 0);
+      break;
+    case 2:
+      if (!queue.is_empty()) {
+        QcTileSpec top = queue.pop();
+        QCOMPARE(queue.priority(top), queue.priority(reference.first()));
+        reference.remove(reference_key(top));
+      }
+      break;
+    }
+    QCOMPARE(queue.size(), reference.size());
+  }
+}
+
+/* Simulate a continuous pan at 60 fps during 10 s on a 4K screen, the
+ * fetcher dispatches less tiles than the pan uncovers so that the queue
+ * holds hundreds of tiles.
+ */
+void TestQcTileRequestQueue::continuous_pan()
+{
+  int level = 16;
+  int width = 16; // tiles
+  int height = 10;
+  int batch_size = 1; // tiles dispatched per frame
+  int number_of_frames = 10 * 60;
+  double speed = .25; // tile per frame
+
+  QBENCHMARK {
+    QcTileRequestQueue queue;
+    QSet<QcTileSpec> visible_tiles;
+    int cancelled = 0;
+    for (int frame = 0; frame < number_of_frames; frame++) {
+      double x = 1000 + frame * speed;
+      double y = 1000 + frame * speed / 2;
+      QSet<QcTileSpec> tiles;
+      for (int i = int(x); i <= int(x) + width; i++)
+        for (int j = int(y); j <= int(y) + height; j++)
+          tiles.insert(QcTileSpec("osm", 1, level, i, j));
+      for (const auto & tile_spec : visible_tiles - tiles)
+        cancelled += queue.remove(tile_spec);
+      queue.set_focus(QcTileRequestFocus(level, x + width / 2., y + height / 2., x, x + width));
+      for (const auto & tile_spec : tiles - visible_tiles)
+        queue.push(tile_spec);
+      visible_tiles = tiles;
+      for (int i = 0; i < batch_size && !queue.is_empty(); i++)
+        queue.pop();
+    }
+    QVERIFY(cancelled > 0);
+  }
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcTileRequestQueue)
+#include "test_tile_request_queue.moc"
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -0,0 +1,144 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+/**************************************************************************************************/
+
+#include <QtTest/QtTest>
+
+/**************************************************************************************************/
+
+#include "coordinate/mercator.h"
+#include "earth.h"
+#include "map/tile_visibility.h"
+#include "map/viewport.h"
+#include "wmts/tile_matrix_set.h"
+
+/***************************************************************************************************/
+
+class TestQcTileVisibility: public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void shared_coverage();
+  void level_count();
+
+private:
+  void init_viewport(QcViewport & viewport);
+};
+
+// Set up the viewport as a map view, at the zoom level of its state
+void
+TestQcTileVisibility::init_viewport(QcViewport & viewport)
+{
+  viewport.set_projection(&QcWebMercatorCoordinate::cls_projection);
+  viewport.set_zoom_level_interval(QcIntervalInt(0, 20), 256);
+  viewport.set_viewport_size(QSize(1024, 512), 1);
+  viewport.set_center(QcWgsCoordinate(2.35, 48.85));
+}
+
+void
+TestQcTileVisibility::shared_coverage()
+{
+  QcViewport viewport(QcViewportState(QcWgsCoordinate(0, 0), QcTiledZoomLevel(EQUATORIAL_PERIMETER, 256, 12), 0), QSize(0, 0));
+  init_viewport(viewport);
+  QcTileVisibility visibility(&viewport);
+
+  // Equal grids share the coverage
+  QcMercatorTileMatrixSet tile_matrix_set1(20, 256);
+  QcMercatorTileMatrixSet tile_matrix_set2(20, 256);
+  const QcTileCoverage * coverage1 = &visibility.coverage(tile_matrix_set1);
+  QVERIFY(coverage1->is_defined());
+  QCOMPARE(coverage1->zoom_level(), 12);
+  QVERIFY(!coverage1->tiled_polygon(QcViewportPartKind::Central).runs().isEmpty());
+  QCOMPARE(&visibility.coverage(tile_matrix_set2), coverage1);
+  QCOMPARE(visibility.number_of_coverages(), 1);
+
+  // Another tile size or origin is another grid
+  QcMercatorTileMatrixSet tile_matrix_set3(20, 512);
+  const QcTileCoverage * coverage3 = &visibility.coverage(tile_matrix_set3);
+  QVERIFY(coverage3 != coverage1);
+  QcTileMatrixSet tile_matrix_set4(QcProjection::by_srid(QLatin1Literal("epsg:3857")),
+                                   QcVectorDouble(0, 0), QcVectorDouble(1., -1.),
+                                   QcWgsCoordinate(.0, .0), 20, 256);
+  const QcTileCoverage * coverage4 = &visibility.coverage(tile_matrix_set4);
+  QVERIFY(coverage4 != coverage1 && coverage4 != coverage3);
+  QCOMPARE(visibility.number_of_coverages(), 3);
+
+  // The coverages are computed again at the next update
+  visibility.begin_update();
+  QCOMPARE(&visibility.coverage(tile_matrix_set2), coverage1);
+  QCOMPARE(coverage1->serial(), 1);
+  QCOMPARE(coverage1->base_serial(), 0);
+  QCOMPARE(visibility.number_of_coverages(), 3);
+}
+
+/* A grid with fewer levels has its own coverage, it is undefined beyond
+ * its last level whatever the order of the requests.
+ */
+void
+TestQcTileVisibility::level_count()
+{
+  QcMercatorTileMatrixSet deep_tile_matrix_set(20, 256); // levels 0 to 19
+  QcMercatorTileMatrixSet shallow_tile_matrix_set(18, 256); // levels 0 to 17
+
+  for (int deep_first = 0; deep_first < 2; deep_first++) {
+    QcViewport viewport(QcViewportState(QcWgsCoordinate(0, 0), QcTiledZoomLevel(EQUATORIAL_PERIMETER, 256, 19), 0), QSize(0, 0));
+    init_viewport(viewport);
+    QCOMPARE(int(viewport.zoom_level()), 19);
+    QcTileVisibility visibility(&viewport);
+
+    const QcTileCoverage * deep_coverage;
+    const QcTileCoverage * shallow_coverage;
+    if (deep_first) {
+      deep_coverage = &visibility.coverage(deep_tile_matrix_set);
+      shallow_coverage = &visibility.coverage(shallow_tile_matrix_set);
+    } else {
+      shallow_coverage = &visibility.coverage(shallow_tile_matrix_set);
+      deep_coverage = &visibility.coverage(deep_tile_matrix_set);
+    }
+    QVERIFY(deep_coverage != shallow_coverage);
+    QCOMPARE(visibility.number_of_coverages(), 2);
+
+    QVERIFY(deep_coverage->is_defined());
+    QCOMPARE(deep_coverage->zoom_level(), 19);
+    QVERIFY(!deep_coverage->tiled_polygon(QcViewportPartKind::Central).runs().isEmpty());
+
+    QVERIFY(!shallow_coverage->is_defined());
+    QVERIFY(shallow_coverage->tiled_polygon(QcViewportPartKind::Central).runs().isEmpty());
+  }
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcTileVisibility)
+#include "test_tile_visibility.moc"
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -31,110 +31,113 @@
 
 /**************************************************************************************************/
 
+#include "earth.h"
 #include "map/map_view.h"
+#include "map/tile_visibility.h"
+#include "map/viewport.h"
+#include "scene/map_scene.h"
+#include "wmts/providers/osm/osm_plugin.h"
 #include "wmts/wmts_manager.h"
-#include "wmts/wmts_plugin.h"
-#include "wmts/wmts_reply.h"
-#include "wmts/wmts_tile_fetcher.h"
+
+#include "local_tile_fetcher.h"
 
 /***************************************************************************************************/
 
-class TestQcWmtsManager : public QObject
+// Layer of a map view, its scene tells which tiles were served
+class LocalMapViewLayer
 {
-  Q_OBJECT;
+public:
+  LocalMapViewLayer(const QcWmtsPluginLayer * plugin_layer)
+    : m_viewport(QcViewportState(QcWgsCoordinate(0, 0), QcTiledZoomLevel(EQUATORIAL_PERIMETER, 256, 0), 0), QSize(0, 0)),
+      m_visibility(&m_viewport),
+      m_layer_scene(plugin_layer, &m_viewport),
+      m_layer(plugin_layer, &m_visibility, &m_layer_scene)
+  {}
+
+  QcMapViewLayer * layer() { return &m_layer; }
+
+  void request_tile(const QcTileSpec & tile_spec) {
+    m_layer_scene.update_visible_tiles(QcViewportPartKind::Central, QcTileKeySet() << tile_spec.key(), QcTileKeySet());
+    m_layer.request_manager()->update_tile_requests(QcTileSpecSet() << tile_spec, QcTileSpecSet());
+  }
 
- private slots:
-  void constructor();
+  bool is_served(const QcTileSpec & tile_spec) const { return m_layer_scene.is_textured(tile_spec.key()); }
+
+private:
+  QcViewport m_viewport;
+  QcTileVisibility m_visibility;
+  QcMapLayerScene m_layer_scene;
+  QcMapViewLayer m_layer;
 };
 
-class FakeWmtsReply : public QcWmtsReply
+/***************************************************************************************************/
+
+class TestQcWmtsManager : public QObject
 {
   Q_OBJECT
 
- private:
-  static QByteArray m_bytes;
-
- public:
-  FakeWmtsReply(const QcTileSpec & tile_spec)
-    : QcWmtsReply(tile_spec)
-  {
-    if (!m_bytes.size()) {
-      QFile file("../wmts.jpg"); // Fixme
-      file.open(QIODevice::ReadOnly);
-      m_bytes = file.readAll();
-    }
-
-    set_map_image_data(m_bytes);
-    set_map_image_format("jpg");
-    set_finished(true);
-  }
+private slots:
+  void initTestCase();
+  void single_flight();
+  void release_map();
 };
 
-QByteArray FakeWmtsReply::m_bytes;
-
-class FakeWmtsTileFetcher : public QcWmtsTileFetcher
+void
+TestQcWmtsManager::initTestCase()
 {
-  Q_OBJECT
+  // Keep the tile cache of the plugin away from the user cache
+  QStandardPaths::setTestModeEnabled(true);
+}
 
- public:
-  FakeWmtsTileFetcher()
-    : QcWmtsTileFetcher()
-  {}
+void
+TestQcWmtsManager::single_flight()
+{
+  QcOsmPlugin plugin;
+  QcWmtsManager * wmts_manager = plugin.wmts_manager();
+  LocalTileFetcher tile_fetcher(LocalTileFetcher::png_tile());
+  wmts_manager->set_tile_fetcher(&tile_fetcher);
+  wmts_manager->tile_cache()->clear_all();
 
- private:
-  QcWmtsReply * get_tile_image(const QcTileSpec & tile_spec) {
-    qInfo() << "FakeWmtsTileFetcher::get_tile_image" << tile_spec;
-    return new FakeWmtsReply(tile_spec);
-  }
-};
+  const QcWmtsPluginLayer * plugin_layer = plugin.layers().first();
+  LocalMapViewLayer map_view1(plugin_layer);
+  LocalMapViewLayer map_view2(plugin_layer);
+
+  // Both map views request the same tile, it is fetched and decoded once
+  QSignalSpy decoded_spy(wmts_manager->tile_cache(), SIGNAL(tile_decoded(QcTileSpec)));
+  QcTileSpec tile_spec = plugin_layer->create_tile_spec(3, 2, 5);
+  map_view1.request_tile(tile_spec);
+  map_view2.request_tile(tile_spec);
+  QTRY_VERIFY(map_view1.is_served(tile_spec) && map_view2.is_served(tile_spec));
+  QCOMPARE(tile_fetcher.number_of_requests(), 1);
+  QCOMPARE(decoded_spy.count(), 1);
+
+  wmts_manager->release_map(map_view1.layer());
+  wmts_manager->release_map(map_view2.layer());
+}
 
-void TestQcWmtsManager::constructor()
+void
+TestQcWmtsManager::release_map()
 {
-  QcWmtsPlugin wmts_plugin("foo", 20, 256);
-  QcWmtsManager * wmts_manager = wmts_plugin.wmts_manager();
-  FakeWmtsTileFetcher tile_fetcher;
+  QcOsmPlugin plugin;
+  QcWmtsManager * wmts_manager = plugin.wmts_manager();
+  LocalTileFetcher tile_fetcher(LocalTileFetcher::png_tile());
   wmts_manager->set_tile_fetcher(&tile_fetcher);
   wmts_manager->tile_cache()->clear_all();
 
-  QcMapView map_view1(&wmts_plugin);
-  map_view1.setObjectName("map1");
-
-  QcMapView map_view2(&wmts_plugin);
-  map_view2.setObjectName("map2");
-
-  QSet<QcTileSpec> tiles_added;
-  QcTileSpecSet tiles_removed ;
-
-  QcTileSpec tile_spec1("geoportail", 1, 16, 1, 1);
-  tiles_added = {tile_spec1};
-  tiles_removed = {} ;
-  wmts_manager->update_tile_requests(&map_view1, tiles_added, tiles_removed);
-  wmts_manager->dump();
-  QTest::qWait(1);
-
-  QcTileSpec tile_spec2("geoportail", 1, 16, 2, 2);
-  tiles_added = {tile_spec2};
-  tiles_removed = {} ;
-  wmts_manager->update_tile_requests(&map_view2, tiles_added, tiles_removed);
-  wmts_manager->dump();
-  QTest::qWait(1);
-
-  tiles_added = {tile_spec2};
-  tiles_removed = {tile_spec1} ;
-  wmts_manager->update_tile_requests(&map_view1, tiles_added, tiles_removed);
-  wmts_manager->dump();
-  QTest::qWait(1);
-
-  QcTileSpec tile_spec3("geoportail", 1, 16, 3, 3);
-  tiles_added = {tile_spec3};
-  tiles_removed = {} ;
-  wmts_manager->update_tile_requests(&map_view2, tiles_added, tiles_removed);
-  wmts_manager->dump();
-  QTest::qWait(1);
-
-  qInfo() << "Release map2";
-  wmts_manager->release_map(&map_view2);
-  wmts_manager->dump();
+  const QcWmtsPluginLayer * plugin_layer = plugin.layers().first();
+  LocalMapViewLayer map_view1(plugin_layer);
+  LocalMapViewLayer map_view2(plugin_layer);
+
+  // The request goes on for the map view which still waits for the tile
+  QcTileSpec tile_spec = plugin_layer->create_tile_spec(4, 7, 9);
+  map_view1.request_tile(tile_spec);
+  map_view2.request_tile(tile_spec);
+  wmts_manager->release_map(map_view1.layer());
+  QTRY_VERIFY(map_view2.is_served(tile_spec));
+  QVERIFY(!map_view1.is_served(tile_spec));
+  QCOMPARE(tile_fetcher.number_of_requests(), 1);
+
+  wmts_manager->release_map(map_view2.layer());
 }
 
 /***************************************************************************************************/
@@ -0,0 +1,325 @@
+/***************************************************************************************************
+**
+** $QTCARTO_BEGIN_LICENSE:GPL3$
+**
+** Copyright (C) 2016 Fabrice Salvaire
+** Contact: http://www.fabrice-salvaire.fr
+**
+** This file is part of the QtCarto library.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+** $QTCARTO_END_LICENSE$
+**
+***************************************************************************************************/
+
+
+/**************************************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QNetworkAccessManager>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtDebug>
+
+/**************************************************************************************************/
+
+#include "wmts/circuit_breaker.h"
+#include "wmts/providers/osm/osm_plugin.h"
+#include "wmts/token_bucket.h"
+#include "wmts/wmts_network_reply.h"
+#include "wmts/wmts_tile_fetcher.h"
+
+/***************************************************************************************************/
+
+// Local stand-in for a tile server, it answers each request after a delay
+// and revalidates the tile of ETag "v1"
+class TileServer : public QTcpServer
+{
+  Q_OBJECT
+
+public:
+  TileServer()
+    : m_pending(0),
+      m_max_pending(0)
+  {
+    connect(this, &QTcpServer::newConnection, this, &TileServer::accept);
+    listen(QHostAddress::LocalHost);
+  }
+
+  int max_pending() const { return m_max_pending; }
+
+private slots:
+  void accept() {
+    while (hasPendingConnections()) {
+      QTcpSocket * socket = nextPendingConnection();
+      connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { read_request(socket); });
+    }
+  }
+
+private:
+  void read_request(QTcpSocket * socket) {
+    QByteArray & buffer = m_buffers[socket];
+    buffer += socket->readAll();
+    int index;
+    while ((index = buffer.indexOf("\r\n\r\n")) >= 0) {
+      bool not_modified = buffer.left(index).contains("If-None-Match: \"v1\"");
+      buffer.remove(0, index + 4);
+      m_max_pending = qMax(m_max_pending, ++m_pending);
+      QTimer::singleShot(20, socket, [this, socket, not_modified]() {
+          m_pending--;
+          if (not_modified)
+            socket->write("HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\nCache-Control: max-age=60\r\n\r\n");
+          else
+            socket->write("HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nETag: \"v1\"\r\n"
+                          "Cache-Control: max-age=60\r\nContent-Length: 4\r\n\r\ntile");
+        });
+    }
+  }
+
+private:
+  QHash<QTcpSocket *, QByteArray> m_buffers;
+  int m_pending;
+  int m_max_pending;
+};
+
+class LocalTileFetcher : public QcWmtsTileFetcher
+{
+  Q_OBJECT
+
+public:
+  LocalTileFetcher(quint16 port)
+    : QcWmtsTileFetcher(),
+      m_port(port)
+  {}
+
+  void set_etag(const QByteArray & etag) { m_etag = etag; }
+
+private:
+  QcWmtsReply * get_tile_image(const QcTileSpec & tile_spec) override {
+    QUrl url(QStringLiteral("http://127.0.0.1:%1/%2/%3/%4")
+             .arg(m_port).arg(tile_spec.level()).arg(tile_spec.x()).arg(tile_spec.y()));
+    QNetworkRequest request(url);
+    if (!m_etag.isEmpty())
+      request.setRawHeader("If-None-Match", m_etag);
+    QNetworkReply * reply = m_manager.get(request);
+    return new QcWmtsNetworkReply(reply, tile_spec, QStringLiteral("png"));
+  }
+
+  QString tile_host(const QcTileSpec & tile_spec) const override {
+    Q_UNUSED(tile_spec);
+    return QStringLiteral("127.0.0.1");
+  }
+
+private:
+  QNetworkAccessManager m_manager;
+  quint16 m_port;
+  QByteArray m_etag;
+};
+
+/***************************************************************************************************/
+
+class TestQcWmtsTileFetcher: public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void token_bucket();
+  void circuit_breaker();
+  void in_flight_limit();
+  void rate_limit();
+  void conditional_request();
+  void reentrant_slots();
+  void network_statistics();
+};
+
+void TestQcWmtsTileFetcher::token_bucket()
+{
+  QcTokenBucket unlimited;
+  QVERIFY(unlimited.try_acquire());
+  QCOMPARE(unlimited.time_to_next_token(), 0);
+
+  QcTokenBucket token_bucket(10, 2);
+  QVERIFY(token_bucket.try_acquire());
+  QVERIFY(token_bucket.try_acquire());
+  QVERIFY(!token_bucket.try_acquire());
+  int delay = token_bucket.time_to_next_token();
+  QVERIFY(delay > 0 && delay <= 100);
+  QTRY_VERIFY(token_bucket.try_acquire());
+}
+
+void TestQcWmtsTileFetcher::circuit_breaker()
+{
+  QcCircuitBreaker circuit_breaker(3, 40, 1000);
+  circuit_breaker.record_failure();
+  circuit_breaker.record_failure();
+  QVERIFY(circuit_breaker.allow_request());
+  circuit_breaker.record_success(); // reset the count
+  for (int i = 0; i < 3; i++)
+    circuit_breaker.record_failure();
+  QCOMPARE(circuit_breaker.state(), QcCircuitBreaker::Open);
+  QVERIFY(!circuit_breaker.allow_request());
+  int time_to_retry = circuit_breaker.time_to_retry();
+  QVERIFY(time_to_retry > 0 && time_to_retry <= 50); // jittered
+
+  // A single probe when the cooldown is elapsed
+  QTRY_VERIFY(circuit_breaker.allow_request());
+  QCOMPARE(circuit_breaker.state(), QcCircuitBreaker::HalfOpen);
+  QVERIFY(!circuit_breaker.allow_request());
+
+  // The probe fails, the cooldown doubles
+  circuit_breaker.record_failure();
+  QCOMPARE(circuit_breaker.state(), QcCircuitBreaker::Open);
+  QVERIFY(circuit_breaker.time_to_retry() > 50);
+  QCOMPARE(circuit_breaker.trips(), 2);
+
+  QTRY_VERIFY(circuit_breaker.allow_request());
+  circuit_breaker.record_success();
+  QVERIFY(circuit_breaker.is_closed());
+  QVERIFY(circuit_breaker.allow_request());
+}
+
+void TestQcWmtsTileFetcher::in_flight_limit()
+{
+  TileServer server;
+  QVERIFY(server.isListening());
+  LocalTileFetcher tile_fetcher(server.serverPort());
+  tile_fetcher.set_max_in_flight_per_host(2);
+  tile_fetcher.set_batch_size(3);
+
+  QSignalSpy spy(&tile_fetcher, SIGNAL(tile_finished(QcTileSpec, QByteArray, QString, QcTileFreshness)));
+  QcTileSpecSet tile_specs;
+  int number_of_tiles = 10;
+  for (int i = 0; i < number_of_tiles; i++)
+    tile_specs.insert(QcTileSpec("osm", 1, 16, i, i));
+  tile_fetcher.update_tile_requests(tile_specs, QcTileSpecSet());
+  QCOMPARE(tile_fetcher.queue_depth(), number_of_tiles);
+
+  QTRY_COMPARE_WITH_TIMEOUT(spy.count(), number_of_tiles, 10000);
+  QCOMPARE(spy.first().at(1).toByteArray(), QByteArray("tile"));
+  QCOMPARE(tile_fetcher.queue_depth(), 0);
+  QCOMPARE(tile_fetcher.in_flight_count(), 0);
+  QCOMPARE(tile_fetcher.max_in_flight_count(), 2);
+  QVERIFY(server.max_pending() <= 2);
+}
+
+void TestQcWmtsTileFetcher::rate_limit()
+{
+  TileServer server;
+  LocalTileFetcher tile_fetcher(server.serverPort());
+  tile_fetcher.set_rate_limit(QStringLiteral("osm"), 20, 1);
+
+  QSignalSpy spy(&tile_fetcher, SIGNAL(tile_finished(QcTileSpec, QByteArray, QString, QcTileFreshness)));
+  QcTileSpecSet tile_specs;
+  int number_of_tiles = 5;
+  for (int i = 0; i < number_of_tiles; i++)
+    tile_specs.insert(QcTileSpec("osm", 1, 16, i, i));
+  QElapsedTimer timer;
+  timer.start();
+  tile_fetcher.update_tile_requests(tile_specs, QcTileSpecSet());
+
+  QTRY_COMPARE_WITH_TIMEOUT(spy.count(), number_of_tiles, 10000);
+  // One token is available at start, then one every 50 ms
+  QVERIFY(timer.elapsed() >= (number_of_tiles - 1) * 50 - 10);
+}
+
+void TestQcWmtsTileFetcher::conditional_request()
+{
+  TileServer server;
+  LocalTileFetcher tile_fetcher(server.serverPort());
+  QcTileSpec tile_spec("osm", 1, 16, 1, 1);
+
+  QSignalSpy finished_spy(&tile_fetcher, SIGNAL(tile_finished(QcTileSpec, QByteArray, QString, QcTileFreshness)));
+  tile_fetcher.update_tile_requests(QcTileSpecSet() << tile_spec, QcTileSpecSet());
+  QVERIFY(finished_spy.wait());
+  QcTileFreshness freshness = finished_spy.first().at(3).value<QcTileFreshness>();
+  QCOMPARE(freshness.etag, QByteArray("\"v1\""));
+  QCOMPARE(freshness.expires_at - freshness.fetched_at, qint64(60 * 1000));
+
+  // The tile is unchanged, the reply has no body
+  tile_fetcher.set_etag(freshness.etag);
+  QSignalSpy not_modified_spy(&tile_fetcher, SIGNAL(tile_not_modified(QcTileSpec, QcTileFreshness)));
+  tile_fetcher.update_tile_requests(QcTileSpecSet() << tile_spec, QcTileSpecSet());
+  QVERIFY(not_modified_spy.wait());
+  QCOMPARE(finished_spy.count(), 1);
+  QVERIFY(!not_modified_spy.first().at(1).value<QcTileFreshness>().is_stale(QDateTime::currentMSecsSinceEpoch()));
+}
+
+void TestQcWmtsTileFetcher::reentrant_slots()
+{
+  TileServer server;
+  LocalTileFetcher tile_fetcher(server.serverPort());
+  QcTileSpec first_tile("osm", 1, 16, 1, 1);
+  QcTileSpec second_tile("osm", 1, 16, 2, 2);
+
+  // The signals are emitted once the queue mutex is released, a slot can call back the fetcher
+  int queue_changes = 0;
+  connect(&tile_fetcher, &QcWmtsTileFetcher::queue_changed, [&tile_fetcher, &queue_changes](int queue_depth) {
+      if (tile_fetcher.queue_depth() == queue_depth)
+        queue_changes++;
+    });
+  connect(&tile_fetcher, &QcWmtsTileFetcher::tile_finished, [&tile_fetcher, first_tile, second_tile](const QcTileSpec & tile_spec) {
+      if (tile_spec == first_tile)
+        tile_fetcher.update_tile_requests(QcTileSpecSet() << second_tile, QcTileSpecSet());
+    });
+
+  QSignalSpy spy(&tile_fetcher, SIGNAL(tile_finished(QcTileSpec, QByteArray, QString, QcTileFreshness)));
+  tile_fetcher.update_tile_requests(QcTileSpecSet() << first_tile, QcTileSpecSet());
+  QTRY_COMPARE_WITH_TIMEOUT(spy.count(), 2, 10000);
+  QCOMPARE(spy.last().at(0).value<QcTileSpec>(), second_tile);
+  QVERIFY(queue_changes >= 4);
+}
+
+void TestQcWmtsTileFetcher::network_statistics()
+{
+  TileServer server;
+  QcOsmPlugin plugin;
+  QUrl url(QStringLiteral("http://127.0.0.1:%1/1/1/1").arg(server.serverPort()));
+
+  QScopedPointer<QNetworkReply> reply(plugin.get(url));
+  QTRY_VERIFY(reply->isFinished());
+  QcTileFreshness validators;
+  validators.etag = "\"v1\"";
+  QScopedPointer<QNetworkReply> conditional_reply(plugin.get(url, validators));
+  QTRY_VERIFY(conditional_reply->isFinished());
+
+  // Nobody listens on this port
+  QTcpServer closed_server;
+  closed_server.listen(QHostAddress::LocalHost);
+  quint16 closed_port = closed_server.serverPort();
+  closed_server.close();
+  QScopedPointer<QNetworkReply> error_reply(plugin.get(QUrl(QStringLiteral("http://127.0.0.1:%1/1/1/1").arg(closed_port))));
+  QTRY_VERIFY(error_reply->isFinished());
+
+  const QcWmtsNetworkStatistics & statistics = plugin.network_statistics();
+  QCOMPARE(statistics.requests, 3);
+  QCOMPARE(statistics.replies, 3);
+  QCOMPARE(statistics.errors, 1);
+  QCOMPARE(statistics.conditional_requests, 1);
+  QCOMPARE(statistics.not_modified_replies, 1);
+  QCOMPARE(statistics.bytes_received, qint64(4)); // the 304 reply has no body
+  QCOMPARE(statistics.to_json()["requests"].toInt(), 3);
+}
+
+/***************************************************************************************************/
+
+QTEST_MAIN(TestQcWmtsTileFetcher)
+#include "test_wmts_tile_fetcher.moc"
+
+
+/***************************************************************************************************
+ *
+ * End
+ *
+ **************************************************************************************************/
@@ -26,54 +26,21 @@
 
 /**************************************************************************************************/
 
+#include <QCommandLineParser>
 #include <QCoreApplication>
-#include <QThread>
 #include <QTimer>
 #include <QtDebug>
 
 /**************************************************************************************************/
 
-#include "cache/offline_cache.h"
-#include "coordinate/mercator.h"
 #include "coordinate/wgs84.h"
+#include "geo_data_format/gpx.h"
 #include "geometry/polygon.h"
 #include "geometry/vector.h"
 #include "tools/logger.h"
+#include "wmts/offline_area_downloader.h"
 #include "wmts/wmts_plugin_manager.h"
 
-// #include "map/tile_loader.h"
-
-/***************************************************************************************************/
-
-class TileFetcherHelper : public QObject
-{
-  Q_OBJECT;
-
- public:
-  TileFetcherHelper(QcOfflineTileCache * offline_cache)
-    : m_offline_cache(offline_cache)
-  {}
-
- public:
-  int number_of_received_tiles() const {
-    return m_finished_tile.size();
-  }
-  bool has_received(const QcTileSpec & tile_spec) const {
-    return m_finished_tile.contains(tile_spec);
-  }
-
- public slots:
-  void tile_finished(const QcTileSpec & tile_spec, const QByteArray & bytes, const QString & format) {
-    qInfo() << "Tile finished" << tile_spec;
-    m_finished_tile.push_back(tile_spec);
-    m_offline_cache->insert(tile_spec, bytes, format);
-  }
-
- private:
-  QcOfflineTileCache * m_offline_cache;
-  QList<QcTileSpec> m_finished_tile;
-};
-
 /**************************************************************************************************/
 
 class Application : public QCoreApplication
@@ -85,126 +52,130 @@ public:
 
 public slots:
   void main_task();
+  void progress_changed(int processed_tiles, int number_of_tiles);
+
+private:
+  QcOfflineAreaDownloader * m_downloader;
 };
 
 Application::Application(int & argc, char ** argv)
-  : QCoreApplication(argc, argv)
+  : QCoreApplication(argc, argv),
+    m_downloader(nullptr)
 {
+  setApplicationName("tile-loader");
   QTimer::singleShot(0, this, SLOT(main_task()));
 }
 
 void
 Application::main_task()
 {
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Download the tiles of an area to the offline cache");
+  parser.addHelpOption();
+  QCommandLineOption plugin_option("plugin", "WMTS plugin", "name", "geoportail");
+  QCommandLineOption layer_option("layer", "Layer title", "title", "Carte topographique");
+  // Mont-Dore
+  QCommandLineOption longitude_option("longitude", "Longitude of the center", "degree", "2.816");
+  QCommandLineOption latitude_option("latitude", "Latitude of the center", "degree", "45.54");
+  QCommandLineOption radius_option("radius", "Half side of the square around the center", "m", "20000");
+  QCommandLineOption gpx_option("gpx", "Download the tracks of a GPX file instead of a square", "path");
+  QCommandLineOption buffer_option("buffer", "Half width of the area around the tracks", "m", "1000");
+  QCommandLineOption min_level_option("min-level", "Minimum level", "level", "0");
+  QCommandLineOption max_level_option("max-level", "Maximum level", "level", "16");
+  QCommandLineOption job_option("job", "Resume a download job", "id");
+  QCommandLineOption list_jobs_option("list-jobs", "List the download jobs");
+  QCommandLineOption estimate_option("estimate", "Only estimate the download");
+  parser.addOptions({plugin_option, layer_option,
+        longitude_option, latitude_option, radius_option,
+        gpx_option, buffer_option,
+        min_level_option, max_level_option,
+        job_option, list_jobs_option, estimate_option});
+  parser.process(*this);
+
   QcWmtsPluginManager & plugin_manager = QcWmtsPluginManager::instance();
+  QcWmtsPlugin * plugin = plugin_manager[parser.value(plugin_option)];
+  if (!plugin) {
+    qWarning() << "Unknown plugin" << parser.value(plugin_option);
+    exit(1);
+    return;
+  }
+  const QcWmtsPluginLayer * layer = plugin->layer(parser.value(layer_option));
+  if (!layer) {
+    qWarning() << "Unknown layer" << parser.value(layer_option);
+    exit(1);
+    return;
+  }
+
+  m_downloader = new QcOfflineAreaDownloader(layer);
+  m_downloader->setParent(this);
+
+  QcOfflineCacheDatabase * database = plugin->wmts_manager()->tile_cache()->offline_cache()->database();
+  if (parser.isSet(list_jobs_option)) {
+    for (int job_id : database->job_ids()) {
+      QcOfflineDownloadJob job;
+      database->load_job(job_id, job);
+      qInfo() << "Job" << job_id << job.provider << job.map_id
+              << "levels" << job.min_level << job.max_level
+              << "missing" << database->missing_job_tiles(job_id) << "/" << job.number_of_tiles;
+    }
+    exit(0);
+    return;
+  }
 
-  QcWmtsPlugin * geoportail_plugin = plugin_manager["geoportail"];
-
-  const QcTileMatrixSet & tile_matrix_set = geoportail_plugin->tile_matrix_set();
-
-  // QcTileLoader tile_loader(geoportail_plugin);
-
-  // Annecy
-  // double longitude = 6.311331853277862;
-  // double latitude = 45.956298260767284;
-
-  // Bezons
-  // double longitude = 2.206142;
-  // double latitude = 48.924482;
-
-  // Bérarde
-  // double longitude = 6.2914;
-  // double latitude = 44.9328;
-
-  // Vallouise
-  // double longitude = 6.4895;
-  // double latitude = 44.8461;
-
-  // Centre
-  // double longitude = 3;
-  // double latitude = 46.5;
-
-  // Freissinieres
-  // double longitude = 6.5383;
-  // double latitude = 44.7523;
-
-  // Mont-dore
-  double longitude = 2.816;
-  double latitude = 45.54;
-
-  QcWgsCoordinate center_wsg84(longitude, latitude);
-  QcPseudoWebMercatorCoordinate center_mercator = center_wsg84.pseudo_web_mercator();
-  QcVectorDouble center = center_mercator.vector();;
-  double radius_m = 20 * 1000;
-  QcVectorDouble half_diagonal_m(radius_m, radius_m);
-
-  QcVectorDouble point1 = center + half_diagonal_m;
-  QcVectorDouble point2 = center + half_diagonal_m.mirror_x();
-  QcVectorDouble point3 = center + half_diagonal_m.rotate_180();
-  QcVectorDouble point4 = center + half_diagonal_m.mirror_y();
-  QcPolygon polygon;
-  polygon.add_vertex(point3);
-  polygon.add_vertex(point2);
-  polygon.add_vertex(point1);
-  polygon.add_vertex(point4);
-
-  const QcInterval2DDouble & interval = polygon.interval();
-  qInfo() << "polygon interval"
-          << "[" << interval.x().inf() << ", " << interval.x().sup() << "]"
-          << "x"
-          << "[" << interval.y().inf() << ", " << interval.y().sup() << "]";
-
-  QcWmtsNetworkTileFetcher * tile_fetcher = geoportail_plugin->tile_fetcher(); // subclass QcGeoportailPlugin ???
-
-  QcOfflineTileCache * offline_cache = geoportail_plugin->wmts_manager()->tile_cache()->offline_cache();
-  TileFetcherHelper tile_fetcher_helper(offline_cache);
-  QObject::connect(tile_fetcher, &QcWmtsNetworkTileFetcher::tile_finished,
-                   &tile_fetcher_helper, &TileFetcherHelper::tile_finished);
-
-  QString layer_title = "Carte topographique";
-  // QString layer_title = "Carte"; // error
-  // QString layer_title = "Vue aérienne";
-  int map_id = geoportail_plugin->layer(layer_title)->map_id();
-
-  QSet<QcTileSpec> tiles_added;
-  QSet<QcTileSpec> tiles_removed;
-
-  // Fixme: level <= 10 : any tiles
-  for (int level = 0; level <= 16; level++) {
-    double tile_length_m = tile_matrix_set[level].tile_length_m();
-    QcTiledPolygon tiled_polygon = polygon.intersec_with_grid(tile_length_m);
-    for (const QcTiledPolygonRun & run:  tiled_polygon.runs()) {
-      const QcIntervalInt & run_interval = run.interval();
-      qInfo() << "Run " << run.y() << " [" << run_interval.inf() << ", " << run_interval.sup() << "]";
-      for (int x = run_interval.inf(); x <= run_interval.sup(); x++) {
-        QcTileSpec tile_spec = geoportail_plugin->create_tile_spec(map_id, level, x, run.y());
-        if (offline_cache->contains(tile_spec)) {
-          qInfo() << "Ok" << tile_spec;
-        }
-        else {
-          qInfo() << "Missing" << tile_spec;
-          tiles_added << tile_spec;
-        }
-      }
+  QcOfflineArea area;
+  if (parser.isSet(job_option)) {
+    if (!m_downloader->set_job(parser.value(job_option).toInt())) {
+      exit(1);
+      return;
     }
+  } else if (parser.isSet(gpx_option)) {
+    QcGpxReader gpx_reader;
+    QcGpx gpx = gpx_reader.read(parser.value(gpx_option));
+    double buffer_m = parser.value(buffer_option).toDouble();
+    for (const QcTrack & track : gpx.tracks())
+      for (const QcPolygon & polygon : QcOfflineArea::from_track(track, buffer_m).polygons())
+        area.add_polygon(polygon);
+  } else {
+    QcWgsCoordinate center_wsg84(parser.value(longitude_option).toDouble(),
+                                 parser.value(latitude_option).toDouble());
+    QcVectorDouble center = center_wsg84.pseudo_web_mercator().vector();
+    double radius_m = parser.value(radius_option).toDouble();
+    QcVectorDouble half_diagonal_m(radius_m, radius_m);
+    QcPolygon polygon;
+    polygon.add_vertex(center + half_diagonal_m.rotate_180());
+    polygon.add_vertex(center + half_diagonal_m.mirror_x());
+    polygon.add_vertex(center + half_diagonal_m);
+    polygon.add_vertex(center + half_diagonal_m.mirror_y());
+    area.add_polygon(polygon);
   }
-  int number_of_tiles = tiles_added.size();
-
-  // Add tiles to disk
-  //  tile_fetcher::tile_finished -> QcWmtsManager::fetcher_tile_finished -> tile_cache()->insert
-  //
-  // Fixme:
-  //   check if on disk
-  //   just save
-  //   don't count in online cache
-
-  tile_fetcher->update_tile_requests(tiles_added, tiles_removed);
-  while (tile_fetcher_helper.number_of_received_tiles() != number_of_tiles) {
-    processEvents();
-    // QThread::msleep(10);
+  if (!area.is_empty()) {
+    m_downloader->set_area(area);
+    m_downloader->set_levels(parser.value(min_level_option).toInt(), parser.value(max_level_option).toInt());
   }
 
-  exit(0);
+  const QVector<int> & tile_counts = m_downloader->tile_counts();
+  for (int i = 0; i < tile_counts.size(); i++)
+    qInfo() << "Level" << m_downloader->min_level() + i << tile_counts[i] << "tiles";
+  qInfo() << "Number of tiles" << m_downloader->number_of_tiles()
+          << "estimated size" << m_downloader->estimated_size() / (1024 * 1024) << "MB";
+  if (parser.isSet(estimate_option)) {
+    exit(0);
+    return;
+  }
+
+  connect(m_downloader, &QcOfflineAreaDownloader::progress_changed,
+          this, &Application::progress_changed);
+  connect(m_downloader, &QcOfflineAreaDownloader::finished,
+          this, &QCoreApplication::quit);
+  m_downloader->start();
+}
+
+void
+Application::progress_changed(int processed_tiles, int number_of_tiles)
+{
+  qInfo() << "Processed" << processed_tiles << "/" << number_of_tiles
+          << "downloaded" << m_downloader->downloaded_tiles()
+          << "failed" << m_downloader->failed_tiles();
 }
 
 /**************************************************************************************************/